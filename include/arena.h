@@ -0,0 +1,34 @@
+#ifndef H_ARENA
+#define H_ARENA
+
+#include <stdint.h>
+#include "globals.h"
+
+// Regions of the startup memory arena, in the order they're laid out.
+// All but the last have a fixed size, the chunk cache gets whatever it
+// asks for out of the rest and can be resized while the server runs.
+enum {
+  ARENA_SEND_QUEUES,    // MAX_PLAYERS rings of SEND_QUEUE_SIZE bytes
+  ARENA_PACKET_CACHE,   // CHUNK_PACKET_CACHE_SIZE bytes of encoded chunks
+  ARENA_ENCODE_SCRATCH, // Packed section data while a chunk is encoded
+  ARENA_CHUNK_CACHE,
+  ARENA_REGION_COUNT
+};
+
+// Packed data of the up to 20 sections of a chunk, 4096 bytes each
+#define CHUNK_ENCODE_SCRATCH_SIZE (20 * 4096)
+
+// Claims the arena and lays out the fixed regions. Called on first use
+// if not called explicitly. Returns 0 on success, 1 if it's unavailable.
+int initArena ();
+// Start of the given region, NULL if the arena couldn't be set up
+void *getArenaRegion (int region);
+// Moves the end of the last region (the chunk cache) to fit `size`
+// bytes, returning its start, or NULL if that much isn't available
+void *resizeArenaRegion (int region, long size);
+// Bytes the last region could grow to
+long getArenaRegionLimit (int region);
+// Prints how the arena is divided up
+void printArenaReport ();
+
+#endif
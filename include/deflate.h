@@ -0,0 +1,16 @@
+#ifndef H_DEFLATE
+#define H_DEFLATE
+
+#include <stdint.h>
+
+// Compresses `len` bytes into a zlib stream, as one block of fixed Huffman
+// codes. Matches are found with a single hash probe, trading ratio for
+// speed on slow CPUs.
+// Returns the size of the stream, or -1 if it doesn't fit in `out_size`
+int zlibCompress (const uint8_t *in, int len, uint8_t *out, int out_size);
+
+// Decompresses a zlib stream that expands to exactly `out_size` bytes
+// Returns 0 on success, 1 if the stream is invalid or of another size
+int zlibDecompress (const uint8_t *in, int len, uint8_t *out, int out_size);
+
+#endif
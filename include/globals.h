@@ -46,23 +46,74 @@
 // Runtime configurable via menu on Mac
 extern int view_distance;
 
-/*
- * Chunk Send Interleaving
- * -----------------------
- * When sending chunks to one player, we want to remain responsive to other
- * players. The interleave callback is called between chunk sections during
- * sc_chunkDataAndUpdateLight(). It allows the main loop to:
- *   1. Process pending packets from other connected clients
- *   2. Run server ticks if they're due
- *   3. Handle Mac events (via task_yield)
- *
- * The callback receives the file descriptor of the client currently being
- * served (so we don't process their packets mid-chunk-send).
- *
- * Set this to NULL to disable interleaving (not recommended for multiplayer).
- */
-typedef void (*chunk_interleave_fn)(int current_client_fd);
-extern chunk_interleave_fn chunk_interleave_callback;
+// Whether clients are sent Set Compression when they log in. Define
+// ENABLE_COMPRESSION to have it on by default, runtime configurable via
+// menu on Mac. Worth it over the internet, less so on a LAN.
+extern uint8_t compression_enabled;
+
+// Packets of at least this many bytes may be sent compressed. Only chunk
+// data actually is: it's compressed once, as it enters the chunk packet
+// cache, and resends reuse that. Everything else is sent uncompressed.
+#define COMPRESSION_THRESHOLD 256
+
+// Bytes of memory to spend on caching encoded chunk packets, so that
+// chunks which haven't changed can be resent without regenerating them
+#ifdef MAC68K_PLATFORM
+  #define CHUNK_PACKET_CACHE_SIZE 131072
+#elif defined(ESP_PLATFORM)
+  #define CHUNK_PACKET_CACHE_SIZE 0
+#else
+  #define CHUNK_PACKET_CACHE_SIZE 524288
+#endif
+
+// Largest value view_distance can be set to
+#define MAX_VIEW_DISTANCE 4
+
+// How many chunks can be waiting to be sent to each player
+#define CHUNK_QUEUE_SIZE ((2 * MAX_VIEW_DISTANCE + 1) * (2 * MAX_VIEW_DISTANCE + 1))
+
+// If defined, generated terrain is also kept in terrain.bin, so that it
+// doesn't need to be generated again after a restart. Flash on the ESP
+// is too small for it to be worth it, and tests shouldn't leave the file
+// behind wherever they're run from.
+#if !defined(ESP_PLATFORM) && !defined(TEST_BUILD)
+  #define ENABLE_TERRAIN_FILE
+#endif
+
+// How many sections terrain.bin can hold, each takes up to 4 KiB on disk
+#define TERRAIN_FILE_SLOTS 4096
+
+// If defined, terrain is generated into the chunk cache while the server
+// is idle, ahead of where players are heading and around spawn
+#define ENABLE_TERRAIN_PREGEN
+
+// Time in microseconds to spend pregenerating terrain per iteration of the
+// main loop. At least one section is generated per iteration regardless.
+#ifdef MAC68K_PLATFORM
+  #define PREGEN_BUDGET 8000
+#else
+  #define PREGEN_BUDGET 4000
+#endif
+
+// Rows of chunks past view distance to pregenerate ahead of players
+#define PREGEN_LOOKAHEAD 2
+
+// Radius in chunks of the area around spawn to pregenerate on startup
+#define PREGEN_SPAWN_RADIUS 3
+
+// Chunks per side of a cell of the broadcast interest grid, as a power of 2
+#define INTEREST_CELL_SHIFT 2
+// How many buckets the interest grid cells are hashed into, a power of 2
+#define INTEREST_GRID_SIZE 64
+// Interest grid buckets hold one bit per player slot
+#if MAX_PLAYERS > 32
+  #error "MAX_PLAYERS can't exceed 32 with the broadcast interest grid"
+#endif
+
+// Time in microseconds to spend sending queued chunks per iteration of
+// the main loop. At least one chunk is sent per iteration regardless,
+// so on slow machines this effectively means one chunk at a time.
+#define CHUNK_SEND_BUDGET 20000
 
 // Time between server ticks in microseconds (default = 1s)
 #define TIME_BETWEEN_TICKS 1000000
@@ -70,6 +121,23 @@ extern chunk_interleave_fn chunk_interleave_callback;
 // Calculated from TIME_BETWEEN_TICKS
 #define TICKS_PER_SECOND ((float)1000000 / TIME_BETWEEN_TICKS)
 
+// Time in microseconds between Keep Alive and Update Time packets
+#define KEEP_ALIVE_INTERVAL 1000000
+
+// Time in microseconds between broadcasts of player movement. Lower
+// values make other players move more smoothly, at the cost of bandwidth.
+#define PLAYER_BROADCAST_INTERVAL (TIME_BETWEEN_TICKS)
+
+// Time in microseconds that periodic server tasks may take per iteration
+// of the main loop. Tasks due past this wait for the next iteration, but
+// at least one task runs per iteration regardless.
+#define SERVER_TASK_BUDGET 10000
+
+// How many mobs to run behavior for per iteration of the main loop.
+// Each tick starts a pass over all mobs, spread out over iterations
+// so that large numbers of mobs don't stall the server at once.
+#define MOB_AI_SLICE 4
+
 // Initial world generation seed, will be hashed on startup
 // Used in generating terrain and biomes
 #define INITIAL_WORLD_SEED 0xA103DE6C
@@ -100,14 +168,30 @@ extern chunk_interleave_fn chunk_interleave_callback;
 // Must be at least 1, otherwise chunks will be sent on each position update
 #define VISITED_HISTORY 4
 
-// How many player-made block changes to allow
-// Determines the fixed amount of memory allocated to blocks
+// How many player-made block changes to hold in memory at once
+// Determines the fixed amount of memory allocated to blocks. With
+// SYNC_WORLD_TO_DISK, the world as a whole can hold more than this.
 #define MAX_BLOCK_CHANGES 20000
 
+// Block changes are grouped into square regions, 1 << REGION_SHIFT blocks
+// to a side, each kept sorted as one run in block_changes. With
+// SYNC_WORLD_TO_DISK, regions are paged in from the world file when
+// they're needed, and paged out when no player has been near them for
+// REGION_IDLE_TIME microseconds, or when block_changes fills up.
+#define REGION_SHIFT 8
+#define BLOCK_REGION(coord) ((short)((coord) >> REGION_SHIFT))
+
+// How many regions the world file has room for, must be a power of 2
+#define REGION_DIRECTORY_SIZE 1024
+#define REGION_IDLE_TIME 60000000
+// Time in microseconds between checks for idle regions
+#define REGION_CHECK_INTERVAL 5000000
+
 // If defined, writes and reads world data to/from disk (or flash).
-// This is a synchronous operation, and can cause performance issues if
-// frequent random disk access is slow. Data is still stored in and
-// accessed from memory - reading from disk is only done on startup.
+// Changes are queued in memory and appended in batches to a journal,
+// which is periodically merged back into the world file. Player and
+// chest data is kept in memory, block changes are paged in and out by
+// region. The journal is replayed on top of the world file on startup.
 // When targeting ESP-IDF, LittleFS is used to manage flash reads and
 // writes. Flash is typically *very* slow and unreliable, which is why
 // this option is disabled by default when targeting ESP-IDF.
@@ -115,11 +199,73 @@ extern chunk_interleave_fn chunk_interleave_callback;
   #define SYNC_WORLD_TO_DISK
 #endif
 
+// Time in microseconds to wait between appending queued changes to the
+// journal. Changes made within this window are lost on a crash.
+#define JOURNAL_FLUSH_INTERVAL 2000000
+
+// Journal size in bytes past which it gets merged into the world file.
+// This writes the whole world file anew, so it shouldn't happen too often.
+// The world file is also compacted once this many bytes of it, and at
+// least half, are slots that regions have since moved out of.
+#define JOURNAL_COMPACT_SIZE 32768
+
+// Time in microseconds between saves of online players' data. Players are
+// also saved when leaving the game.
+#define PLAYER_SAVE_INTERVAL 60000000
+
 // Time in microseconds to spend waiting for data transmission before
 // timing out. Default is 15s, which leaves 5s to prevent starving other
 // clients from Keep Alive packets.
 #define NETWORK_TIMEOUT_TIME 15000000
 
+// Bytes of incoming data to buffer per client. Packets are read out of
+// this buffer, larger ones are streamed through it.
+#ifdef MAC68K_PLATFORM
+  #define RECV_QUEUE_SIZE 2048
+#else
+  #define RECV_QUEUE_SIZE 4096
+#endif
+
+// Bytes of outgoing data to hold per client while its connection is busy.
+// Must be a power of two. Sends that don't fit wait for the queue to drain,
+// for as long as the client keeps taking data (see SEND_QUEUE_STALL_TIME).
+#ifdef MAC68K_PLATFORM
+  #define SEND_QUEUE_SIZE 16384
+#elif defined(ESP_PLATFORM)
+  #define SEND_QUEUE_SIZE 2048
+#else
+  #define SEND_QUEUE_SIZE 65536
+#endif
+
+// Once this many bytes are queued for a client, chunks for it are held
+// back and mob and player movement updates to it are dropped
+#define SEND_QUEUE_CONGESTED (SEND_QUEUE_SIZE / 4)
+
+// Time in microseconds a send to a full queue waits for the client to take
+// any data before giving up on it. This holds up the whole server, so it's
+// much shorter than NETWORK_TIMEOUT_TIME, which applies to queued data.
+#define SEND_QUEUE_STALL_TIME 250000
+
+// Time in microseconds a closing send queue waits for asynchronous sends
+// still in flight (MacTCP only), so that packets sent right before a
+// disconnect aren't thrown away
+#define SEND_QUEUE_CLOSE_TIME 500000
+
+// The send queues, chunk packet cache, chunk encoding scratch and chunk
+// cache are all carved out of one block allocated at startup, so that
+// nothing is allocated (or fragments the heap) while the server runs.
+// On Mac, the block is the application partition set in Get Info, less
+// this many bytes left over for the Toolbox, networking stack and stdio.
+// The ESP only has room for the send queues and encoding scratch, so it
+// goes without both caches.
+#ifdef MAC68K_PLATFORM
+  #define ARENA_HEAP_RESERVE 393216
+#elif defined(ESP_PLATFORM)
+  #define ARENA_SIZE (MAX_PLAYERS * SEND_QUEUE_SIZE + CHUNK_ENCODE_SCRATCH_SIZE)
+#else
+  #define ARENA_SIZE (MAX_PLAYERS * SEND_QUEUE_SIZE + CHUNK_PACKET_CACHE_SIZE + 1048576)
+#endif
+
 // Size of the receive buffer for incoming string data
 #define MAX_RECV_BUF_LEN 256
 
@@ -129,15 +275,28 @@ extern chunk_interleave_fn chunk_interleave_callback;
 #define SEND_BRAND
 
 // If defined, calculates fluid flow when blocks are updated near fluids
-// Somewhat computationally expensive and potentially unstable
+// Flow is spread out over ticks, see FLUID_TICK_BUDGET
 #define DO_FLUID_FLOW
 
+// How many fluid blocks can be waiting to flow at once
+#define FLUID_QUEUE_SIZE 512
+
+// How many queued fluid blocks to update per server tick
+#define FLUID_TICK_BUDGET 128
+
+// How many block updates can be collected before they're broadcast
+#define BLOCK_UPDATE_BATCH_SIZE 256
+
 // If defined, allows players to craft and use chests.
-// Chests take up 15 block change slots each, require additional checks,
-// and use some terrible memory hacks to function. On some platforms, this
-// could cause bad performance or even crashes during gameplay.
+// Chest contents are kept in a separate pool (see MAX_CHESTS), which is
+// stored after player data in "world.bin". Opening a chest still relies
+// on a memory hack that stores a pointer in the player's crafting grid.
 #define ALLOW_CHESTS
 
+// Maximum amount of chests that can exist in the world
+// Each one takes up 88 bytes of memory, whether placed or not
+#define MAX_CHESTS 256
+
 // If defined, enables flight for all players. As a side-effect, allows
 // players to sprint when starving.
 // #define ENABLE_PLAYER_FLIGHT
@@ -158,14 +317,6 @@ extern chunk_interleave_fn chunk_interleave_callback;
 // If defined, players are able to receive damage from nearby cacti.
 #define ENABLE_CACTUS_DAMAGE
 
-// If defined, uses binary search for block change lookups instead of linear
-// search. This dramatically improves performance with many block changes
-// (O(log n) vs O(n)), but is incompatible with ALLOW_CHESTS as chests
-// require contiguous entries in the block_changes array.
-#if !defined(ALLOW_CHESTS)
-  #define USE_SORTED_BLOCK_CHANGES
-#endif
-
 // If defined, logs unrecognized packet IDs
 // #define DEV_LOG_UNKNOWN_PACKETS
 
@@ -175,6 +326,20 @@ extern chunk_interleave_fn chunk_interleave_callback;
 // If defined, log chunk generation events
 // #define DEV_LOG_CHUNK_GENERATION
 
+// If defined, compiles in the section profiler (see profiler.h)
+// On Mac it is switched on and off from the Debug menu, elsewhere it
+// runs from startup and writes profile.txt every PROF_REPORT_INTERVAL.
+// When not defined, all profiler hooks compile to nothing.
+#ifdef MAC68K_PLATFORM
+  #define ENABLE_PROFILER
+#else
+  // #define ENABLE_PROFILER
+#endif
+
+// How often (in microseconds) to write out the profiler report
+// Only used outside of Mac, where reports are saved from the Debug menu
+#define PROF_REPORT_INTERVAL 60000000
+
 // If defined, allows dumping world data by sending 0xBEEF (big-endian),
 // and uploading world data by sending 0xFEED, followed by the data buffer.
 // Doesn't implement authentication, hence disabled by default.
@@ -213,6 +378,18 @@ typedef struct {
   uint8_t block;
 } BlockChange;
 
+#ifdef ALLOW_CHESTS
+typedef struct {
+  short x;
+  short z;
+  uint8_t y;
+  // Whether this entry belongs to a placed chest
+  uint8_t used;
+  // 27 slots of 3 bytes each - item ID (2 bytes), then count (1 byte)
+  uint8_t items[27 * 3];
+} ChestData;
+#endif
+
 #pragma pack(push, 1)
 
 typedef struct {
@@ -350,8 +527,16 @@ typedef struct {
 extern BlockChange block_changes[MAX_BLOCK_CHANGES];
 extern int block_changes_count;
 
+#ifdef ALLOW_CHESTS
+extern ChestData chest_data[MAX_CHESTS];
+#endif
+
 extern PlayerData player_data[MAX_PLAYERS];
 extern int player_data_count;
+// Indices into player_data of the players that are connected, in no
+// particular order, so that loops over them don't visit offline players
+extern uint8_t online_players[MAX_PLAYERS];
+extern int online_player_count;
 
 extern MobData mob_data[MAX_MOBS];
 
@@ -13,6 +13,10 @@ void console_init(void);
 /* Process Mac events (call periodically to keep UI responsive) */
 void console_poll_events(void);
 
+/* Like console_poll_events, but lets other applications run for up to
+ * sleep_ticks (1/60 s) if no event is waiting */
+void console_wait_events(long sleep_ticks);
+
 /* Print a string to the console window */
 void console_print(const char *str);
 
@@ -22,8 +26,8 @@ void console_printf(const char *fmt, ...);
 /* Check if the application should quit */
 int console_should_quit(void);
 
-/* Get the configured chunk cache size (in entries) */
-int console_get_cache_size(void);
+/* Get the configured chunk cache size (in KB) */
+long console_get_cache_size_kb(void);
 
 /* Get the mob interpolation setting (0=disabled, 1=enabled) */
 int console_get_mob_interpolation(void);
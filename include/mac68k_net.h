@@ -25,7 +25,6 @@ typedef long ssize_t;
 
 #define INADDR_ANY    0x00000000
 
-#define MSG_PEEK      0x02
 #define MSG_NOSIGNAL  0x4000
 
 #ifndef O_NONBLOCK
@@ -107,6 +106,28 @@ void cleanup_open_transport(void);
 /* Legacy cleanup alias (calls cleanup_open_transport) */
 void cleanup_mactcp(void);
 
+/* Asynchronous gather sends - with MacTCP, buffers are handed straight to
+ * TCPSend through a write data structure instead of being copied, and
+ * several sends can be in flight per stream. The buffers must not be
+ * touched until net_send_completed has counted them. */
+typedef struct {
+    const void *data;
+    unsigned short length;
+} NetSendPart;
+
+int net_can_send_async(int fd);     /* Check if fd supports the calls below */
+int net_send_gather(int fd, const NetSendPart *parts, int count);  /* 0, or -1 with EAGAIN if busy */
+long net_send_completed(int fd);    /* Bytes finished since last call, -1 on error */
+void net_send_abort(int fd);        /* Abort and wait out in-flight sends */
+
+/* Event-driven servicing - with Open Transport notifiers, endpoints are
+ * flagged as ready when they have work. When polling (MacTCP, or if the
+ * notifiers can't be installed) everything always counts as ready. */
+int net_is_event_driven(void);
+int net_is_ready(int fd);           /* Check if fd may have work waiting */
+int net_any_ready(void);            /* Check if any endpoint has work */
+void net_wait_for_event(long max_ticks);  /* Sleep until an endpoint is flagged */
+
 /* Network stack selection */
 int net_is_open_transport_available(void);
 int net_is_using_open_transport(void);
@@ -26,6 +26,7 @@ int cs_playerLoaded (int client_fd);
 
 // Clientbound packets
 int sc_statusResponse (int client_fd);
+int sc_setCompression (int client_fd);
 int sc_loginSuccess (int client_fd, uint8_t *uuid, char *name);
 int sc_knownPacks (int client_fd);
 int sc_sendPluginMessage (int client_fd, const char *channel, const uint8_t *data, size_t data_len);
@@ -37,12 +38,15 @@ int sc_startWaitingForChunks (int client_fd);
 int sc_playerAbilities (int client_fd, uint8_t flags);
 int sc_updateTime (int client_fd, uint64_t ticks);
 int sc_setCenterChunk (int client_fd, int x, int y);
+int sc_setChunkCacheRadius (int client_fd, int distance);
 int sc_chunkDataAndUpdateLight (int client_fd, int _x, int _z);
+int initChunkTemplates ();
 int sc_keepAlive (int client_fd);
 int sc_setContainerSlot (int client_fd, int window_id, uint16_t slot, uint8_t count, uint16_t item);
 int sc_setCursorItem (int client_fd, uint16_t item, uint8_t count);
 int sc_setHeldItem (int client_fd, uint8_t slot);
 int sc_blockUpdate (int client_fd, int64_t x, int64_t y, int64_t z, uint8_t block);
+int sc_updateSectionBlocks (int client_fd, int cx, int cy, int cz, int count, const uint16_t *positions, const uint8_t *blocks);
 int sc_openScreen (int client_fd, uint8_t window, const char *title, uint16_t length);
 int sc_acknowledgeBlockChange (int client_fd, int sequence);
 int sc_playerInfoUpdateAddPlayer (int client_fd, PlayerData player);
@@ -5,8 +5,7 @@
 
 #include "globals.h"
 
-extern int client_states[MAX_PLAYERS * 2];
-
+void initClientTable ();
 void setClientState (int client_fd, int new_state);
 int getClientState (int client_fd);
 int getClientIndex (int client_fd);
@@ -20,6 +19,18 @@ void handlePlayerJoin (PlayerData* player);
 void disconnectClient (int *client_fd, int cause);
 int givePlayerItem (PlayerData *player, uint16_t item, uint8_t count);
 void spawnPlayer (PlayerData *player);
+void resetChunkQueue (PlayerData *player, short _x, short _z);
+void updateChunkQueue (PlayerData *player, short _x, short _z);
+void setViewDistance (int distance);
+void serviceChunkQueues ();
+int hasChunksToSend ();
+#ifdef ENABLE_TERRAIN_PREGEN
+int pregenerateTerrain (int64_t budget);
+#endif
+void updatePlayerInterest (PlayerData *player, short _x, short _z);
+void clearPlayerInterest (PlayerData *player);
+uint32_t getPlayersNear (short x, short z);
+uint32_t getPlayerViewers (PlayerData *player, short x, short z, uint8_t *catch_up);
 
 void broadcastPlayerMetadata (PlayerData *player);
 void broadcastMobMetadata (int client_fd, int entity_id);
@@ -29,9 +40,18 @@ uint8_t clientSlotToServerSlot (int window_id, uint8_t slot);
 
 uint8_t getBlockChange (short x, uint8_t y, short z);
 uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block);
+uint8_t applyBlockChange (short x, uint8_t y, short z, uint8_t block);
+void queueBlockUpdate (short x, uint8_t y, short z, uint8_t block);
+void flushBlockUpdates ();
+void replayBlockChange (short x, uint8_t y, short z, uint8_t block);
 
-#ifdef USE_SORTED_BLOCK_CHANGES
 void sortBlockChanges(void);
+int findRegionRun (short rx, short rz, int *first);
+void removeBlockChangeRun (int first, int count);
+uint8_t openBlockChangeRun (int first, int count);
+
+#ifdef ALLOW_CHESTS
+ChestData *getChestData (short x, uint8_t y, short z);
 #endif
 
 uint8_t isInstantlyMined (PlayerData *player, uint8_t block);
@@ -47,12 +67,17 @@ void bumpToolDurability (PlayerData *player);
 void handlePlayerAction (PlayerData *player, int action, short x, short y, short z);
 void handlePlayerUseItem (PlayerData *player, short x, short y, short z, uint8_t face);
 
+#ifdef DO_FLUID_FLOW
 void checkFluidUpdate (short x, uint8_t y, short z, uint8_t block);
+void processFluidUpdates ();
+#endif
 
 void spawnMob (uint8_t type, short x, uint8_t y, short z, uint8_t health);
 void interactEntity (int entity_id, int interactor_id);
 void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t damage);
 void handleServerTick (int64_t time_since_last_tick);
+void initServerTasks (int64_t now);
+int64_t runServerTasks (int64_t now);
 #ifdef ENABLE_OPTIN_MOB_INTERPOLATION
 void processMobInterpolation (int64_t now);
 #else
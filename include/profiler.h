@@ -0,0 +1,69 @@
+#ifndef H_PROFILER
+#define H_PROFILER
+
+#include <stdint.h>
+#include "globals.h"
+
+// Code sections that can be timed with PROF_START/PROF_END
+enum {
+  PROF_SEC_CHUNK_GEN,
+  PROF_SEC_CHUNK_SEND,
+  PROF_SEC_BLOCK_CHANGE,
+  PROF_SEC_BLOCK_BROADCAST,
+  PROF_SEC_PLAYER_BROADCAST,
+  PROF_SEC_INVENTORY_UPDATE,
+  PROF_SEC_NET_SEND,
+  PROF_SEC_PACKET_ACTION,
+  PROF_SEC_MOB_AI,
+  PROF_SEC_TICK_TOTAL,
+  PROF_SECTION_COUNT
+};
+
+#ifdef ENABLE_PROFILER
+
+// Nonzero while statistics are being collected
+extern uint8_t prof_enabled;
+
+void prof_section_start (int section);
+void prof_section_end (int section);
+void prof_section_blocked (int section);
+void prof_bytes_sent (int client_fd, int64_t count);
+void prof_bytes_received (int client_fd, int64_t count);
+void prof_client_closed (int client_fd);
+
+void prof_init ();
+void prof_toggle ();
+int prof_is_enabled ();
+void prof_reset ();
+void prof_tick_completed (int64_t time_since_last_tick);
+void prof_print_report ();
+void prof_save_report ();
+
+// The enabled check is inlined so that idle sections cost a single branch
+#define PROF_START(X) do { if (prof_enabled) prof_section_start(PROF_SEC_##X); } while (0)
+#define PROF_END(X) do { if (prof_enabled) prof_section_end(PROF_SEC_##X); } while (0)
+#define PROF_BLOCKED(X) do { if (prof_enabled) prof_section_blocked(PROF_SEC_##X); } while (0)
+#define PROF_SENT(fd, n) do { if (prof_enabled) prof_bytes_sent(fd, n); } while (0)
+#define PROF_RECEIVED(fd, n) do { if (prof_enabled) prof_bytes_received(fd, n); } while (0)
+
+#else
+
+// With the profiler compiled out, every hook expands to nothing
+#define PROF_START(X)
+#define PROF_END(X)
+#define PROF_BLOCKED(X)
+#define PROF_SENT(fd, n)
+#define PROF_RECEIVED(fd, n)
+
+#define prof_client_closed(fd)
+#define prof_init()
+#define prof_toggle()
+#define prof_is_enabled() 0
+#define prof_reset()
+#define prof_tick_completed(time_since_last_tick)
+#define prof_print_report()
+#define prof_save_report()
+
+#endif
+
+#endif
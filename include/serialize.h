@@ -5,17 +5,28 @@
 
 #ifdef SYNC_WORLD_TO_DISK
   int initSerializer ();
-  void writeBlockChangesToDisk (int from, int to);
+  void journalBlockChange (short x, uint8_t y, short z, uint8_t block);
+  void markChestDirty (int index);
   void writeChestChangesToDisk (uint8_t *storage_ptr, uint8_t slot);
-  void writePlayerDataToDisk ();
+  void markPlayerDirty (int index);
+  void serviceJournal (int64_t now);
   void writeAllDataToDisk ();
+  int resetWorldFile ();
+  void loadBlockRegion (short x, short z);
+  uint8_t claimBlockRegion (short x, short z, uint8_t create);
 #else
   // Define no-op placeholders for when disk syncing isn't enabled
-  #define writeBlockChangesToDisk(a, b)
+  #define journalBlockChange(a, b, c, d)
+  #define markChestDirty(a)
   #define writeChestChangesToDisk(a, b)
-  #define writePlayerDataToDisk()
+  #define markPlayerDirty(a)
+  #define serviceJournal(a)
   #define writeAllDataToDisk()
   #define initSerializer() 0
+  #define resetWorldFile() 0
+  // Without a world file, every region stays in memory
+  #define loadBlockRegion(a, b)
+  #define claimBlockRegion(a, b, c) 0
 #endif
 
 #endif
@@ -45,6 +45,39 @@ ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first);
 ssize_t send_all (int client_fd, const void *buf, ssize_t len);
 void discard_all (int client_fd, size_t remaining, uint8_t require_first);
 
+// Per-client inbound queues - recv_all reads out of the queue, refilling it
+// from the network with as few recv calls as possible
+int openRecvQueue (int client_fd);
+void closeRecvQueue (int client_fd);
+// Returns 1 if a whole packet is ready to be read (or, if not framed, at
+// least 2 bytes), 0 if not yet, or -1 if the connection has closed
+int pollRecvQueue (int client_fd, uint8_t framed);
+// Copies up to n unread bytes without consuming them
+ssize_t peekRecvQueue (int client_fd, void *buf, size_t n);
+// Returns true if any client has data waiting, buffered or not
+int hasIncomingData ();
+
+// Per-client outbound queues - send_all queues whatever the network
+// doesn't accept right away, flushSendQueues sends it later
+int openSendQueue (int client_fd);
+void closeSendQueue (int client_fd);
+void flushSendQueues ();
+void waitForSendQueue (int client_fd);
+int isSendQueueCongested (int client_fd);
+int hasSendQueueFailed (int client_fd);
+
+// Protocol compression, enabled for a client once it has been sent Set
+// Compression. send_all then frames everything sent to the client as
+// uncompressed, and readPacketLength decompresses what the client sends.
+void setCompression (int client_fd, uint8_t enabled);
+int isCompressed (int client_fd);
+// Sends a whole packet that is already framed and compressed
+ssize_t send_compressed (int client_fd, const void *buf, ssize_t len);
+// Reads the length prefix of the next packet (and its data length, with
+// compression, decompressing the packet if needed). Returns the length
+// of the packet ID and data, or VARNUM_ERROR.
+int32_t readPacketLength (int client_fd);
+
 // Packet buffering system - reduces network calls by batching writes
 #define PACKET_BUFFER_SIZE 2048
 extern uint8_t packet_buffer[PACKET_BUFFER_SIZE];
@@ -57,6 +90,15 @@ ssize_t packet_flush_continue (void);   // Send buffered data but keep buffering
 void packet_end (void);                 // End buffering without sending (discard)
 void packet_write (const void *buf, size_t len);  // Add data to buffer
 
+// Broadcast buffering - packets written to BROADCAST_FD between
+// broadcast_start and broadcast_flush/packet_end are encoded only once,
+// then the same bytes are handed to the send queue of every recipient
+#define BROADCAST_FD -2
+void broadcast_start (void);            // Begin encoding a broadcast
+void broadcast_send (int client_fd);    // Send the encoded bytes to one client
+void broadcast_flush (int exclude_fd);  // Send to all in-game players but one, then end
+void broadcast_flush_players (uint32_t players, int exclude_fd);  // Same, limited to a player_data index bitmask
+
 ssize_t writeByte (int client_fd, uint8_t byte);
 ssize_t writeUint16 (int client_fd, uint16_t num);
 ssize_t writeInt16 (int client_fd, int16_t num);
@@ -88,8 +130,9 @@ uint64_t splitmix64 (uint64_t state);
   int64_t get_program_time ();
 #endif
 
-// Check if more movement packets are queued after the current one
+// Check if more movement packets are queued after the current one, which
+// has `remaining` bytes left to read
 // Returns 1 if more movement packets are waiting, 0 otherwise
-int hasMoreMovementPackets (int client_fd);
+int hasMoreMovementPackets (int client_fd, int remaining);
 
 #endif
@@ -25,11 +25,53 @@ uint8_t getTerrainAt (int x, int y, int z, ChunkAnchor anchor);
 uint8_t getBlockAt (int x, int y, int z);
 
 extern uint8_t chunk_section[4096];
+// Reads the block at the given section address (dx + dz * 16 + dy * 256)
+// from chunk_section, which stores entries in 8-byte big-endian groups
+#define SECTION_BLOCK(address) chunk_section[((address) & ~7) | (7 - ((address) & 7))]
+// Block that all of chunk_section is made of, or -1 if it's not known to be
+// uniform. Set by buildChunkSection, so valid until chunk_section is reused.
+extern int16_t chunk_section_uniform;
 uint8_t buildChunkSection (int cx, int cy, int cz);
+int pregenerateChunkSection (int cx, int cy, int cz, int may_evict);
+
+// chunk_section in the paletted container format of chunk packets
+typedef struct {
+  uint8_t bits;         // 0 = single value, 4 = local palette, 8 = global palette
+  uint8_t palette_len;  // number of local palette entries (0 and 4 bit only)
+  uint8_t palette[16];  // local palette as block IDs
+} PalettedSection;
+void paletteChunkSection (PalettedSection *out, uint8_t *data);
+
+/* Chunk cache statistics, reported by the profiler */
+typedef struct {
+  uint32_t hits;       /* Sections found in the cache */
+  uint32_t misses;     /* Sections that had to be loaded or generated */
+  uint32_t evictions;  /* Columns dropped to make room for others */
+} ChunkCacheStats;
+extern ChunkCacheStats chunk_cache_stats;
+
+/* Sections cached per column, the 20 that go into a chunk packet */
+#define CACHE_COLUMN_SECTIONS 20
 
 /* Chunk cache functions */
 void initChunkCache(void);
+void resizeChunkCache(long size_kb);
 void invalidateChunkCache(int16_t x, uint8_t y, int16_t z);
 void clearChunkCache(void);
 
+/* Chunk packet cache functions */
+uint8_t *findChunkPacket(int16_t x, int16_t z, int *size);
+uint8_t *allocChunkPacket(int16_t x, int16_t z, int size);
+void invalidateChunkPackets(int16_t min_x, int16_t min_z, int16_t max_x, int16_t max_z);
+void setChunkPacketCompressed(int16_t x, int16_t z, int size);
+uint8_t isChunkPacketCompressed(int16_t x, int16_t z);
+
+/* Block change index functions */
+void indexBlockChange(int index);
+void unindexBlockChange(int index);
+void shiftBlockChangeIndex(int from, int delta);
+void rebuildBlockChangeIndex(void);
+int firstBlockChangeInSection(int cx, int cy, int cz);
+int nextBlockChangeInSection(int index);
+
 #endif
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MAC68K_PLATFORM
+  #include <Memory.h>
+  #include "mac68k_console.h"
+#endif
+
+#include "globals.h"
+#include "arena.h"
+
+// Regions are kept at 4-byte boundaries
+#define ARENA_ALIGN(size) (((size) + 3) & ~3L)
+
+static const char *region_names[ARENA_REGION_COUNT] = {
+  "send queues",
+  "packet cache",
+  "encode scratch",
+  "chunk cache"
+};
+
+static uint8_t *arena = NULL;
+static long arena_size = 0;
+static uint8_t arena_ready = false;
+
+static long region_offset[ARENA_REGION_COUNT];
+static long region_size[ARENA_REGION_COUNT];
+
+// Prints one line of the layout report
+static void arenaLine (const char *name, long bytes) {
+  #ifdef MAC68K_PLATFORM
+    console_printf("  %-15s %6ld KB\r", name, bytes / 1024);
+  #else
+    printf("  %-15s %6ld KB\n", name, bytes / 1024);
+  #endif
+}
+
+int initArena () {
+  if (arena_ready) return arena == NULL;
+  arena_ready = true;
+
+  // Fixed regions, the chunk cache starts out empty after them
+  region_size[ARENA_SEND_QUEUES] = (long)MAX_PLAYERS * SEND_QUEUE_SIZE;
+  region_size[ARENA_PACKET_CACHE] = CHUNK_PACKET_CACHE_SIZE;
+  region_size[ARENA_ENCODE_SCRATCH] = CHUNK_ENCODE_SCRATCH_SIZE;
+  region_size[ARENA_CHUNK_CACHE] = 0;
+  long fixed = 0;
+  for (int i = 0; i < ARENA_REGION_COUNT; i ++) {
+    region_offset[i] = fixed;
+    fixed += ARENA_ALIGN(region_size[i]);
+  }
+
+  #ifdef MAC68K_PLATFORM
+    // Grow the heap to the full partition set in Get Info, then take all
+    // of it but what the Toolbox, networking stack and stdio will need
+    MaxApplZone();
+    long grow;
+    arena_size = MaxMem(&grow) - ARENA_HEAP_RESERVE;
+    if (arena_size >= fixed) arena = (uint8_t *)NewPtr(arena_size);
+  #else
+    arena_size = ARENA_SIZE;
+    arena = (uint8_t *)malloc(arena_size);
+  #endif
+
+  if (arena == NULL) {
+    #ifdef MAC68K_PLATFORM
+      console_printf("ERROR: Need %ld KB for the memory arena, only %ld KB free\r",
+        (fixed + ARENA_HEAP_RESERVE) / 1024, (arena_size + ARENA_HEAP_RESERVE) / 1024);
+    #else
+      printf("ERROR: Failed to allocate %ld KB for the memory arena\n", arena_size / 1024);
+    #endif
+    arena_size = 0;
+    return 1;
+  }
+  return 0;
+}
+
+void *getArenaRegion (int region) {
+  if (initArena()) return NULL;
+  return arena + region_offset[region];
+}
+
+long getArenaRegionLimit (int region) {
+  if (initArena() || region != ARENA_REGION_COUNT - 1) return 0;
+  return arena_size - region_offset[region];
+}
+
+void *resizeArenaRegion (int region, long size) {
+  if (size > getArenaRegionLimit(region)) return NULL;
+  region_size[region] = size;
+  return arena + region_offset[region];
+}
+
+void printArenaReport () {
+  if (initArena()) return;
+  #ifdef MAC68K_PLATFORM
+    console_printf("Memory arena: %ld KB\r", arena_size / 1024);
+  #else
+    printf("Memory arena: %ld KB\n", arena_size / 1024);
+  #endif
+  long used = 0;
+  for (int i = 0; i < ARENA_REGION_COUNT; i ++) {
+    arenaLine(region_names[i], region_size[i]);
+    used += ARENA_ALIGN(region_size[i]);
+  }
+  arenaLine("unused", arena_size - used);
+}
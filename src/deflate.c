@@ -0,0 +1,389 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "deflate.h"
+
+// Minimal zlib (RFC 1950) and deflate (RFC 1951) support, just enough for
+// the compressed protocol framing: a fast compressor for chunk packets,
+// and a decompressor for the occasional large packet sent by clients.
+
+#define WINDOW_SIZE 32768
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+
+// Most recent position of each hashed 3-byte sequence, -1 if none
+static int32_t hash_head[HASH_SIZE];
+
+static const uint16_t length_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Computes the Adler-32 checksum that ends a zlib stream. The modulo is
+// only taken every 5552 bytes, the most that can't overflow 32 bits.
+static uint32_t adler32 (const uint8_t *data, int len) {
+  uint32_t a = 1, b = 0;
+  while (len > 0) {
+    int run = len < 5552 ? len : 5552;
+    len -= run;
+    while (run --) {
+      a += *data ++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+typedef struct {
+  uint8_t *out;
+  int size;
+  int pos;
+  uint32_t bits;
+  int count;
+} BitWriter;
+
+// Appends `n` bits, least significant first. Writes past the end of the
+// output are only counted, the caller checks `pos` against `size`.
+static void putBits (BitWriter *w, uint32_t value, int n) {
+  w->bits |= value << w->count;
+  w->count += n;
+  while (w->count >= 8) {
+    if (w->pos < w->size) w->out[w->pos] = w->bits;
+    w->pos ++;
+    w->bits >>= 8;
+    w->count -= 8;
+  }
+}
+
+// Appends a Huffman code, which goes out most significant bit first
+static void putCode (BitWriter *w, uint32_t code, int n) {
+  uint32_t reversed = 0;
+  for (int i = 0; i < n; i ++) {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+  putBits(w, reversed, n);
+}
+
+// Appends a literal/length symbol using the fixed Huffman codes
+static void putSymbol (BitWriter *w, int symbol) {
+  if (symbol < 144) putCode(w, 0x30 + symbol, 8);
+  else if (symbol < 256) putCode(w, 0x190 + symbol - 144, 9);
+  else if (symbol < 280) putCode(w, symbol - 256, 7);
+  else putCode(w, 0xC0 + symbol - 280, 8);
+}
+
+static void putMatch (BitWriter *w, int length, int distance) {
+  int code = 28;
+  while (length_base[code] > length) code --;
+  putSymbol(w, 257 + code);
+  putBits(w, length - length_base[code], length_extra[code]);
+
+  code = 29;
+  while (distance_base[code] > distance) code --;
+  putCode(w, code, 5);
+  putBits(w, distance - distance_base[code], distance_extra[code]);
+}
+
+static inline uint32_t hash3 (const uint8_t *p) {
+  return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+int zlibCompress (const uint8_t *in, int len, uint8_t *out, int out_size) {
+
+  BitWriter w = { out, out_size, 0, 0, 0 };
+
+  // Deflate with a 32K window, flagged as the fastest compression level
+  putBits(&w, 0x78, 8);
+  putBits(&w, 0x01, 8);
+  // One final block, with fixed Huffman codes
+  putBits(&w, 1, 1);
+  putBits(&w, 1, 2);
+
+  memset(hash_head, 0xFF, sizeof(hash_head));
+
+  int i = 0;
+  while (i < len) {
+    // Give up as soon as the output no longer fits
+    if (w.pos > out_size) return -1;
+
+    int match = 0, distance = 0;
+    if (i + MIN_MATCH <= len) {
+      uint32_t h = hash3(in + i);
+      int32_t candidate = hash_head[h];
+      hash_head[h] = i;
+      if (candidate >= 0 && i - candidate <= WINDOW_SIZE) {
+        int max = len - i < MAX_MATCH ? len - i : MAX_MATCH;
+        while (match < max && in[candidate + match] == in[i + match]) match ++;
+        distance = i - candidate;
+      }
+    }
+
+    if (match < MIN_MATCH) {
+      putSymbol(&w, in[i]);
+      i ++;
+      continue;
+    }
+
+    putMatch(&w, match, distance);
+    // Hash the positions inside the match too, so later data can refer
+    // back to them
+    for (int j = i + 1; j < i + match && j + MIN_MATCH <= len; j ++) {
+      hash_head[hash3(in + j)] = j;
+    }
+    i += match;
+  }
+
+  // End of block, then pad to a byte boundary for the checksum
+  putSymbol(&w, 256);
+  if (w.count > 0) putBits(&w, 0, 8 - w.count);
+  uint32_t checksum = adler32(in, len);
+  for (int shift = 24; shift >= 0; shift -= 8) putBits(&w, (checksum >> shift) & 0xFF, 8);
+
+  if (w.pos > out_size) return -1;
+  return w.pos;
+
+}
+
+typedef struct {
+  const uint8_t *in;
+  int len;
+  int pos;
+  uint32_t bits;
+  int count;
+} BitReader;
+
+// Reads `n` bits, least significant first
+// Returns -1 if the input runs out
+static int32_t getBits (BitReader *r, int n) {
+  while (r->count < n) {
+    if (r->pos == r->len) return -1;
+    r->bits |= (uint32_t)r->in[r->pos ++] << r->count;
+    r->count += 8;
+  }
+  int32_t value = r->bits & ((1UL << n) - 1);
+  r->bits >>= n;
+  r->count -= n;
+  return value;
+}
+
+// Canonical Huffman code, as the number of codes of each length and the
+// symbols sorted by code
+typedef struct {
+  uint16_t count[16];
+  uint16_t symbol[288];
+} Huffman;
+
+// Builds a Huffman code from the code length of each symbol
+// Returns 1 if the lengths are over-subscribed, 0 otherwise
+static int buildHuffman (Huffman *h, const uint8_t *lengths, int n) {
+  uint16_t offsets[16];
+  memset(h->count, 0, sizeof(h->count));
+  for (int i = 0; i < n; i ++) h->count[lengths[i]] ++;
+  h->count[0] = 0;
+
+  int left = 1;
+  for (int len = 1; len < 16; len ++) {
+    left <<= 1;
+    left -= h->count[len];
+    if (left < 0) return 1;
+  }
+
+  offsets[1] = 0;
+  for (int len = 1; len < 15; len ++) offsets[len + 1] = offsets[len] + h->count[len];
+  for (int i = 0; i < n; i ++) {
+    if (lengths[i] != 0) h->symbol[offsets[lengths[i]] ++] = i;
+  }
+  return 0;
+}
+
+// Decodes one symbol, a bit at a time, which is plenty fast for the few
+// compressed packets clients send
+// Returns -1 on invalid or truncated input
+static int decodeSymbol (BitReader *r, const Huffman *h) {
+  int code = 0, first = 0, index = 0;
+  for (int len = 1; len < 16; len ++) {
+    int32_t bit = getBits(r, 1);
+    if (bit < 0) return -1;
+    code |= bit;
+    int count = h->count[len];
+    if (code - count < first) return h->symbol[index + (code - first)];
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+// Decodes the compressed data of a block until its end of block symbol
+// Returns 0 on success, 1 on invalid input or output overflow
+static int inflateCodes (BitReader *r, uint8_t *out, int out_size, int *out_pos, const Huffman *lengths, const Huffman *distances) {
+  int pos = *out_pos;
+  for (;;) {
+    int symbol = decodeSymbol(r, lengths);
+    if (symbol < 0) return 1;
+    if (symbol == 256) break;
+    if (symbol < 256) {
+      if (pos == out_size) return 1;
+      out[pos ++] = symbol;
+      continue;
+    }
+
+    symbol -= 257;
+    if (symbol >= 29) return 1;
+    int32_t extra = getBits(r, length_extra[symbol]);
+    if (extra < 0) return 1;
+    int length = length_base[symbol] + extra;
+
+    symbol = decodeSymbol(r, distances);
+    if (symbol < 0 || symbol >= 30) return 1;
+    extra = getBits(r, distance_extra[symbol]);
+    if (extra < 0) return 1;
+    int distance = distance_base[symbol] + extra;
+
+    if (distance > pos || length > out_size - pos) return 1;
+    // Copied a byte at a time, as matches may overlap what they produce
+    for (int i = 0; i < length; i ++, pos ++) out[pos] = out[pos - distance];
+  }
+  *out_pos = pos;
+  return 0;
+}
+
+// Order in which the code length code lengths of a dynamic block are sent
+static const uint8_t code_length_order[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+// Reads the code definitions of a dynamic block
+// Returns 0 on success, 1 on invalid input
+static int readDynamicCodes (BitReader *r, Huffman *lengths, Huffman *distances) {
+  uint8_t code_lengths[320];
+
+  int32_t nlen = getBits(r, 5);
+  int32_t ndist = getBits(r, 5);
+  int32_t ncode = getBits(r, 4);
+  if (nlen < 0 || ndist < 0 || ncode < 0) return 1;
+  nlen += 257;
+  ndist += 1;
+  ncode += 4;
+  if (nlen > 286 || ndist > 30) return 1;
+
+  memset(code_lengths, 0, 19);
+  for (int i = 0; i < ncode; i ++) {
+    int32_t len = getBits(r, 3);
+    if (len < 0) return 1;
+    code_lengths[code_length_order[i]] = len;
+  }
+  // The literal/length table is free until the codes themselves are read
+  if (buildHuffman(lengths, code_lengths, 19)) return 1;
+
+  int i = 0;
+  while (i < nlen + ndist) {
+    int symbol = decodeSymbol(r, lengths);
+    if (symbol < 0) return 1;
+    if (symbol < 16) {
+      code_lengths[i ++] = symbol;
+      continue;
+    }
+    int repeat, value = 0;
+    int32_t extra;
+    if (symbol == 16) {
+      if (i == 0) return 1;
+      value = code_lengths[i - 1];
+      extra = getBits(r, 2);
+      repeat = 3 + extra;
+    } else if (symbol == 17) {
+      extra = getBits(r, 3);
+      repeat = 3 + extra;
+    } else {
+      extra = getBits(r, 7);
+      repeat = 11 + extra;
+    }
+    if (extra < 0 || i + repeat > nlen + ndist) return 1;
+    while (repeat --) code_lengths[i ++] = value;
+  }
+
+  // Without an end of block code, the block could never end
+  if (code_lengths[256] == 0) return 1;
+  if (buildHuffman(lengths, code_lengths, nlen)) return 1;
+  if (buildHuffman(distances, code_lengths + nlen, ndist)) return 1;
+  return 0;
+}
+
+int zlibDecompress (const uint8_t *in, int len, uint8_t *out, int out_size) {
+
+  // Deflate, with no preset dictionary and a valid header check
+  if (len < 6) return 1;
+  if ((in[0] & 0x0F) != 8 || (in[1] & 0x20)) return 1;
+  if (((in[0] << 8) | in[1]) % 31 != 0) return 1;
+
+  BitReader r = { in, len - 4, 2, 0, 0 };
+  static Huffman lengths, distances;
+  int out_pos = 0;
+  int32_t final;
+
+  do {
+    final = getBits(&r, 1);
+    int32_t type = getBits(&r, 2);
+    if (final < 0 || type < 0) return 1;
+
+    if (type == 0) {
+      // Stored block, starting at the next byte boundary
+      r.bits = 0;
+      r.count = 0;
+      if (r.pos + 4 > r.len) return 1;
+      int stored = r.in[r.pos] | (r.in[r.pos + 1] << 8);
+      int check = r.in[r.pos + 2] | (r.in[r.pos + 3] << 8);
+      r.pos += 4;
+      if (stored != (~check & 0xFFFF)) return 1;
+      if (stored > r.len - r.pos || stored > out_size - out_pos) return 1;
+      memcpy(out + out_pos, r.in + r.pos, stored);
+      r.pos += stored;
+      out_pos += stored;
+      continue;
+    }
+
+    if (type == 1) {
+      uint8_t code_lengths[288];
+      int i = 0;
+      for (; i < 144; i ++) code_lengths[i] = 8;
+      for (; i < 256; i ++) code_lengths[i] = 9;
+      for (; i < 280; i ++) code_lengths[i] = 7;
+      for (; i < 288; i ++) code_lengths[i] = 8;
+      buildHuffman(&lengths, code_lengths, 288);
+      for (i = 0; i < 30; i ++) code_lengths[i] = 5;
+      buildHuffman(&distances, code_lengths, 30);
+    } else if (type == 2) {
+      if (readDynamicCodes(&r, &lengths, &distances)) return 1;
+    } else return 1;
+
+    if (inflateCodes(&r, out, out_size, &out_pos, &lengths, &distances)) return 1;
+
+  } while (!final);
+
+  if (out_pos != out_size) return 1;
+
+  // The checksum follows the last block, big-endian
+  const uint8_t *trailer = in + len - 4;
+  uint32_t checksum = ((uint32_t)trailer[0] << 24) | ((uint32_t)trailer[1] << 16) | (trailer[2] << 8) | trailer[3];
+  return checksum != adler32(out, out_size);
+
+}
@@ -42,8 +42,11 @@ uint32_t server_ticks = 0;
 
 int view_distance = 1;
 
-/* Chunk interleave callback - set by main.c, called by packets.c */
-chunk_interleave_fn chunk_interleave_callback = NULL;
+#ifdef ENABLE_COMPRESSION
+  uint8_t compression_enabled = true;
+#else
+  uint8_t compression_enabled = false;
+#endif
 
 char motd[] = { "A bareiron server" };
 uint8_t motd_len = sizeof(motd) - 1;
@@ -58,7 +61,13 @@ uint16_t client_count;
 BlockChange block_changes[MAX_BLOCK_CHANGES];
 int block_changes_count = 0;
 
+#ifdef ALLOW_CHESTS
+ChestData chest_data[MAX_CHESTS];
+#endif
+
 PlayerData player_data[MAX_PLAYERS];
 int player_data_count = 0;
+uint8_t online_players[MAX_PLAYERS];
+int online_player_count = 0;
 
 MobData mob_data[MAX_MOBS];
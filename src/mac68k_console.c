@@ -27,6 +27,9 @@
 #include "mac68k_net.h"
 #include "profiler.h"
 #include "globals.h"
+#include "worldgen.h"
+#include "procedures.h"
+#include "arena.h"
 
 /* Font constants - Monaco is font ID 4 */
 #define kFontMonaco 4
@@ -50,6 +53,7 @@
 #define ITEM_SERVER_CACHE   6  /* Set Cache Size... */
 #define ITEM_SERVER_SEP2    7  /* Separator */
 #define ITEM_SERVER_INTERP  8  /* Smooth Mob Movement */
+#define ITEM_SERVER_COMPRESS 9 /* Compress Chunks */
 
 #define ITEM_DEBUG_PROFILE  1
 #define ITEM_DEBUG_SAVE     2
@@ -180,7 +184,7 @@ static void show_cache_size_dialog(void) {
     MoveTo(20, 75);
     DrawString("\p(e.g., 1024 for 1MB, 4096 for 4MB)");
     MoveTo(20, 90);
-    DrawString("\pChanges take effect after restart.");
+    DrawString("\pThe cache is emptied and resized.");
     TextSize(12);
 
     /* Event loop */
@@ -259,7 +263,7 @@ static void show_cache_size_dialog(void) {
                     MoveTo(20, 75);
                     DrawString("\p(e.g., 1024 for 1MB, 4096 for 4MB)");
                     MoveTo(20, 90);
-                    DrawString("\pChanges take effect after restart.");
+                    DrawString("\pThe cache is emptied and resized.");
                     TextSize(12);
                     InsetRect(&input_rect, 3, 3);
                     TEUpdate(&input_rect, te);
@@ -278,8 +282,10 @@ static void show_cache_size_dialog(void) {
     }
 
     if (accepted) {
+        /* Rebalance the arena now, rather than waiting for a restart */
         console_printf("Cache size set to %ld KB\r", g_cache_size_kb);
-        console_print("(Will take effect after restart)\r");
+        resizeChunkCache(g_cache_size_kb);
+        printArenaReport();
     }
 }
 
@@ -307,9 +313,11 @@ static void setup_menus(void) {
     AppendMenu(g_server_menu, "\pSet Cache Size...");
     AppendMenu(g_server_menu, "\p(-");  /* Separator */
     AppendMenu(g_server_menu, "\pSmooth Mob Movement");
+    AppendMenu(g_server_menu, "\pCompress Chunks");
     InsertMenu(g_server_menu, 0);
     update_view_distance_checkmarks();
     CheckItem(g_server_menu, ITEM_SERVER_INTERP, g_mob_interpolation);
+    CheckItem(g_server_menu, ITEM_SERVER_COMPRESS, compression_enabled);
 
     /* Create Debug menu */
     g_debug_menu = NewMenu(MENU_DEBUG, "\pDebug");
@@ -359,7 +367,7 @@ static void handle_menu_choice(long menu_choice) {
 
         case MENU_SERVER:
             if (item_id >= ITEM_SERVER_VD1 && item_id <= ITEM_SERVER_VD4) {
-                view_distance = item_id;  /* VD1=1, VD2=2, etc. */
+                setViewDistance(item_id);  /* VD1=1, VD2=2, etc. */
                 update_view_distance_checkmarks();
                 console_printf("View distance set to %d\r", view_distance);
             } else if (item_id == ITEM_SERVER_CACHE) {
@@ -368,6 +376,11 @@ static void handle_menu_choice(long menu_choice) {
                 g_mob_interpolation = !g_mob_interpolation;
                 CheckItem(g_server_menu, ITEM_SERVER_INTERP, g_mob_interpolation);
                 console_printf("Mob interpolation %s\r", g_mob_interpolation ? "enabled" : "disabled");
+            } else if (item_id == ITEM_SERVER_COMPRESS) {
+                /* Only affects players who log in afterwards */
+                compression_enabled = !compression_enabled;
+                CheckItem(g_server_menu, ITEM_SERVER_COMPRESS, compression_enabled);
+                console_printf("Chunk compression %s\r", compression_enabled ? "enabled" : "disabled");
             }
             break;
 
@@ -465,12 +478,16 @@ void console_init(void) {
 }
 
 void console_poll_events(void) {
+    /* Use WaitNextEvent with zero sleep for minimal latency during networking */
+    console_wait_events(0);
+}
+
+void console_wait_events(long sleep_ticks) {
     EventRecord event;
     WindowPtr which_window;
     long menu_choice;
 
-    /* Use WaitNextEvent with zero sleep for minimal latency during networking */
-    if (WaitNextEvent(everyEvent, &event, 0, NULL)) {
+    if (WaitNextEvent(everyEvent, &event, sleep_ticks, NULL)) {
         switch (event.what) {
             case mouseDown:
                 switch (FindWindow(event.where, &which_window)) {
@@ -583,10 +600,8 @@ int console_should_quit(void) {
     return g_should_quit;
 }
 
-int console_get_cache_size(void) {
-    /* Convert KB to number of entries */
-    /* Each CachedChunkSection is approximately 4KB */
-    return (int)(g_cache_size_kb / 4);
+long console_get_cache_size_kb(void) {
+    return g_cache_size_kb;
 }
 
 int console_get_mob_interpolation(void) {
@@ -605,10 +620,11 @@ typedef struct {
     short view_dist;      /* View distance setting */
     long cache_size_kb;   /* Cache size in KB */
     short mob_interp;     /* Mob interpolation enabled */
+    short compression;    /* Chunk compression enabled */
 } BareironPrefs;
 
 #define PREFS_MAGIC 'BARI'
-#define PREFS_VERSION 2
+#define PREFS_VERSION 3
 
 void console_save_prefs(void) {
     OSErr err;
@@ -654,6 +670,7 @@ void console_save_prefs(void) {
     prefs.view_dist = view_distance;
     prefs.cache_size_kb = g_cache_size_kb;
     prefs.mob_interp = g_mob_interpolation;
+    prefs.compression = compression_enabled;
 
     /* Write prefs */
     count = sizeof(BareironPrefs);
@@ -661,8 +678,8 @@ void console_save_prefs(void) {
     if (err != noErr) {
         console_print("Error writing prefs\r");
     } else {
-        console_printf("Saved prefs: view_dist=%d, cache=%ldKB, interp=%d\r",
-                       view_distance, g_cache_size_kb, g_mob_interpolation);
+        console_printf("Saved prefs: view_dist=%d, cache=%ldKB, interp=%d, compress=%d\r",
+                       view_distance, g_cache_size_kb, g_mob_interpolation, compression_enabled);
     }
 
     FSClose(refNum);
@@ -700,7 +717,8 @@ void console_load_prefs(void) {
     err = FSRead(refNum, &count, &prefs);
     FSClose(refNum);
 
-    if (err != noErr) {
+    /* Prefs from older versions are shorter, which reads as eofErr */
+    if (err != noErr && err != eofErr) {
         return;  /* Read failed, use defaults */
     }
 
@@ -710,7 +728,7 @@ void console_load_prefs(void) {
     }
 
     /* Apply settings */
-    if (prefs.view_dist >= 1 && prefs.view_dist <= 4) {
+    if (prefs.view_dist >= 1 && prefs.view_dist <= MAX_VIEW_DISTANCE) {
         view_distance = prefs.view_dist;
     }
     if (prefs.cache_size_kb >= 64 && prefs.cache_size_kb <= 65536) {
@@ -720,9 +738,13 @@ void console_load_prefs(void) {
     if (prefs.version >= 2) {
         g_mob_interpolation = prefs.mob_interp ? 1 : 0;
     }
+    /* Only load compression if version >= 3 */
+    if (prefs.version >= 3) {
+        compression_enabled = prefs.compression ? 1 : 0;
+    }
 
-    console_printf("Loaded prefs: view_dist=%d, cache=%ldKB, interp=%d\r",
-                   view_distance, g_cache_size_kb, g_mob_interpolation);
+    console_printf("Loaded prefs: view_dist=%d, cache=%ldKB, interp=%d, compress=%d\r",
+                   view_distance, g_cache_size_kb, g_mob_interpolation, compression_enabled);
 }
 
 #endif /* MAC68K_PLATFORM */
@@ -10,6 +10,8 @@
 #ifdef MAC68K_PLATFORM
 
 #include <Gestalt.h>
+#include <Processes.h>
+#include <Devices.h>
 #include <string.h>
 
 /* Include system networking headers FIRST - they define O_NONBLOCK etc. */
@@ -31,9 +33,6 @@ int errno = 0;
 /* Maximum number of connections we can track */
 #define MAX_STREAMS 34  /* 1 listener + MAX_PLAYERS clients + margin */
 
-/* Peek buffer size - enough for protocol header checks */
-#define PEEK_BUFFER_SIZE 16
-
 /* Which networking stack are we using? */
 static int g_use_open_transport = 0;
 static int g_net_initialized = 0;
@@ -61,14 +60,22 @@ typedef struct {
     TCall pending_call;
     InetAddress pending_addr;
     int has_pending;
-    unsigned char peek_buf[PEEK_BUFFER_SIZE];
-    int peek_len;
+    volatile int ready;  /* Set by the notifier when there's work to do */
     int orderly_disconnect_sent;
     int orderly_disconnect_rcvd;
 } OTStreamInfo;
 
 static OTStreamInfo g_ot_streams[MAX_STREAMS];
 
+/* Event mode - a notifier on each endpoint flags it as ready when data
+ * arrives, flow control lifts, a client connects or disconnects. The
+ * main loop then only visits ready endpoints, and sleeps otherwise. */
+static int g_ot_event_mode = 0;
+static OTNotifyUPP g_ot_notifier_upp = NULL;
+static ProcessSerialNumber g_ot_psn;
+static volatile int g_ot_event_pending = 0;
+static volatile int g_ot_sleeping = 0;
+
 static int ot_fd_to_index(int fd) {
     int idx = fd - FD_BASE;
     if (idx < 0 || idx >= MAX_STREAMS) return -1;
@@ -155,6 +162,39 @@ static int ot_handle_disconnect_event(OTStreamInfo *info, OTResult event) {
     }
 }
 
+/* Runs at deferred task time, so it must only set flags. WakeUpProcess
+ * is safe to call here and cuts short a sleep in WaitNextEvent. */
+static pascal void ot_notifier(void *context, OTEventCode code,
+                               OTResult result, void *cookie) {
+    OTStreamInfo *info = (OTStreamInfo *)context;
+    (void)result;
+    (void)cookie;
+
+    switch (code) {
+        case T_DATA:
+        case T_GODATA:
+        case T_LISTEN:
+        case T_DISCONNECT:
+        case T_ORDREL:
+            info->ready = 1;
+            g_ot_event_pending = 1;
+            if (g_ot_sleeping) WakeUpProcess(&g_ot_psn);
+            break;
+        default:
+            break;
+    }
+}
+
+static void ot_install_notifier(OTStreamInfo *info) {
+    /* Have the main loop look at new endpoints at least once */
+    info->ready = 1;
+    if (!g_ot_event_mode) return;
+    if (OTInstallNotifier(info->endpoint, g_ot_notifier_upp, info) != noErr) {
+        console_print("OT notifier install failed, falling back to polling.\r");
+        g_ot_event_mode = 0;
+    }
+}
+
 static int ot_init(void) {
     OSStatus err = InitOpenTransport();
     if (err != noErr) {
@@ -164,6 +204,11 @@ static int ot_init(void) {
     memset(g_ot_streams, 0, sizeof(g_ot_streams));
     g_ot_initialized = 1;
     console_print("Open Transport initialized.\r");
+
+    if (g_ot_notifier_upp == NULL) g_ot_notifier_upp = NewOTNotifyUPP(ot_notifier);
+    g_ot_event_mode = (g_ot_notifier_upp != NULL && GetCurrentProcess(&g_ot_psn) == noErr);
+    g_ot_event_pending = 0;
+    if (g_ot_event_mode) console_print("Using OT notifiers (event mode).\r");
     return 0;
 }
 
@@ -196,6 +241,7 @@ static int ot_socket(void) {
 
     OTSetSynchronous(info->endpoint);
     OTSetNonBlocking(info->endpoint);
+    ot_install_notifier(info);
 
     return fd;
 }
@@ -258,7 +304,15 @@ static int ot_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
 
     info = &g_ot_streams[idx];
 
+    /* In event mode, a T_LISTEN will have flagged the listener */
+    if (g_ot_event_mode && !info->has_pending && !info->ready) {
+        errno = EAGAIN;
+        return -1;
+    }
+
     if (!info->has_pending) {
+        /* Clear before looking, so a T_LISTEN after this isn't lost */
+        info->ready = 0;
         look_result = OTLook(info->endpoint);
         if (look_result == T_LISTEN) {
             OTMemzero(&info->pending_call, sizeof(TCall));
@@ -306,6 +360,7 @@ static int ot_accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
 
     OTSetSynchronous(new_info->endpoint);
     OTSetNonBlocking(new_info->endpoint);
+    ot_install_notifier(new_info);
 
     err = OTBind(new_info->endpoint, NULL, NULL);
     if (err != noErr) {
@@ -383,7 +438,6 @@ static ssize_t ot_recv(int sockfd, void *buf, size_t len, int flags) {
     OTResult result;
     OTFlags ot_flags = 0;
     OTByteCount avail;
-    size_t copy_len;
 
     if (idx < 0 || !g_ot_streams[idx].in_use) {
         errno = EBADF;
@@ -396,45 +450,12 @@ static ssize_t ot_recv(int sockfd, void *buf, size_t len, int flags) {
         return -1;
     }
 
-    if (flags & MSG_PEEK) {
-        if (info->peek_len >= (int)len) {
-            memcpy(buf, info->peek_buf, len);
-            return (ssize_t)len;
-        }
-        if (info->peek_len < PEEK_BUFFER_SIZE) {
-            if (OTCountDataBytes(info->endpoint, &avail) == noErr && avail > 0) {
-                size_t to_read = PEEK_BUFFER_SIZE - info->peek_len;
-                if (to_read > (size_t)avail) to_read = (size_t)avail;
-                result = OTRcv(info->endpoint, info->peek_buf + info->peek_len, to_read, &ot_flags);
-                if (result > 0) {
-                    info->peek_len += result;
-                } else if (result == kOTLookErr) {
-                    if (ot_handle_disconnect_event(info, OTLook(info->endpoint))) {
-                        return 0;
-                    }
-                }
-            }
-        }
-        if (info->peek_len > 0) {
-            copy_len = ((size_t)info->peek_len < len) ? (size_t)info->peek_len : len;
-            memcpy(buf, info->peek_buf, copy_len);
-            return (ssize_t)copy_len;
-        }
-        errno = EAGAIN;
-        return -1;
-    }
-
-    if (info->peek_len > 0) {
-        copy_len = ((size_t)info->peek_len < len) ? (size_t)info->peek_len : len;
-        memcpy(buf, info->peek_buf, copy_len);
-        if (copy_len < (size_t)info->peek_len) {
-            memmove(info->peek_buf, info->peek_buf + copy_len, info->peek_len - copy_len);
-        }
-        info->peek_len -= copy_len;
-        return (ssize_t)copy_len;
-    }
-
-    if (OTCountDataBytes(info->endpoint, &avail) == noErr && avail == 0) {
+    /* In event mode, OTRcv has to run into kOTNoDataErr for Open
+     * Transport to send another T_DATA, so skip the byte count check.
+     * Clear the flag first, a T_DATA arriving after this sets it again. */
+    if (g_ot_event_mode) {
+        info->ready = 0;
+    } else if (OTCountDataBytes(info->endpoint, &avail) == noErr && avail == 0) {
         OTResult look = OTLook(info->endpoint);
         if (look == T_DISCONNECT || look == T_ORDREL) {
             ot_handle_disconnect_event(info, look);
@@ -445,7 +466,11 @@ static ssize_t ot_recv(int sockfd, void *buf, size_t len, int flags) {
     }
 
     result = OTRcv(info->endpoint, buf, len, &ot_flags);
-    if (result > 0) return (ssize_t)result;
+    if (result > 0) {
+        /* There may be more, stay ready until a read comes up empty */
+        info->ready = 1;
+        return (ssize_t)result;
+    }
     if (result == 0) return 0;
     if (result == kOTNoDataErr) {
         errno = EAGAIN;
@@ -524,6 +549,19 @@ static void ot_cleanup(void) {
 
 #define STREAM_BUFFER_SIZE 4096
 
+/* Asynchronous sends - each TCPSend takes a write data structure (WDS)
+ * pointing at up to MACTCP_WDS_MAX caller buffers, and several can be in
+ * flight on a stream at once. MacTCP completes them in order. */
+#define MACTCP_SEND_SLOTS 4
+#define MACTCP_WDS_MAX 4
+#define MACTCP_SEND_TIMEOUT 30  /* Seconds before MacTCP aborts a send */
+
+typedef struct {
+    TCPiopb pb;
+    wdsEntry wds[MACTCP_WDS_MAX + 1];  /* Zero length entry terminates */
+    unsigned long length;
+} MacTCPSend;
+
 typedef struct {
     unsigned long stream;
     int in_use;
@@ -535,12 +573,16 @@ typedef struct {
     long remote_host;
     short remote_port;
     bool cancel_flag;
-    unsigned char peek_buf[PEEK_BUFFER_SIZE];
-    int peek_len;
+    MacTCPSend sends[MACTCP_SEND_SLOTS];
+    int send_first;  /* Oldest send in flight */
+    int send_count;  /* Number of sends in flight */
 } MacTCPStreamInfo;
 
 static MacTCPStreamInfo g_mactcp_streams[MAX_STREAMS];
 
+/* Driver reference number for issuing our own TCPSend calls */
+static short g_mactcp_refnum = 0;
+
 static void mactcp_give_time_callback(void) {
     console_poll_events();
 }
@@ -573,6 +615,12 @@ static int mactcp_init(void) {
     memset(g_mactcp_streams, 0, sizeof(g_mactcp_streams));
     g_mactcp_initialized = 1;
     console_print("MacTCP initialized.\r");
+
+    /* Already open after InitNetwork, this just gets the refnum */
+    if (OpenDriver("\p.IPP", &g_mactcp_refnum) != noErr) {
+        console_print("MacTCP driver refnum unavailable, using synchronous sends.\r");
+        g_mactcp_refnum = 0;
+    }
     return 0;
 }
 
@@ -736,6 +784,10 @@ static ssize_t mactcp_send(int sockfd, const void *buf, size_t len) {
         return -1;
     }
 
+    /* SendData takes an unsigned short length, so send large buffers in
+     * parts and let the caller come back for the rest */
+    if (len > 65535) len = 65535;
+
     err = SendData(info->stream, (Ptr)buf, (unsigned short)len, false,
                    (GiveTimePtr)mactcp_give_time_callback, &info->cancel_flag);
 
@@ -751,12 +803,17 @@ static ssize_t mactcp_send(int sockfd, const void *buf, size_t len) {
     return (ssize_t)len;
 }
 
-static ssize_t mactcp_recv(int sockfd, void *buf, size_t len, int flags) {
+/* Issues a TCPSend for the given buffers without waiting for it.
+ * The buffers must stay untouched until mactcp_send_completed has
+ * counted them. Returns 0 on success, or -1 with errno set (EAGAIN if
+ * every send slot is in flight). */
+static int mactcp_send_gather(int sockfd, const NetSendPart *parts, int count) {
     int idx = mactcp_fd_to_index(sockfd);
     MacTCPStreamInfo *info;
+    MacTCPSend *send;
+    unsigned long total = 0;
     OSErr err;
-    unsigned short recv_len;
-    size_t copy_len;
+    int i;
 
     if (idx < 0 || !g_mactcp_streams[idx].in_use) {
         errno = EBADF;
@@ -768,42 +825,111 @@ static ssize_t mactcp_recv(int sockfd, void *buf, size_t len, int flags) {
         errno = ENOTCONN;
         return -1;
     }
-
-    if (flags & MSG_PEEK) {
-        if (info->peek_len >= (int)len) {
-            memcpy(buf, info->peek_buf, len);
-            return (ssize_t)len;
-        }
-        if (info->peek_len < PEEK_BUFFER_SIZE) {
-            recv_len = (unsigned short)(PEEK_BUFFER_SIZE - info->peek_len);
-            err = RecvData(info->stream, (Ptr)(info->peek_buf + info->peek_len),
-                           &recv_len, false, (GiveTimePtr)mactcp_give_time_callback,
-                           &info->cancel_flag);
-            if (err == noErr && recv_len > 0) {
-                info->peek_len += recv_len;
-            } else if (err != noErr && err != commandTimeout) {
-                if (err == connectionClosing || err == connectionTerminated) {
-                    return 0;
-                }
-            }
-        }
-        if (info->peek_len > 0) {
-            copy_len = (info->peek_len < (int)len) ? info->peek_len : len;
-            memcpy(buf, info->peek_buf, copy_len);
-            return (ssize_t)copy_len;
-        }
+    if (info->send_count == MACTCP_SEND_SLOTS) {
         errno = EAGAIN;
         return -1;
     }
+    if (count > MACTCP_WDS_MAX) count = MACTCP_WDS_MAX;
+
+    send = &info->sends[(info->send_first + info->send_count) % MACTCP_SEND_SLOTS];
+    for (i = 0; i < count; i++) {
+        send->wds[i].length = parts[i].length;
+        send->wds[i].ptr = (Ptr)parts[i].data;
+        total += parts[i].length;
+    }
+    send->wds[count].length = 0;
+    send->wds[count].ptr = NULL;
+    send->length = total;
+
+    memset(&send->pb, 0, sizeof(TCPiopb));
+    send->pb.ioCRefNum = g_mactcp_refnum;
+    send->pb.csCode = TCPSend;
+    send->pb.tcpStream = (StreamPtr)info->stream;
+    send->pb.csParam.send.ulpTimeoutValue = MACTCP_SEND_TIMEOUT;
+    send->pb.csParam.send.ulpTimeoutAction = 1;  /* Abort */
+    send->pb.csParam.send.validityFlags = timeoutValue | timeoutAction;
+    send->pb.csParam.send.pushFlag = true;
+    send->pb.csParam.send.urgentFlag = false;
+    send->pb.csParam.send.wdsPtr = (Ptr)send->wds;
+
+    err = PBControlAsync((ParmBlkPtr)&send->pb);
+    if (err != noErr) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    info->send_count++;
+    return 0;
+}
+
+/* Returns how many bytes have finished sending since the last call,
+ * or -1 if a send failed */
+static long mactcp_send_completed(int sockfd) {
+    int idx = mactcp_fd_to_index(sockfd);
+    MacTCPStreamInfo *info;
+    MacTCPSend *send;
+    long done = 0;
+
+    if (idx < 0 || !g_mactcp_streams[idx].in_use) {
+        errno = EBADF;
+        return -1;
+    }
 
-    if (info->peek_len > 0) {
-        copy_len = (info->peek_len < (int)len) ? info->peek_len : len;
-        memcpy(buf, info->peek_buf, copy_len);
-        if (copy_len < info->peek_len) {
-            memmove(info->peek_buf, info->peek_buf + copy_len, info->peek_len - copy_len);
+    info = &g_mactcp_streams[idx];
+    while (info->send_count > 0) {
+        send = &info->sends[info->send_first];
+        if (send->pb.ioResult > 0) break;  /* Still in progress */
+        if (send->pb.ioResult != noErr) {
+            errno = ECONNRESET;
+            return -1;
         }
-        info->peek_len -= copy_len;
-        return (ssize_t)copy_len;
+        done += send->length;
+        info->send_first = (info->send_first + 1) % MACTCP_SEND_SLOTS;
+        info->send_count--;
+    }
+    return done;
+}
+
+/* Aborts the connection and waits for its sends to come back, so that
+ * their buffers can be released */
+static void mactcp_send_abort(int sockfd) {
+    int idx = mactcp_fd_to_index(sockfd);
+    MacTCPStreamInfo *info;
+    TCPiopb pb;
+    int i;
+
+    if (idx < 0 || !g_mactcp_streams[idx].in_use) return;
+    info = &g_mactcp_streams[idx];
+    if (info->send_count == 0) return;
+
+    memset(&pb, 0, sizeof(TCPiopb));
+    pb.ioCRefNum = g_mactcp_refnum;
+    pb.csCode = TCPAbort;
+    pb.tcpStream = (StreamPtr)info->stream;
+    PBControlSync((ParmBlkPtr)&pb);
+    info->is_connected = 0;
+
+    for (i = 0; i < info->send_count; i++) {
+        MacTCPSend *send = &info->sends[(info->send_first + i) % MACTCP_SEND_SLOTS];
+        while (send->pb.ioResult > 0) mactcp_give_time_callback();
+    }
+    info->send_count = 0;
+}
+
+static ssize_t mactcp_recv(int sockfd, void *buf, size_t len, int flags) {
+    int idx = mactcp_fd_to_index(sockfd);
+    MacTCPStreamInfo *info;
+    OSErr err;
+    unsigned short recv_len;
+
+    if (idx < 0 || !g_mactcp_streams[idx].in_use) {
+        errno = EBADF;
+        return -1;
+    }
+
+    info = &g_mactcp_streams[idx];
+    if (!info->is_connected) {
+        errno = ENOTCONN;
+        return -1;
     }
 
     recv_len = (unsigned short)len;
@@ -837,6 +963,9 @@ static int mactcp_close(int fd) {
     if (idx < 0 || !g_mactcp_streams[idx].in_use) return 0;
     info = &g_mactcp_streams[idx];
 
+    /* Sends still in flight would use the stream after it's released */
+    mactcp_send_abort(fd);
+
     if (info->stream != 0) {
         if (info->is_connected) {
             CloseConnection(info->stream, (GiveTimePtr)mactcp_give_time_callback, &info->cancel_flag);
@@ -1040,6 +1169,62 @@ void task_yield(void) {
     console_poll_events();
 }
 
+/* Asynchronous sends (MacTCP only) */
+
+int net_can_send_async(int fd) {
+    int idx;
+    if (g_use_open_transport || g_mactcp_refnum == 0) return 0;
+    idx = mactcp_fd_to_index(fd);
+    return idx >= 0 && g_mactcp_streams[idx].in_use && g_mactcp_streams[idx].is_connected;
+}
+
+int net_send_gather(int fd, const NetSendPart *parts, int count) {
+    return mactcp_send_gather(fd, parts, count);
+}
+
+long net_send_completed(int fd) {
+    return mactcp_send_completed(fd);
+}
+
+void net_send_abort(int fd) {
+    if (g_use_open_transport) return;
+    mactcp_send_abort(fd);
+}
+
+/* Event-driven servicing (Open Transport notifiers) */
+
+int net_is_event_driven(void) {
+    return g_use_open_transport && g_ot_event_mode;
+}
+
+int net_is_ready(int fd) {
+    int idx;
+    if (!net_is_event_driven()) return 1;
+    idx = ot_fd_to_index(fd);
+    if (idx < 0 || !g_ot_streams[idx].in_use) return 1;
+    return g_ot_streams[idx].ready;
+}
+
+int net_any_ready(void) {
+    int i;
+    if (!net_is_event_driven()) return 1;
+    for (i = 0; i < MAX_STREAMS; i++) {
+        if (g_ot_streams[i].in_use && g_ot_streams[i].ready) return 1;
+    }
+    return 0;
+}
+
+void net_wait_for_event(long max_ticks) {
+    if (!net_is_event_driven()) return;
+    if (!g_ot_event_pending) {
+        g_ot_sleeping = 1;
+        /* Check again now that the notifier knows to wake us */
+        if (!g_ot_event_pending) console_wait_events(max_ticks);
+        g_ot_sleeping = 0;
+    }
+    g_ot_event_pending = 0;
+}
+
 /* Query and control networking stack selection */
 
 int net_is_open_transport_available(void) {
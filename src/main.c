@@ -49,161 +49,12 @@
 #include "procedures.h"
 #include "serialize.h"
 #include "profiler.h"
+#include "arena.h"
 
-/*
- * ============================================================================
- * Chunk Send Interleaving Support
- * ============================================================================
- * These static variables and functions allow chunk sending to be interleaved
- * with processing other clients. When sending chunks to Player A, we
- * periodically check if Players B, C, D have pending packets and process
- * them. This prevents one player's chunk load from freezing everyone else.
- *
- * The interleave_process_other_clients() function is called via the
- * chunk_interleave_callback function pointer from packets.c.
- */
-
-/* Client file descriptors - moved to file scope for interleave access */
+/* Client file descriptors, indexed by connection slot */
 static int interleave_clients[MAX_PLAYERS];
 static int interleave_client_index = 0;
 
-/* Forward declaration of handlePacket (defined below) */
-void handlePacket(int client_fd, int length, int packet_id, int state);
-
-/*
- * Process other clients during chunk sends.
- *
- * Called between chunk sections to keep other players responsive.
- * Processes at most one packet from each other client to avoid
- * spending too much time away from the chunk send.
- *
- * REENTRANCY NOTE:
- * This function calls handlePacket(), which can trigger chunk sends for
- * other players, which would call this function again. We use a static
- * guard to prevent recursive interleaving. This is safe because:
- *   1. We skip the current_client_fd, so we won't re-enter for the same client
- *   2. The guard prevents processing other clients' packets recursively
- *   3. Recursive calls still yield to the system via task_yield()
- *
- * GLOBAL STATE WARNING:
- * This function uses global state (recv_buffer, recv_count, etc.) that is
- * shared with the main packet processing loop. The chunk send code in
- * packets.c must not rely on these globals after calling the interleave
- * callback, as they may have been modified by processing other clients.
- *
- * @param current_client_fd  The client currently receiving chunks (skip this one)
- */
-static void interleave_process_other_clients(int current_client_fd) {
-    /* Recursion guard - prevent nested interleaving */
-    static int interleave_active = 0;
-
-    /* Always yield to system (Mac events, ESP watchdog, etc.) */
-    task_yield();
-
-    /* Advance mob interpolation during chunk sends to prevent freezing */
-    processMobInterpolation(get_program_time());
-
-    /* If already processing an interleave, don't recurse */
-    if (interleave_active) return;
-    interleave_active = 1;
-
-    /* Check each client slot for pending data */
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        int client_fd = interleave_clients[i];
-
-        /* Skip empty slots and the client we're sending chunks to */
-        if (client_fd == -1) continue;
-        if (client_fd == current_client_fd) continue;
-
-        /*
-         * Peek packet header to check if it's safe to process.
-         * We need to decode the packet ID WITHOUT consuming bytes,
-         * so we can skip packets that could trigger chunk sends
-         * (which would corrupt worldgen globals).
-         */
-        uint8_t peek_buf[6];  /* Enough for 2 small varints */
-        #ifdef _WIN32
-        int peek_result = recv(client_fd, (char *)peek_buf, 6, MSG_PEEK);
-        #else
-        ssize_t peek_result = recv(client_fd, peek_buf, 6, MSG_PEEK);
-        #endif
-        if (peek_result < 2) continue;  /* Need at least 2 bytes for header */
-
-        /* Decode packet length varint from peeked buffer */
-        int offset = 0;
-        int length = 0;
-        int shift = 0;
-        while (offset < peek_result && offset < 5) {
-            uint8_t b = peek_buf[offset++];
-            length |= (b & 0x7F) << shift;
-            if ((b & 0x80) == 0) break;
-            shift += 7;
-        }
-        if (offset >= peek_result) continue;  /* Incomplete length */
-
-        /* Decode packet ID varint from peeked buffer */
-        int packet_id = 0;
-        shift = 0;
-        while (offset < peek_result && offset < 10) {
-            uint8_t b = peek_buf[offset++];
-            packet_id |= (b & 0x7F) << shift;
-            if ((b & 0x80) == 0) break;
-            shift += 7;
-        }
-
-        /*
-         * CRITICAL: Skip packets that could trigger chunk sends.
-         * These packets would call sc_chunkDataAndUpdateLight(), which
-         * uses the same worldgen globals (chunk_section, etc.) as the
-         * chunk send we're currently in the middle of. Processing them
-         * would silently corrupt both players' chunk data.
-         *
-         * Skip these packet types - they'll be processed by the main loop:
-         *   0x03 (config ack) - triggers initial spawn + chunk send
-         *   0x1D-0x20 (movement) - triggers chunk send on boundary crossing
-         *
-         * Safe to process during interleave:
-         *   0x08 (chat), 0x0B (client status), 0x11 (click container),
-         *   0x12 (close container), 0x19 (interact/attack entity),
-         *   0x1B (keep-alive), 0x28 (player action), 0x29 (player command),
-         *   0x34 (held item), 0x3C (swing arm), 0x3F/0x40 (use item)
-         */
-        if (packet_id == 0x03 || (packet_id >= 0x1D && packet_id <= 0x20)) {
-            continue;  /* Leave packet in buffer for main loop */
-        }
-
-        /* Safe to process - now actually consume the bytes */
-        int state = client_states[i * 2];
-        if (state < 0) continue;
-
-        /* Read packet length (consuming bytes this time) */
-        length = readVarInt(client_fd);
-        if (recv_count <= 0) continue;
-
-        /* Read packet ID */
-        packet_id = readVarInt(client_fd);
-        if (recv_count <= 0) continue;
-
-        /* Handle the packet */
-        handlePacket(client_fd, length - sizeVarInt(packet_id), packet_id, state);
-    }
-
-    /*
-     * NOTE: We intentionally do NOT run server ticks during interleave.
-     *
-     * handleServerTick() sends keep-alive, time updates, and mob packets
-     * to multiple clients. Running it mid-chunk-send adds complexity and
-     * risk of packet interleaving issues. A 1-second tick delay during
-     * chunk loads is acceptable - the main loop handles ticks between
-     * clients normally.
-     *
-     * This also keeps behavior consistent with TIME_BETWEEN_TICKS tuning
-     * documented in the project options.
-     */
-
-    interleave_active = 0;
-}
-
 /**
  * Routes an incoming packet to its packet handler or procedure.
  *
@@ -249,6 +100,7 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
           recv_count = 0;
           return;
         }
+        if (compression_enabled && sc_setCompression(client_fd)) break;
         if (sc_loginSuccess(client_fd, uuid, name)) break;
       } else if (state == STATE_CONFIGURATION) {
         if (cs_clientInformation(client_fd)) break;
@@ -296,8 +148,8 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
         spawnPlayer(player);
 
         // Register all existing players and spawn their entities
-        for (int i = 0; i < MAX_PLAYERS; i ++) {
-          if (player_data[i].client_fd == -1) continue;
+        for (int n = 0; n < online_player_count; n ++) {
+          int i = online_players[n];
           // Note that this will also filter out the joining player
           if (player_data[i].flags & 0x20) continue;
           sc_playerInfoUpdateAddPlayer(client_fd, player_data[i]);
@@ -381,7 +233,7 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
         // Skip stale movement packets - if more movement packets are queued,
         // discard this one and use the more recent position data instead.
         // This prevents queue buildup when the server can't keep up.
-        if (hasMoreMovementPackets(client_fd)) {
+        if (hasMoreMovementPackets(client_fd, length)) {
           discard_all(client_fd, length, false);
           break;
         }
@@ -477,24 +329,23 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
           uint8_t yaw_byte = (uint8_t)((player->yaw + 127) * 256 / 254);
           uint8_t pitch_byte = (uint8_t)((player->pitch + 127) * 128 / 254);
 
-          // Send current position data to all connected players
-          for (int i = 0; i < MAX_PLAYERS; i ++) {
-            if (player_data[i].client_fd == -1) continue;
-            if (player_data[i].flags & 0x20) continue;
-            if (player_data[i].client_fd == client_fd) continue;
-            packet_start(player_data[i].client_fd);
-            if (packet_id == 0x1F) {
-              sc_updateEntityRotation(player_data[i].client_fd, client_fd, player->yaw, player->pitch);
-            } else if (use_teleport) {
-              sc_teleportEntity(player_data[i].client_fd, client_fd, x, y, z, yaw, pitch);
-            } else {
-              sc_updateEntityPositionAndRotation(player_data[i].client_fd, client_fd,
-                                                 (int16_t)delta_x, (int16_t)delta_y, (int16_t)delta_z,
-                                                 yaw_byte, pitch_byte, 1);
-            }
-            sc_setHeadRotation(player_data[i].client_fd, client_fd, yaw_byte);
-            packet_flush();
+          // Send current position data to the players that can see this one
+          uint32_t viewers = getPlayerViewers(
+            player, player->x, player->z,
+            packet_id == 0x1F ? NULL : &use_teleport
+          );
+          broadcast_start();
+          if (packet_id == 0x1F) {
+            sc_updateEntityRotation(BROADCAST_FD, client_fd, player->yaw, player->pitch);
+          } else if (use_teleport) {
+            sc_teleportEntity(BROADCAST_FD, client_fd, x, y, z, yaw, pitch);
+          } else {
+            sc_updateEntityPositionAndRotation(BROADCAST_FD, client_fd,
+                                               (int16_t)delta_x, (int16_t)delta_y, (int16_t)delta_z,
+                                               yaw_byte, pitch_byte, 1);
           }
+          sc_setHeadRotation(BROADCAST_FD, client_fd, yaw_byte);
+          broadcast_flush_players(viewers, client_fd);
 
           // Update last broadcast position (only if we sent position data)
           if (packet_id != 0x1F) {
@@ -549,7 +400,16 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
         // Exit early if no chunk borders were crossed
         if (dx == 0 && dz == 0) break;
 
-        // Check if the player has recently been in this chunk
+        // Move the player in the broadcast interest grid
+        updatePlayerInterest(player, _x, _z);
+
+        // Queue the chunks that came into view, they're sent from the main
+        // loop. This has to happen on every crossing, even into chunks the
+        // player has just been in, or the queue is left with a stale center.
+        sc_setCenterChunk(client_fd, _x, _z);
+        updateChunkQueue(player, _x, _z);
+
+        // Only spawn mobs in chunks the player hasn't recently been in
         int found = false;
         for (int i = 0; i < VISITED_HISTORY; i ++) {
           if (player->visited_x[i] == _x && player->visited_z[i] == _z) {
@@ -606,44 +466,6 @@ void handlePacket (int client_fd, int length, int packet_id, int state) {
           }
         }
 
-        int count = 0;
-        #ifdef DEV_LOG_CHUNK_GENERATION
-          printf("Sending new chunks (%d, %d)\n", _x, _z);
-          clock_t start, end;
-          start = clock();
-        #endif
-
-        sc_setCenterChunk(client_fd, _x, _z);
-
-        PROF_START(CHUNK_SEND);
-        while (dx != 0) {
-          sc_chunkDataAndUpdateLight(client_fd, _x + dx * view_distance, _z);
-          count ++;
-          for (int i = 1; i <= view_distance; i ++) {
-            sc_chunkDataAndUpdateLight(client_fd, _x + dx * view_distance, _z - i);
-            sc_chunkDataAndUpdateLight(client_fd, _x + dx * view_distance, _z + i);
-            count += 2;
-          }
-          dx += dx > 0 ? -1 : 1;
-        }
-        while (dz != 0) {
-          sc_chunkDataAndUpdateLight(client_fd, _x, _z + dz * view_distance);
-          count ++;
-          for (int i = 1; i <= view_distance; i ++) {
-            sc_chunkDataAndUpdateLight(client_fd, _x - i, _z + dz * view_distance);
-            sc_chunkDataAndUpdateLight(client_fd, _x + i, _z + dz * view_distance);
-            count += 2;
-          }
-          dz += dz > 0 ? -1 : 1;
-        }
-        PROF_END(CHUNK_SEND);
-
-        #ifdef DEV_LOG_CHUNK_GENERATION
-          end = clock();
-          double total_ms = (double)(end - start) / CLOCKS_PER_SEC * 1000;
-          printf("Generated %d chunks in %.0f ms (%.2f ms per chunk)\n", count, total_ms, total_ms / (double)count);
-        #endif
-
       }
       break;
 
@@ -726,7 +548,12 @@ int main () {
     // Load saved preferences (view distance, cache size)
     console_load_prefs();
     console_printf("Starting Bareiron server...\r\r");
-    // Initialize chunk cache early, before other allocations consume heap
+    // Claim the memory arena early, before other allocations consume heap
+    if (initArena()) {
+      console_printf("Press Cmd-Q to quit.\r");
+      while (!console_should_quit()) console_poll_events();
+      return 1;
+    }
     initChunkCache();
   #endif
 
@@ -764,14 +591,22 @@ int main () {
   // Start the disk/flash serializer (if applicable)
   if (initSerializer()) exit(EXIT_FAILURE);
 
+  // Precompute the parts of chunk packets that never change
+  if (initChunkTemplates()) exit(EXIT_FAILURE);
+  initChunkCache();
+  printArenaReport();
+
+  // On Mac, the profiler is set up along with the console and menus
+  #ifndef MAC68K_PLATFORM
+    prof_init();
+  #endif
+
   // Initialize all file descriptor references to -1 (unallocated)
-  // Note: We use the static interleave_clients[] array instead of a local array
-  // so that the interleave callback can access connected client file descriptors
   for (int i = 0; i < MAX_PLAYERS; i ++) {
     interleave_clients[i] = -1;
-    client_states[i * 2] = -1;
     player_data[i].client_fd = -1;
   }
+  initClientTable();
 
   // Create server TCP socket
   int server_fd, opt = 1;
@@ -851,15 +686,8 @@ int main () {
   fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
   #endif
 
-  // Track time of last server tick (in microseconds)
-  int64_t last_tick_time = get_program_time();
-
-  /*
-   * Set up chunk interleaving callback.
-   * This allows packets.c to call back into main.c during long chunk sends,
-   * keeping other connected players responsive.
-   */
-  chunk_interleave_callback = interleave_process_other_clients;
+  // Start the clocks of periodic server tasks (ticks, keep-alives, etc.)
+  initServerTasks(get_program_time());
 
   /**
    * Cycles through all connected clients, handling one packet at a time
@@ -913,65 +741,93 @@ int main () {
         int flags = fcntl(interleave_clients[i], F_GETFL, 0);
         fcntl(interleave_clients[i], F_SETFL, flags | O_NONBLOCK);
       #endif
+        openRecvQueue(interleave_clients[i]);
+        openSendQueue(interleave_clients[i]);
         client_count ++;
       }
       break;
     }
 
+    // Broadcast the block changes made since the last pass
+    flushBlockUpdates();
+
+    // Push out data that clients' connections weren't ready for earlier
+    flushSendQueues();
+
+    // Write out queued world changes, even while nobody is connected
+    serviceJournal(get_program_time());
+
+    // Run server ticks and the other periodic tasks that are due, along
+    // with a slice of mob behavior. This happens on every iteration, so
+    // that ticks keep running while chunks are being streamed.
+    int64_t task_delay = runServerTasks(get_program_time());
+    (void)task_delay;
+
+    // Send some of the chunks players are waiting for
+    serviceChunkQueues();
+
+    // With nothing else to do, generate terrain players are likely to need
+    int pregen_pending = false;
+    #ifdef ENABLE_TERRAIN_PREGEN
+      if (!hasChunksToSend() && !hasIncomingData()) {
+        pregen_pending = pregenerateTerrain(PREGEN_BUDGET);
+      }
+    #endif
+    (void)pregen_pending;
+
+    #ifdef MAC68K_PLATFORM
+      // With Open Transport notifiers, sleep in WaitNextEvent while no
+      // endpoint has anything for us, up until the next server task is due
+      if (net_is_event_driven() && !net_any_ready() && !hasChunksToSend() && !pregen_pending && task_delay > 0) {
+        net_wait_for_event((long)(task_delay / 16667));
+      }
+    #endif
+
     // Look for valid connected clients
     interleave_client_index ++;
     if (interleave_client_index == MAX_PLAYERS) interleave_client_index = 0;
     if (interleave_clients[interleave_client_index] == -1) continue;
 
-    // Handle periodic events (server ticks)
-    int64_t time_since_last_tick = get_program_time() - last_tick_time;
-    if (time_since_last_tick > TIME_BETWEEN_TICKS) {
-      PROF_START(TICK_TOTAL);
-      handleServerTick(time_since_last_tick);
-      PROF_END(TICK_TOTAL);
-      prof_tick_completed(time_since_last_tick);
-      last_tick_time = get_program_time();
-    }
-
     processMobInterpolation(get_program_time());
 
     // Handle this individual client
     int client_fd = interleave_clients[interleave_client_index];
 
-    // Check if at least 2 bytes are available for reading
-    #ifdef _WIN32
-    recv_count = recv(client_fd, recv_buffer, 2, MSG_PEEK);
-    if (recv_count == 0) {
-      disconnectClient(&interleave_clients[interleave_client_index], 1);
+    // Drop clients that have stopped accepting data
+    if (hasSendQueueFailed(client_fd)) {
+      disconnectClient(&interleave_clients[interleave_client_index], -2);
       continue;
     }
-    if (recv_count == SOCKET_ERROR) {
-      int err = WSAGetLastError();
-      if (err == WSAEWOULDBLOCK) {
-        continue; // no data yet, keep client alive
-      } else {
-        disconnectClient(&interleave_clients[interleave_client_index], 1);
-        continue;
-      }
-    }
-    #else
-    recv_count = recv(client_fd, &recv_buffer, 2, MSG_PEEK);
-    if (recv_count < 2) {
-      if (recv_count == 0 || (recv_count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-        disconnectClient(&interleave_clients[interleave_client_index], 1);
-      }
+
+    #ifdef MAC68K_PLATFORM
+      // In event mode, skip clients that Open Transport hasn't flagged
+      if (!net_is_ready(client_fd)) continue;
+    #endif
+
+    // Pull in what the client has sent, and wait for a whole packet. Before
+    // the handshake, data isn't necessarily framed (legacy pings, 0xBEEF),
+    // so 2 bytes are enough to look at.
+    int state = getClientState(client_fd);
+    int ready = pollRecvQueue(client_fd, state != STATE_NONE);
+    if (ready < 0) {
+      disconnectClient(&interleave_clients[interleave_client_index], 1);
       continue;
     }
-    #endif
+    if (ready == 0) continue;
     // Handle 0xBEEF and 0xFEED packets for dumping/uploading world data
     #ifdef DEV_ENABLE_BEEF_DUMPS
+    peekRecvQueue(client_fd, recv_buffer, 2);
     // Received BEEF packet, dump world data and disconnect
     if (recv_buffer[0] == 0xBE && recv_buffer[1] == 0xEF && getClientState(client_fd) == STATE_NONE) {
       // Send block changes and player data back to back
       // The client is expected to know (or calculate) the size of these buffers
       send_all(client_fd, block_changes, sizeof(block_changes));
       send_all(client_fd, player_data, sizeof(player_data));
+      #ifdef ALLOW_CHESTS
+      send_all(client_fd, chest_data, sizeof(chest_data));
+      #endif
       // Flush the socket and receive everything left on the wire
+      waitForSendQueue(client_fd);
       shutdown(client_fd, SHUT_WR);
       recv_all(client_fd, recv_buffer, sizeof(recv_buffer), false);
       // Kick the client
@@ -985,15 +841,21 @@ int main () {
       // Write full buffers straight into memory
       recv_all(client_fd, block_changes, sizeof(block_changes), false);
       recv_all(client_fd, player_data, sizeof(player_data), false);
+      #ifdef ALLOW_CHESTS
+      recv_all(client_fd, chest_data, sizeof(chest_data), false);
+      #endif
       // Recover block_changes_count
+      block_changes_count = 0;
       for (int i = 0; i < MAX_BLOCK_CHANGES; i ++) {
         if (block_changes[i].block == 0xFF) continue;
-        if (block_changes[i].block == B_chest) i += 14;
         if (i >= block_changes_count) block_changes_count = i + 1;
       }
-      // Update data on disk
-      writeBlockChangesToDisk(0, block_changes_count);
-      writePlayerDataToDisk();
+      sortBlockChanges();
+      rebuildBlockChangeIndex();
+      clearChunkCache();
+      // Update data on disk, the old regions no longer apply
+      resetWorldFile();
+      writeAllDataToDisk();
       // Kick the client
       disconnectClient(&interleave_clients[interleave_client_index], 7);
       continue;
@@ -1001,7 +863,7 @@ int main () {
     #endif
 
     // Read packet length
-    int length = readVarInt(client_fd);
+    int length = readPacketLength(client_fd);
     if (length == VARNUM_ERROR) {
       disconnectClient(&interleave_clients[interleave_client_index], 2);
       continue;
@@ -1012,8 +874,6 @@ int main () {
       disconnectClient(&interleave_clients[interleave_client_index], 3);
       continue;
     }
-    // Get client connection state
-    int state = getClientState(client_fd);
     // Disconnect on legacy server list ping
     if (state == STATE_NONE && length == 254 && packet_id == 122) {
       disconnectClient(&interleave_clients[interleave_client_index], 5);
@@ -1035,15 +895,15 @@ int main () {
       const int max_drain = 16;
 
       while (packets_drained < max_drain) {
-        // Check if more data is available
-        recv_count = recv(client_fd, recv_buffer, 2, MSG_PEEK);
-        if (recv_count < 2) break;
+        // Check if another whole packet is available
+        state = getClientState(client_fd);
+        if (pollRecvQueue(client_fd, state != STATE_NONE) != 1) break;
 
         // Yield periodically to keep system responsive
         if ((packets_drained & 3) == 3) task_yield();
 
         // Read next packet
-        length = readVarInt(client_fd);
+        length = readPacketLength(client_fd);
         if (length == VARNUM_ERROR) {
           disconnectClient(&interleave_clients[interleave_client_index], 2);
           break;
@@ -1054,7 +914,6 @@ int main () {
           break;
         }
 
-        state = getClientState(client_fd);
         handlePacket(client_fd, length - sizeVarInt(packet_id), packet_id, state);
 
         if (recv_count == 0 || (recv_count == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
@@ -24,8 +24,11 @@
 #include "worldgen.h"
 #include "crafting.h"
 #include "procedures.h"
+#include "serialize.h"
 #include "packets.h"
 #include "profiler.h"
+#include "arena.h"
+#include "deflate.h"
 
 // S->C Status Response (server list ping)
 int sc_statusResponse (int client_fd) {
@@ -84,6 +87,16 @@ int cs_loginStart (int client_fd, uint8_t *uuid, char *name) {
   return 0;
 }
 
+// S->C Set Compression
+// Everything sent after this, in either direction, carries a data length
+int sc_setCompression (int client_fd) {
+  writeVarInt(client_fd, 1 + sizeVarInt(COMPRESSION_THRESHOLD));
+  writeVarInt(client_fd, 0x03);
+  writeVarInt(client_fd, COMPRESSION_THRESHOLD);
+  setCompression(client_fd, true);
+  return 0;
+}
+
 // S->C Login Success
 int sc_loginSuccess (int client_fd, uint8_t *uuid, char *name) {
   printf("Sending Login Success...\n\n");
@@ -334,143 +347,405 @@ int sc_setCenterChunk (int client_fd, int x, int y) {
   return 0;
 }
 
-// S->C Chunk Data and Update Light
-int sc_chunkDataAndUpdateLight (int client_fd, int _x, int _z) {
-  PROF_START(CHUNK_GEN);
+// S->C Set Chunk Cache Radius
+int sc_setChunkCacheRadius (int client_fd, int distance) {
+  writeVarInt(client_fd, 1 + sizeVarInt(distance));
+  writeByte(client_fd, 0x58);
+  writeVarInt(client_fd, distance);
+  return 0;
+}
 
-  /* Enable packet buffering - batches small writes for efficiency */
-  packet_start(client_fd);
+// Per-section encoding, produced before the chunk packet is written so
+// that its total length is known up front
+typedef struct {
+  PalettedSection blocks;
+  uint8_t biome;
+  int size;             // bytes this section contributes to the chunk data
+} EncodedSection;
+
+static EncodedSection encoded_sections[20];
+// Packed block data for each section: 0, 2048 or 4096 bytes used per slot,
+// held in the memory arena and set up by initChunkTemplates
+static uint8_t (*encoded_section_data)[4096];
+
+// Encodes the section currently held in chunk_section, see
+// paletteChunkSection, and works out how many bytes it takes up
+static void encodeChunkSection (EncodedSection *out, uint8_t *data, uint8_t biome) {
+
+  PalettedSection *blocks = &out->blocks;
+  paletteChunkSection(blocks, data);
+  out->biome = biome;
+
+  // block count, bits per entry, biome bits and biome palette
+  out->size = 2 + 1 + 2;
+
+  if (blocks->bits == 0) {
+    out->size += sizeVarInt(block_palette[blocks->palette[0]]);
+  } else if (blocks->bits == 8) {
+    out->size += sizeVarInt(256) + sizeof(network_block_palette) + 4096;
+  } else {
+    out->size += sizeVarInt(blocks->palette_len) + 2048;
+    for (int i = 0; i < blocks->palette_len; i ++) {
+      out->size += sizeVarInt(block_palette[blocks->palette[i]]);
+    }
+  }
 
-  const int chunk_data_size = (4101 + sizeVarInt(256) + sizeof(network_block_palette)) * 20 + 6 * 12;
-  const int light_data_size = 14 + (sizeVarInt(2048) + 2048) * 26;
+}
 
-  writeVarInt(client_fd, 11 + sizeVarInt(chunk_data_size) + chunk_data_size + light_data_size);
-  writeByte(client_fd, 0x27);
+// Chunk packets are assembled in memory when the chunk packet cache has
+// room for them, and streamed to the client otherwise. This points to
+// where the next bytes go in the cache entry, or is NULL when streaming.
+static uint8_t *chunk_out = NULL;
+
+// Appends bytes to the chunk packet being written
+static void writeChunkBytes (int client_fd, const void *buf, int len) {
+  if (chunk_out != NULL) {
+    memcpy(chunk_out, buf, len);
+    chunk_out += len;
+  } else if (len < 64) {
+    packet_write(buf, len);
+  } else {
+    // Large arrays skip the packet buffer
+    packet_flush_continue();
+    send_all(client_fd, buf, len);
+  }
+}
 
-  writeUint32(client_fd, _x);
-  writeUint32(client_fd, _z);
+// Appends a VarInt to the chunk packet being written
+static void writeChunkVarInt (int client_fd, uint32_t value) {
+  uint8_t buf[5];
+  int len = 0;
+  while (value & ~SEGMENT_BITS) {
+    buf[len ++] = (value & SEGMENT_BITS) | CONTINUE_BIT;
+    value >>= 7;
+  }
+  buf[len ++] = value;
+  writeChunkBytes(client_fd, buf, len);
+}
 
-  writeVarInt(client_fd, 0); // omit heightmaps
+// Appends a big-endian integer of the given size to the chunk packet
+static void writeChunkInt (int client_fd, uint64_t value, int len) {
+  uint8_t buf[8];
+  for (int i = len - 1; i >= 0; i --) {
+    buf[i] = value & 0xFF;
+    value >>= 8;
+  }
+  writeChunkBytes(client_fd, buf, len);
+}
 
-  writeVarInt(client_fd, chunk_data_size);
+// Writes a section previously prepared by encodeChunkSection
+static void writeEncodedSection (int client_fd, EncodedSection *section, uint8_t *data) {
 
-  int x = _x * 16, z = _z * 16, y;
+  PalettedSection *blocks = &section->blocks;
+  writeChunkInt(client_fd, 4096, 2); // block count
+  writeChunkInt(client_fd, blocks->bits, 1); // bits per entry
 
-  // send 4 chunk sections (up to Y=0) with no blocks
-  for (int i = 0; i < 4; i ++) {
-    writeUint16(client_fd, 4096); // block count
-    writeByte(client_fd, 0); // block bits
-    writeVarInt(client_fd, 85); // block palette (bedrock)
-    writeByte(client_fd, 0); // biome bits
-    writeByte(client_fd, 0); // biome palette
+  if (blocks->bits == 0) {
+    writeChunkVarInt(client_fd, block_palette[blocks->palette[0]]);
+  } else if (blocks->bits == 4) {
+    writeChunkVarInt(client_fd, blocks->palette_len);
+    for (int i = 0; i < blocks->palette_len; i ++) {
+      writeChunkVarInt(client_fd, block_palette[blocks->palette[i]]);
+    }
+    writeChunkBytes(client_fd, data, 2048);
+  } else {
+    writeChunkVarInt(client_fd, 256); // block palette length
+    writeChunkBytes(client_fd, network_block_palette, sizeof(network_block_palette));
+    writeChunkBytes(client_fd, data, 4096);
   }
-  // yield to idle task
-  task_yield();
 
-  // send chunk sections
+  // biome data
+  writeChunkInt(client_fd, 0, 1); // bits per entry
+  writeChunkInt(client_fd, section->biome, 1); // biome palette
+
+}
+
+// Bytes of one section with no variation: block count, zero bits per
+// entry, a single-byte block palette varint, and a single-value biome
+#define CONSTANT_SECTION_SIZE 6
+
+// Parts of the chunk packet that are the same for every chunk. The prefix
+// holds the 4 bedrock sections below Y=0, the suffix holds the 8 air
+// sections above Y=256 and the (empty) block entity list.
+static uint8_t chunk_prefix[4 * CONSTANT_SECTION_SIZE];
+static uint8_t chunk_suffix[8 * CONSTANT_SECTION_SIZE + 1];
+
+// Writes a section filled with the given block to a chunk template
+static uint8_t *writeConstantSection (uint8_t *out, uint8_t block_id) {
+  *out++ = 4096 >> 8; // block count
+  *out++ = 4096 & 0xFF;
+  *out++ = 0; // block bits
+  *out++ = block_id; // block palette, always fits a single-byte varint
+  *out++ = 0; // biome bits
+  *out++ = 0; // biome palette
+  return out;
+}
+
+// Builds the constant parts of the chunk packet, call once on startup
+// Returns 0 on success, 1 if there's no memory for encoding chunks
+int initChunkTemplates () {
+
+  encoded_section_data = (uint8_t (*)[4096])getArenaRegion(ARENA_ENCODE_SCRATCH);
+  if (encoded_section_data == NULL) return 1;
+
+  uint8_t *out = chunk_prefix;
+  // 4 chunk sections (up to Y=0) of bedrock
+  for (int i = 0; i < 4; i ++) out = writeConstantSection(out, 85);
+
+  out = chunk_suffix;
+  // 8 chunk sections (up to Y=192) of air
+  for (int i = 0; i < 8; i ++) out = writeConstantSection(out, 0);
+
+  *out = 0; // omit block entities
+
+  return 0;
+}
+
+// Y coordinate of the highest block that stops sky light in each column
+// of the chunk being sent, indexed by dx + dz * 16. Starts at -1, which
+// is the top of the bedrock sections below Y=0.
+static int16_t sky_column_top[256];
+
+// Checks whether sky light can pass through the given block
+static uint8_t isSkyLightBlocked (uint8_t block) {
+  if (isPassableBlock(block)) return false;
+  return (
+    block != B_oak_leaves &&
+    block != B_ice &&
+    block != B_cactus &&
+    block != B_lily_pad &&
+    block != B_oak_sapling &&
+    block != B_chest
+  );
+}
+
+// Raises sky_column_top to the highest light-blocking blocks of the
+// section currently held in chunk_section. Sections must be traced from
+// the bottom up.
+static void traceSkyLight (EncodedSection *section, int y) {
+
+  // Uniform sections either cover every column or none of them
+  if (section->blocks.bits == 0) {
+    if (!isSkyLightBlocked(section->blocks.palette[0])) return;
+    for (int i = 0; i < 256; i ++) sky_column_top[i] = y + 15;
+    return;
+  }
+
+  for (int column = 0; column < 256; column ++) {
+    for (int dy = 15; dy >= 0; dy --) {
+      if (!isSkyLightBlocked(SECTION_BLOCK(column + dy * 256))) continue;
+      sky_column_top[column] = y + dy;
+      break;
+    }
+  }
+
+}
+
+// Builds the sky light array of the light section starting at the given
+// Y coordinate from sky_column_top, prefixed with its length varint
+static void buildSkyLightArray (uint8_t *out, int y) {
+  *out++ = 0x80; // 2048 as a varint
+  *out++ = 0x10;
+  for (int i = 0; i < 4096; i += 2) {
+    int block_y = y + (i >> 8);
+    int column = i & 255;
+    // Two blocks per byte, lower X in the low nibble
+    *out++ =
+      (block_y > sky_column_top[column] ? 0x0F : 0) |
+      (block_y > sky_column_top[column + 1] ? 0xF0 : 0);
+  }
+}
+
+// Compresses a chunk packet that has just been written to the chunk packet
+// cache, framed for clients that have been sent Set Compression. The
+// result goes in the encode scratch, which is free again by then.
+// Returns its size and stores where it starts, or returns 0 if it's not
+// worth compressing.
+static int compressChunkPacket (uint8_t *packet, int packet_length, uint8_t **framed) {
+  if (packet_length < COMPRESSION_THRESHOLD) return 0;
+
+  // Leave room in front for the two length prefixes
+  uint8_t *scratch = (uint8_t *)encoded_section_data;
+  int body = sizeVarInt(packet_length);
+  int size = zlibCompress(packet + body, packet_length, scratch + 10, CHUNK_ENCODE_SCRATCH_SIZE - 10);
+  if (size < 0) return 0;
+
+  int inner = sizeVarInt(packet_length) + size;
+  int total = sizeVarInt(inner) + inner;
+  if (total >= body + packet_length) return 0;
+
+  *framed = scratch + 10 - (total - size);
+  chunk_out = *framed;
+  writeChunkVarInt(-1, inner);
+  writeChunkVarInt(-1, packet_length); // uncompressed length
+  chunk_out = NULL;
+  return total;
+}
+
+// Generates and writes the chunk data packet of the given chunk, storing
+// it in the chunk packet cache if there's room. For clients that have
+// been sent Set Compression, the cached copy is then replaced by its
+// compressed form, so that the cost of compressing is only paid once.
+// Otherwise the uncompressed copy is kept, which clients with compression
+// can be sent too, so that mixing both kinds doesn't re-encode each time.
+static void writeChunkPacket (int client_fd, int _x, int _z) {
+
+  int x = _x * 16, z = _z * 16;
+
+  // Generate and encode all sections ahead of time, as the packet length
+  // depends on the palette chosen for each of them
+  int chunk_data_size = CONSTANT_SECTION_SIZE * 12;
+  for (int i = 0; i < 256; i ++) sky_column_top[i] = -1;
   for (int i = 0; i < 20; i ++) {
-    y = i * 16;
-    writeUint16(client_fd, 4096); // block count
-    writeByte(client_fd, 8); // bits per entry
-    writeVarInt(client_fd, 256); // block palette length
-    // block palette as varint buffer - flush before large send
-    packet_flush_continue();
-    send_all(client_fd, network_block_palette, sizeof(network_block_palette));
-    // chunk section buffer
+    int y = i * 16;
     uint8_t biome = buildChunkSection(x, y, z);
-    send_all(client_fd, chunk_section, 4096);
-    // biome data
-    writeByte(client_fd, 0); // bits per entry
-    writeByte(client_fd, biome); // biome palette
-
-    /*
-     * Smart interleaving: Every 4 chunk sections, check if other clients
-     * have pending packets and process them. This keeps multiplayer
-     * responsive during long chunk sends.
-     *
-     * IMPORTANT: We save/restore the packet buffer state, but we FORCE
-     * packet_buffer_len = 0 after the callback. This is critical because:
-     *   1. The callback may process packets that use packet_start/flush
-     *   2. If a handler returns early or broadcasts to multiple clients,
-     *      packet_buffer_len could be nonzero when we return
-     *   3. Without forcing it to 0, stale bytes get prepended to chunk data
-     *
-     * The callback itself skips packets that could trigger chunk sends
-     * (movement, config ack) to prevent worldgen global corruption.
-     */
-    if ((i & 3) == 3 && chunk_interleave_callback != NULL) {
-      /* Flush any buffered data before interleave */
-      packet_flush_continue();
-
-      /* Save packet buffer fd (len should be 0 after flush) */
-      int saved_fd = packet_buffer_fd;
-
-      /* Clear buffer state for callback */
-      packet_buffer_fd = -1;
-      packet_buffer_len = 0;
-
-      /* Process other clients */
-      chunk_interleave_callback(client_fd);
-
-      /* Restore fd but FORCE len to 0 - don't trust callback's state */
-      packet_buffer_fd = saved_fd;
-      packet_buffer_len = 0;
+    encodeChunkSection(&encoded_sections[i], encoded_section_data[i], biome);
+    traceSkyLight(&encoded_sections[i], y);
+    chunk_data_size += encoded_sections[i].size;
+
+    // Other clients are served between chunks, see serviceChunkQueues
+    task_yield();
+  }
+
+  // Sort the 26 light sections (Y=-80 to Y=336) by their sky light.
+  // Sections entirely below the terrain are sent as empty. Those entirely
+  // above it are left out, which the client treats as fully lit.
+  int min_top = sky_column_top[0], max_top = sky_column_top[0];
+  for (int i = 1; i < 256; i ++) {
+    if (sky_column_top[i] < min_top) min_top = sky_column_top[i];
+    if (sky_column_top[i] > max_top) max_top = sky_column_top[i];
+  }
+  uint32_t sky_light_mask = 0, empty_sky_light_mask = 0;
+  int sky_light_arrays = 0;
+  for (int i = 0; i < 26; i ++) {
+    int section_y = i * 16 - 80;
+    if (section_y > max_top) break;
+    if (section_y + 15 <= min_top) {
+      empty_sky_light_mask |= (uint32_t)1 << i;
     } else {
-      task_yield();
+      sky_light_mask |= (uint32_t)1 << i;
+      sky_light_arrays ++;
     }
   }
 
-  // send 8 chunk sections (up to Y=192) with no blocks
-  for (int i = 0; i < 8; i ++) {
-    writeUint16(client_fd, 4096); // block count
-    writeByte(client_fd, 0); // block bits
-    writeVarInt(client_fd, 0); // block palette (air)
-    writeByte(client_fd, 0); // biome bits
-    writeByte(client_fd, 0); // biome palette
+  // masks and array counts, then the arrays with their length prefixes
+  const int light_data_size = 9 + 1 + 9 + 1 + 1 + sky_light_arrays * (2 + 2048) + 1;
+
+  int packet_length = 11 + sizeVarInt(chunk_data_size) + chunk_data_size + light_data_size;
+  int packet_size = sizeVarInt(packet_length) + packet_length;
+
+  uint8_t *packet = allocChunkPacket(_x, _z, packet_size);
+  chunk_out = packet;
+  /* Enable packet buffering - batches small writes for efficiency */
+  if (packet == NULL) packet_start(client_fd);
+
+  writeChunkVarInt(client_fd, packet_length);
+  writeChunkInt(client_fd, 0x27, 1);
+
+  writeChunkInt(client_fd, (uint32_t)_x, 4);
+  writeChunkInt(client_fd, (uint32_t)_z, 4);
+
+  writeChunkVarInt(client_fd, 0); // omit heightmaps
+
+  writeChunkVarInt(client_fd, chunk_data_size);
+
+  // sections below Y=0
+  writeChunkBytes(client_fd, chunk_prefix, sizeof(chunk_prefix));
+
+  // send chunk sections
+  for (int i = 0; i < 20; i ++) {
+    writeEncodedSection(client_fd, &encoded_sections[i], encoded_section_data[i]);
+    if ((i & 3) == 3) {
+      task_yield();
+    }
   }
+
+  // sections above Y=256 and block entities
+  writeChunkBytes(client_fd, chunk_suffix, sizeof(chunk_suffix));
   // yield to idle task
   task_yield();
 
-  writeVarInt(client_fd, 0); // omit block entities
-
   // light data
-  writeVarInt(client_fd, 1);
-  writeUint64(client_fd, 0b11111111111111111111111111);
-  writeVarInt(client_fd, 0);
-  writeVarInt(client_fd, 0);
-  writeVarInt(client_fd, 0);
-
-  // sky light array
-  writeVarInt(client_fd, 26);
-  for (int i = 0; i < 2048; i ++) chunk_section[i] = 0xFF;
-  for (int i = 2048; i < 4096; i ++) chunk_section[i] = 0;
-  packet_flush_continue();  // flush before light data sends
-  for (int i = 0; i < 8; i ++) {
-    writeVarInt(client_fd, 2048);
-    packet_flush_continue();
-    send_all(client_fd, chunk_section + 2048, 2048);
-  }
-  for (int i = 0; i < 18; i ++) {
-    writeVarInt(client_fd, 2048);
-    packet_flush_continue();
-    send_all(client_fd, chunk_section, 2048);
+  writeChunkVarInt(client_fd, 1);
+  writeChunkInt(client_fd, sky_light_mask, 8);
+  writeChunkVarInt(client_fd, 0); // block light mask
+  writeChunkVarInt(client_fd, 1);
+  writeChunkInt(client_fd, empty_sky_light_mask, 8);
+  writeChunkVarInt(client_fd, 0); // empty block light mask
+
+  // sky light arrays, each built into chunk_section as it's no longer
+  // needed for the blocks
+  writeChunkVarInt(client_fd, sky_light_arrays);
+  for (int i = 0; i < 26; i ++) {
+    if (!(sky_light_mask & ((uint32_t)1 << i))) continue;
+    buildSkyLightArray(chunk_section, i * 16 - 80);
+    writeChunkBytes(client_fd, chunk_section, 2 + 2048);
   }
   // don't send block light
-  writeVarInt(client_fd, 0);
+  writeChunkVarInt(client_fd, 0);
+
+  if (packet != NULL) {
+    chunk_out = NULL;
+    uint8_t *framed;
+    int compressed_size = 0;
+    if (compression_enabled && isCompressed(client_fd)) {
+      compressed_size = compressChunkPacket(packet, packet_length, &framed);
+    }
+    if (compressed_size > 0) {
+      send_compressed(client_fd, framed, compressed_size);
+      memcpy(packet, framed, compressed_size);
+      setChunkPacketCompressed(_x, _z, compressed_size);
+    } else {
+      send_all(client_fd, packet, packet_size);
+    }
+  } else {
+    packet_flush();
+  }
+
+}
+
+// S->C Chunk Data and Update Light
+int sc_chunkDataAndUpdateLight (int client_fd, int _x, int _z) {
+  PROF_START(CHUNK_GEN);
+
+  int x = _x * 16, z = _z * 16, y;
+
+  // Chunks that haven't changed since they were last encoded are resent
+  // straight from the chunk packet cache
+  int packet_size;
+  uint8_t *packet = findChunkPacket(_x, _z, &packet_size);
+  if (packet != NULL && isChunkPacketCompressed(_x, _z)) {
+    // Clients without compression get the chunk encoded again, which
+    // leaves the uncompressed copy in the cache for everyone
+    if (isCompressed(client_fd)) send_compressed(client_fd, packet, packet_size);
+    else writeChunkPacket(client_fd, _x, _z);
+  } else if (packet != NULL) {
+    // send_all frames this as uncompressed for clients with compression
+    send_all(client_fd, packet, packet_size);
+  } else {
+    writeChunkPacket(client_fd, _x, _z);
+  }
+
+  packet_start(client_fd);
 
   // Sending block updates changes light prediciton on the client.
   // Light-emitting blocks are omitted from chunk data so that they can
   // be overlayed here. This seems to be cheaper than sending actual
   // block light data.
-  for (int i = 0; i < block_changes_count; i ++) {
-    #ifdef ALLOW_CHESTS
-      if (block_changes[i].block != B_torch && block_changes[i].block != B_chest) continue;
-    #else
-      if (block_changes[i].block != B_torch) continue;
-    #endif
-    if (block_changes[i].x < x || block_changes[i].x >= x + 16) continue;
-    if (block_changes[i].z < z || block_changes[i].z >= z + 16) continue;
-    sc_blockUpdate(client_fd, block_changes[i].x, block_changes[i].y, block_changes[i].z, block_changes[i].block);
+  loadBlockRegion(x, z);
+  for (y = 0; y < 256; y += 16) {
+    for (int i = firstBlockChangeInSection(x, y, z); i != -1; i = nextBlockChangeInSection(i)) {
+      #ifdef ALLOW_CHESTS
+        if (block_changes[i].block != B_torch && block_changes[i].block != B_chest) continue;
+      #else
+        if (block_changes[i].block != B_torch) continue;
+      #endif
+      if (block_changes[i].x < x || block_changes[i].x >= x + 16) continue;
+      if (block_changes[i].z < z || block_changes[i].z >= z + 16) continue;
+      // Sections of this column may share a bucket, only send each once
+      if (block_changes[i].y < y || block_changes[i].y >= y + 16) continue;
+      sc_blockUpdate(client_fd, block_changes[i].x, block_changes[i].y, block_changes[i].z, block_changes[i].block);
+    }
   }
 
   packet_flush();  // flush remaining buffered data
@@ -535,6 +810,34 @@ int sc_blockUpdate (int client_fd, int64_t x, int64_t y, int64_t z, uint8_t bloc
   return 0;
 }
 
+// S->C Update Section Blocks
+// `positions` holds each block's offset within the section, packed as
+// (x << 8) | (z << 4) | y, and `blocks` the block placed there
+int sc_updateSectionBlocks (int client_fd, int cx, int cy, int cz, int count, const uint16_t *positions, const uint8_t *blocks) {
+  // Entries are VarLongs, but with block state IDs below 2^20 they always
+  // fit in 32 bits, where VarLongs and VarInts are encoded the same
+  int size = 9 + sizeVarInt(count);
+  for (int i = 0; i < count; i ++) {
+    size += sizeVarInt(((uint32_t)block_palette[blocks[i]] << 12) | positions[i]);
+  }
+
+  int batching = (packet_buffer_fd == client_fd);
+  if (!batching) packet_start(client_fd);
+  writeVarInt(client_fd, size);
+  writeByte(client_fd, 0x4D);
+  writeUint64(client_fd,
+    (((uint64_t)cx & 0x3FFFFF) << 42) |
+    (((uint64_t)cz & 0x3FFFFF) << 20) |
+    ((uint64_t)cy & 0xFFFFF)
+  );
+  writeVarInt(client_fd, count);
+  for (int i = 0; i < count; i ++) {
+    writeVarInt(client_fd, ((uint32_t)block_palette[blocks[i]] << 12) | positions[i]);
+  }
+  if (!batching) packet_flush();
+  return 0;
+}
+
 // S->C Acknowledge Block Change
 int sc_acknowledgeBlockChange (int client_fd, int sequence) {
   int batching = (packet_buffer_fd == client_fd);
@@ -856,10 +1159,9 @@ int cs_swingArm (int client_fd) {
     return 1;
 
   // Forward animation to all connected players
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    PlayerData* other_player = &player_data[i];
+  for (int n = 0; n < online_player_count; n ++) {
+    PlayerData* other_player = &player_data[online_players[n]];
 
-    if (other_player->client_fd == -1) continue;
     if (other_player->client_fd == player->client_fd) continue;
     if (other_player->flags & 0x20) continue;
 
@@ -1017,14 +1319,15 @@ int sc_spawnEntityPlayer (int client_fd, PlayerData player) {
 
 // S->C Entity Animation
 int sc_entityAnimation (int client_fd, int id, uint8_t animation) {
-  packet_start(client_fd);
+  int batching = (packet_buffer_fd == client_fd);
+  if (!batching) packet_start(client_fd);
   writeVarInt(client_fd, 2 + sizeVarInt(id));
   writeByte(client_fd, 0x02);
 
   writeVarInt(client_fd, id); // Entity ID
   writeByte(client_fd, animation); // Animation
 
-  packet_flush();
+  if (!batching) packet_flush();
   return 0;
 }
 
@@ -1159,7 +1462,8 @@ int sc_setEntityVelocity (int client_fd, int id, int16_t vx, int16_t vy, int16_t
 // S->C Damage Event
 int sc_damageEvent (int client_fd, int entity_id, int type) {
 
-  packet_start(client_fd);
+  int batching = (packet_buffer_fd == client_fd);
+  if (!batching) packet_start(client_fd);
   writeVarInt(client_fd, 4 + sizeVarInt(entity_id) + sizeVarInt(type));
   writeByte(client_fd, 0x19);
 
@@ -1169,7 +1473,7 @@ int sc_damageEvent (int client_fd, int entity_id, int type) {
   writeByte(client_fd, 0);
   writeByte(client_fd, false);
 
-  packet_flush();
+  if (!batching) packet_flush();
   return 0;
 }
 
@@ -1283,8 +1587,8 @@ int cs_chat (int client_fd) {
     recv_buffer[name_len + 2] = ' ';
 
     // Forward message to all connected players
-    for (int i = 0; i < MAX_PLAYERS; i ++) {
-      if (player_data[i].client_fd == -1) continue;
+    for (int n = 0; n < online_player_count; n ++) {
+      int i = online_players[n];
       if (player_data[i].flags & 0x20) continue;
       sc_systemChat(player_data[i].client_fd, (char *)recv_buffer, message_len + name_len + 3);
     }
@@ -38,11 +38,73 @@ static MobInterpState mob_interp_state[MAX_MOBS];
 static int64_t mob_interp_tick_start = 0;
 #endif
 
-int client_states[MAX_PLAYERS * 2];
+// Chunks waiting to be sent to a player, filled in as the player moves
+// across chunk borders and drained by serviceChunkQueues
+typedef struct {
+  // Chunk the player was in when the queue was last updated
+  short center_x;
+  short center_z;
+  short count;
+  short x[CHUNK_QUEUE_SIZE];
+  short z[CHUNK_QUEUE_SIZE];
+} ChunkQueue;
+
+static ChunkQueue chunk_queues[MAX_PLAYERS];
+
+// Coarse index of which players can see which parts of the world, used to
+// only broadcast updates to players that can see them. The world is split
+// into cells of (1 << INTEREST_CELL_SHIFT) chunks a side, which are hashed
+// into buckets holding a bit for each player whose view overlaps the cell.
+// Collisions only add candidates, getPlayersNear checks those exactly.
+static uint32_t interest_grid[INTEREST_GRID_SIZE];
+// Chunk each player was last registered at, and which players are
+static short interest_x[MAX_PLAYERS], interest_z[MAX_PLAYERS];
+static uint32_t interest_players = 0;
+// Players that have an up to date position of each player and mob. Those
+// that come into view of a player or mob without one are caught up with a
+// teleport, as they'll have missed any updates sent while out of range.
+static uint32_t player_seen_by[MAX_PLAYERS];
+static uint32_t mob_seen_by[MAX_MOBS];
+
+// Connections by file descriptor, in an open addressing hash table so
+// that finding a client's state or player takes a probe or two rather
+// than a scan. Free entries have an fd of -1.
+#define CLIENT_TABLE_BITS 6
+#define CLIENT_TABLE_SIZE (1 << CLIENT_TABLE_BITS)
+#define CLIENT_TABLE_MASK (CLIENT_TABLE_SIZE - 1)
+#if MAX_PLAYERS * 2 > CLIENT_TABLE_SIZE
+  #error "CLIENT_TABLE_SIZE must be at least twice MAX_PLAYERS"
+#endif
+
+typedef struct {
+  int fd;
+  int state;
+  // Index into player_data, or -1 until the client has logged in
+  int player;
+} ClientEntry;
+
+static ClientEntry client_table[CLIENT_TABLE_SIZE];
+
+/*
+ * Compare two block changes by coordinates.
+ * Sort order: region, then x, z and y within it. This keeps the changes
+ * of each region together, so that they can be paged in and out as one.
+ */
+static inline int compareBlockChangeCoords(short x1, uint8_t y1, short z1,
+                                           short x2, uint8_t y2, short z2) {
+    short r1 = BLOCK_REGION(x1), r2 = BLOCK_REGION(x2);
+    if (r1 != r2) return (r1 < r2) ? -1 : 1;
+    r1 = BLOCK_REGION(z1);
+    r2 = BLOCK_REGION(z2);
+    if (r1 != r2) return (r1 < r2) ? -1 : 1;
+    if (x1 != x2) return (x1 < x2) ? -1 : 1;
+    if (z1 != z2) return (z1 < z2) ? -1 : 1;
+    if (y1 != y2) return (y1 < y2) ? -1 : 1;
+    return 0;
+}
 
-#ifdef USE_SORTED_BLOCK_CHANGES
 /*
- * Comparison function for qsort - sorts block changes by coordinates
+ * Comparison function for qsort - sorts block changes by region and coordinates
  */
 static int compareBlockChangeQsort(const void *a, const void *b) {
     const BlockChange *ba = (const BlockChange *)a;
@@ -53,11 +115,7 @@ static int compareBlockChangeQsort(const void *a, const void *b) {
     if (ba->block != 0xFF && bb->block == 0xFF) return -1;
     if (ba->block == 0xFF && bb->block == 0xFF) return 0;
 
-    /* Compare by x, z, y */
-    if (ba->x != bb->x) return (ba->x < bb->x) ? -1 : 1;
-    if (ba->z != bb->z) return (ba->z < bb->z) ? -1 : 1;
-    if (ba->y != bb->y) return (ba->y < bb->y) ? -1 : 1;
-    return 0;
+    return compareBlockChangeCoords(ba->x, ba->y, ba->z, bb->x, bb->y, bb->z);
 }
 
 /*
@@ -81,38 +139,81 @@ void sortBlockChanges(void) {
     }
     block_changes_count = valid_count;
 }
-#endif /* USE_SORTED_BLOCK_CHANGES */
 
-void setClientState (int client_fd, int new_state) {
-  // Look for a client state with a matching file descriptor
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != client_fd) continue;
-    client_states[i + 1] = new_state;
-    return;
-  }
-  // If the above failed, look for an unused client state slot
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != -1) continue;
-    client_states[i] = client_fd;
-    client_states[i + 1] = new_state;
-    return;
+void initClientTable () {
+  for (int i = 0; i < CLIENT_TABLE_SIZE; i ++) client_table[i].fd = -1;
+}
+
+// Returns where the given file descriptor's probe sequence starts
+static int getClientHash (int client_fd) {
+  return ((uint32_t)client_fd * 2654435761u) >> (32 - CLIENT_TABLE_BITS);
+}
+
+// Returns the client table index of the given client, or -1 if not found
+int getClientIndex (int client_fd) {
+  if (client_fd < 0) return -1;
+  for (int i = getClientHash(client_fd); client_table[i].fd != -1; i = (i + 1) & CLIENT_TABLE_MASK) {
+    if (client_table[i].fd == client_fd) return i;
   }
+  return -1;
+}
+
+// Returns the client table entry of the given client, adding one if needed
+static ClientEntry *claimClientEntry (int client_fd) {
+  int i = getClientHash(client_fd);
+  while (client_table[i].fd != -1) {
+    if (client_table[i].fd == client_fd) return &client_table[i];
+    i = (i + 1) & CLIENT_TABLE_MASK;
+  }
+  client_table[i].fd = client_fd;
+  client_table[i].state = STATE_NONE;
+  client_table[i].player = -1;
+  return &client_table[i];
+}
+
+// Removes the given client's entry from the client table
+static void releaseClientEntry (int client_fd) {
+  int gap = getClientIndex(client_fd);
+  if (gap == -1) return;
+  // Move later entries of the same probe run into the gap, where that
+  // doesn't put them ahead of their own hash, so lookups don't stop short
+  for (int i = (gap + 1) & CLIENT_TABLE_MASK; client_table[i].fd != -1; i = (i + 1) & CLIENT_TABLE_MASK) {
+    int home = getClientHash(client_table[i].fd);
+    if (((i - home) & CLIENT_TABLE_MASK) < ((i - gap) & CLIENT_TABLE_MASK)) continue;
+    client_table[gap] = client_table[i];
+    gap = i;
+  }
+  client_table[gap].fd = -1;
+}
+
+void setClientState (int client_fd, int new_state) {
+  if (client_fd < 0) return;
+  claimClientEntry(client_fd)->state = new_state;
 }
 
 int getClientState (int client_fd) {
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != client_fd) continue;
-    return client_states[i + 1];
+  int i = getClientIndex(client_fd);
+  if (i == -1) return STATE_NONE;
+  return client_table[i].state;
+}
+
+// Links a client to its player_data entry and marks the player online
+static void setClientPlayer (int client_fd, int index) {
+  if (player_data[index].client_fd == -1) {
+    online_players[online_player_count ++] = index;
   }
-  return STATE_NONE;
+  player_data[index].client_fd = client_fd;
+  claimClientEntry(client_fd)->player = index;
 }
 
-int getClientIndex (int client_fd) {
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] != client_fd) continue;
-    return i;
+// Marks a player as offline
+static void clearClientPlayer (int index) {
+  player_data[index].client_fd = -1;
+  for (int i = 0; i < online_player_count; i ++) {
+    if (online_players[i] != index) continue;
+    online_players[i] = online_players[-- online_player_count];
+    break;
   }
-  return -1;
 }
 
 // Restores player data to initial state (fresh spawn)
@@ -143,7 +244,7 @@ int reservePlayerData (int client_fd, uint8_t *uuid, char *name) {
     // Found existing player entry (UUID match)
     if (memcmp(player_data[i].uuid, uuid, 16) == 0) {
       // Set network file descriptor and username
-      player_data[i].client_fd = client_fd;
+      setClientPlayer(client_fd, i);
       memcpy(player_data[i].name, name, 16);
       // Flag player as loading
       player_data[i].flags |= 0x20;
@@ -166,7 +267,7 @@ int reservePlayerData (int client_fd, uint8_t *uuid, char *name) {
     // Found free space for a player, initialize default parameters
     if (empty) {
       if (player_data_count >= MAX_PLAYERS) return 1;
-      player_data[i].client_fd = client_fd;
+      setClientPlayer(client_fd, i);
       player_data[i].flags |= 0x20;
       player_data[i].flagval_16 = 0;
       memcpy(player_data[i].uuid, uuid, 16);
@@ -182,19 +283,19 @@ int reservePlayerData (int client_fd, uint8_t *uuid, char *name) {
 }
 
 int getPlayerData (int client_fd, PlayerData **output) {
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == client_fd) {
-      *output = &player_data[i];
-      return 0;
-    }
-  }
-  return 1;
+  int i = getClientIndex(client_fd);
+  if (i == -1 || client_table[i].player == -1) return 1;
+  PlayerData *player = &player_data[client_table[i].player];
+  // The player may have logged in again since, on another connection
+  if (player->client_fd != client_fd) return 1;
+  *output = player;
+  return 0;
 }
 
 // Returns the player with the given name, or NULL if not found
 PlayerData *getPlayerByName (int start_offset, int end_offset, uint8_t *buffer) {
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
     int j;
     for (j = start_offset; j < end_offset && j < 256 && buffer[j] != ' '; j++) {
       if (player_data[i].name[j - start_offset] != buffer[j]) break;
@@ -209,33 +310,34 @@ PlayerData *getPlayerByName (int start_offset, int end_offset, uint8_t *buffer)
 
 // Marks a client as disconnected and cleans up player data
 void handlePlayerDisconnect (int client_fd) {
-  // Search for a corresponding player in the player data array
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd != client_fd) continue;
+  // Look up the corresponding player in the player data array
+  PlayerData *player;
+  if (!getPlayerData(client_fd, &player)) {
+    int i = player - player_data;
     // Mark the player as being offline
-    player_data[i].client_fd = -1;
+    clearClientPlayer(i);
+    // Save their data on the next journal flush
+    markPlayerDirty(i);
+    // Drop any chunks still waiting to be sent
+    chunk_queues[i].count = 0;
+    // Stop sending them updates from around the world
+    clearPlayerInterest(&player_data[i]);
     // Prepare leave message for broadcast
     uint8_t player_name_len = strlen(player_data[i].name);
     strcpy((char *)recv_buffer, player_data[i].name);
     strcpy((char *)recv_buffer + player_name_len, " left the game");
     // Broadcast this player's leave to all other connected clients
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == client_fd) continue;
-      if (player_data[j].flags & 0x20) continue;
+    for (int n = 0; n < online_player_count; n ++) {
+      PlayerData *other = &player_data[online_players[n]];
+      if (other->flags & 0x20) continue;
       // Send chat message
-      sc_systemChat(player_data[j].client_fd, (char *)recv_buffer, 14 + player_name_len);
+      sc_systemChat(other->client_fd, (char *)recv_buffer, 14 + player_name_len);
       // Remove leaving player's entity
-      sc_removeEntity(player_data[j].client_fd, client_fd);
-    }
-    break;
-  }
-  // Find the client state entry and reset it
-  for (int i = 0; i < MAX_PLAYERS * 2; i += 2) {
-    if (client_states[i] == client_fd) {
-      client_states[i] = -1;
-      return;
+      sc_removeEntity(other->client_fd, client_fd);
     }
   }
+  // Drop the client's connection table entry
+  releaseClientEntry(client_fd);
 }
 
 // Marks a client as connected and broadcasts their data to other players
@@ -254,7 +356,8 @@ void handlePlayerJoin (PlayerData* player) {
   strcpy((char *)recv_buffer + player_name_len, " joined the game");
 
   // Inform other clients (and the joining client) of the player's name and entity
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
     sc_systemChat(player_data[i].client_fd, (char *)recv_buffer, 16 + player_name_len);
     sc_playerInfoUpdateAddPlayer(player_data[i].client_fd, *player);
     if (player_data[i].client_fd != player->client_fd) {
@@ -273,6 +376,10 @@ void disconnectClient (int *client_fd, int cause) {
   client_count --;
   setClientState(*client_fd, STATE_NONE);
   handlePlayerDisconnect(*client_fd);
+  prof_client_closed(*client_fd);
+  closeSendQueue(*client_fd);
+  closeRecvQueue(*client_fd);
+  setCompression(*client_fd, false);
   #ifdef _WIN32
   closesocket(*client_fd);
   printf("Disconnected client %d, cause: %d, errno: %d\n", *client_fd, cause, WSAGetLastError());
@@ -461,18 +568,379 @@ void spawnPlayer (PlayerData *player) {
 
   task_yield(); // Check task timer between packets
 
-  // Send spawn chunk first
+  // Send spawn chunk right away, queue the rest of the view distance
   sc_chunkDataAndUpdateLight(player->client_fd, _x, _z);
-  for (int i = -view_distance; i <= view_distance; i ++) {
-    for (int j = -view_distance; j <= view_distance; j ++) {
+  resetChunkQueue(player, _x, _z);
+  updatePlayerInterest(player, _x, _z);
+  // Re-teleport player now that there's ground to stand on
+  sc_synchronizePlayerPosition(player->client_fd, spawn_x, spawn_y, spawn_z, spawn_yaw, spawn_pitch);
+
+  task_yield(); // Check task timer between packets
+
+}
+
+// Player slot that was last sent a chunk, for round-robin scheduling
+static int chunk_queue_player = 0;
+
+// Empties a player's chunk queue, then queues every chunk in view
+// distance around the given chunk, except for that chunk itself
+void resetChunkQueue (PlayerData *player, short _x, short _z) {
+  ChunkQueue *queue = &chunk_queues[player - player_data];
+  queue->center_x = _x;
+  queue->center_z = _z;
+  queue->count = 0;
+  for (short i = -view_distance; i <= view_distance; i ++) {
+    for (short j = -view_distance; j <= view_distance; j ++) {
       if (i == 0 && j == 0) continue;
-      sc_chunkDataAndUpdateLight(player->client_fd, _x + i, _z + j);
+      if (queue->count == CHUNK_QUEUE_SIZE) return;
+      queue->x[queue->count] = _x + i;
+      queue->z[queue->count] = _z + j;
+      queue->count ++;
     }
   }
-  // Re-teleport player after all chunks have been sent
-  sc_synchronizePlayerPosition(player->client_fd, spawn_x, spawn_y, spawn_z, spawn_yaw, spawn_pitch);
+}
 
-  task_yield(); // Check task timer between packets
+// Moves a player's chunk queue to a new center chunk. Queued chunks that
+// are now out of view distance are cancelled, and chunks that have just
+// come into view distance are queued.
+void updateChunkQueue (PlayerData *player, short _x, short _z) {
+
+  ChunkQueue *queue = &chunk_queues[player - player_data];
+
+  // Cancel chunks that went out of range before being sent
+  for (int i = 0; i < queue->count; i ++) {
+    if (
+      abs(queue->x[i] - _x) <= view_distance &&
+      abs(queue->z[i] - _z) <= view_distance
+    ) continue;
+    queue->count --;
+    queue->x[i] = queue->x[queue->count];
+    queue->z[i] = queue->z[queue->count];
+    i --;
+  }
+
+  // Queue chunks that weren't in range of the previous center
+  for (short i = _x - view_distance; i <= _x + view_distance; i ++) {
+    for (short j = _z - view_distance; j <= _z + view_distance; j ++) {
+      if (
+        abs(i - queue->center_x) <= view_distance &&
+        abs(j - queue->center_z) <= view_distance
+      ) continue;
+      if (queue->count == CHUNK_QUEUE_SIZE) break;
+      queue->x[queue->count] = i;
+      queue->z[queue->count] = j;
+      queue->count ++;
+    }
+  }
+
+  queue->center_x = _x;
+  queue->center_z = _z;
+
+}
+
+// Changes view_distance while players are online. The client is told its
+// new chunk cache radius, and every chunk queue is adjusted: chunks that
+// are now too far are cancelled, chunks that have just come into view
+// are queued.
+void setViewDistance (int distance) {
+
+  int old_distance = view_distance;
+  view_distance = distance;
+
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    PlayerData *player = &player_data[i];
+    if (player->client_fd == -1) continue;
+    if (player->flags & 0x20) continue;
+
+    sc_setChunkCacheRadius(player->client_fd, distance);
+
+    ChunkQueue *queue = &chunk_queues[i];
+    short _x = queue->center_x, _z = queue->center_z;
+
+    for (int j = 0; j < queue->count; j ++) {
+      if (
+        abs(queue->x[j] - _x) <= distance &&
+        abs(queue->z[j] - _z) <= distance
+      ) continue;
+      queue->count --;
+      queue->x[j] = queue->x[queue->count];
+      queue->z[j] = queue->z[queue->count];
+      j --;
+    }
+
+    for (short x = _x - distance; x <= _x + distance; x ++) {
+      for (short z = _z - distance; z <= _z + distance; z ++) {
+        if (abs(x - _x) <= old_distance && abs(z - _z) <= old_distance) continue;
+        if (queue->count == CHUNK_QUEUE_SIZE) break;
+        queue->x[queue->count] = x;
+        queue->z[queue->count] = z;
+        queue->count ++;
+      }
+    }
+  }
+
+}
+
+static int getInterestBucket (int cell_x, int cell_z) {
+  return (cell_x * 31 + cell_z) & (INTEREST_GRID_SIZE - 1);
+}
+
+// Registers every player in the cells they could be viewing. Views are
+// taken to be of MAX_VIEW_DISTANCE, so that changing view_distance doesn't
+// need a rebuild. Only runs when a player crosses a chunk border.
+static void rebuildInterestGrid () {
+  memset(interest_grid, 0, sizeof(interest_grid));
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    uint32_t bit = (uint32_t)1 << i;
+    if (!(interest_players & bit)) continue;
+    int min_x = div_floor(interest_x[i] - MAX_VIEW_DISTANCE - 1, 1 << INTEREST_CELL_SHIFT);
+    int max_x = div_floor(interest_x[i] + MAX_VIEW_DISTANCE + 1, 1 << INTEREST_CELL_SHIFT);
+    int min_z = div_floor(interest_z[i] - MAX_VIEW_DISTANCE - 1, 1 << INTEREST_CELL_SHIFT);
+    int max_z = div_floor(interest_z[i] + MAX_VIEW_DISTANCE + 1, 1 << INTEREST_CELL_SHIFT);
+    for (int x = min_x; x <= max_x; x ++) {
+      for (int z = min_z; z <= max_z; z ++) {
+        interest_grid[getInterestBucket(x, z)] |= bit;
+      }
+    }
+  }
+}
+
+// Moves a player to a new chunk in the interest grid
+void updatePlayerInterest (PlayerData *player, short _x, short _z) {
+  int index = player - player_data;
+  uint32_t bit = (uint32_t)1 << index;
+  if ((interest_players & bit) && interest_x[index] == _x && interest_z[index] == _z) return;
+  interest_x[index] = _x;
+  interest_z[index] = _z;
+  interest_players |= bit;
+  rebuildInterestGrid();
+}
+
+// Removes a disconnecting player from the interest grid
+void clearPlayerInterest (PlayerData *player) {
+  interest_players &= ~((uint32_t)1 << (player - player_data));
+  rebuildInterestGrid();
+}
+
+// Returns a bitmask of the in-game players (by player_data index) whose
+// view contains the given block coordinates. The view is taken to be one
+// chunk wider than view_distance, to cover chunks the client still holds.
+uint32_t getPlayersNear (short x, short z) {
+  short _x = div_floor(x, 16), _z = div_floor(z, 16);
+  uint32_t candidates = interest_grid[getInterestBucket(
+    div_floor(_x, 1 << INTEREST_CELL_SHIFT),
+    div_floor(_z, 1 << INTEREST_CELL_SHIFT)
+  )];
+  uint32_t players = 0;
+  for (int i = 0; candidates; i ++, candidates >>= 1) {
+    if (!(candidates & 1)) continue;
+    if (player_data[i].client_fd == -1) continue;
+    if (player_data[i].flags & 0x20) continue;
+    if (abs(interest_x[i] - _x) > view_distance + 1) continue;
+    if (abs(interest_z[i] - _z) > view_distance + 1) continue;
+    players |= (uint32_t)1 << i;
+  }
+  return players;
+}
+
+// Returns the players that should be sent a movement update for the given
+// player at the given block coordinates. If any of them haven't been
+// following this player's movement, sets *catch_up so that the caller
+// sends an absolute position. Pass NULL for updates without a position.
+// Players whose connection is backed up are left out, like for mobs, and
+// get caught up once they're able to take updates again.
+uint32_t getPlayerViewers (PlayerData *player, short x, short z, uint8_t *catch_up) {
+  int index = player - player_data;
+  uint32_t viewers = getPlayersNear(x, z) & ~((uint32_t)1 << index);
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    if (!(viewers & ((uint32_t)1 << i))) continue;
+    if (isSendQueueCongested(player_data[i].client_fd)) viewers &= ~((uint32_t)1 << i);
+  }
+  if (catch_up == NULL) return viewers;
+  if (viewers & ~player_seen_by[index]) *catch_up = true;
+  player_seen_by[index] = viewers;
+  return viewers;
+}
+
+// Chunk offsets of the 8 directions returned by getPlayerFacing
+static const int8_t facing_x[8] = { 0, -1, -1, -1, 0, 1, 1, 1 };
+static const int8_t facing_z[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+
+// Returns the direction the player is facing, rounded to one of 8
+// directions. Yaw 0 faces +Z, and increases clockwise as seen from above.
+static int getPlayerFacing (PlayerData *player) {
+  return (((uint8_t)player->yaw + 16) >> 5) & 7;
+}
+
+// Returns the index of the queued chunk that should be sent next. Closer
+// chunks go first, and of those, the ones the player is facing.
+static int getNextQueuedChunk (PlayerData *player, ChunkQueue *queue) {
+
+  int facing = getPlayerFacing(player);
+
+  int best = 0, best_score = 0x7FFFFFFF;
+  for (int i = 0; i < queue->count; i ++) {
+    int dx = queue->x[i] - queue->center_x;
+    int dz = queue->z[i] - queue->center_z;
+    int score = (dx * dx + dz * dz) * 2;
+    // Chunks behind the player are pushed back by about one ring
+    if (dx * facing_x[facing] + dz * facing_z[facing] < 0) score += 3;
+    if (score >= best_score) continue;
+    best = i;
+    best_score = score;
+  }
+
+  return best;
+
+}
+
+#ifdef ENABLE_TERRAIN_PREGEN
+// Where each player was when their lookahead was last started, and how far
+// through it the pregenerator has got, counted in sections
+static short pregen_x[MAX_PLAYERS], pregen_z[MAX_PLAYERS];
+static uint8_t pregen_facing[MAX_PLAYERS];
+static uint16_t pregen_next[MAX_PLAYERS];
+// How far through the ring around spawn the pregenerator has got
+static uint16_t pregen_spawn_next = 0;
+// Player to look at first on the next call, so that nobody is starved
+static int pregen_player = 0;
+
+// Finds the next section to pregenerate, storing its block coordinates
+// and whether it's worth evicting other sections for
+// Returns false if there's nothing left to look at
+static int getNextPregenSection (int *cx, int *cy, int *cz, int *urgent) {
+
+  // Sections that come into view if the player keeps going the same way,
+  // nearest rows first and, within a row, middle first
+  int width = 2 * view_distance + 1;
+  int lookahead = PREGEN_LOOKAHEAD * width * CACHE_COLUMN_SECTIONS;
+  for (int n = 0; n < MAX_PLAYERS; n ++) {
+    int i = (pregen_player + n) % MAX_PLAYERS;
+    PlayerData *player = &player_data[i];
+    if (player->client_fd == -1) continue;
+    if (pregen_next[i] >= lookahead) continue;
+    int column = pregen_next[i] / CACHE_COLUMN_SECTIONS;
+    int row = column / width + 1;
+    int offset = column % width;
+    int side = (offset & 1) ? (offset + 1) / 2 : -(offset / 2);
+    int f = pregen_facing[i];
+    *cx = (pregen_x[i] + facing_x[f] * (view_distance + row) - facing_z[f] * side) * 16;
+    *cz = (pregen_z[i] + facing_z[f] * (view_distance + row) + facing_x[f] * side) * 16;
+    *cy = (pregen_next[i] % CACHE_COLUMN_SECTIONS) * 16;
+    pregen_next[i] ++;
+    pregen_player = (i + 1) % MAX_PLAYERS;
+    *urgent = true;
+    return true;
+  }
+
+  // Then the ring around spawn, which is done once per run, and only
+  // with what room there is to spare in the cache
+  int spawn_width = 2 * PREGEN_SPAWN_RADIUS + 1;
+  if (pregen_spawn_next < spawn_width * spawn_width * CACHE_COLUMN_SECTIONS) {
+    int column = pregen_spawn_next / CACHE_COLUMN_SECTIONS;
+    *cx = (column % spawn_width - PREGEN_SPAWN_RADIUS) * 16;
+    *cz = (column / spawn_width - PREGEN_SPAWN_RADIUS) * 16;
+    *cy = (pregen_spawn_next % CACHE_COLUMN_SECTIONS) * 16;
+    pregen_spawn_next ++;
+    *urgent = false;
+    return true;
+  }
+
+  return false;
+
+}
+
+// Generates terrain into the chunk cache while the server is idle, so that
+// chunks are ready by the time they're sent. Looks ahead of players in the
+// direction they're facing first, then around spawn. Runs for up to
+// `budget` microseconds, but stops early once a client has sent data.
+// Returns true if there's more left to generate.
+int pregenerateTerrain (int64_t budget) {
+
+  // Start a player's lookahead over once they've moved or turned
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
+    PlayerData *player = &player_data[i];
+    short _x = div_floor(player->x, 16), _z = div_floor(player->z, 16);
+    uint8_t facing = getPlayerFacing(player);
+    if (_x == pregen_x[i] && _z == pregen_z[i] && facing == pregen_facing[i]) continue;
+    pregen_x[i] = _x;
+    pregen_z[i] = _z;
+    pregen_facing[i] = facing;
+    pregen_next[i] = 0;
+  }
+
+  int64_t start = get_program_time();
+  int cx, cy, cz, urgent;
+  while (getNextPregenSection(&cx, &cy, &cz, &urgent)) {
+    // Sections that are cached already cost only a lookup
+    if (!pregenerateChunkSection(cx, cy, cz, urgent)) continue;
+    if (get_program_time() - start >= budget) return true;
+    if (hasIncomingData()) return true;
+  }
+  return false;
+
+}
+#endif
+
+// Returns true if serviceChunkQueues has a chunk it could send right now
+int hasChunksToSend () {
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
+    if (chunk_queues[i].count == 0) continue;
+    if (isSendQueueCongested(player_data[i].client_fd)) continue;
+    return true;
+  }
+  return false;
+}
+
+// Sends queued chunks to players, going round-robin across players with
+// one chunk at a time, until CHUNK_SEND_BUDGET has been used up.
+// At least one chunk is sent if any are queued for a player whose
+// connection isn't backed up. Call from the main loop.
+void serviceChunkQueues () {
+
+  int64_t start = get_program_time();
+  int sent = 0;
+  // Number of players in a row that had nothing queued
+  int idle = 0;
+
+  PROF_START(CHUNK_SEND);
+  while (idle < MAX_PLAYERS) {
+
+    chunk_queue_player ++;
+    if (chunk_queue_player == MAX_PLAYERS) chunk_queue_player = 0;
+
+    PlayerData *player = &player_data[chunk_queue_player];
+    ChunkQueue *queue = &chunk_queues[chunk_queue_player];
+    // Hold chunks back while the player's connection is backed up
+    if (player->client_fd == -1 || queue->count == 0 || isSendQueueCongested(player->client_fd)) {
+      idle ++;
+      continue;
+    }
+    idle = 0;
+
+    // Pop the chunk off the queue before sending it
+    int i = getNextQueuedChunk(player, queue);
+    short x = queue->x[i], z = queue->z[i];
+    queue->count --;
+    queue->x[i] = queue->x[queue->count];
+    queue->z[i] = queue->z[queue->count];
+
+    sc_chunkDataAndUpdateLight(player->client_fd, x, z);
+    sent ++;
+
+    if (get_program_time() - start >= CHUNK_SEND_BUDGET) break;
+
+  }
+  PROF_END(CHUNK_SEND);
+
+  #ifdef DEV_LOG_CHUNK_GENERATION
+  if (sent > 0) {
+    int64_t total_us = get_program_time() - start;
+    printf("Sent %d chunks in %d ms (%d ms per chunk)\n", sent, (int)(total_us / 1000), (int)(total_us / 1000 / sent));
+  }
+  #endif
 
 }
 
@@ -501,11 +969,10 @@ void broadcastPlayerMetadata (PlayerData *player) {
     }
   };
 
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    PlayerData* other_player = &player_data[i];
+  for (int n = 0; n < online_player_count; n ++) {
+    PlayerData* other_player = &player_data[online_players[n]];
     int client_fd = other_player->client_fd;
 
-    if (client_fd == -1) continue;
     if (client_fd == player->client_fd) continue;
     if (other_player->flags & 0x20) continue;
 
@@ -521,7 +988,7 @@ void broadcastMobMetadata (int client_fd, int entity_id) {
   if (mob_index < 0 || mob_index >= MAX_MOBS) return;
   MobData *mob = &mob_data[mob_index];
 
-  EntityData *metadata;
+  EntityData metadata[1];
   size_t length;
 
   switch (mob->type) {
@@ -529,7 +996,6 @@ void broadcastMobMetadata (int client_fd, int entity_id) {
       if (!((mob->data >> 5) & 1)) // Don't send metadata if sheep isn't sheared
         return;
 
-      metadata = malloc(sizeof *metadata);
       metadata[0] = (EntityData){
         17,                // Index (Sheep Bit Mask),
         0,                 // Type (Byte),
@@ -543,11 +1009,10 @@ void broadcastMobMetadata (int client_fd, int entity_id) {
   }
 
   if (client_fd == -1) {
-    for (int i = 0; i < MAX_PLAYERS; i ++) {
-      PlayerData* player = &player_data[i];
+    for (int n = 0; n < online_player_count; n ++) {
+      PlayerData* player = &player_data[online_players[n]];
       client_fd = player->client_fd;
 
-      if (client_fd == -1) continue;
       if (player->flags & 0x20) continue;
 
       sc_setEntityMetadata(client_fd, entity_id, metadata, length);
@@ -555,22 +1020,6 @@ void broadcastMobMetadata (int client_fd, int entity_id) {
   } else {
     sc_setEntityMetadata(client_fd, entity_id, metadata, length);
   }
-
-  free(metadata);
-}
-
-#ifdef USE_SORTED_BLOCK_CHANGES
-
-/*
- * Compare two block changes by coordinates.
- * Sort order: x, then z, then y (groups nearby blocks together)
- */
-static inline int compareBlockChangeCoords(short x1, uint8_t y1, short z1,
-                                           short x2, uint8_t y2, short z2) {
-    if (x1 != x2) return (x1 < x2) ? -1 : 1;
-    if (z1 != z2) return (z1 < z2) ? -1 : 1;
-    if (y1 != y2) return (y1 < y2) ? -1 : 1;
-    return 0;
 }
 
 /*
@@ -606,6 +1055,8 @@ static int binarySearchBlockChange(short x, uint8_t y, short z, int *insert_pos)
 }
 
 uint8_t getBlockChange (short x, uint8_t y, short z) {
+    // Page the surrounding region in, if it's been paged out
+    loadBlockRegion(x, z);
     int idx = binarySearchBlockChange(x, y, z, NULL);
     if (idx >= 0) {
         return block_changes[idx].block;
@@ -613,25 +1064,56 @@ uint8_t getBlockChange (short x, uint8_t y, short z) {
     return 0xFF;
 }
 
-#else /* !USE_SORTED_BLOCK_CHANGES */
+// Finds the entries of block_changes in the given region, which are kept
+// together as one run. Returns how many there are, and stores the index
+// of the first one (or where it would go) in *first.
+int findRegionRun (short rx, short rz, int *first) {
+  int bounds[2];
+  // Find where the region starts, then where the one after it starts
+  for (int b = 0; b < 2; b ++) {
+    int left = 0, right = block_changes_count;
+    while (left < right) {
+      int mid = left + (right - left) / 2;
+      short mx = BLOCK_REGION(block_changes[mid].x);
+      short mz = BLOCK_REGION(block_changes[mid].z);
+      if (mx < rx || (mx == rx && (mz < rz || (b == 1 && mz == rz)))) left = mid + 1;
+      else right = mid;
+    }
+    bounds[b] = left;
+  }
+  *first = bounds[0];
+  return bounds[1] - bounds[0];
+}
 
-uint8_t getBlockChange (short x, uint8_t y, short z) {
-  for (int i = 0; i < block_changes_count; i ++) {
-    if (block_changes[i].block == 0xFF) continue;
-    if (
-      block_changes[i].x == x &&
-      block_changes[i].y == y &&
-      block_changes[i].z == z
-    ) return block_changes[i].block;
-    #ifdef ALLOW_CHESTS
-      // Skip chest contents
-      if (block_changes[i].block == B_chest) i += 14;
-    #endif
+// Removes `count` entries from block_changes, starting at `first`
+void removeBlockChangeRun (int first, int count) {
+  if (count == 0) return;
+  for (int i = first; i < first + count; i ++) unindexBlockChange(i);
+  memmove(
+    &block_changes[first], &block_changes[first + count],
+    (block_changes_count - first - count) * sizeof(BlockChange)
+  );
+  block_changes_count -= count;
+  // Unallocate the now-duplicate tail entries
+  for (int i = block_changes_count; i < block_changes_count + count; i ++) {
+    block_changes[i].block = 0xFF;
   }
-  return 0xFF;
+  shiftBlockChangeIndex(first + count, -count);
 }
 
-#endif /* USE_SORTED_BLOCK_CHANGES */
+// Moves the entries from `first` on up by `count` slots, leaving room for
+// a run of entries that the caller writes and then indexes
+// Returns 1 if block_changes doesn't have room, 0 otherwise
+uint8_t openBlockChangeRun (int first, int count) {
+  if (block_changes_count + count > MAX_BLOCK_CHANGES) return 1;
+  memmove(
+    &block_changes[first + count], &block_changes[first],
+    (block_changes_count - first) * sizeof(BlockChange)
+  );
+  block_changes_count += count;
+  shiftBlockChangeIndex(first, count);
+  return 0;
+}
 
 // Handle running out of memory for new block changes
 void failBlockChange (short x, uint8_t y, short z, uint8_t block) {
@@ -640,8 +1122,8 @@ void failBlockChange (short x, uint8_t y, short z, uint8_t block) {
   uint8_t before = getBlockAt(x, y, z);
 
   // Broadcast a new update to all players
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
     if (player_data[i].flags & 0x20) continue;
     // Reset the block they tried to change
     sc_blockUpdate(player_data[i].client_fd, x, y, z, before);
@@ -651,31 +1133,52 @@ void failBlockChange (short x, uint8_t y, short z, uint8_t block) {
 
 }
 
-#ifdef USE_SORTED_BLOCK_CHANGES
+#ifdef ALLOW_CHESTS
 
-uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block) {
+// Returns the contents of the chest at the given coordinates, or NULL
+ChestData *getChestData (short x, uint8_t y, short z) {
+  for (int i = 0; i < MAX_CHESTS; i ++) {
+    if (!chest_data[i].used) continue;
+    if (chest_data[i].x != x || chest_data[i].y != y || chest_data[i].z != z) continue;
+    return &chest_data[i];
+  }
+  return NULL;
+}
 
-  // Transmit block update to all in-game clients
-  PROF_START(BLOCK_BROADCAST);
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
-    if (player_data[i].flags & 0x20) continue;
-    sc_blockUpdate(player_data[i].client_fd, x, y, z, block);
+// Assigns an empty chest_data entry to a new chest
+// Returns 1 if all entries are taken, 0 otherwise
+static uint8_t claimChestData (short x, uint8_t y, short z) {
+  for (int i = 0; i < MAX_CHESTS; i ++) {
+    if (chest_data[i].used) continue;
+    chest_data[i].x = x;
+    chest_data[i].y = y;
+    chest_data[i].z = z;
+    chest_data[i].used = true;
+    memset(chest_data[i].items, 0, sizeof(chest_data[i].items));
+    markChestDirty(i);
+    return 0;
   }
-  PROF_END(BLOCK_BROADCAST);
+  return 1;
+}
 
-  PROF_START(BLOCK_CHANGE);
-  // Calculate terrain at these coordinates and compare it to the input block.
-  ChunkAnchor anchor = {
-    x / CHUNK_SIZE,
-    z / CHUNK_SIZE
-  };
-  if (x % CHUNK_SIZE < 0) anchor.x --;
-  if (z % CHUNK_SIZE < 0) anchor.z --;
-  anchor.hash = getChunkHash(anchor.x, anchor.z);
-  anchor.biome = getChunkBiome(anchor.x, anchor.z);
+// Frees the chest_data entry of a chest that has been replaced
+// The contents of the chest are lost
+static void releaseChestData (short x, uint8_t y, short z) {
+  ChestData *chest = getChestData(x, y, z);
+  if (chest == NULL) return;
+  chest->used = false;
+  markChestDirty((int)(chest - chest_data));
+}
 
-  uint8_t is_base_block = block == getTerrainAt(x, y, z, anchor);
+#endif
+
+// Stores a block change in the sorted block_changes array
+// Returns 1 if there's no more space for new entries, 0 otherwise
+static uint8_t storeBlockChange (short x, uint8_t y, short z, uint8_t block, uint8_t is_base_block) {
+
+  // The region has to be in memory, and only needs to exist if the change
+  // adds something rather than restoring terrain
+  if (claimBlockRegion(x, z, !is_base_block)) return 1;
 
   // Use binary search to find existing entry or insertion point
   int insert_pos;
@@ -685,33 +1188,26 @@ uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block) {
     // Entry exists - update or delete it
     if (is_base_block) {
       // Restoring to base terrain - remove entry by shifting left
+      unindexBlockChange(existing);
       for (int i = existing; i < block_changes_count - 1; i++) {
         block_changes[i] = block_changes[i + 1];
       }
       block_changes_count--;
-      // Invalidate cache for this chunk
-      invalidateChunkCache(x, y, z);
+      // Unallocate the now-duplicate tail entry so it doesn't get saved
+      block_changes[block_changes_count].block = 0xFF;
+      shiftBlockChangeIndex(existing + 1, -1);
     } else {
       // Update existing entry
       block_changes[existing].block = block;
-      invalidateChunkCache(x, y, z);
     }
-    PROF_END(BLOCK_CHANGE);
     return 0;
   }
 
   // Entry doesn't exist
-  if (is_base_block) {
-    PROF_END(BLOCK_CHANGE);
-    return 0;  // Nothing to do
-  }
+  if (is_base_block) return 0;  // Nothing to do
 
   // Check for space
-  if (block_changes_count >= MAX_BLOCK_CHANGES) {
-    PROF_END(BLOCK_CHANGE);
-    failBlockChange(x, y, z, block);
-    return 1;
-  }
+  if (block_changes_count >= MAX_BLOCK_CHANGES) return 1;
 
   // Insert new entry at sorted position - shift right to make room
   for (int i = block_changes_count; i > insert_pos; i--) {
@@ -724,30 +1220,16 @@ uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block) {
   block_changes[insert_pos].z = z;
   block_changes[insert_pos].block = block;
   block_changes_count++;
+  shiftBlockChangeIndex(insert_pos, 1);
+  indexBlockChange(insert_pos);
 
-  // Invalidate cache for this chunk
-  invalidateChunkCache(x, y, z);
-
-  PROF_END(BLOCK_CHANGE);
   return 0;
 }
 
-#else /* !USE_SORTED_BLOCK_CHANGES */
-
-uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block) {
-
-  // Transmit block update to all in-game clients
-  PROF_START(BLOCK_BROADCAST);
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
-    if (player_data[i].flags & 0x20) continue;
-    sc_blockUpdate(player_data[i].client_fd, x, y, z, block);
-  }
-  PROF_END(BLOCK_BROADCAST);
-
-  // Calculate terrain at these coordinates and compare it to the input block.
-  // Since block changes get overlayed on top of terrain, we don't want to
-  // store blocks that don't differ from the base terrain.
+// Calculates terrain at these coordinates and compares it to the input block.
+// Since block changes get overlayed on top of terrain, we don't want to
+// store blocks that don't differ from the base terrain.
+static uint8_t isBaseBlock (short x, uint8_t y, short z, uint8_t block) {
   ChunkAnchor anchor = {
     x / CHUNK_SIZE,
     z / CHUNK_SIZE
@@ -756,112 +1238,150 @@ uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block) {
   if (z % CHUNK_SIZE < 0) anchor.z --;
   anchor.hash = getChunkHash(anchor.x, anchor.z);
   anchor.biome = getChunkBiome(anchor.x, anchor.z);
+  return block == getTerrainAt(x, y, z, anchor);
+}
 
-  uint8_t is_base_block = block == getTerrainAt(x, y, z, anchor);
-
-  // In the block_changes array, 0xFF indicates a missing/restored entry.
-  // We track the position of the first such "gap" for when the operation
-  // isn't replacing an existing block change.
-  int first_gap = block_changes_count;
+// Applies a block change read back from the world journal on startup
+// Unlike makeBlockChange, this doesn't broadcast or touch chest_data, as
+// the journal records chest contents separately
+void replayBlockChange (short x, uint8_t y, short z, uint8_t block) {
+  if (storeBlockChange(x, y, z, block, isBaseBlock(x, y, z, block))) {
+    printf("WARNING: Block change at (%d, %d, %d) dropped, MAX_BLOCK_CHANGES exceeded.\n", x, y, z);
+  }
+}
 
-  // Prioritize replacing entries with matching coordinates
-  // This prevents having conflicting entries for one set of coordinates
-  for (int i = 0; i < block_changes_count; i ++) {
-    if (block_changes[i].block == 0xFF) {
-      if (first_gap == block_changes_count) first_gap = i;
-      continue;
-    }
-    if (
-      block_changes[i].x == x &&
-      block_changes[i].y == y &&
-      block_changes[i].z == z
-    ) {
-      #ifdef ALLOW_CHESTS
-      // When replacing chests, clear following 14 entries too (item data)
-      if (block_changes[i].block == B_chest) {
-        for (int j = 1; j < 15; j ++) block_changes[i + j].block = 0xFF;
-      }
-      #endif
-      if (is_base_block) block_changes[i].block = 0xFF;
-      else {
-        #ifdef ALLOW_CHESTS
-        // When placing chests, just unallocate the target block and fall
-        // through to the chest-specific routine below.
-        if (block == B_chest) {
-          block_changes[i].block = 0xFF;
-          if (first_gap > i) first_gap = i;
-          break;
-        }
-        #endif
-        block_changes[i].block = block;
-      }
-      return 0;
-    }
+// Block changes waiting to be broadcast, so that changes to the same
+// section can go out as one Update Section Blocks packet
+typedef struct {
+  short x;
+  uint8_t y;
+  short z;
+  uint8_t block;
+} PendingBlockUpdate;
+
+static PendingBlockUpdate pending_updates[BLOCK_UPDATE_BATCH_SIZE];
+static int pending_update_count = 0;
+
+// Queues an update for a block that has been changed with applyBlockChange
+void queueBlockUpdate (short x, uint8_t y, short z, uint8_t block) {
+  // A later change to the same block replaces the earlier one
+  for (int i = 0; i < pending_update_count; i ++) {
+    PendingBlockUpdate *update = &pending_updates[i];
+    if (update->x != x || update->y != y || update->z != z) continue;
+    update->block = block;
+    return;
   }
+  if (pending_update_count == BLOCK_UPDATE_BATCH_SIZE) flushBlockUpdates();
+  PendingBlockUpdate *update = &pending_updates[pending_update_count ++];
+  update->x = x;
+  update->y = y;
+  update->z = z;
+  update->block = block;
+}
 
-  // Don't create a new entry if it contains the base terrain block
-  if (is_base_block) return 0;
+// Broadcasts the queued block updates, one packet per section. Sections
+// with a single change get a plain Block Update, which is smaller.
+void flushBlockUpdates () {
 
-  #ifdef ALLOW_CHESTS
-  if (block == B_chest) {
-    // Chests require 15 entries total, so for maximum space-efficiency,
-    // we have to find a continuous gap that's at least 15 slots wide.
-    // By design, this loop also continues past the current search range,
-    // which naturally appends the chest to the end if a gap isn't found.
-    int last_real_entry = first_gap - 1;
-    for (int i = first_gap; i <= block_changes_count + 15; i ++) {
-      if (i >= MAX_BLOCK_CHANGES) break; // No more space, trigger failBlockChange
-
-      if (block_changes[i].block != 0xFF) {
-        last_real_entry = i;
+  if (pending_update_count == 0) return;
+  PROF_START(BLOCK_BROADCAST);
+
+  uint16_t positions[BLOCK_UPDATE_BATCH_SIZE];
+  uint8_t blocks[BLOCK_UPDATE_BATCH_SIZE];
+
+  while (pending_update_count > 0) {
+    // Take every update in the same section as the first one, and keep
+    // the rest for the next round
+    short cx = div_floor(pending_updates[0].x, 16);
+    short cz = div_floor(pending_updates[0].z, 16);
+    uint8_t cy = pending_updates[0].y / 16;
+    int count = 0, kept = 0;
+    for (int i = 0; i < pending_update_count; i ++) {
+      PendingBlockUpdate *update = &pending_updates[i];
+      if (
+        div_floor(update->x, 16) != cx ||
+        div_floor(update->z, 16) != cz ||
+        update->y / 16 != cy
+      ) {
+        pending_updates[kept ++] = *update;
         continue;
       }
-      if (i - last_real_entry != 15) continue;
-      // A wide enough gap has been found, assign the chest
-      block_changes[last_real_entry + 1].x = x;
-      block_changes[last_real_entry + 1].y = y;
-      block_changes[last_real_entry + 1].z = z;
-      block_changes[last_real_entry + 1].block = block;
-      // Zero out the following 14 entries for item data
-      for (int i = 2; i <= 15; i ++) {
-        block_changes[last_real_entry + i].x = 0;
-        block_changes[last_real_entry + i].y = 0;
-        block_changes[last_real_entry + i].z = 0;
-        block_changes[last_real_entry + i].block = 0;
-      }
-      // Extend future search range if necessary
-      if (i >= block_changes_count) {
-        block_changes_count = i + 1;
-      }
-      return 0;
+      positions[count] = ((update->x & 15) << 8) | ((update->z & 15) << 4) | (update->y & 15);
+      blocks[count] = update->block;
+      count ++;
     }
-    // If we're here, no changes were made
-    failBlockChange(x, y, z, block);
-    return 1;
+    pending_update_count = kept;
+
+    broadcast_start();
+    if (count == 1) {
+      sc_blockUpdate(BROADCAST_FD,
+        cx * 16 + (positions[0] >> 8),
+        cy * 16 + (positions[0] & 15),
+        cz * 16 + ((positions[0] >> 4) & 15),
+        blocks[0]
+      );
+    } else {
+      sc_updateSectionBlocks(BROADCAST_FD, cx, cy, cz, count, positions, blocks);
+    }
+    // Players out of view get the changes with the chunk when they return
+    broadcast_flush_players(getPlayersNear(cx * 16 + 8, cz * 16 + 8), -1);
   }
-  #endif
 
-  // Handle running out of memory for new block changes
-  if (first_gap == MAX_BLOCK_CHANGES) {
-    failBlockChange(x, y, z, block);
+  PROF_END(BLOCK_BROADCAST);
+
+}
+
+// Changes a block and queues the update for in-game clients
+// The update goes out with the next flushBlockUpdates, which the main
+// loop calls every pass, so that bursts of changes (trees, fluids) are
+// sent as one packet per section
+uint8_t makeBlockChange (short x, uint8_t y, short z, uint8_t block) {
+  if (applyBlockChange(x, y, z, block)) return 1;
+  queueBlockUpdate(x, y, z, block);
+  return 0;
+}
+
+// Stores a block change without telling clients about it
+// Returns 1 if the change couldn't be made
+uint8_t applyBlockChange (short x, uint8_t y, short z, uint8_t block) {
+
+  PROF_START(BLOCK_CHANGE);
+  uint8_t is_base_block = isBaseBlock(x, y, z, block);
+
+  #ifdef ALLOW_CHESTS
+  // Chests never generate naturally, so any chest is a block change
+  uint8_t was_chest = getBlockChange(x, y, z) == B_chest;
+  // New chests need an entry in chest_data for their contents
+  if (block == B_chest && !was_chest && claimChestData(x, y, z)) {
+    PROF_END(BLOCK_CHANGE);
+    failBlockChange(x, y, z, block);
     return 1;
   }
+  #endif
 
-  // Fall back to storing the change at the first possible gap
-  block_changes[first_gap].x = x;
-  block_changes[first_gap].y = y;
-  block_changes[first_gap].z = z;
-  block_changes[first_gap].block = block;
-  // Extend future search range if we've appended to the end
-  if (first_gap == block_changes_count) {
-    block_changes_count ++;
+  if (storeBlockChange(x, y, z, block, is_base_block)) {
+    #ifdef ALLOW_CHESTS
+    if (block == B_chest && !was_chest) releaseChestData(x, y, z);
+    #endif
+    PROF_END(BLOCK_CHANGE);
+    failBlockChange(x, y, z, block);
+    return 1;
   }
 
+  #ifdef ALLOW_CHESTS
+  if (was_chest && block != B_chest) releaseChestData(x, y, z);
+  #endif
+
+  // Queue the change to be saved to disk
+  journalBlockChange(x, y, z, block);
+
+  // Invalidate cache for this chunk
+  invalidateChunkCache(x, y, z);
+
+  PROF_END(BLOCK_CHANGE);
   return 0;
 }
 
-#endif /* USE_SORTED_BLOCK_CHANGES */
-
 // Returns the result of mining a block, taking into account the block type and tools
 // Probability numbers obtained with this formula: N = floor(P * (2 ^ 32))
 uint16_t getMiningResult (uint16_t held_item, uint8_t block) {
@@ -1255,7 +1775,21 @@ uint8_t handlePlayerEating (PlayerData *player, uint8_t just_check) {
   return true;
 }
 
-void handleFluidMovement (short x, uint8_t y, short z, uint8_t fluid, uint8_t block) {
+#ifdef DO_FLUID_FLOW
+// Fluid blocks waiting to be updated. Updates are handled breadth-first,
+// each one queueing the blocks it flows into, rather than recursing.
+typedef struct {
+  short x;
+  uint8_t y;
+  short z;
+} FluidUpdate;
+
+static FluidUpdate fluid_queue[FLUID_QUEUE_SIZE];
+static int fluid_queue_head = 0;
+static int fluid_queue_count = 0;
+
+// Runs one step of flow for the fluid block at the given coordinates
+static void handleFluidMovement (short x, uint8_t y, short z, uint8_t fluid, uint8_t block) {
 
   // Get fluid level (0-7)
   // The terminology here is a bit different from vanilla:
@@ -1295,7 +1829,8 @@ void handleFluidMovement (short x, uint8_t y, short z, uint8_t fluid, uint8_t bl
   uint8_t block_below = getBlockAt(x, y - 1, z);
   if (isReplaceableBlock(block_below)) {
     makeBlockChange(x, y - 1, z, fluid);
-    return handleFluidMovement(x, y - 1, z, fluid, fluid);
+    checkFluidUpdate(x, y - 1, z, fluid);
+    return;
   }
 
   // Stop flowing laterally at the maximum level
@@ -1305,34 +1840,68 @@ void handleFluidMovement (short x, uint8_t y, short z, uint8_t fluid, uint8_t bl
   // Handle lateral water flow, increasing level by 1
   if (isReplaceableFluid(adjacent[0], level, fluid)) {
     makeBlockChange(x + 1, y, z, block + 1);
-    handleFluidMovement(x + 1, y, z, fluid, block + 1);
+    checkFluidUpdate(x + 1, y, z, block + 1);
   }
   if (isReplaceableFluid(adjacent[1], level, fluid)) {
     makeBlockChange(x - 1, y, z, block + 1);
-    handleFluidMovement(x - 1, y, z, fluid, block + 1);
+    checkFluidUpdate(x - 1, y, z, block + 1);
   }
   if (isReplaceableFluid(adjacent[2], level, fluid)) {
     makeBlockChange(x, y, z + 1, block + 1);
-    handleFluidMovement(x, y, z + 1, fluid, block + 1);
+    checkFluidUpdate(x, y, z + 1, block + 1);
   }
   if (isReplaceableFluid(adjacent[3], level, fluid)) {
     makeBlockChange(x, y, z - 1, block + 1);
-    handleFluidMovement(x, y, z - 1, fluid, block + 1);
+    checkFluidUpdate(x, y, z - 1, block + 1);
   }
 
 }
 
+// Returns the fluid that the given block is a level of, or 0 if none
+static uint8_t getFluidType (uint8_t block) {
+  if (block >= B_water && block < B_water + 8) return B_water;
+  if (block >= B_lava && block < B_lava + 4) return B_lava;
+  return 0;
+}
+
+// Queues a block for a fluid update, if it's a fluid
 void checkFluidUpdate (short x, uint8_t y, short z, uint8_t block) {
 
-  uint8_t fluid;
-  if (block >= B_water && block < B_water + 8) fluid = B_water;
-  else if (block >= B_lava && block < B_lava + 4) fluid = B_lava;
-  else return;
+  if (getFluidType(block) == 0) return;
 
-  handleFluidMovement(x, y, z, fluid, block);
+  if (fluid_queue_count == FLUID_QUEUE_SIZE) {
+    // The flow will pick up from here the next time something nearby changes
+    printf("WARNING: Fluid update at (%d, %d, %d) dropped, FLUID_QUEUE_SIZE exceeded.\n", x, y, z);
+    return;
+  }
+  FluidUpdate *update = &fluid_queue[(fluid_queue_head + fluid_queue_count) % FLUID_QUEUE_SIZE];
+  update->x = x;
+  update->y = y;
+  update->z = z;
+  fluid_queue_count ++;
 
 }
 
+// Handles up to FLUID_TICK_BUDGET queued fluid updates, call once per tick
+// The resulting block changes are broadcast together
+void processFluidUpdates () {
+
+  for (int i = 0; i < FLUID_TICK_BUDGET && fluid_queue_count > 0; i ++) {
+    FluidUpdate update = fluid_queue[fluid_queue_head];
+    fluid_queue_head = (fluid_queue_head + 1) % FLUID_QUEUE_SIZE;
+    fluid_queue_count --;
+    // The block may have changed since it was queued
+    uint8_t block = getBlockAt(update.x, update.y, update.z);
+    uint8_t fluid = getFluidType(block);
+    if (fluid == 0) continue;
+    handleFluidMovement(update.x, update.y, update.z, fluid, block);
+  }
+
+  flushBlockUpdates();
+
+}
+#endif
+
 #ifdef ENABLE_PICKUP_ANIMATION
 // Plays the item pickup animation with the given item at the given coordinates
 void playPickupAnimation (PlayerData *player, uint16_t item, double x, double y, double z) {
@@ -1476,15 +2045,10 @@ void handlePlayerUseItem (PlayerData *player, short x, short y, short z, uint8_t
     }
     #ifdef ALLOW_CHESTS
     else if (target == B_chest) {
-      // Get a pointer to the entry following this chest in block_changes
-      uint8_t *storage_ptr = NULL;
-      for (int i = 0; i < block_changes_count; i ++) {
-        if (block_changes[i].block != B_chest) continue;
-        if (block_changes[i].x != x || block_changes[i].y != y || block_changes[i].z != z) continue;
-        storage_ptr = (uint8_t *)(&block_changes[i + 1]);
-        break;
-      }
-      if (storage_ptr == NULL) return;
+      // Get a pointer to the contents of this chest
+      ChestData *chest = getChestData(x, y, z);
+      if (chest == NULL) return;
+      uint8_t *storage_ptr = chest->items;
       // Terrible memory hack!!
       // Copy the pointer into the player's crafting table item array.
       // This allows us to save some memory by repurposing a feature that
@@ -1495,7 +2059,7 @@ void handlePlayerUseItem (PlayerData *player, short x, short y, short z, uint8_t
       player->flags |= 0x80;
       // Show the player the chest UI
       sc_openScreen(player->client_fd, 2, "Chest", 5);
-      // Load the slots of the chest from the block_changes array.
+      // Load the slots of the chest from its chest_data entry.
       // This is a similarly dubious memcpy hack, but at least we're not
       // mixing data types? Kind of?
       for (int i = 0; i < 27; i ++) {
@@ -1625,8 +2189,8 @@ void spawnMob (uint8_t type, short x, uint8_t y, short z, uint8_t health) {
     memcpy(uuid + 4, &i, 4);
 
     // Broadcast entity creation to all players
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == -1) continue;
+    for (int n = 0; n < online_player_count; n ++) {
+      int j = online_players[n];
       sc_spawnEntity(
         player_data[j].client_fd,
         -2 - i, // Use negative IDs to avoid conflicts with player IDs
@@ -1637,6 +2201,10 @@ void spawnMob (uint8_t type, short x, uint8_t y, short z, uint8_t health) {
       );
     }
 
+    // Everyone connected has been sent the spawn position, and players
+    // that join later are sent it on joining
+    mob_seen_by[i] = 0xFFFFFFFF;
+
     // Freshly spawned mobs currently don't need metadata updates.
     // If this changes, uncomment this line.
     // broadcastMobMetadata(-1, i);
@@ -1674,15 +2242,9 @@ void interactEntity (int entity_id, int interactor_id) {
       uint8_t item_count = 1 + (fast_rand() & 1); // 1-2
       givePlayerItem(player, I_white_wool, item_count);
 
-      for (int i = 0; i < MAX_PLAYERS; i ++) {
-        PlayerData* player = &player_data[i];
-        int client_fd = player->client_fd;
-
-        if (client_fd == -1) continue;
-        if (player->flags & 0x20) continue;
-
-        sc_entityAnimation(client_fd, interactor_id, 0);
-      }
+      broadcast_start();
+      sc_entityAnimation(BROADCAST_FD, interactor_id, 0);
+      broadcast_flush_players(getPlayersNear(player->x, player->z), -1);
 
       broadcastMobMetadata(-1, entity_id);
 
@@ -1717,6 +2279,8 @@ void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t da
 
   // Whether this attack caused the target entity to die
   uint8_t entity_died = false;
+  // Where the target entity is, for picking who to tell about it
+  short target_x, target_z;
 
   if (entity_id > 0) { // The attacked entity is a player
 
@@ -1725,6 +2289,8 @@ void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t da
 
     // Don't continue if the player is already dead
     if (player->health == 0) return;
+    target_x = player->x;
+    target_z = player->z;
 
     // Calculate damage reduction from player's armor
     uint8_t defense = getPlayerDefensePoints(player);
@@ -1833,6 +2399,8 @@ void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t da
 
     // Don't continue if the mob is already dead
     if (mob_health == 0) return;
+    target_x = mobBlockX(mob);
+    target_z = mobBlockZ(mob);
 
     // Set the mob's panic timer
     mob->data |= (3 << 6);
@@ -1862,16 +2430,16 @@ void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t da
 
   }
 
-  // Broadcast damage event to all players
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    int client_fd = player_data[i].client_fd;
-    if (client_fd == -1) continue;
-    sc_damageEvent(client_fd, entity_id, damage_type);
-    // Below this, handle death events
-    if (!entity_died) continue;
-    sc_entityEvent(client_fd, entity_id, 3);
-    if (entity_id >= 0) {
-      // If a player died, broadcast their death message
+  // Broadcast damage event, and death event, to players in view
+  broadcast_start();
+  sc_damageEvent(BROADCAST_FD, entity_id, damage_type);
+  if (entity_died) sc_entityEvent(BROADCAST_FD, entity_id, 3);
+  broadcast_flush_players(getPlayersNear(target_x, target_z), -1);
+
+  // If a player died, broadcast their death message to everyone
+  if (entity_died && entity_id >= 0) {
+    for (int n = 0; n < online_player_count; n ++) {
+      int client_fd = player_data[online_players[n]].client_fd;
       sc_systemChat(client_fd, (char *)recv_buffer, strlen((char *)recv_buffer));
     }
   }
@@ -1880,17 +2448,378 @@ void hurtEntity (int entity_id, int attacker_id, uint8_t damage_type, uint8_t da
 
 // Simulates events scheduled for regular intervals
 // Takes the time since the last tick in microseconds as the only arguemnt
+// Sends a mob's position to the given players, skipping any whose
+// connection is backed up. Returns the players that were sent it.
+static uint32_t broadcastMobPosition (int mob_index, uint32_t players, double x, double y, double z, uint8_t yaw) {
+  int entity_id = -2 - mob_index;
+  broadcast_start();
+  sc_teleportEntity(BROADCAST_FD, entity_id, x, y, z, yaw * 360.0f / 256.0f, 0);
+  if (yaw) sc_setHeadRotation(BROADCAST_FD, entity_id, yaw);
+  uint32_t sent = 0;
+  for (int j = 0; j < MAX_PLAYERS; j ++) {
+    if (!(players & ((uint32_t)1 << j))) continue;
+    // Mob positions are absolute, so a backed up client can skip some
+    if (isSendQueueCongested(player_data[j].client_fd)) continue;
+    broadcast_send(player_data[j].client_fd);
+    sent |= (uint32_t)1 << j;
+  }
+  packet_end();
+  return sent;
+}
+
+// Next mob slot to run behavior for in the current pass, MAX_MOBS once
+// the pass is complete. A pass starts with every server tick.
+static int mob_ai_cursor = MAX_MOBS;
+#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
+// Whether any mob has moved during the current pass
+static uint8_t any_mob_moved = 0;
+// When the current pass was started, movement is interpolated from here
+static int64_t mob_pass_started = 0;
+#endif
+
+// Runs the behavior of a single mob for this tick
+static void tickMob (int i) {
+
+  int entity_id = -2 - i;
+
+  // Handle deallocation on mob death
+  if ((mob_data[i].data & 31) == 0) {
+    if (mob_data[i].y < (unsigned int)TICKS_PER_SECOND) {
+      mob_data[i].y ++;
+      return;
+    }
+    mob_data[i].type = 0;
+#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
+    mob_interp_state[i].active = 0;
+#endif
+    broadcast_start();
+    // Spawn death smoke particles
+    sc_entityEvent(BROADCAST_FD, entity_id, 60);
+    // Remove the entity from the client
+    sc_removeEntity(BROADCAST_FD, entity_id);
+    // Loading clients are included, they know of the mob already
+    for (int n = 0; n < online_player_count; n ++) {
+      broadcast_send(player_data[online_players[n]].client_fd);
+    }
+    packet_end();
+    return;
+  }
+
+  // Catch up players that came into view since this mob last moved
+  short mob_x = mobBlockX(&mob_data[i]), mob_z = mobBlockZ(&mob_data[i]);
+  uint32_t stale = getPlayersNear(mob_x, mob_z) & ~mob_seen_by[i];
+  if (stale) {
+    int8_t last_dx = mobDeltaX(&mob_data[i]), last_dz = mobDeltaZ(&mob_data[i]);
+    uint8_t last_yaw = (last_dx != 0 || last_dz != 0) ? mobBaseYaw(last_dx, last_dz) : 0;
+    mob_seen_by[i] |= broadcastMobPosition(
+      i, stale,
+      (double)mob_x + 0.5, mob_data[i].y, (double)mob_z + 0.5, last_yaw
+    );
+  }
+
+  uint8_t passive = (
+    mob_data[i].type == 25 || // Chicken
+    mob_data[i].type == 28 || // Cow
+    mob_data[i].type == 95 || // Pig
+    mob_data[i].type == 106 // Sheep
+  );
+  // Mob "panic" timer, set to 3 after being hit
+  // Currently has no effect on hostile mobs
+  uint8_t panic = (mob_data[i].data >> 6) & 3;
+
+  // Burn hostile mobs if above ground during sunlight
+  if (!passive && (world_time < 13000 || world_time > 23460) && mob_data[i].y > 48) {
+    hurtEntity(entity_id, -1, D_on_fire, 2);
+  }
+
+  uint32_t r = fast_rand();
+
+  if (passive) {
+    if (panic) {
+      // If panicking, move randomly at up to 4 times per second
+      if (TICKS_PER_SECOND >= 4) {
+        uint32_t ticks_per_panic = (uint32_t)(TICKS_PER_SECOND / 4);
+        if (server_ticks % ticks_per_panic != 0) return;
+      }
+      // Reset panic state after timer runs out
+      // Each panic timer tick takes one second
+      if (server_ticks % (uint32_t)TICKS_PER_SECOND == 0) {
+        mob_data[i].data -= (1 << 6);
+      }
+    } else {
+      // When not panicking, move idly once per 4 seconds on average
+      if (r % (4 * (unsigned int)TICKS_PER_SECOND) != 0) return;
+    }
+  } else {
+    // Update hostile mobs once per second
+    if (server_ticks % (uint32_t)TICKS_PER_SECOND != 0) return;
+  }
+
+  // Find the player closest to this mob
+  PlayerData* closest_player = &player_data[0];
+  uint32_t closest_dist = 2147483647;
+  short old_x = mobBlockX(&mob_data[i]);
+  short old_z = mobBlockZ(&mob_data[i]);
+  uint8_t old_y = mob_data[i].y;
+  int8_t prev_dx = mobDeltaX(&mob_data[i]);
+  int8_t prev_dz = mobDeltaZ(&mob_data[i]);
+
+  for (int n = 0; n < online_player_count; n ++) {
+    int j = online_players[n];
+    uint16_t curr_dist = (
+      abs(old_x - player_data[j].x) +
+      abs(old_z - player_data[j].z)
+    );
+    if (curr_dist < closest_dist) {
+      closest_dist = curr_dist;
+      closest_player = &player_data[j];
+    }
+  }
+
+  // Despawn mobs past a certain distance from nearest player
+  if (closest_dist > MOB_DESPAWN_DISTANCE) {
+    mob_data[i].type = 0;
+#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
+    mob_interp_state[i].active = 0;
+#endif
+    return;
+  }
+  short new_x = old_x, new_z = old_z;
+  uint8_t new_y = old_y;
+  int fallback_attempts = 0;
+
+  if (passive) { // Passive mob movement handling
+
+    int8_t move_dx = 0, move_dz = 0;
+
+    if (panic && (prev_dx != 0 || prev_dz != 0)) {
+      move_dx = prev_dx;
+      move_dz = prev_dz;
+    } else {
+      if ((r >> 2) & 1) {
+        move_dx = ((r >> 1) & 1) ? 1 : -1;
+      } else {
+        move_dz = ((r >> 1) & 1) ? 1 : -1;
+      }
+    }
+
+    new_x += move_dx;
+    new_z += move_dz;
+
+  } else { // Hostile mob movement handling
+
+    // If we're already next to the player, hurt them and skip movement
+    if (closest_dist < 3 && abs(old_y - closest_player->y) < 2) {
+      hurtEntity(closest_player->client_fd, entity_id, D_generic, 6);
+      return;
+    }
+
+    // Move towards the closest player on 8 axis
+    // The condition nesting ensures a correct yaw at 45 degree turns
+    if (closest_player->x < old_x) {
+      new_x -= 1;
+      if (closest_player->z < old_z) new_z -= 1;
+      else if (closest_player->z > old_z) new_z += 1;
+    }
+    else if (closest_player->x > old_x) {
+      new_x += 1;
+      if (closest_player->z < old_z) new_z -= 1;
+      else if (closest_player->z > old_z) new_z += 1;
+    } else {
+      if (closest_player->z < old_z) new_z -= 1;
+      else if (closest_player->z > old_z) new_z += 1;
+    }
+
+  }
+
+attempt_move:
+  // Holds the block that the mob is moving into
+  uint8_t block = getBlockAt(new_x, new_y, new_z);
+  // Holds the block above the target block, i.e. the "head" block
+  uint8_t block_above = getBlockAt(new_x, new_y + 1, new_z);
+
+  // Validate movement on X axis
+  if (new_x != old_x && (
+    !isPassableBlock(getBlockAt(new_x, new_y + 1, old_z)) ||
+    (
+      !isPassableBlock(getBlockAt(new_x, new_y, old_z)) &&
+      !isPassableBlock(getBlockAt(new_x, new_y + 2, old_z))
+    )
+  )) {
+    new_x = old_x;
+    block = getBlockAt(old_x, new_y, new_z);
+    block_above = getBlockAt(old_x, new_y + 1, new_z);
+  }
+  // Validate movement on Z axis
+  if (new_z != old_z && (
+    !isPassableBlock(getBlockAt(old_x, new_y + 1, new_z)) ||
+    (
+      !isPassableBlock(getBlockAt(old_x, new_y, new_z)) &&
+      !isPassableBlock(getBlockAt(old_x, new_y + 2, new_z))
+    )
+  )) {
+    new_z = old_z;
+    block = getBlockAt(new_x, new_y, old_z);
+    block_above = getBlockAt(new_x, new_y + 1, old_z);
+  }
+  // Validate diagonal movement
+  if (new_x != old_x && new_z != old_z && (
+    !isPassableBlock(block_above) ||
+    (
+      !isPassableBlock(block) &&
+      !isPassableBlock(getBlockAt(new_x, new_y + 2, new_z))
+    )
+  )) {
+    // We know that movement along just one axis is fine thanks to the
+    // checks above, pick one based on proximity.
+    int dist_x = abs(old_x - closest_player->x);
+    int dist_z = abs(old_z - closest_player->z);
+    if (dist_x < dist_z) new_z = old_z;
+    else new_x = old_x;
+    block = getBlockAt(new_x, new_y, new_z);
+  }
+
+  // Check if we're supposed to climb/drop one block
+  // The checks above already ensure that there's enough space to climb
+  if (!isPassableBlock(block)) new_y += 1;
+  else if (isPassableBlock(getBlockAt(new_x, new_y - 1, new_z))) new_y -= 1;
+
+  // Exit early if all movement was cancelled
+  if (new_x == old_x && new_z == old_z && new_y == old_y) {
+    if (panic && fallback_attempts < 4) {
+      fallback_attempts ++;
+      uint32_t r_dir = fast_rand();
+      if (r_dir & 1) {
+        new_x = old_x + ((r_dir >> 1) & 1 ? 1 : -1);
+        new_z = old_z;
+      } else {
+        new_z = old_z + ((r_dir >> 2) & 1 ? 1 : -1);
+        new_x = old_x;
+      }
+      new_y = old_y;
+      goto attempt_move;
+    }
+    return;
+  }
+
+  // Prevent collisions with other mobs
+  uint8_t colliding = false;
+  for (int j = 0; j < MAX_MOBS; j ++) {
+    if (j == i) continue;
+    if (mob_data[j].type == 0) continue;
+    if (
+      mobBlockX(&mob_data[j]) == new_x &&
+      mobBlockZ(&mob_data[j]) == new_z &&
+      abs((int)mob_data[j].y - (int)new_y) < 2
+    ) {
+      colliding = true;
+      break;
+    }
+  }
+  if (colliding) return;
+
+  if ( // Hurt mobs that stumble into lava
+    (block >= B_lava && block < B_lava + 4) ||
+    (block_above >= B_lava && block_above < B_lava + 4)
+  ) hurtEntity(entity_id, -1, D_lava, 8);
+
+  int8_t delta_x = (int8_t)(new_x - old_x);
+  int8_t delta_z = (int8_t)(new_z - old_z);
+  int8_t delta_y = (int8_t)(new_y - old_y);
+
+  mobSetX(&mob_data[i], new_x, delta_x);
+  mob_data[i].y = new_y;
+  mobSetZ(&mob_data[i], new_z, delta_z);
+
+#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
+  if (delta_x != 0 || delta_z != 0 || delta_y != 0) {
+    mob_interp_state[i].start_x = old_x;
+    mob_interp_state[i].start_y = old_y;
+    mob_interp_state[i].start_z = old_z;
+    mob_interp_state[i].active = 1;
+    mob_interp_state[i].sent_midpoint = 0;
+    any_mob_moved = 1;
+  } else {
+    mob_interp_state[i].active = 0;
+  }
+#else
+  (void)delta_y;
+#endif
+
+  uint8_t yaw = 0;
+  if (delta_x != 0 || delta_z != 0) {
+    yaw = mobBaseYaw(delta_x, delta_z);
+  }
+
+#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
+#ifdef MAC68K_PLATFORM
+  /* On Mac 68k, check runtime toggle */
+  if (!console_get_mob_interpolation()) {
+#else
+  if (0) {
+#endif
+#endif
+    /* Send immediate teleport when interpolation disabled */
+    mob_seen_by[i] = broadcastMobPosition(
+      i, getPlayersNear(new_x, new_z),
+      (double)new_x + 0.5, new_y, (double)new_z + 0.5, yaw
+    );
+#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
+  } else {
+    /* Store yaw for interpolation to use */
+    mob_interp_state[i].active = 1;
+  }
+#endif
+
+}
+
+// Runs mob behavior for up to `limit` mobs of the current pass, stopping
+// early once `deadline` has passed. At least one mob is handled per call.
+static void continueMobPass (int limit, int64_t deadline) {
+
+  if (mob_ai_cursor >= MAX_MOBS) return;
+
+  PROF_START(MOB_AI);
+  while (mob_ai_cursor < MAX_MOBS && limit > 0) {
+    int i = mob_ai_cursor ++;
+    if (mob_data[i].type == 0) continue;
+    tickMob(i);
+    limit --;
+    if (get_program_time() > deadline) break;
+  }
+  PROF_END(MOB_AI);
+
+  if (mob_ai_cursor < MAX_MOBS) return;
+
+#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
+  if (any_mob_moved) {
+    mob_interp_tick_start = mob_pass_started;
+  } else {
+    mob_interp_tick_start = 0;
+  }
+#endif
+
+}
+
 void handleServerTick (int64_t time_since_last_tick) {
 
+  // Mobs left over from the previous pass get to act before the next one
+  continueMobPass(MAX_MOBS, INT64_MAX);
+
   // Update world time
   world_time = (world_time + time_since_last_tick / 50000) % 24000;
   // Increment server tick counter
   server_ticks ++;
 
-  // Update player events
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
+  #ifdef DO_FLUID_FLOW
+  // Let fluids flow a bit further
+  processFluidUpdates();
+  #endif
+
+  // Update player events, only online players need them
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
     PlayerData *player = &player_data[i];
-    if (player->client_fd == -1) continue; // Skip offline players
     if (player->flags & 0x20) { // Check "client loading" flag
       // If 3 seconds (60 vanilla ticks) have passed, assume player has loaded
       player->flagval_16 ++;
@@ -1913,73 +2842,8 @@ void handleServerTick (int64_t time_since_last_tick) {
         player->flagval_16 = 0;
       } else player->flagval_16 ++;
     }
-    // Broadcast deferred position updates (0x40 = position dirty flag)
-    // This batches all movement packets received since last tick into one update
-    if (player->flags & 0x40) {
-      PROF_START(PLAYER_BROADCAST);
-      player->flags &= ~0x40;
-      // Convert stored rotation back to degrees for teleport, or keep as byte for relative
-      float yaw_deg = player->yaw * 180.0f / 127.0f;
-      float pitch_deg = player->pitch * 90.0f / 127.0f;
-      // Yaw in 256ths of a full rotation for relative packets
-      uint8_t yaw_byte = (uint8_t)((player->yaw + 127) * 256 / 254);
-      uint8_t pitch_byte = (uint8_t)((player->pitch + 127) * 128 / 254);
-
-      // Compute current position in fixed-point (1 block = 4096 units)
-      // Add 0.5 to center in block, matching what sc_spawnEntityPlayer does
-      int32_t cur_x = (int32_t)((player->x + 0.5) * 4096);
-      int32_t cur_y = (int32_t)(player->y * 4096);
-      int32_t cur_z = (int32_t)((player->z + 0.5) * 4096);
-
-      // Compute deltas from last broadcast position
-      int32_t delta_x = cur_x - player->last_bx;
-      int32_t delta_y = cur_y - player->last_by;
-      int32_t delta_z = cur_z - player->last_bz;
-
-      // Use teleport if deltas too large (>8 blocks = ±32768 in fixed-point)
-      // or every 10 seconds for drift correction
-      uint8_t use_teleport = (
-        delta_x < -32768 || delta_x > 32767 ||
-        delta_y < -32768 || delta_y > 32767 ||
-        delta_z < -32768 || delta_z > 32767 ||
-        (server_ticks % (uint32_t)(10 * TICKS_PER_SECOND) == 0)
-      );
-
-      // Send position to all other connected players
-      for (int j = 0; j < MAX_PLAYERS; j ++) {
-        if (player_data[j].client_fd == -1) continue;
-        if (player_data[j].flags & 0x20) continue;
-        if (player_data[j].client_fd == player->client_fd) continue;
-        // Batch movement + head rotation into single network send
-        packet_start(player_data[j].client_fd);
-        if (use_teleport) {
-          // Full teleport for drift correction or large movements
-          sc_teleportEntity(player_data[j].client_fd, player->client_fd,
-                            player->x + 0.5, player->y, player->z + 0.5, yaw_deg, pitch_deg);
-        } else {
-          // Relative move with rotation - triggers client-side interpolation
-          sc_updateEntityPositionAndRotation(player_data[j].client_fd, player->client_fd,
-                                             (int16_t)delta_x, (int16_t)delta_y, (int16_t)delta_z,
-                                             yaw_byte, pitch_byte, 1);
-        }
-        sc_setHeadRotation(player_data[j].client_fd, player->client_fd, yaw_byte);
-        packet_flush();
-      }
-
-      // Update last broadcast position
-      player->last_bx = cur_x;
-      player->last_by = cur_y;
-      player->last_bz = cur_z;
-
-      PROF_END(PLAYER_BROADCAST);
-    }
     // Below this, process events that happen once per second
     if (server_ticks % (uint32_t)TICKS_PER_SECOND != 0) continue;
-    // Send Keep Alive and Update Time packets (batched together)
-    packet_start(player->client_fd);
-    sc_keepAlive(player->client_fd);
-    sc_updateTime(player->client_fd, world_time);
-    packet_flush();
     // Tick damage from lava
     uint8_t block = getBlockAt(player->x, player->y, player->z);
     if (block >= B_lava && block < B_lava + 4) {
@@ -2018,311 +2882,185 @@ void handleServerTick (int64_t time_since_last_tick) {
 
 #ifdef ENABLE_OPTIN_MOB_INTERPOLATION
   processMobInterpolation(get_program_time());
+  mob_pass_started = get_program_time();
+  any_mob_moved = 0;
 #endif
 
-#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
-  uint8_t any_mob_moved = 0;
-#endif
-
-  // Tick mob behavior
-  for (int i = 0; i < MAX_MOBS; i ++) {
-    if (mob_data[i].type == 0) continue;
-    int entity_id = -2 - i;
-
-    // Handle deallocation on mob death
-    if ((mob_data[i].data & 31) == 0) {
-      if (mob_data[i].y < (unsigned int)TICKS_PER_SECOND) {
-        mob_data[i].y ++;
-        continue;
-      }
-      mob_data[i].type = 0;
-#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
-      mob_interp_state[i].active = 0;
-#endif
-      for (int j = 0; j < MAX_PLAYERS; j ++) {
-        if (player_data[j].client_fd == -1) continue;
-        // Spawn death smoke particles
-        sc_entityEvent(player_data[j].client_fd, entity_id, 60);
-        // Remove the entity from the client
-        sc_removeEntity(player_data[j].client_fd, entity_id);
-      }
-      continue;
-    }
-
-    uint8_t passive = (
-      mob_data[i].type == 25 || // Chicken
-      mob_data[i].type == 28 || // Cow
-      mob_data[i].type == 95 || // Pig
-      mob_data[i].type == 106 // Sheep
-    );
-    // Mob "panic" timer, set to 3 after being hit
-    // Currently has no effect on hostile mobs
-    uint8_t panic = (mob_data[i].data >> 6) & 3;
+  // Start a new pass of mob behavior, which runServerTasks spreads out
+  // over the following iterations of the main loop
+  mob_ai_cursor = 0;
 
-    // Burn hostile mobs if above ground during sunlight
-    if (!passive && (world_time < 13000 || world_time > 23460) && mob_data[i].y > 48) {
-      hurtEntity(entity_id, -1, D_on_fire, 2);
-    }
-
-    uint32_t r = fast_rand();
-
-    if (passive) {
-      if (panic) {
-        // If panicking, move randomly at up to 4 times per second
-        if (TICKS_PER_SECOND >= 4) {
-          uint32_t ticks_per_panic = (uint32_t)(TICKS_PER_SECOND / 4);
-          if (server_ticks % ticks_per_panic != 0) continue;
-        }
-        // Reset panic state after timer runs out
-        // Each panic timer tick takes one second
-        if (server_ticks % (uint32_t)TICKS_PER_SECOND == 0) {
-          mob_data[i].data -= (1 << 6);
-        }
-      } else {
-        // When not panicking, move idly once per 4 seconds on average
-        if (r % (4 * (unsigned int)TICKS_PER_SECOND) != 0) continue;
-      }
-    } else {
-      // Update hostile mobs once per second
-      if (server_ticks % (uint32_t)TICKS_PER_SECOND != 0) continue;
-    }
+}
 
-    // Find the player closest to this mob
-    PlayerData* closest_player = &player_data[0];
-    uint32_t closest_dist = 2147483647;
-    short old_x = mobBlockX(&mob_data[i]);
-    short old_z = mobBlockZ(&mob_data[i]);
-    uint8_t old_y = mob_data[i].y;
-    int8_t prev_dx = mobDeltaX(&mob_data[i]);
-    int8_t prev_dz = mobDeltaZ(&mob_data[i]);
-
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == -1) continue;
-      uint16_t curr_dist = (
-        abs(old_x - player_data[j].x) +
-        abs(old_z - player_data[j].z)
-      );
-      if (curr_dist < closest_dist) {
-        closest_dist = curr_dist;
-        closest_player = &player_data[j];
-      }
-    }
+// Sends Keep Alive and Update Time packets to all players in game
+static void sendKeepAlives (int64_t elapsed) {
+  (void)elapsed;
+  for (int n = 0; n < online_player_count; n ++) {
+    PlayerData *player = &player_data[online_players[n]];
+    if (player->flags & 0x20) continue;
+    // Batched together, as they always go out at the same time
+    packet_start(player->client_fd);
+    sc_keepAlive(player->client_fd);
+    sc_updateTime(player->client_fd, world_time);
+    packet_flush();
+  }
+}
 
-    // Despawn mobs past a certain distance from nearest player
-    if (closest_dist > MOB_DESPAWN_DISTANCE) {
-      mob_data[i].type = 0;
-#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
-      mob_interp_state[i].active = 0;
-#endif
-      continue;
-    }
-    short new_x = old_x, new_z = old_z;
-    uint8_t new_y = old_y;
-    int fallback_attempts = 0;
+// How many times player movement has been broadcast
+static uint32_t player_broadcast_passes = 0;
 
-    if (passive) { // Passive mob movement handling
+// Sends the movement of players since the last pass to those who can see them
+static void broadcastPlayerMovement (int64_t elapsed) {
+  (void)elapsed;
 
-      int8_t move_dx = 0, move_dz = 0;
+  // Passes between full teleports, which correct drift in relative moves
+  uint32_t drift_passes = (uint32_t)(10000000 / PLAYER_BROADCAST_INTERVAL);
+  if (drift_passes == 0) drift_passes = 1;
+  player_broadcast_passes ++;
 
-      if (panic && (prev_dx != 0 || prev_dz != 0)) {
-        move_dx = prev_dx;
-        move_dz = prev_dz;
-      } else {
-        if ((r >> 2) & 1) {
-          move_dx = ((r >> 1) & 1) ? 1 : -1;
-        } else {
-          move_dz = ((r >> 1) & 1) ? 1 : -1;
-        }
-      }
+  for (int n = 0; n < online_player_count; n ++) {
+    PlayerData *player = &player_data[online_players[n]];
+    if (player->flags & 0x20) continue;
+    // Broadcast deferred position updates (0x40 = position dirty flag)
+    // This batches all movement packets received since the last pass into one update
+    if (player->flags & 0x40) {
+      PROF_START(PLAYER_BROADCAST);
+      player->flags &= ~0x40;
+      // Convert stored rotation back to degrees for teleport, or keep as byte for relative
+      float yaw_deg = player->yaw * 180.0f / 127.0f;
+      float pitch_deg = player->pitch * 90.0f / 127.0f;
+      // Yaw in 256ths of a full rotation for relative packets
+      uint8_t yaw_byte = (uint8_t)((player->yaw + 127) * 256 / 254);
+      uint8_t pitch_byte = (uint8_t)((player->pitch + 127) * 128 / 254);
 
-      new_x += move_dx;
-      new_z += move_dz;
+      // Compute current position in fixed-point (1 block = 4096 units)
+      // Add 0.5 to center in block, matching what sc_spawnEntityPlayer does
+      int32_t cur_x = (int32_t)((player->x + 0.5) * 4096);
+      int32_t cur_y = (int32_t)(player->y * 4096);
+      int32_t cur_z = (int32_t)((player->z + 0.5) * 4096);
 
-    } else { // Hostile mob movement handling
+      // Compute deltas from last broadcast position
+      int32_t delta_x = cur_x - player->last_bx;
+      int32_t delta_y = cur_y - player->last_by;
+      int32_t delta_z = cur_z - player->last_bz;
 
-      // If we're already next to the player, hurt them and skip movement
-      if (closest_dist < 3 && abs(old_y - closest_player->y) < 2) {
-        hurtEntity(closest_player->client_fd, entity_id, D_generic, 6);
-        continue;
-      }
+      // Use teleport if deltas too large (>8 blocks = ±32768 in fixed-point)
+      // or about every 10 seconds for drift correction
+      uint8_t use_teleport = (
+        delta_x < -32768 || delta_x > 32767 ||
+        delta_y < -32768 || delta_y > 32767 ||
+        delta_z < -32768 || delta_z > 32767 ||
+        (player_broadcast_passes % drift_passes == 0)
+      );
 
-      // Move towards the closest player on 8 axis
-      // The condition nesting ensures a correct yaw at 45 degree turns
-      if (closest_player->x < old_x) {
-        new_x -= 1;
-        if (closest_player->z < old_z) new_z -= 1;
-        else if (closest_player->z > old_z) new_z += 1;
-      }
-      else if (closest_player->x > old_x) {
-        new_x += 1;
-        if (closest_player->z < old_z) new_z -= 1;
-        else if (closest_player->z > old_z) new_z += 1;
+      // Send position to the players that can see this one, encoding
+      // movement and head rotation once for all of them
+      uint32_t viewers = getPlayerViewers(player, player->x, player->z, &use_teleport);
+      broadcast_start();
+      if (use_teleport) {
+        // Full teleport for drift correction or large movements
+        sc_teleportEntity(BROADCAST_FD, player->client_fd,
+                          player->x + 0.5, player->y, player->z + 0.5, yaw_deg, pitch_deg);
       } else {
-        if (closest_player->z < old_z) new_z -= 1;
-        else if (closest_player->z > old_z) new_z += 1;
+        // Relative move with rotation - triggers client-side interpolation
+        sc_updateEntityPositionAndRotation(BROADCAST_FD, player->client_fd,
+                                           (int16_t)delta_x, (int16_t)delta_y, (int16_t)delta_z,
+                                           yaw_byte, pitch_byte, 1);
       }
+      sc_setHeadRotation(BROADCAST_FD, player->client_fd, yaw_byte);
+      broadcast_flush_players(viewers, player->client_fd);
 
-    }
+      // Update last broadcast position
+      player->last_bx = cur_x;
+      player->last_by = cur_y;
+      player->last_bz = cur_z;
 
-attempt_move:
-    // Holds the block that the mob is moving into
-    uint8_t block = getBlockAt(new_x, new_y, new_z);
-    // Holds the block above the target block, i.e. the "head" block
-    uint8_t block_above = getBlockAt(new_x, new_y + 1, new_z);
-
-    // Validate movement on X axis
-    if (new_x != old_x && (
-      !isPassableBlock(getBlockAt(new_x, new_y + 1, old_z)) ||
-      (
-        !isPassableBlock(getBlockAt(new_x, new_y, old_z)) &&
-        !isPassableBlock(getBlockAt(new_x, new_y + 2, old_z))
-      )
-    )) {
-      new_x = old_x;
-      block = getBlockAt(old_x, new_y, new_z);
-      block_above = getBlockAt(old_x, new_y + 1, new_z);
-    }
-    // Validate movement on Z axis
-    if (new_z != old_z && (
-      !isPassableBlock(getBlockAt(old_x, new_y + 1, new_z)) ||
-      (
-        !isPassableBlock(getBlockAt(old_x, new_y, new_z)) &&
-        !isPassableBlock(getBlockAt(old_x, new_y + 2, new_z))
-      )
-    )) {
-      new_z = old_z;
-      block = getBlockAt(new_x, new_y, old_z);
-      block_above = getBlockAt(new_x, new_y + 1, old_z);
-    }
-    // Validate diagonal movement
-    if (new_x != old_x && new_z != old_z && (
-      !isPassableBlock(block_above) ||
-      (
-        !isPassableBlock(block) &&
-        !isPassableBlock(getBlockAt(new_x, new_y + 2, new_z))
-      )
-    )) {
-      // We know that movement along just one axis is fine thanks to the
-      // checks above, pick one based on proximity.
-      int dist_x = abs(old_x - closest_player->x);
-      int dist_z = abs(old_z - closest_player->z);
-      if (dist_x < dist_z) new_z = old_z;
-      else new_x = old_x;
-      block = getBlockAt(new_x, new_y, new_z);
+      PROF_END(PLAYER_BROADCAST);
     }
+  }
 
-    // Check if we're supposed to climb/drop one block
-    // The checks above already ensure that there's enough space to climb
-    if (!isPassableBlock(block)) new_y += 1;
-    else if (isPassableBlock(getBlockAt(new_x, new_y - 1, new_z))) new_y -= 1;
-
-    // Exit early if all movement was cancelled
-    if (new_x == old_x && new_z == old_z && new_y == old_y) {
-      if (panic && fallback_attempts < 4) {
-        fallback_attempts ++;
-        uint32_t r_dir = fast_rand();
-        if (r_dir & 1) {
-          new_x = old_x + ((r_dir >> 1) & 1 ? 1 : -1);
-          new_z = old_z;
-        } else {
-          new_z = old_z + ((r_dir >> 2) & 1 ? 1 : -1);
-          new_x = old_x;
-        }
-        new_y = old_y;
-        goto attempt_move;
-      }
-      continue;
-    }
+}
 
-    // Prevent collisions with other mobs
-    uint8_t colliding = false;
-    for (int j = 0; j < MAX_MOBS; j ++) {
-      if (j == i) continue;
-      if (mob_data[j].type == 0) continue;
-      if (
-        mobBlockX(&mob_data[j]) == new_x &&
-        mobBlockZ(&mob_data[j]) == new_z &&
-        abs((int)mob_data[j].y - (int)new_y) < 2
-      ) {
-        colliding = true;
-        break;
-      }
-    }
-    if (colliding) continue;
+// Runs a server tick, timing it for the profiler
+static void runServerTick (int64_t elapsed) {
+  PROF_START(TICK_TOTAL);
+  handleServerTick(elapsed);
+  PROF_END(TICK_TOTAL);
+  prof_tick_completed(elapsed);
+}
 
-    if ( // Hurt mobs that stumble into lava
-      (block >= B_lava && block < B_lava + 4) ||
-      (block_above >= B_lava && block_above < B_lava + 4)
-    ) hurtEntity(entity_id, -1, D_lava, 8);
+typedef struct {
+  void (*run) (int64_t elapsed);
+  // Time in microseconds between runs
+  int64_t period;
+  int64_t last_run;
+} ServerTask;
+
+// Periodic work done by the server, each task is passed the time since
+// it last ran. Mob behavior isn't listed here, as it runs in slices.
+static ServerTask server_tasks[] = {
+  { runServerTick, TIME_BETWEEN_TICKS, 0 },
+  { sendKeepAlives, KEEP_ALIVE_INTERVAL, 0 },
+  { broadcastPlayerMovement, PLAYER_BROADCAST_INTERVAL, 0 }
+};
+#define SERVER_TASK_COUNT (int)(sizeof(server_tasks) / sizeof(server_tasks[0]))
+
+void initServerTasks (int64_t now) {
+  // Spread the tasks out over their periods, so that they don't all
+  // come due on the same iteration of the main loop
+  for (int i = 0; i < SERVER_TASK_COUNT; i ++) {
+    server_tasks[i].last_run = now - server_tasks[i].period * i / SERVER_TASK_COUNT;
+  }
+}
 
-    int8_t delta_x = (int8_t)(new_x - old_x);
-    int8_t delta_z = (int8_t)(new_z - old_z);
-    int8_t delta_y = (int8_t)(new_y - old_y);
+// Runs the periodic tasks that are due, then continues the current pass
+// of mob behavior with what's left of SERVER_TASK_BUDGET. Returns the
+// time in microseconds until there's more work to do.
+int64_t runServerTasks (int64_t now) {
 
-    mobSetX(&mob_data[i], new_x, delta_x);
-    mob_data[i].y = new_y;
-    mobSetZ(&mob_data[i], new_z, delta_z);
+  // Ticks only run while clients are connected
+  if (client_count == 0) return TIME_BETWEEN_TICKS / 2;
 
-#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
-    if (delta_x != 0 || delta_z != 0 || delta_y != 0) {
-      mob_interp_state[i].start_x = old_x;
-      mob_interp_state[i].start_y = old_y;
-      mob_interp_state[i].start_z = old_z;
-      mob_interp_state[i].active = 1;
-      mob_interp_state[i].sent_midpoint = 0;
-      any_mob_moved = 1;
-    } else {
-      mob_interp_state[i].active = 0;
-    }
-#else
-    (void)delta_y;
-#endif
+  int64_t deadline = now + SERVER_TASK_BUDGET;
+  int64_t until_due = INT64_MAX;
+  uint8_t ran_task = false;
 
-    uint8_t yaw = 0;
-    if (delta_x != 0 || delta_z != 0) {
-      yaw = mobBaseYaw(delta_x, delta_z);
+  for (int i = 0; i < SERVER_TASK_COUNT; i ++) {
+    ServerTask *task = &server_tasks[i];
+    int64_t since_run = now - task->last_run;
+    if (since_run < task->period) {
+      if (task->period - since_run < until_due) until_due = task->period - since_run;
+      continue;
     }
-
-#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
-#ifdef MAC68K_PLATFORM
-    /* On Mac 68k, check runtime toggle */
-    if (!console_get_mob_interpolation()) {
-#else
-    if (0) {
-#endif
-#endif
-      /* Send immediate teleport when interpolation disabled */
-      for (int j = 0; j < MAX_PLAYERS; j ++) {
-        if (player_data[j].client_fd == -1) continue;
-        sc_teleportEntity(
-          player_data[j].client_fd,
-          entity_id,
-          (double)new_x + 0.5,
-          new_y,
-          (double)new_z + 0.5,
-          yaw * 360.0f / 256.0f,
-          0
-        );
-        if (yaw) sc_setHeadRotation(player_data[j].client_fd, entity_id, yaw);
-      }
-#ifdef ENABLE_OPTIN_MOB_INTERPOLATION
-    } else {
-      /* Store yaw for interpolation to use */
-      mob_interp_state[i].active = 1;
+    // Past the budget, leave due tasks for the next iteration
+    if (ran_task && get_program_time() > deadline) {
+      until_due = 0;
+      continue;
     }
-#endif
-
+    task->run(since_run);
+    task->last_run = now;
+    ran_task = true;
+    if (task->period < until_due) until_due = task->period;
   }
 
+  continueMobPass(MOB_AI_SLICE, deadline);
+  if (mob_ai_cursor < MAX_MOBS) return 0;
+
 #ifdef ENABLE_OPTIN_MOB_INTERPOLATION
-  if (any_mob_moved) {
-    mob_interp_tick_start = get_program_time();
-  } else {
-    mob_interp_tick_start = 0;
+  // Wake up for the midpoint and end of interpolated mob movement
+  if (mob_interp_tick_start != 0) {
+    int64_t since_start = now - mob_interp_tick_start;
+    int64_t until_step = TIME_BETWEEN_TICKS - since_start;
+    if (since_start < TIME_BETWEEN_TICKS / 2) until_step = TIME_BETWEEN_TICKS / 2 - since_start;
+    if (until_step < 0) until_step = 0;
+    if (until_step < until_due) until_due = until_step;
   }
 #endif
 
+  return until_due;
+
 }
+
 #ifdef ENABLE_OPTIN_MOB_INTERPOLATION
 
 void processMobInterpolation (int64_t now) {
@@ -2353,20 +3091,10 @@ void processMobInterpolation (int64_t now) {
       int dz = end_z - state->start_z;
       uint8_t yaw = (dx != 0 || dz != 0) ? mobBaseYaw(dx, dz) : 0;
 
-      for (int j = 0; j < MAX_PLAYERS; j ++) {
-        if (player_data[j].client_fd == -1) continue;
-        if (player_data[j].flags & 0x20) continue;
-        sc_teleportEntity(
-          player_data[j].client_fd,
-          -2 - i,
-          (double)end_x + 0.5,
-          end_y,
-          (double)end_z + 0.5,
-          yaw * 360.0f / 256.0f,
-          0
-        );
-        if (yaw) sc_setHeadRotation(player_data[j].client_fd, -2 - i, yaw);
-      }
+      mob_seen_by[i] = broadcastMobPosition(
+        i, getPlayersNear(end_x, end_z),
+        (double)end_x + 0.5, end_y, (double)end_z + 0.5, yaw
+      );
 
       state->active = 0;
     }
@@ -2394,20 +3122,10 @@ void processMobInterpolation (int64_t now) {
     int dz = end_z - state->start_z;
     uint8_t yaw = (dx != 0 || dz != 0) ? mobBaseYaw(dx, dz) : 0;
 
-    for (int j = 0; j < MAX_PLAYERS; j ++) {
-      if (player_data[j].client_fd == -1) continue;
-      if (player_data[j].flags & 0x20) continue;
-      sc_teleportEntity(
-        player_data[j].client_fd,
-        -2 - i,
-        interp_x,
-        interp_y,
-        interp_z,
-        yaw * 360.0f / 256.0f,
-        0
-      );
-      if (yaw) sc_setHeadRotation(player_data[j].client_fd, -2 - i, yaw);
-    }
+    mob_seen_by[i] = broadcastMobPosition(
+      i, getPlayersNear((short)interp_x, (short)interp_z),
+      interp_x, interp_y, interp_z, yaw
+    );
 
     state->sent_midpoint = 1;
   }
@@ -2421,14 +3139,16 @@ void processMobInterpolation (int64_t now) {
 // except for the client who initiated the update.
 void broadcastChestUpdate (int origin_fd, uint8_t *storage_ptr, uint16_t item, uint8_t count, uint8_t slot) {
 
-  for (int i = 0; i < MAX_PLAYERS; i ++) {
-    if (player_data[i].client_fd == -1) continue;
+  broadcast_start();
+  sc_setContainerSlot(BROADCAST_FD, 2, slot, count, item);
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
     if (player_data[i].flags & 0x20) continue;
     // Filter for players that have this chest open
     if (memcmp(player_data[i].craft_items, &storage_ptr, sizeof(storage_ptr)) != 0) continue;
-    // Send slot update packet
-    sc_setContainerSlot(player_data[i].client_fd, 2, slot, count, item);
+    broadcast_send(player_data[i].client_fd);
   }
+  packet_end();
 
   #ifndef DISK_SYNC_BLOCKS_ON_INTERVAL
   writeChestChangesToDisk(storage_ptr, slot);
@@ -0,0 +1,317 @@
+#include "globals.h"
+
+#ifdef ENABLE_PROFILER
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifdef MAC68K_PLATFORM
+  #include "mac68k_console.h"
+  #define PROF_REPORT_PATH "profile.txt"
+  #define PROF_NEWLINE "\r"
+#elif defined(ESP_PLATFORM)
+  #define PROF_REPORT_PATH "/littlefs/profile.txt"
+  #define PROF_NEWLINE "\n"
+#else
+  #define PROF_REPORT_PATH "profile.txt"
+  #define PROF_NEWLINE "\n"
+#endif
+
+#include "tools.h"
+#include "worldgen.h"
+#include "profiler.h"
+
+// Upper bounds (in microseconds) of the tick histogram buckets
+// The last bucket collects everything above the final bound
+#define PROF_HISTOGRAM_BUCKETS 7
+static const int32_t histogram_bounds[PROF_HISTOGRAM_BUCKETS - 1] = {
+  5000, 10000, 25000, 50000, 100000, 250000
+};
+
+// How many clients to keep byte counts for at once
+#define PROF_CLIENT_SLOTS (MAX_PLAYERS)
+
+typedef struct {
+  uint32_t calls;
+  uint32_t blocked;
+  int64_t total;
+  int64_t min;
+  int64_t max;
+  int64_t last;
+  int64_t started_at;
+  // Nesting depth, only the outermost start/end pair is timed
+  uint8_t depth;
+} ProfSection;
+
+typedef struct {
+  int fd;
+  int64_t sent;
+  int64_t received;
+} ProfClient;
+
+static const char *section_names[PROF_SECTION_COUNT] = {
+  "CHUNK_GEN",
+  "CHUNK_SEND",
+  "BLOCK_CHANGE",
+  "BLOCK_BROADCAST",
+  "PLAYER_BROADCAST",
+  "INVENTORY_UPDATE",
+  "NET_SEND",
+  "PACKET_ACTION",
+  "MOB_AI",
+  "TICK_TOTAL"
+};
+
+uint8_t prof_enabled = false;
+
+static ProfSection sections[PROF_SECTION_COUNT];
+static ProfClient clients[PROF_CLIENT_SLOTS];
+// Byte counts of clients that have since disconnected
+static int64_t closed_sent, closed_received;
+
+// How late each tick started, past TIME_BETWEEN_TICKS
+static uint32_t tick_lateness[PROF_HISTOGRAM_BUCKETS];
+// How long the tick handler took to run
+static uint32_t tick_duration[PROF_HISTOGRAM_BUCKETS];
+static uint32_t tick_count, tick_overruns;
+
+// When collection was last started or reset
+static int64_t prof_since;
+#ifndef MAC68K_PLATFORM
+static int64_t last_report_time;
+#endif
+
+// Report destination, NULL to only print
+static FILE *report_file;
+
+void prof_section_start (int section) {
+  ProfSection *s = &sections[section];
+  if (s->depth++ == 0) s->started_at = get_program_time();
+}
+
+void prof_section_end (int section) {
+  ProfSection *s = &sections[section];
+  // Ignore ends whose start happened before profiling was enabled
+  if (s->depth == 0) return;
+  if (--s->depth != 0) return;
+
+  int64_t elapsed = get_program_time() - s->started_at;
+  if (s->calls == 0 || elapsed < s->min) s->min = elapsed;
+  if (elapsed > s->max) s->max = elapsed;
+  s->last = elapsed;
+  s->total += elapsed;
+  s->calls ++;
+}
+
+void prof_section_blocked (int section) {
+  sections[section].blocked ++;
+}
+
+// Finds the byte counters for the given client, claiming a slot if needed
+static ProfClient *getProfClient (int client_fd) {
+  ProfClient *free_slot = NULL;
+  for (int i = 0; i < PROF_CLIENT_SLOTS; i ++) {
+    if (clients[i].fd == client_fd) return &clients[i];
+    if (clients[i].fd == -1 && free_slot == NULL) free_slot = &clients[i];
+  }
+  if (free_slot == NULL) return NULL;
+  free_slot->fd = client_fd;
+  free_slot->sent = 0;
+  free_slot->received = 0;
+  return free_slot;
+}
+
+void prof_bytes_sent (int client_fd, int64_t count) {
+  ProfClient *client = getProfClient(client_fd);
+  if (client == NULL) closed_sent += count;
+  else client->sent += count;
+}
+
+void prof_bytes_received (int client_fd, int64_t count) {
+  ProfClient *client = getProfClient(client_fd);
+  if (client == NULL) closed_received += count;
+  else client->received += count;
+}
+
+// Called regardless of prof_enabled, so that stale fds don't linger
+void prof_client_closed (int client_fd) {
+  for (int i = 0; i < PROF_CLIENT_SLOTS; i ++) {
+    if (clients[i].fd != client_fd) continue;
+    closed_sent += clients[i].sent;
+    closed_received += clients[i].received;
+    clients[i].fd = -1;
+    return;
+  }
+}
+
+static int getHistogramBucket (int64_t value) {
+  for (int i = 0; i < PROF_HISTOGRAM_BUCKETS - 1; i ++) {
+    if (value < histogram_bounds[i]) return i;
+  }
+  return PROF_HISTOGRAM_BUCKETS - 1;
+}
+
+void prof_tick_completed (int64_t time_since_last_tick) {
+  if (!prof_enabled) return;
+
+  int64_t lateness = time_since_last_tick - TIME_BETWEEN_TICKS;
+  if (lateness < 0) lateness = 0;
+  tick_lateness[getHistogramBucket(lateness)] ++;
+
+  // PROF_END(TICK_TOTAL) has just run, so its last timing is this tick.
+  // Skip the tick during which profiling was switched on, it wasn't timed.
+  if (sections[PROF_SEC_TICK_TOTAL].calls == 0) return;
+  int64_t duration = sections[PROF_SEC_TICK_TOTAL].last;
+  tick_duration[getHistogramBucket(duration)] ++;
+  if (duration > TIME_BETWEEN_TICKS) tick_overruns ++;
+  tick_count ++;
+
+  #if defined(PROF_REPORT_INTERVAL) && !defined(MAC68K_PLATFORM)
+  // Without a Debug menu, write the report out periodically instead
+  int64_t now = get_program_time();
+  if (now - last_report_time > PROF_REPORT_INTERVAL) {
+    last_report_time = now;
+    prof_save_report();
+  }
+  #endif
+}
+
+void prof_reset () {
+  memset(sections, 0, sizeof(sections));
+  memset(tick_lateness, 0, sizeof(tick_lateness));
+  memset(tick_duration, 0, sizeof(tick_duration));
+  tick_count = 0;
+  tick_overruns = 0;
+  for (int i = 0; i < PROF_CLIENT_SLOTS; i ++) {
+    clients[i].sent = 0;
+    clients[i].received = 0;
+  }
+  closed_sent = 0;
+  closed_received = 0;
+  memset(&chunk_cache_stats, 0, sizeof(chunk_cache_stats));
+  prof_since = get_program_time();
+}
+
+void prof_init () {
+  for (int i = 0; i < PROF_CLIENT_SLOTS; i ++) clients[i].fd = -1;
+  prof_reset();
+  #ifdef MAC68K_PLATFORM
+    // Toggled from the Debug menu
+    prof_enabled = false;
+  #else
+    // Having compiled the profiler in is taken as asking for it
+    prof_enabled = true;
+    last_report_time = prof_since;
+  #endif
+}
+
+void prof_toggle () {
+  // Sections that were open when collection stopped can't be closed
+  // properly, so start over with clean statistics
+  if (!prof_enabled) prof_reset();
+  prof_enabled = !prof_enabled;
+  #ifdef MAC68K_PLATFORM
+    console_printf("Profiling %s\r", prof_enabled ? "enabled" : "disabled");
+  #else
+    printf("Profiling %s\n", prof_enabled ? "enabled" : "disabled");
+  #endif
+}
+
+int prof_is_enabled () {
+  return prof_enabled;
+}
+
+// Prints one line of the report to the console, and to the report file
+// if one is open. Lines are kept short enough for the Mac console window.
+static void reportLine (const char *fmt, ...) {
+  char line[96];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+
+  #ifdef MAC68K_PLATFORM
+    console_printf("%s\r", line);
+  #else
+    printf("%s\n", line);
+  #endif
+  if (report_file) fprintf(report_file, "%s" PROF_NEWLINE, line);
+}
+
+static void reportHistogram (const char *title, uint32_t *buckets) {
+  reportLine("%s", title);
+  for (int i = 0; i < PROF_HISTOGRAM_BUCKETS; i ++) {
+    if (i == PROF_HISTOGRAM_BUCKETS - 1) {
+      reportLine(" >= %4ld ms: %lu", (long)(histogram_bounds[i - 1] / 1000), (unsigned long)buckets[i]);
+    } else {
+      reportLine("  < %4ld ms: %lu", (long)(histogram_bounds[i] / 1000), (unsigned long)buckets[i]);
+    }
+  }
+}
+
+// Timings are printed as long, since 64-bit printf isn't available everywhere
+void prof_print_report () {
+  int64_t elapsed = get_program_time() - prof_since;
+
+  reportLine("=== Profile over %ld s ===", (long)(elapsed / 1000000));
+  reportLine("%-16s %7s %8s %6s %6s %7s", "section", "calls", "total ms", "avg us", "min us", "max us");
+  for (int i = 0; i < PROF_SECTION_COUNT; i ++) {
+    ProfSection *s = &sections[i];
+    if (s->calls == 0) continue;
+    reportLine("%-16s %7lu %8ld %6ld %6ld %7ld",
+      section_names[i], (unsigned long)s->calls, (long)(s->total / 1000),
+      (long)(s->total / s->calls), (long)s->min, (long)s->max
+    );
+    if (s->blocked) reportLine("  blocked waits: %lu", (unsigned long)s->blocked);
+  }
+
+  reportLine("Ticks: %lu, over budget: %lu", (unsigned long)tick_count, (unsigned long)tick_overruns);
+  if (tick_count) {
+    reportHistogram("Tick lateness:", tick_lateness);
+    reportHistogram("Tick duration:", tick_duration);
+  }
+
+  reportLine("Chunk cache: %lu hits, %lu misses, %lu evicted",
+    (unsigned long)chunk_cache_stats.hits, (unsigned long)chunk_cache_stats.misses,
+    (unsigned long)chunk_cache_stats.evictions
+  );
+
+  reportLine("%-16s %10s %10s", "client", "sent", "received");
+  for (int i = 0; i < PROF_CLIENT_SLOTS; i ++) {
+    if (clients[i].fd == -1) continue;
+    // Show the player name where the fd belongs to a player
+    const char *name = NULL;
+    for (int j = 0; j < MAX_PLAYERS; j ++) {
+      if (player_data[j].client_fd != clients[i].fd) continue;
+      name = player_data[j].name;
+      break;
+    }
+    char label[17];
+    if (name) snprintf(label, sizeof(label), "%s", name);
+    else snprintf(label, sizeof(label), "fd %d", clients[i].fd);
+    reportLine("%-16s %10ld %10ld", label, (long)clients[i].sent, (long)clients[i].received);
+  }
+  if (closed_sent || closed_received) {
+    reportLine("%-16s %10ld %10ld", "(disconnected)", (long)closed_sent, (long)closed_received);
+  }
+}
+
+void prof_save_report () {
+  report_file = fopen(PROF_REPORT_PATH, "w");
+  if (report_file == NULL) {
+    perror("Failed to open profiler report file");
+  }
+  prof_print_report();
+  if (report_file) {
+    fclose(report_file);
+    report_file = NULL;
+    #ifdef MAC68K_PLATFORM
+      console_printf("Profile saved to " PROF_REPORT_PATH "\r");
+    #else
+      printf("Profile saved to " PROF_REPORT_PATH "\n");
+    #endif
+  }
+}
+
+#endif
@@ -5,15 +5,611 @@
 #ifdef ESP_PLATFORM
   #include "esp_littlefs.h"
   #define FILE_PATH "/littlefs/world.bin"
+  #define TEMP_FILE_PATH "/littlefs/world.bin.tmp"
+  #define JOURNAL_PATH "/littlefs/world.jnl"
 #else
   #include <stdio.h>
   #define FILE_PATH "world.bin"
+  #define TEMP_FILE_PATH "world.bin.tmp"
+  #define JOURNAL_PATH "world.jnl"
 #endif
 
 #include "tools.h"
 #include "registries.h"
 #include "serialize.h"
 #include "procedures.h"
+#include "worldgen.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// Journal record types, each record is this byte followed by its data
+#define JOURNAL_BLOCK_CHANGE 1 // BlockChange
+#define JOURNAL_CHEST 2 // uint16_t index, then ChestData
+#define JOURNAL_PLAYER 3 // uint16_t index, then PlayerData
+
+// How many block changes to queue in memory before forcing a flush
+#define JOURNAL_QUEUE_SIZE 256
+
+// The world file starts with this header, followed by player data, chest
+// contents and the region directory. The rest of the file is made up of
+// slots holding the block changes of one region each, sorted.
+#define WORLD_FILE_MAGIC 0x42525744 // "BRWD"
+#define WORLD_FILE_VERSION 2
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t region_shift;
+  uint16_t directory_size;
+  uint16_t reserved;
+} WorldFileHeader;
+
+// Directory entry locating the slot of a region in the world file. The
+// directory is a hash table, probed linearly from the region's hash.
+typedef struct {
+  short rx, rz;
+  uint16_t count;    // Block changes in the slot
+  uint16_t capacity; // Block changes the slot has room for
+  uint32_t offset;   // Where the slot starts, 0 for unused entries
+} RegionEntry;
+
+// Flags of each directory entry, only kept in memory
+#define REGION_USED 1
+#define REGION_LOADED 2   // Its block changes are in block_changes
+#define REGION_DIRTY 4    // It has changed since its slot was written
+#define REGION_TOUCHED 8  // It has been used since the last idle check
+#define REGION_DEFERRED 16 // Paging it in failed, don't retry until the next check
+#define REGION_HIDDEN 32  // Chunks may have been built without its block changes
+
+static RegionEntry region_directory[REGION_DIRECTORY_SIZE];
+static uint8_t region_flags[REGION_DIRECTORY_SIZE];
+// When each region was last found to have been used
+static int64_t region_last_used[REGION_DIRECTORY_SIZE];
+// Directory entry of the last region looked up, most lookups are nearby
+static int last_region = -1;
+// End of the last slot, new slots are appended there
+static long world_file_end = 0;
+// Bytes taken up by slots that have since been replaced
+static long world_file_waste = 0;
+// Set once the world file is in place, regions can't be saved before then
+static uint8_t regions_ready = false;
+static int64_t last_region_check = 0;
+
+#define PLAYER_DATA_OFFSET ((long)sizeof(WorldFileHeader))
+#ifdef ALLOW_CHESTS
+  #define DIRECTORY_OFFSET (PLAYER_DATA_OFFSET + (long)sizeof(player_data) + (long)sizeof(chest_data))
+#else
+  #define DIRECTORY_OFFSET (PLAYER_DATA_OFFSET + (long)sizeof(player_data))
+#endif
+#define REGION_DATA_OFFSET (DIRECTORY_OFFSET + (long)sizeof(region_directory))
+
+// Block changes waiting to be appended to the journal
+static BlockChange journal_queue[JOURNAL_QUEUE_SIZE];
+static int journal_queue_count = 0;
+// Bitmaps of entries that need to be appended to the journal
+#ifdef ALLOW_CHESTS
+static uint8_t chest_dirty[(MAX_CHESTS + 7) / 8];
+#endif
+static uint8_t player_dirty[(MAX_PLAYERS + 7) / 8];
+// Set when any of the above holds something
+static uint8_t journal_pending = false;
+
+// Current size of the journal file in bytes
+static long journal_size = 0;
+static int64_t last_journal_flush = 0;
+static int64_t last_player_save = 0;
+
+static int regionHash (short rx, short rz) {
+  uint32_t h = (uint32_t)(rx * 73856093) ^ (uint32_t)(rz * 19349663);
+  return (int)(h & (REGION_DIRECTORY_SIZE - 1));
+}
+
+// Returns the directory entry of a region, or -1 if it has none. With
+// `create` set, a new entry is made for it, unless the directory is full.
+static int findRegion (short rx, short rz, uint8_t create) {
+  int i = last_region;
+  if (i != -1 && region_directory[i].rx == rx && region_directory[i].rz == rz) return i;
+
+  i = regionHash(rx, rz);
+  for (int probe = 0; probe < REGION_DIRECTORY_SIZE; probe ++) {
+    if (!(region_flags[i] & REGION_USED)) {
+      if (!create) return -1;
+      // New regions have no block changes to page in
+      region_directory[i].rx = rx;
+      region_directory[i].rz = rz;
+      region_directory[i].count = 0;
+      region_directory[i].capacity = 0;
+      region_directory[i].offset = 0;
+      region_flags[i] = REGION_USED | REGION_LOADED;
+      region_last_used[i] = 0;
+      last_region = i;
+      return i;
+    }
+    if (region_directory[i].rx == rx && region_directory[i].rz == rz) {
+      last_region = i;
+      return i;
+    }
+    i = (i + 1) & (REGION_DIRECTORY_SIZE - 1);
+  }
+  return -1;
+}
+
+// Checks whether any player is close enough to have chunks of a region
+static uint8_t isRegionInView (int i) {
+  int reach = (view_distance + 1) * 16;
+  long x = (long)region_directory[i].rx << REGION_SHIFT;
+  long z = (long)region_directory[i].rz << REGION_SHIFT;
+  for (int n = 0; n < online_player_count; n ++) {
+    PlayerData *player = &player_data[online_players[n]];
+    if (player->x + reach < x || player->x - reach >= x + (1 << REGION_SHIFT)) continue;
+    if (player->z + reach < z || player->z - reach >= z + (1 << REGION_SHIFT)) continue;
+    return true;
+  }
+  return false;
+}
+
+// Writes a paged in region's block changes to a new slot at the end of
+// the world file, and then points its directory entry there. The old slot
+// stays as it was until then, so a save cut short by a crash leaves the
+// region as of its last save, with the journal holding everything newer.
+// Old slots are only reclaimed when the world file is compacted.
+// Returns 0 on success, 1 on failure.
+static int saveRegion (FILE *file, int i) {
+
+  RegionEntry entry = region_directory[i];
+  int first;
+  int count = findRegionRun(entry.rx, entry.rz, &first);
+
+  // Never mind whether it would fit in the old slot, writing over that
+  // would shift entries around under the old count
+  entry.offset = world_file_end;
+  entry.count = count;
+  entry.capacity = count;
+
+  if (fseek(file, entry.offset, SEEK_SET) != 0) return 1;
+  if (fwrite(&block_changes[first], sizeof(BlockChange), count, file) != (size_t)count) return 1;
+  if (fflush(file) != 0) return 1;
+  // The slot is taken now, even if the directory doesn't get to point at it
+  world_file_end = entry.offset + (long)count * sizeof(BlockChange);
+
+  // Only point the directory at the slot once it has been written
+  if (fseek(file, DIRECTORY_OFFSET + (long)i * sizeof(RegionEntry), SEEK_SET) != 0) return 1;
+  if (fwrite(&entry, sizeof(entry), 1, file) != 1) return 1;
+
+  if (region_directory[i].offset != 0) {
+    world_file_waste += (long)region_directory[i].capacity * sizeof(BlockChange);
+  }
+  region_directory[i] = entry;
+  region_flags[i] &= ~REGION_DIRTY;
+  return 0;
+
+}
+
+static void flushJournal ();
+
+// Opens the world file to save a single region
+static int writeRegionToDisk (int i) {
+  // Anything still queued is newer than what the journal holds for this
+  // region. Left queued, replaying the journal after a crash would put
+  // those older changes on top of the slot.
+  if (journal_queue_count > 0) flushJournal();
+  FILE *file = fopen(FILE_PATH, "r+b");
+  if (!file) {
+    perror("Failed to open \"world.bin\". Region has not been saved.");
+    return 1;
+  }
+  int failed = saveRegion(file, i);
+  if (fclose(file) != 0) failed = true;
+  if (failed) perror("Failed to write to \"world.bin\". Region has not been saved.");
+  return failed;
+}
+
+// Drops a region's block changes from memory, saving them first if they
+// have changed. Returns 0 on success, 1 if the region has to stay.
+static int pageOutRegion (int i) {
+  if (i == -1 || !regions_ready) return 1;
+  if ((region_flags[i] & REGION_DIRTY) && writeRegionToDisk(i)) return 1;
+  int first;
+  int count = findRegionRun(region_directory[i].rx, region_directory[i].rz, &first);
+  removeBlockChangeRun(first, count);
+  region_flags[i] &= ~REGION_LOADED;
+  return 0;
+}
+
+// Picks a region to page out to make room for another, the one that has
+// gone unused the longest. Regions in view of a player are left alone, as
+// are ones that wouldn't free anything. Returns -1 if there's none.
+static int pickIdleRegion (int keep) {
+  int best = -1;
+  int64_t best_used = 0;
+  for (int i = 0; i < REGION_DIRECTORY_SIZE; i ++) {
+    if (i == keep || !(region_flags[i] & REGION_LOADED)) continue;
+    // Regions touched since the last check were used just now
+    int64_t used = (region_flags[i] & REGION_TOUCHED) ? INT64_MAX : region_last_used[i];
+    if (best != -1 && used >= best_used) continue;
+    int first;
+    if (findRegionRun(region_directory[i].rx, region_directory[i].rz, &first) == 0) continue;
+    if (isRegionInView(i)) continue;
+    best = i;
+    best_used = used;
+  }
+  return best;
+}
+
+// Reads a region's block changes from its slot into block_changes,
+// paging out others if there isn't room
+// Returns 0 on success, 1 if the region couldn't be paged in
+static int pageInRegion (int i) {
+
+  RegionEntry *region = &region_directory[i];
+
+  while (block_changes_count + region->count > MAX_BLOCK_CHANGES) {
+    if (pageOutRegion(pickIdleRegion(i)) == 0) continue;
+    printf("WARNING: No room to page in region %d, %d. Its block changes are hidden for now.\n", region->rx, region->rz);
+    region_flags[i] |= REGION_DEFERRED | REGION_HIDDEN;
+    return 1;
+  }
+
+  if (region->count > 0) {
+    FILE *file = fopen(FILE_PATH, "rb");
+    if (!file) {
+      perror("Failed to open \"world.bin\" to page in a region");
+      region_flags[i] |= REGION_DEFERRED | REGION_HIDDEN;
+      return 1;
+    }
+    int first;
+    findRegionRun(region->rx, region->rz, &first);
+    openBlockChangeRun(first, region->count);
+    size_t read = 0;
+    if (fseek(file, region->offset, SEEK_SET) == 0) {
+      read = fread(&block_changes[first], sizeof(BlockChange), region->count, file);
+    }
+    fclose(file);
+    if (read != region->count) {
+      removeBlockChangeRun(first, region->count);
+      printf("WARNING: Failed to read region %d, %d from \"world.bin\".\n", region->rx, region->rz);
+      region_flags[i] |= REGION_DEFERRED | REGION_HIDDEN;
+      return 1;
+    }
+    for (int j = first; j < first + region->count; j ++) indexBlockChange(j);
+  }
+
+  // Packets cached while the region was missing don't show its changes
+  if (region_flags[i] & REGION_HIDDEN) {
+    short chunks = 1 << (REGION_SHIFT - 4);
+    short min_x = region->rx * chunks;
+    short min_z = region->rz * chunks;
+    invalidateChunkPackets(min_x, min_z, min_x + chunks - 1, min_z + chunks - 1);
+  }
+
+  region_flags[i] = (region_flags[i] | REGION_LOADED) & ~REGION_HIDDEN;
+  return 0;
+
+}
+
+// Makes sure the block changes of the region around the given block are
+// in memory, for looking them up
+void loadBlockRegion (short x, short z) {
+  int i = findRegion(BLOCK_REGION(x), BLOCK_REGION(z), false);
+  if (i == -1) return;
+  region_flags[i] |= REGION_TOUCHED;
+  if (region_flags[i] & (REGION_LOADED | REGION_DEFERRED)) return;
+  pageInRegion(i);
+}
+
+// Prepares the region around the given block for a change to be stored
+// in block_changes. With `create` set, the region is created if it has
+// no block changes yet. Returns 1 if the change can't be stored.
+uint8_t claimBlockRegion (short x, short z, uint8_t create) {
+  int i = findRegion(BLOCK_REGION(x), BLOCK_REGION(z), create);
+  // Either there's nothing to restore, or the directory is full
+  if (i == -1) return create;
+  if (!(region_flags[i] & REGION_LOADED) && pageInRegion(i)) return 1;
+
+  // New regions get a slot right away, so that the directory in the world
+  // file lists every region that was probed past when looking one up
+  if (region_directory[i].offset == 0 && regions_ready) writeRegionToDisk(i);
+  region_flags[i] |= REGION_DIRTY | REGION_TOUCHED;
+
+  // Make room for a new entry
+  while (block_changes_count >= MAX_BLOCK_CHANGES) {
+    if (pageOutRegion(pickIdleRegion(i))) break;
+  }
+  return 0;
+}
+
+// Pages out regions that haven't been used for REGION_IDLE_TIME, and that
+// no player is near
+static void checkIdleRegions (int64_t now) {
+  for (int i = 0; i < REGION_DIRECTORY_SIZE; i ++) {
+    if (!(region_flags[i] & REGION_USED)) continue;
+    region_flags[i] &= ~REGION_DEFERRED;
+    if (region_flags[i] & REGION_TOUCHED) {
+      region_flags[i] &= ~REGION_TOUCHED;
+      region_last_used[i] = now;
+      continue;
+    }
+    if (!(region_flags[i] & REGION_LOADED)) continue;
+    if (now - region_last_used[i] < REGION_IDLE_TIME) continue;
+    if (isRegionInView(i)) continue;
+    pageOutRegion(i);
+  }
+}
+
+#ifdef ALLOW_CHESTS
+// Moves chest contents out of world files written before chests had their
+// own region. Back then, each chest was followed by 14 block change entries
+// holding its items, which are unallocated here.
+static void migrateLegacyChests () {
+
+  int migrated = 0, dropped = 0;
+
+  for (int i = 0; i < MAX_BLOCK_CHANGES; i ++) {
+    if (block_changes[i].block != B_chest) continue;
+    if (migrated < MAX_CHESTS && i + 14 < MAX_BLOCK_CHANGES) {
+      ChestData *chest = &chest_data[migrated ++];
+      chest->x = block_changes[i].x;
+      chest->y = block_changes[i].y;
+      chest->z = block_changes[i].z;
+      chest->used = true;
+      memcpy(chest->items, &block_changes[i + 1], sizeof(chest->items));
+    } else dropped ++;
+    for (int j = 1; j < 15 && i + j < MAX_BLOCK_CHANGES; j ++) {
+      block_changes[i + j].block = 0xFF;
+    }
+    i += 14;
+  }
+
+  printf("Migrated %d chests to the chest region of \"world.bin\".\n", migrated);
+  if (dropped) printf("Chest limit reached, contents of %d chests have been lost.\n", dropped);
+
+}
+#endif
+
+// Reapplies the changes recorded in the journal on top of the world file.
+// A record cut short by a crash ends the replay, as do unknown records.
+// Returns the number of records applied.
+static int replayJournal () {
+
+  FILE *file = fopen(JOURNAL_PATH, "rb");
+  if (!file) return 0;
+
+  int applied = 0;
+  int type;
+
+  while ((type = fgetc(file)) != EOF) {
+
+    if (type == JOURNAL_BLOCK_CHANGE) {
+      BlockChange change;
+      if (fread(&change, 1, sizeof(change), file) != sizeof(change)) break;
+      replayBlockChange(change.x, change.y, change.z, change.block);
+    } else if (type == JOURNAL_PLAYER) {
+      uint16_t index;
+      PlayerData player;
+      if (fread(&index, 1, sizeof(index), file) != sizeof(index)) break;
+      if (fread(&player, 1, sizeof(player), file) != sizeof(player)) break;
+      if (index < MAX_PLAYERS) player_data[index] = player;
+    }
+    #ifdef ALLOW_CHESTS
+    else if (type == JOURNAL_CHEST) {
+      uint16_t index;
+      ChestData chest;
+      if (fread(&index, 1, sizeof(index), file) != sizeof(index)) break;
+      if (fread(&chest, 1, sizeof(chest), file) != sizeof(chest)) break;
+      if (index < MAX_CHESTS) chest_data[index] = chest;
+    }
+    #endif
+    else break;
+
+    applied ++;
+  }
+
+  fclose(file);
+
+  if (applied) printf("Replayed %d changes from \"world.jnl\".\n", applied);
+  return applied;
+
+}
+
+// Reads a world file from before regions, which starts with all of
+// block_changes, followed by player data and chest contents. Closes the
+// file. Returns 0 on success, 1 on failure.
+static int loadLegacyWorldFile (FILE *file) {
+
+  // Read block changes from the start of the file directly into memory
+  size_t read = fread(block_changes, 1, sizeof(block_changes), file);
+  if (read != sizeof(block_changes)) {
+    printf("Read %u bytes from \"world.bin\", expected %u (block changes). Aborting.\n", (unsigned)read, (unsigned)sizeof(block_changes));
+    fclose(file);
+    return 1;
+  }
+
+  // Read player data directly into memory
+  read = fread(player_data, 1, sizeof(player_data), file);
+  if (read != sizeof(player_data)) {
+    printf("Read %u bytes from \"world.bin\", expected %u (player data). Aborting.\n", (unsigned)read, (unsigned)sizeof(player_data));
+    fclose(file);
+    return 1;
+  }
+
+  #ifdef ALLOW_CHESTS
+  // Read chest contents, which directly follow player data
+  read = fread(chest_data, 1, sizeof(chest_data), file);
+  fclose(file);
+  if (read == 0) {
+    // Files from before the chest region existed end here
+    migrateLegacyChests();
+  } else if (read != sizeof(chest_data)) {
+    printf("Read %u bytes from \"world.bin\", expected %u (chest data). Aborting.\n", (unsigned)read, (unsigned)sizeof(chest_data));
+    return 1;
+  }
+  #else
+  fclose(file);
+  #endif
+
+  // Find the index of the last occupied entry to recover block_changes_count
+  for (int i = 0; i < MAX_BLOCK_CHANGES; i ++) {
+    if (block_changes[i].block == 0xFF) continue;
+    if (i >= block_changes_count) block_changes_count = i + 1;
+  }
+
+  // Group block changes by region, then bucket them by section
+  sortBlockChanges();
+  rebuildBlockChangeIndex();
+
+  return 0;
+
+}
+
+// Returns the directory entry a region gets in a compacted world file,
+// with its slot at *offset, and moves *offset past the slot
+static RegionEntry getCompactedEntry (int i, long *offset) {
+  RegionEntry entry = { 0, 0, 0, 0, 0 };
+  if (!(region_flags[i] & REGION_USED)) return entry;
+  entry = region_directory[i];
+  if (region_flags[i] & REGION_LOADED) {
+    int first;
+    entry.count = findRegionRun(entry.rx, entry.rz, &first);
+  }
+  entry.capacity = entry.count;
+  entry.offset = *offset;
+  *offset += (long)entry.count * sizeof(BlockChange);
+  return entry;
+}
+
+// Copies the slot of a paged out region from the current world file
+static int copyRegionSlot (FILE *from, FILE *to, RegionEntry *region) {
+  BlockChange buffer[64];
+  if (fseek(from, region->offset, SEEK_SET) != 0) return 1;
+  for (int left = region->count; left > 0; ) {
+    int n = left < 64 ? left : 64;
+    if (fread(buffer, sizeof(BlockChange), n, from) != (size_t)n) return 1;
+    if (fwrite(buffer, sizeof(BlockChange), n, to) != (size_t)n) return 1;
+    left -= n;
+  }
+  return 0;
+}
+
+// Writes a compacted world file, holding what's in memory along with the
+// slots of paged out regions, to TEMP_FILE_PATH, and then moves it over
+// the world file. Until then, the world file stays as it was, so a crash
+// partway through loses nothing. Returns 0 on success, 1 on failure.
+static int writeWorldImage () {
+
+  FILE *file = fopen(TEMP_FILE_PATH, "wb");
+  if (!file) return 1;
+  // Only needed if a region has to be copied over
+  FILE *old_file = NULL;
+
+  // The header goes in last, files without it are incomplete
+  WorldFileHeader header = { 0, WORLD_FILE_VERSION, REGION_SHIFT, REGION_DIRECTORY_SIZE, 0 };
+  int failed =
+    fwrite(&header, sizeof(header), 1, file) != 1 ||
+    fwrite(player_data, 1, sizeof(player_data), file) != sizeof(player_data)
+    #ifdef ALLOW_CHESTS
+    || fwrite(chest_data, 1, sizeof(chest_data), file) != sizeof(chest_data)
+    #endif
+  ;
+
+  // Slots go back to back, in directory order
+  long offset = REGION_DATA_OFFSET;
+  for (int i = 0; i < REGION_DIRECTORY_SIZE && !failed; i ++) {
+    RegionEntry entry = getCompactedEntry(i, &offset);
+    failed = fwrite(&entry, sizeof(entry), 1, file) != 1;
+  }
+  for (int i = 0; i < REGION_DIRECTORY_SIZE && !failed; i ++) {
+    if (!(region_flags[i] & REGION_USED)) continue;
+    if (region_flags[i] & REGION_LOADED) {
+      int first;
+      int count = findRegionRun(region_directory[i].rx, region_directory[i].rz, &first);
+      failed = fwrite(&block_changes[first], sizeof(BlockChange), count, file) != (size_t)count;
+      continue;
+    }
+    if (region_directory[i].count == 0) continue;
+    if (old_file == NULL) old_file = fopen(FILE_PATH, "rb");
+    failed = old_file == NULL || copyRegionSlot(old_file, file, &region_directory[i]);
+  }
+  if (old_file) fclose(old_file);
+
+  if (!failed && fflush(file) == 0) {
+    header.magic = WORLD_FILE_MAGIC;
+    failed = fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1;
+  } else failed = true;
+  if (fclose(file) != 0) failed = true;
+  if (failed) {
+    remove(TEMP_FILE_PATH);
+    return 1;
+  }
+
+  // Not every platform can rename over an existing file. For those, the
+  // world file is removed first, and initSerializer picks up the new
+  // one if there's a crash in between.
+  if (rename(TEMP_FILE_PATH, FILE_PATH) != 0) {
+    remove(FILE_PATH);
+    if (rename(TEMP_FILE_PATH, FILE_PATH) != 0) return 1;
+  }
+
+  // Only now does the directory in memory match the file
+  offset = REGION_DATA_OFFSET;
+  for (int i = 0; i < REGION_DIRECTORY_SIZE; i ++) {
+    RegionEntry entry = getCompactedEntry(i, &offset);
+    if (!(region_flags[i] & REGION_USED)) continue;
+    region_directory[i] = entry;
+    region_flags[i] &= ~REGION_DIRTY;
+  }
+  world_file_end = offset;
+  world_file_waste = 0;
+  regions_ready = true;
+  return 0;
+
+}
+
+// Writes a new world file holding what's in memory, with each region of
+// block_changes in a slot of its own. Used for new worlds, for converting
+// world files from before regions, and when block_changes is replaced as
+// a whole. Expects block_changes to be sorted.
+int resetWorldFile () {
+
+  memset(region_directory, 0, sizeof(region_directory));
+  memset(region_flags, 0, sizeof(region_flags));
+  last_region = -1;
+  regions_ready = false;
+
+  // Every region in memory gets a directory entry
+  for (int i = 0; i < block_changes_count; ) {
+    short rx = BLOCK_REGION(block_changes[i].x);
+    short rz = BLOCK_REGION(block_changes[i].z);
+    int first;
+    int count = findRegionRun(rx, rz, &first);
+    if (findRegion(rx, rz, true) == -1) {
+      printf("WARNING: Region directory full, %d block changes have been lost.\n", count);
+      removeBlockChangeRun(first, count);
+      continue;
+    }
+    i = first + count;
+  }
+
+  if (writeWorldImage()) {
+    perror(
+      "Failed to write \"world.bin\".\n"
+      "Consider checking permissions or disabling SYNC_WORLD_TO_DISK in \"globals.h\"."
+    );
+    return 1;
+  }
+  return 0;
+
+}
+
+// Checks whether writeWorldImage got to finish TEMP_FILE_PATH
+static uint8_t hasCompleteWorldImage () {
+  FILE *file = fopen(TEMP_FILE_PATH, "rb");
+  if (!file) return false;
+  WorldFileHeader header;
+  size_t read = fread(&header, 1, sizeof(header), file);
+  fclose(file);
+  return read == sizeof(header) && header.magic == WORLD_FILE_MAGIC;
+}
 
 // Restores world data from disk, or writes world file if it doesn't exist
 int initSerializer () {
@@ -34,175 +630,238 @@ int initSerializer () {
     }
   #endif
 
+  memset(region_flags, 0, sizeof(region_flags));
+  last_region = -1;
+  regions_ready = false;
+
   // Attempt to open existing world file
   FILE *file = fopen(FILE_PATH, "rb");
+  if (!file && hasCompleteWorldImage()) {
+    // A compaction was cut short right before its file was moved in place
+    printf("Recovering \"world.bin\" from \"world.bin.tmp\"...\n");
+    if (rename(TEMP_FILE_PATH, FILE_PATH) == 0) file = fopen(FILE_PATH, "rb");
+  } else remove(TEMP_FILE_PATH);
   if (file) {
 
-    // Read block changes from the start of the file directly into memory
-    size_t read = fread(block_changes, 1, sizeof(block_changes), file);
-    if (read != sizeof(block_changes)) {
-      printf("Read %u bytes from \"world.bin\", expected %u (block changes). Aborting.\n", read, sizeof(block_changes));
-      fclose(file);
-      return 1;
-    }
-    // Find the index of the last occupied entry to recover block_changes_count
-    for (int i = 0; i < MAX_BLOCK_CHANGES; i ++) {
-      if (block_changes[i].block == 0xFF) continue;
-      if (block_changes[i].block == B_chest) i += 14;
-      if (i >= block_changes_count) block_changes_count = i + 1;
-    }
+    WorldFileHeader header;
+    size_t read = fread(&header, 1, sizeof(header), file);
 
-    #ifdef USE_SORTED_BLOCK_CHANGES
-    // Sort block changes for binary search optimization
-    sortBlockChanges();
-    #endif
+    if (read == sizeof(header) && header.magic == WORLD_FILE_MAGIC) {
+
+      if (
+        header.version != WORLD_FILE_VERSION ||
+        header.region_shift != REGION_SHIFT ||
+        header.directory_size != REGION_DIRECTORY_SIZE
+      ) {
+        printf("\"world.bin\" was saved with different region settings. Aborting.\n");
+        fclose(file);
+        return 1;
+      }
 
-    // Seek past block changes to start reading player data
-    if (fseek(file, sizeof(block_changes), SEEK_SET) != 0) {
-      perror("Failed to seek to player data in \"world.bin\". Aborting.");
+      // Read everything but the regions, which are paged in as needed
+      if (
+        fread(player_data, 1, sizeof(player_data), file) != sizeof(player_data)
+        #ifdef ALLOW_CHESTS
+        || fread(chest_data, 1, sizeof(chest_data), file) != sizeof(chest_data)
+        #endif
+        || fread(region_directory, 1, sizeof(region_directory), file) != sizeof(region_directory)
+      ) {
+        printf("\"world.bin\" is shorter than expected. Aborting.\n");
+        fclose(file);
+        return 1;
+      }
       fclose(file);
-      return 1;
-    }
-    // Read player data directly into memory
-    read = fread(player_data, 1, sizeof(player_data), file);
-    fclose(file);
-    if (read != sizeof(player_data)) {
-      printf("Read %u bytes from \"world.bin\", expected %u (player data). Aborting.\n", read, sizeof(player_data));
-      return 1;
-    }
 
-  } else { // World file doesn't exist or failed to open
-    printf("No \"world.bin\" file found, creating one...\n\n");
+      world_file_end = REGION_DATA_OFFSET;
+      long used = 0;
+      for (int i = 0; i < REGION_DIRECTORY_SIZE; i ++) {
+        if (region_directory[i].offset == 0) continue;
+        region_flags[i] = REGION_USED;
+        long size = (long)region_directory[i].capacity * sizeof(BlockChange);
+        long end = region_directory[i].offset + size;
+        if (end > world_file_end) world_file_end = end;
+        used += size;
+      }
+      // Whatever no slot covers was left behind by earlier saves
+      world_file_waste = world_file_end - REGION_DATA_OFFSET - used;
+      regions_ready = true;
+
+    } else {
+
+      // Files from before regions are read in whole, then rewritten
+      rewind(file);
+      if (loadLegacyWorldFile(file)) return 1;
+      printf("Converting \"world.bin\" to regions...\n");
+      if (resetWorldFile()) return 1;
 
-    // Try to create the file in binary write mode
-    file = fopen(FILE_PATH, "wb");
-    if (!file) {
-      perror(
-        "Failed to open \"world.bin\" for writing.\n"
-        "Consider checking permissions or disabling SYNC_WORLD_TO_DISK in \"globals.h\"."
-      );
-      return 1;
-    }
-    // Write initial block changes array
-    // This should be done after all entries have had `block` set to 0xFF
-    size_t written = fwrite(block_changes, 1, sizeof(block_changes), file);
-    if (written != sizeof(block_changes)) {
-      perror(
-        "Failed to write initial block data to \"world.bin\".\n"
-        "Consider checking permissions or disabling SYNC_WORLD_TO_DISK in \"globals.h\"."
-      );
-      fclose(file);
-      return 1;
-    }
-    // Seek past written block changes to start writing player data
-    if (fseek(file, sizeof(block_changes), SEEK_SET) != 0) {
-      perror(
-        "Failed to seek past block changes in \"world.bin\"."
-        "Consider checking permissions or disabling SYNC_WORLD_TO_DISK in \"globals.h\"."
-      );
-      fclose(file);
-      return 1;
-    }
-    // Write initial player data to disk (should be just nulls?)
-    written = fwrite(player_data, 1, sizeof(player_data), file);
-    fclose(file);
-    if (written != sizeof(player_data)) {
-      perror(
-        "Failed to write initial player data to \"world.bin\".\n"
-        "Consider checking permissions or disabling SYNC_WORLD_TO_DISK in \"globals.h\"."
-      );
-      return 1;
     }
 
+    // Apply any changes that didn't make it into the world file, then
+    // merge the journal back into it
+    if (replayJournal()) writeAllDataToDisk();
+
+  } else { // World file doesn't exist or failed to open
+    printf("No \"world.bin\" file found, creating one...\n\n");
+    if (resetWorldFile()) return 1;
   }
 
   return 0;
 }
 
-// Writes a range of block change entries to disk
-void writeBlockChangesToDisk (int from, int to) {
+// Writes all world data to disk and clears the journal, as everything in
+// it is now part of the world file. The world file is written anew, which
+// also drops the slots that regions have moved out of. Called on shutdown,
+// and periodically by serviceJournal to keep the journal from growing
+// indefinitely.
+void writeAllDataToDisk () {
 
-  // Try to open the file in rw (without overwriting)
-  FILE *file = fopen(FILE_PATH, "r+b");
-  if (!file) {
-    perror("Failed to open \"world.bin\". Block updates have been dropped.");
+  if (writeWorldImage()) {
+    // Keep the journal, it's still needed to restore what wasn't written
+    perror("Failed to write \"world.bin\". World data has not been saved.");
     return;
   }
 
-  for (int i = from; i <= to; i ++) {
-    // Seek to relevant offset in file
-    if (fseek(file, i * sizeof(BlockChange), SEEK_SET) != 0) {
-      fclose(file);
-      perror("Failed to seek in \"world.bin\". Block updates have been dropped.");
-      return;
-    }
-    // Write block change entry to file
-    if (fwrite(&block_changes[i], 1, sizeof(BlockChange), file) != sizeof(BlockChange)) {
-      fclose(file);
-      perror("Failed to write to \"world.bin\". Block updates have been dropped.");
-      return;
-    }
-  }
+  // Truncate the journal, only now that the world file holds all of it
+  FILE *file = fopen(JOURNAL_PATH, "wb");
+  if (file) fclose(file);
+  journal_size = 0;
+
+  // Anything still queued is included in what was just written
+  journal_queue_count = 0;
+  #ifdef ALLOW_CHESTS
+  memset(chest_dirty, 0, sizeof(chest_dirty));
+  #endif
+  memset(player_dirty, 0, sizeof(player_dirty));
+  journal_pending = false;
 
-  fclose(file);
 }
 
-// Writes all player data to disk
-void writePlayerDataToDisk () {
+// Appends all queued changes to the journal in one go
+static void flushJournal () {
 
-  // Try to open the file in rw (without overwriting)
-  FILE *file = fopen(FILE_PATH, "r+b");
+  FILE *file = fopen(JOURNAL_PATH, "ab");
   if (!file) {
-    perror("Failed to open \"world.bin\". Player updates have been dropped.");
+    perror("Failed to open \"world.jnl\". World changes have not been saved.");
     return;
   }
-  // Seek past block changes in file
-  if (fseek(file, sizeof(block_changes), SEEK_SET) != 0) {
-    fclose(file);
-    perror("Failed to seek in \"world.bin\". Player updates have been dropped.");
-    return;
+
+  long written = 0;
+  uint8_t type;
+
+  type = JOURNAL_BLOCK_CHANGE;
+  for (int i = 0; i < journal_queue_count; i ++) {
+    written += fwrite(&type, 1, 1, file);
+    written += fwrite(&journal_queue[i], 1, sizeof(BlockChange), file);
   }
-  // Write full player data array to file
-  // Since this is a bigger write, it should ideally be done infrequently
-  if (fwrite(&player_data, 1, sizeof(player_data), file) != sizeof(player_data)) {
-    fclose(file);
-    perror("Failed to write to \"world.bin\". Player updates have been dropped.");
+  journal_queue_count = 0;
+
+  #ifdef ALLOW_CHESTS
+  type = JOURNAL_CHEST;
+  for (uint16_t i = 0; i < MAX_CHESTS; i ++) {
+    if (!(chest_dirty[i / 8] & (1 << (i % 8)))) continue;
+    written += fwrite(&type, 1, 1, file);
+    written += fwrite(&i, 1, sizeof(i), file);
+    written += fwrite(&chest_data[i], 1, sizeof(ChestData), file);
+  }
+  memset(chest_dirty, 0, sizeof(chest_dirty));
+  #endif
+
+  type = JOURNAL_PLAYER;
+  for (uint16_t i = 0; i < MAX_PLAYERS; i ++) {
+    if (!(player_dirty[i / 8] & (1 << (i % 8)))) continue;
+    written += fwrite(&type, 1, 1, file);
+    written += fwrite(&i, 1, sizeof(i), file);
+    written += fwrite(&player_data[i], 1, sizeof(PlayerData), file);
+  }
+  memset(player_dirty, 0, sizeof(player_dirty));
+
+  if (fclose(file) != 0) {
+    perror("Failed to write to \"world.jnl\". World changes have not been saved.");
+  }
+
+  journal_size += written;
+  journal_pending = false;
+
+}
+
+// Queues a block change to be appended to the journal
+void journalBlockChange (short x, uint8_t y, short z, uint8_t block) {
+
+  // Repeated changes to the same block only need their latest state
+  for (int i = 0; i < journal_queue_count; i ++) {
+    if (journal_queue[i].x != x || journal_queue[i].y != y || journal_queue[i].z != z) continue;
+    journal_queue[i].block = block;
     return;
   }
 
-  fclose(file);
+  // Flush right away if the queue is full
+  if (journal_queue_count == JOURNAL_QUEUE_SIZE) flushJournal();
+
+  journal_queue[journal_queue_count].x = x;
+  journal_queue[journal_queue_count].y = y;
+  journal_queue[journal_queue_count].z = z;
+  journal_queue[journal_queue_count].block = block;
+  journal_queue_count ++;
+  journal_pending = true;
+
 }
 
-// Writes all world data to disk (call on shutdown)
-void writeAllDataToDisk () {
-  writePlayerDataToDisk();
-  writeBlockChangesToDisk(0, block_changes_count);
+// Marks an entry of player_data to be appended to the journal
+void markPlayerDirty (int index) {
+  player_dirty[index / 8] |= 1 << (index % 8);
+  journal_pending = true;
+}
+
+// Writes out queued changes when enough time has passed since the last
+// flush, so that bursts of changes end up in a single append. Once the
+// journal grows past JOURNAL_COMPACT_SIZE, it's merged into the world file
+// instead. Also pages out idle regions. Call regularly from the main loop.
+void serviceJournal (int64_t now) {
+
+  if (regions_ready && now - last_region_check >= REGION_CHECK_INTERVAL) {
+    checkIdleRegions(now);
+    last_region_check = now;
+  }
+
+  // Periodically save online players, as they're otherwise only saved
+  // when leaving the game
+  if (now - last_player_save >= PLAYER_SAVE_INTERVAL) {
+    for (int i = 0; i < MAX_PLAYERS; i ++) {
+      if (player_data[i].client_fd != -1) markPlayerDirty(i);
+    }
+    last_player_save = now;
+  }
+
+  if (!journal_pending) return;
+  if (now - last_journal_flush < JOURNAL_FLUSH_INTERVAL) return;
+
+  // Also compact once most of the world file is slots regions have
+  // moved out of
+  if (
+    journal_size >= JOURNAL_COMPACT_SIZE ||
+    (world_file_waste >= JOURNAL_COMPACT_SIZE && world_file_waste * 2 >= world_file_end)
+  ) writeAllDataToDisk();
+  else flushJournal();
+
+  last_journal_flush = now;
+
 }
 
 #ifdef ALLOW_CHESTS
-// Writes a chest slot change to disk
+// Marks an entry of chest_data to be appended to the journal
+void markChestDirty (int index) {
+  chest_dirty[index / 8] |= 1 << (index % 8);
+  journal_pending = true;
+}
+
+// Queues a chest slot change to be written to disk
 void writeChestChangesToDisk (uint8_t *storage_ptr, uint8_t slot) {
-  /**
-   * More chest-related memory hacks!!
-   *
-   * Since chests are implemented in the block_changes array, any
-   * changes to the contents of a chest have to be synced to the block
-   * changes part of the world file. The index of the "blocks" is
-   * determined as such:
-   *
-   * The storage pointer points to the block entry directly following
-   * the chest itself. To get the index of this entry, we can subtract
-   * the pointer to the block changes array (cast to uint8_t*) from the
-   * storage pointer. This gets us the amount of bytes between the start
-   * of the block changes array and the chest's item data, as a pointer.
-   * To get the actual block index, we cast this weird pointer to an
-   * integer, and divide it by the byte size of the BlockChange struct.
-   * Finally, the chest slot divided by 2 is added to this index to get
-   * the block entry pertaining to the relevant chest slot, as each
-   * entry encodes exactly 2 slots.
-   */
-  int index = (int)(storage_ptr - (uint8_t *)block_changes) / sizeof(BlockChange) + slot / 2;
-  writeBlockChangesToDisk(index, index);
+  // The storage pointer points into the items of a chest_data entry, so
+  // the entry's index can be recovered with some pointer arithmetic.
+  // The whole entry is journaled, as it's barely larger than a single slot.
+  (void)slot;
+  ChestData *chest = (ChestData *)(storage_ptr - offsetof(ChestData, items));
+  markChestDirty((int)(chest - chest_data));
 }
 #endif
 
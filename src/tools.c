@@ -1,7 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef MAC68K_PLATFORM
+  #include <Memory.h>
   #include "mac68k_net.h"
   extern int errno;
 #else
@@ -20,6 +22,7 @@
     #include <ws2tcpip.h>
   #else
     #include <sys/socket.h>
+    #include <sys/select.h>
     #include <arpa/inet.h>
   #endif
   #include <unistd.h>
@@ -34,6 +37,8 @@
 #include "procedures.h"
 #include "tools.h"
 #include "profiler.h"
+#include "arena.h"
+#include "deflate.h"
 
 #ifndef htonll
   static uint64_t htonll (uint64_t value) {
@@ -60,8 +65,17 @@ void packet_start (int client_fd) {
   packet_buffer_len = 0;
 }
 
+// Set when a broadcast packet didn't fit in the buffer
+static uint8_t broadcast_overflow = false;
+
 void packet_write (const void *buf, size_t len) {
   if (packet_buffer_len + len > PACKET_BUFFER_SIZE) {
+    // A broadcast has no single client to flush to, so drop it instead
+    if (packet_buffer_fd == BROADCAST_FD) {
+      if (!broadcast_overflow) printf("WARNING: Broadcast exceeds packet buffer, dropped.\n");
+      broadcast_overflow = true;
+      return;
+    }
     // Buffer overflow - flush and continue
     packet_flush_continue();
   }
@@ -70,7 +84,7 @@ void packet_write (const void *buf, size_t len) {
 }
 
 ssize_t packet_flush_continue (void) {
-  if (packet_buffer_fd == -1 || packet_buffer_len == 0) {
+  if (packet_buffer_fd < 0 || packet_buffer_len == 0) {
     return 0;
   }
   int fd = packet_buffer_fd;
@@ -92,47 +106,235 @@ void packet_end (void) {
   packet_buffer_fd = -1;
 }
 
+// Broadcasts reuse the packet buffer, encoding into it once under
+// BROADCAST_FD and then passing the same bytes to each recipient
+void broadcast_start (void) {
+  // Don't lose whatever another client had pending
+  if (packet_buffer_fd >= 0) packet_flush();
+  packet_start(BROADCAST_FD);
+  broadcast_overflow = false;
+}
+
+void broadcast_send (int client_fd) {
+  if (packet_buffer_fd != BROADCAST_FD || broadcast_overflow) return;
+  if (client_fd == -1 || packet_buffer_len == 0) return;
+  send_all(client_fd, packet_buffer, packet_buffer_len);
+}
+
+void broadcast_flush (int exclude_fd) {
+  broadcast_flush_players(0xFFFFFFFF, exclude_fd);
+}
+
+void broadcast_flush_players (uint32_t players, int exclude_fd) {
+  for (int n = 0; n < online_player_count; n ++) {
+    int i = online_players[n];
+    if (!(players & ((uint32_t)1 << i))) continue;
+    if (player_data[i].flags & 0x20) continue;
+    if (player_data[i].client_fd == exclude_fd) continue;
+    broadcast_send(player_data[i].client_fd);
+  }
+  packet_end();
+}
+
+// Incoming data that has been received but not parsed yet, one queue per
+// client. Filling it takes a single recv call for everything the network
+// stack is holding, after which packets are read out of memory.
+typedef struct {
+  int fd;
+  // Unread bytes are data[start] up to (not including) data[end]
+  uint16_t start;
+  uint16_t end;
+  // Set once recv has reported the connection as closed
+  uint8_t closed;
+  uint8_t data[RECV_QUEUE_SIZE];
+} RecvQueue;
+
+static RecvQueue recv_queues[MAX_PLAYERS];
+static int recv_queues_ready = false;
+
+static RecvQueue *getRecvQueue (int client_fd) {
+  if (!recv_queues_ready) return NULL;
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    if (recv_queues[i].fd == client_fd) return &recv_queues[i];
+  }
+  return NULL;
+}
+
+// Receives as much as fits in the queue without waiting
+// Returns bytes received, 0 if nothing was available, or -1 if the
+// connection was closed or failed
+static ssize_t fillRecvQueue (RecvQueue *queue) {
+  if (queue->closed) return -1;
+  // Move unread data to the front to make room at the end
+  if (queue->start > 0) {
+    memmove(queue->data, queue->data + queue->start, queue->end - queue->start);
+    queue->end -= queue->start;
+    queue->start = 0;
+  }
+  if (queue->end == RECV_QUEUE_SIZE) return 0;
+
+  ssize_t r = recv(queue->fd, queue->data + queue->end, RECV_QUEUE_SIZE - queue->end, 0);
+  if (r > 0) {
+    queue->end += r;
+    PROF_RECEIVED(queue->fd, r);
+    return r;
+  }
+  if (r == 0) {
+    queue->closed = true;
+    return -1;
+  }
+  #ifdef _WIN32
+    int err = WSAGetLastError();
+    if (err == WSAEWOULDBLOCK || err == WSAEINTR) return 0;
+  #else
+  if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+  #endif
+  return -1;
+}
+
+// Returns true if any client has data waiting to be handled, so that
+// long running idle jobs can get out of the way
+int hasIncomingData () {
+  if (!recv_queues_ready) return false;
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    if (recv_queues[i].fd == -1) continue;
+    if (recv_queues[i].start != recv_queues[i].end) return true;
+  }
+  #ifdef MAC68K_PLATFORM
+    // Only Open Transport notifiers can tell us this cheaply
+    return net_is_event_driven() && net_any_ready();
+  #else
+    fd_set fds;
+    FD_ZERO(&fds);
+    int max_fd = -1;
+    for (int i = 0; i < MAX_PLAYERS; i ++) {
+      if (recv_queues[i].fd == -1) continue;
+      FD_SET(recv_queues[i].fd, &fds);
+      if (recv_queues[i].fd > max_fd) max_fd = recv_queues[i].fd;
+    }
+    if (max_fd == -1) return false;
+    struct timeval timeout = { 0, 0 };
+    return select(max_fd + 1, &fds, NULL, NULL, &timeout) > 0;
+  #endif
+}
+
+int openRecvQueue (int client_fd) {
+  if (!recv_queues_ready) {
+    for (int i = 0; i < MAX_PLAYERS; i ++) recv_queues[i].fd = -1;
+    recv_queues_ready = true;
+  }
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    RecvQueue *queue = &recv_queues[i];
+    if (queue->fd != -1) continue;
+    queue->fd = client_fd;
+    queue->start = 0;
+    queue->end = 0;
+    queue->closed = false;
+    return 0;
+  }
+  return 1;
+}
+
+void closeRecvQueue (int client_fd) {
+  RecvQueue *queue = getRecvQueue(client_fd);
+  if (queue != NULL) queue->fd = -1;
+}
+
+// Parses a VarInt out of the queue, starting at the given offset
+// Returns its size in bytes, 0 if it's incomplete, or -1 if it's invalid
+static int peekVarInt (RecvQueue *queue, int offset, int32_t *value) {
+  int position = 0;
+  *value = 0;
+  for (int i = queue->start + offset; i < queue->end; i ++) {
+    uint8_t byte = queue->data[i];
+    *value |= (int32_t)(byte & SEGMENT_BITS) << position;
+    if ((byte & CONTINUE_BIT) == 0) return i - queue->start - offset + 1;
+    position += 7;
+    if (position >= 32) return -1;
+  }
+  return 0;
+}
+
+int pollRecvQueue (int client_fd, uint8_t framed) {
+  RecvQueue *queue = getRecvQueue(client_fd);
+  if (queue == NULL) return -1;
+
+  // Only go to the network if there isn't a packet here already
+  for (int attempt = 0; attempt < 2; attempt ++) {
+    int available = queue->end - queue->start;
+    if (!framed) {
+      if (available >= 2) return 1;
+    } else {
+      int32_t length;
+      int size = peekVarInt(queue, 0, &length);
+      // Let the reader fail on an invalid length
+      if (size < 0) return 1;
+      if (size > 0 && size + length <= available) return 1;
+      // Packets larger than the queue are streamed through it instead
+      if (available == RECV_QUEUE_SIZE) return 1;
+    }
+    // Whatever arrived before a close is still worth a second look
+    if (attempt == 0) fillRecvQueue(queue);
+  }
+
+  if (queue->closed) return -1;
+  return 0;
+}
+
+ssize_t peekRecvQueue (int client_fd, void *buf, size_t n) {
+  RecvQueue *queue = getRecvQueue(client_fd);
+  if (queue == NULL) return -1;
+  size_t available = queue->end - queue->start;
+  if (n > available) n = available;
+  memcpy(buf, queue->data + queue->start, n);
+  return n;
+}
+
 ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first) {
   char *p = buf;
   size_t total = 0;
 
+  RecvQueue *queue = getRecvQueue(client_fd);
+  if (queue == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
   // Track time of last meaningful network update
   // Used to handle timeout when client is stalling
   int64_t last_update_time = get_program_time();
 
   // If requested, exit early when first byte not immediately available
-  if (require_first) {
-    ssize_t r = recv(client_fd, p, 1, MSG_PEEK);
-    if (r <= 0) {
-      if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-        return 0; // no first byte available yet
-      }
-      return -1; // error or connection closed
-    }
+  if (require_first && queue->start == queue->end) {
+    if (fillRecvQueue(queue) < 0) return -1; // error or connection closed
+    if (queue->start == queue->end) return 0; // no first byte available yet
   }
 
   // Busy-wait (with task yielding) until we get exactly n bytes
   while (total < n) {
-    ssize_t r = recv(client_fd, p + total, n - total, 0);
+    size_t available = queue->end - queue->start;
+    if (available > 0) {
+      size_t count = n - total < available ? n - total : available;
+      memcpy(p + total, queue->data + queue->start, count);
+      queue->start += count;
+      total += count;
+      continue;
+    }
+    ssize_t r = fillRecvQueue(queue);
     if (r < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        // handle network timeout
-        if (get_program_time() - last_update_time > NETWORK_TIMEOUT_TIME) {
-          disconnectClient(&client_fd, -1);
-          return -1;
-        }
-        task_yield();
-        continue;
-      } else {
-        total_bytes_received += total;
-        return -1; // real error
-      }
-    } else if (r == 0) {
-      // connection closed before full read
       total_bytes_received += total;
-      return total;
+      // connection closed before full read, or a real error
+      return queue->closed ? (ssize_t)total : -1;
+    }
+    if (r == 0) {
+      // handle network timeout
+      if (get_program_time() - last_update_time > NETWORK_TIMEOUT_TIME) {
+        disconnectClient(&client_fd, -1);
+        return -1;
+      }
+      task_yield();
+      continue;
     }
-    total += r;
     last_update_time = get_program_time();
   }
 
@@ -140,17 +342,40 @@ ssize_t recv_all (int client_fd, void *buf, size_t n, uint8_t require_first) {
   return total; // got exactly n bytes
 }
 
-ssize_t send_all (int client_fd, const void *buf, ssize_t len) {
-  PROF_START(NET_SEND);
-  // Treat any input buffer as *uint8_t for simplicity
-  const uint8_t *p = (const uint8_t *)buf;
-  ssize_t sent = 0;
-
-  // Track time of last meaningful network update
-  // Used to handle timeout when client is stalling
-  int64_t last_update_time = get_program_time();
+// Outgoing data waiting for the network to accept it, one queue per client.
+// This lets a slow client fall behind without holding up everyone else.
+typedef struct {
+  int fd;
+  uint8_t *data;
+  // Offset of the oldest queued byte, and how many bytes are queued
+  uint32_t head;
+  uint32_t len;
+  // Bytes at the front of the queue handed to the network stack, which
+  // it hasn't finished sending yet (MacTCP asynchronous sends only)
+  uint32_t in_flight;
+  // Last time the queue was empty or made progress
+  int64_t last_progress;
+  // Set when the client has stopped accepting data or was disconnected
+  uint8_t failed;
+} SendQueue;
+
+static SendQueue send_queues[MAX_PLAYERS];
+static int send_queues_ready = false;
+// Queue to start from on the next call to flushSendQueues
+static int send_queue_index = 0;
+
+static SendQueue *getSendQueue (int client_fd) {
+  if (!send_queues_ready) return NULL;
+  for (int i = 0; i < MAX_PLAYERS; i ++) {
+    if (send_queues[i].fd == client_fd) return &send_queues[i];
+  }
+  return NULL;
+}
 
-  // Busy-wait (with task yielding) until all data has been sent
+// Sends as much as the network stack accepts without waiting
+// Returns how many bytes were sent, or -1 on error
+static ssize_t sendAvailable (int client_fd, const uint8_t *p, size_t len) {
+  size_t sent = 0;
   while (sent < len) {
     #ifdef _WIN32
       ssize_t n = send(client_fd, p + sent, len - sent, 0);
@@ -159,37 +384,415 @@ ssize_t send_all (int client_fd, const void *buf, ssize_t len) {
     #endif
     if (n > 0) { // some data was sent, log it
       sent += n;
-      last_update_time = get_program_time();
+      PROF_SENT(client_fd, n);
       continue;
     }
     if (n == 0) { // connection was closed, treat this as an error
       errno = ECONNRESET;
-      PROF_END(NET_SEND);
       return -1;
     }
-    // not yet ready to transmit, try again
-    #ifdef _WIN32 //handles windows socket timeout
+    // not yet ready to transmit, we'll come back later
+    #ifdef _WIN32
       int err = WSAGetLastError();
-      if (err == WSAEWOULDBLOCK || err == WSAEINTR) {
+      if (err == WSAEWOULDBLOCK || err == WSAEINTR) break;
     #else
-    if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+    if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) break;
     #endif
-      PROF_BLOCKED(NET_SEND);  // Track blocking waits
-      // handle network timeout
-      if (get_program_time() - last_update_time > NETWORK_TIMEOUT_TIME) {
-        disconnectClient(&client_fd, -2);
-        PROF_END(NET_SEND);
-        return -1;
-      }
-      task_yield();
+    return -1; // real error
+  }
+  return sent;
+}
+
+#ifdef MAC68K_PLATFORM
+// With MacTCP, queued data is sent in place: TCPSend gets pointers into
+// the ring, which are only released once MacTCP reports them as sent.
+// Returns the number of bytes released, or -1 on error.
+static ssize_t drainSendQueueAsync (SendQueue *queue) {
+  long done = net_send_completed(queue->fd);
+  if (done < 0) {
+    queue->failed = true;
+    return -1;
+  }
+  queue->head = (queue->head + done) & (SEND_QUEUE_SIZE - 1);
+  queue->len -= done;
+  queue->in_flight -= done;
+  if (done > 0 || queue->len == 0) queue->last_progress = get_program_time();
+
+  // Hand everything not yet in flight over in one send, as up to two
+  // parts if it wraps around the end of the ring
+  uint32_t unsent = queue->len - queue->in_flight;
+  if (unsent == 0) return done;
+  uint32_t start = (queue->head + queue->in_flight) & (SEND_QUEUE_SIZE - 1);
+  uint32_t run = SEND_QUEUE_SIZE - start;
+  if (run > unsent) run = unsent;
+  NetSendPart parts[2];
+  int count = 1;
+  parts[0].data = queue->data + start;
+  parts[0].length = run;
+  if (run < unsent) {
+    parts[1].data = queue->data;
+    parts[1].length = unsent - run;
+    count = 2;
+  }
+  if (net_send_gather(queue->fd, parts, count) == 0) {
+    queue->in_flight += unsent;
+  } else if (errno != EAGAIN) {
+    queue->failed = true;
+    return -1;
+  }
+  return done;
+}
+#endif
+
+// Sends queued data from the front of the queue, up to the point where
+// the network stops accepting it. Returns -1 on error.
+static ssize_t drainSendQueue (SendQueue *queue) {
+  #ifdef MAC68K_PLATFORM
+    if (net_can_send_async(queue->fd)) return drainSendQueueAsync(queue);
+  #endif
+  ssize_t total = 0;
+  while (queue->len > 0) {
+    // Send the contiguous run up to the end of the ring first
+    uint32_t run = SEND_QUEUE_SIZE - queue->head;
+    if (run > queue->len) run = queue->len;
+    ssize_t n = sendAvailable(queue->fd, queue->data + queue->head, run);
+    if (n < 0) {
+      queue->failed = true;
+      return -1;
+    }
+    queue->head = (queue->head + n) & (SEND_QUEUE_SIZE - 1);
+    queue->len -= n;
+    total += n;
+    if (n < run) break;
+  }
+  if (total > 0 || queue->len == 0) queue->last_progress = get_program_time();
+  return total;
+}
+
+int openSendQueue (int client_fd) {
+  if (!send_queues_ready) {
+    for (int i = 0; i < MAX_PLAYERS; i ++) send_queues[i].fd = -1;
+    send_queues_ready = true;
+  }
+  // Each slot owns a fixed ring in the memory arena
+  uint8_t *rings = (uint8_t *)getArenaRegion(ARENA_SEND_QUEUES);
+  for (int i = 0; i < MAX_PLAYERS && rings != NULL; i ++) {
+    SendQueue *queue = &send_queues[i];
+    if (queue->fd != -1) continue;
+    queue->data = rings + (long)i * SEND_QUEUE_SIZE;
+    queue->fd = client_fd;
+    queue->head = 0;
+    queue->len = 0;
+    queue->in_flight = 0;
+    queue->failed = false;
+    queue->last_progress = get_program_time();
+    return 0;
+  }
+  printf("WARNING: No send queue for client %d, sends to it will block.\n", client_fd);
+  return 1;
+}
+
+void closeSendQueue (int client_fd) {
+  SendQueue *queue = getSendQueue(client_fd);
+  if (queue == NULL) return;
+  // Give whatever was said last (e.g. a disconnect reason) a chance to go out
+  if (!queue->failed) drainSendQueue(queue);
+  #ifdef MAC68K_PLATFORM
+    // MacTCP may still be reading from the ring. Wait a little for those
+    // sends to complete, as they usually hold the disconnect packet, and
+    // only abort what's left after that.
+    int64_t close_start = get_program_time();
+    while (queue->len > 0 && !queue->failed && net_can_send_async(client_fd)) {
+      if (get_program_time() - close_start > SEND_QUEUE_CLOSE_TIME) break;
+      drainSendQueue(queue);
+    }
+    if (queue->in_flight > 0) net_send_abort(client_fd);
+  #endif
+  queue->data = NULL;
+  queue->fd = -1;
+}
+
+void waitForSendQueue (int client_fd) {
+  SendQueue *queue = getSendQueue(client_fd);
+  if (queue == NULL) return;
+  while (queue->len > 0 && !queue->failed) {
+    if (drainSendQueue(queue) > 0) continue;
+    if (get_program_time() - queue->last_progress > NETWORK_TIMEOUT_TIME) {
+      queue->failed = true;
+      return;
+    }
+    task_yield();
+  }
+}
+
+int isSendQueueCongested (int client_fd) {
+  SendQueue *queue = getSendQueue(client_fd);
+  if (queue == NULL) return false;
+  return queue->failed || queue->len >= SEND_QUEUE_CONGESTED;
+}
+
+int hasSendQueueFailed (int client_fd) {
+  SendQueue *queue = getSendQueue(client_fd);
+  if (queue == NULL) return false;
+  return queue->failed;
+}
+
+void flushSendQueues () {
+  if (!send_queues_ready) return;
+
+  PROF_START(NET_SEND);
+  int64_t now = get_program_time();
+  // Rotate the starting point so that no client always goes first
+  for (int j = 0; j < MAX_PLAYERS; j ++) {
+    SendQueue *queue = &send_queues[(send_queue_index + j) % MAX_PLAYERS];
+    if (queue->fd == -1 || queue->failed || queue->len == 0) continue;
+    drainSendQueue(queue);
+    // Clients that stop accepting data get dropped by the main loop
+    if (queue->len > 0 && now - queue->last_progress > NETWORK_TIMEOUT_TIME) {
+      queue->failed = true;
+    }
+  }
+  send_queue_index = (send_queue_index + 1) % MAX_PLAYERS;
+  PROF_END(NET_SEND);
+}
+
+// Original blocking sender, for clients without a send queue
+static ssize_t sendBlocking (int client_fd, const uint8_t *p, ssize_t len) {
+  ssize_t sent = 0;
+
+  // Track time of last meaningful network update
+  // Used to handle timeout when client is stalling
+  int64_t last_update_time = get_program_time();
+
+  // Busy-wait (with task yielding) until all data has been sent
+  while (sent < len) {
+    ssize_t n = sendAvailable(client_fd, p + sent, len - sent);
+    if (n < 0) return -1;
+    if (n > 0) {
+      sent += n;
+      last_update_time = get_program_time();
       continue;
     }
+    PROF_BLOCKED(NET_SEND);  // Track blocking waits
+    // handle network timeout
+    if (get_program_time() - last_update_time > NETWORK_TIMEOUT_TIME) {
+      disconnectClient(&client_fd, -2);
+      return -1;
+    }
+    task_yield();
+  }
+
+  return sent;
+}
+
+// Sends data through the client's send queue, as given
+static ssize_t sendQueued (int client_fd, const void *buf, ssize_t len) {
+  PROF_START(NET_SEND);
+  // Treat any input buffer as *uint8_t for simplicity
+  const uint8_t *p = (const uint8_t *)buf;
+  ssize_t remaining = len;
+
+  SendQueue *queue = getSendQueue(client_fd);
+  if (queue == NULL) {
+    ssize_t result = sendBlocking(client_fd, p, len);
     PROF_END(NET_SEND);
-    return -1; // real error
+    return result;
+  }
+  if (queue->failed) {
+    PROF_END(NET_SEND);
+    return -1;
+  }
+
+  // Asynchronous sends need the data to stay put until they complete, so
+  // it always goes through the ring for those
+  uint8_t in_place = false;
+  #ifdef MAC68K_PLATFORM
+    in_place = net_can_send_async(client_fd);
+  #endif
+
+  // With nothing queued ahead of it, try sending the data right away. An
+  // idle queue also starts counting stalls from here, not from whenever
+  // it last emptied.
+  if (queue->len == 0) queue->last_progress = get_program_time();
+  if (queue->len == 0 && !in_place) {
+    ssize_t n = sendAvailable(client_fd, p, remaining);
+    if (n < 0) {
+      queue->failed = true;
+      PROF_END(NET_SEND);
+      return -1;
+    }
+    p += n;
+    remaining -= n;
+  }
+
+  // Queue the rest. Only if the queue fills up do we wait on this client.
+  while (remaining > 0) {
+    uint32_t space = SEND_QUEUE_SIZE - queue->len;
+    if (space > 0) {
+      uint32_t tail = (queue->head + queue->len) & (SEND_QUEUE_SIZE - 1);
+      uint32_t run = SEND_QUEUE_SIZE - tail;
+      if (run > space) run = space;
+      if (run > remaining) run = remaining;
+      memcpy(queue->data + tail, p, run);
+      queue->len += run;
+      p += run;
+      remaining -= run;
+      continue;
+    }
+    if (drainSendQueue(queue) < 0) {
+      PROF_END(NET_SEND);
+      return -1;
+    }
+    if (queue->len < SEND_QUEUE_SIZE) continue;
+    PROF_BLOCKED(NET_SEND);  // Track blocking waits
+    // Everyone else is waiting on this client, so drop it (through the
+    // main loop) as soon as it stops taking data, rather than stalling
+    // the server for the full network timeout
+    if (get_program_time() - queue->last_progress > SEND_QUEUE_STALL_TIME) {
+      queue->failed = true;
+      PROF_END(NET_SEND);
+      return -1;
+    }
+    task_yield();
+  }
+
+  // Get the send started now rather than on the next flushSendQueues
+  if (in_place && drainSendQueue(queue) < 0) {
+    PROF_END(NET_SEND);
+    return -1;
   }
 
   PROF_END(NET_SEND);
-  return sent;
+  return len;
+}
+
+// Clients that have been sent Set Compression. From then on, every packet
+// has a data length between its length prefix and its ID, so send_all
+// re-frames what it's given: packet bodies pass through as they are, and
+// each length prefix is rewritten to count a data length of 0, which
+// marks the packet as uncompressed.
+typedef struct {
+  int fd;
+  // Bytes of the current outgoing packet still to pass through
+  uint32_t remaining;
+  // Length prefix of the next outgoing packet, while it's being parsed
+  uint32_t length;
+  uint8_t shift;
+} FrameState;
+
+static FrameState frame_states[MAX_PLAYERS];
+static int compressed_clients = 0;
+
+static FrameState *getFrameState (int client_fd) {
+  for (int i = 0; i < compressed_clients; i ++) {
+    if (frame_states[i].fd == client_fd) return &frame_states[i];
+  }
+  return NULL;
+}
+
+void setCompression (int client_fd, uint8_t enabled) {
+  FrameState *frame = getFrameState(client_fd);
+  if (enabled && frame == NULL) {
+    if (compressed_clients == MAX_PLAYERS) return;
+    frame = &frame_states[compressed_clients ++];
+    frame->fd = client_fd;
+    frame->remaining = 0;
+    frame->length = 0;
+    frame->shift = 0;
+  } else if (!enabled && frame != NULL) {
+    *frame = frame_states[-- compressed_clients];
+  }
+}
+
+int isCompressed (int client_fd) {
+  return getFrameState(client_fd) != NULL;
+}
+
+ssize_t send_all (int client_fd, const void *buf, ssize_t len) {
+  FrameState *frame = compressed_clients > 0 ? getFrameState(client_fd) : NULL;
+  if (frame == NULL) return sendQueued(client_fd, buf, len);
+
+  const uint8_t *p = (const uint8_t *)buf;
+  ssize_t left = len;
+  while (left > 0) {
+    if (frame->remaining > 0) {
+      ssize_t run = left < (ssize_t)frame->remaining ? left : (ssize_t)frame->remaining;
+      if (sendQueued(client_fd, p, run) < 0) return -1;
+      p += run;
+      left -= run;
+      frame->remaining -= run;
+      continue;
+    }
+    // Parse the length prefix, which may be written a byte at a time
+    uint8_t byte = *p ++;
+    left --;
+    frame->length |= (uint32_t)(byte & SEGMENT_BITS) << frame->shift;
+    frame->shift += 7;
+    if (byte & CONTINUE_BIT) continue;
+    // Send it on with the data length added
+    uint8_t header[6];
+    int size = 0;
+    uint32_t value = frame->length + 1;
+    while (value & ~SEGMENT_BITS) {
+      header[size ++] = (value & SEGMENT_BITS) | CONTINUE_BIT;
+      value >>= 7;
+    }
+    header[size ++] = value;
+    header[size ++] = 0;
+    if (sendQueued(client_fd, header, size) < 0) return -1;
+    frame->remaining = frame->length;
+    frame->length = 0;
+    frame->shift = 0;
+  }
+  return len;
+}
+
+ssize_t send_compressed (int client_fd, const void *buf, ssize_t len) {
+  return sendQueued(client_fd, buf, len);
+}
+
+// Replaces the compressed packet at the front of a client's receive queue
+// with its decompressed form, so that it can be read out as usual
+// Returns 0 on success, 1 if it can't be decompressed
+static int inflateRecvQueue (int client_fd, int32_t compressed_length, int32_t data_length) {
+  static uint8_t inflated[RECV_QUEUE_SIZE];
+
+  RecvQueue *queue = getRecvQueue(client_fd);
+  if (queue == NULL) return 1;
+  // Packets under the threshold must be sent uncompressed
+  if (data_length < COMPRESSION_THRESHOLD) {
+    printf("WARNING: Client %d compressed a packet of %d bytes, below the threshold.\n", client_fd, data_length);
+    return 1;
+  }
+  int rest = queue->end - queue->start - compressed_length;
+  // Only packets that fit in the queue whole, both ways, can be handled
+  if (compressed_length < 0 || rest < 0 || data_length > RECV_QUEUE_SIZE - rest) {
+    printf("WARNING: Compressed packet of %d bytes from client %d is too large.\n", data_length, client_fd);
+    return 1;
+  }
+  if (zlibDecompress(queue->data + queue->start, compressed_length, inflated, data_length)) {
+    printf("WARNING: Failed to decompress packet from client %d.\n", client_fd);
+    return 1;
+  }
+
+  memmove(queue->data + data_length, queue->data + queue->start + compressed_length, rest);
+  memcpy(queue->data, inflated, data_length);
+  queue->start = 0;
+  queue->end = data_length + rest;
+  return 0;
+}
+
+int32_t readPacketLength (int client_fd) {
+  int32_t length = readVarInt(client_fd);
+  if (length == (int32_t)VARNUM_ERROR || compressed_clients == 0 || !isCompressed(client_fd)) return length;
+
+  int32_t data_length = readVarInt(client_fd);
+  if (data_length == (int32_t)VARNUM_ERROR) return VARNUM_ERROR;
+  length -= sizeVarInt(data_length);
+  // A data length of 0 marks the packet as uncompressed
+  if (data_length == 0) return length;
+  if (inflateRecvQueue(client_fd, length, data_length)) return VARNUM_ERROR;
+  return data_length;
 }
 
 void discard_all (int client_fd, size_t remaining, uint8_t require_first) {
@@ -390,46 +993,28 @@ int64_t get_program_time () {
 }
 #endif
 
-// Check if more movement packets are queued after the current one.
+// Check if more movement packets are queued after the current one
 // Used to skip stale position packets and prevent queue buildup.
+// Takes the number of bytes left in the current packet.
 // Returns 1 if more movement packets are waiting, 0 otherwise.
-int hasMoreMovementPackets (int client_fd) {
-  // Peek a small amount - we just need to see the next packet
-  uint8_t peek_buf[16];
-
-  #ifdef _WIN32
-    ssize_t peeked = recv(client_fd, (char *)peek_buf, sizeof(peek_buf), MSG_PEEK);
-  #else
-    ssize_t peeked = recv(client_fd, peek_buf, sizeof(peek_buf), MSG_PEEK);
-  #endif
-
-  if (peeked <= 2) return 0;
-
-  // Parse varint length
-  int pos = 0;
-  int length = 0;
-  int shift = 0;
-
-  while (pos < peeked) {
-    uint8_t byte = peek_buf[pos++];
-    length |= (byte & 0x7F) << shift;
-    if (!(byte & 0x80)) break;
-    shift += 7;
-    if (pos > 3) return 0; // Invalid varint
-  }
-
-  if (pos >= peeked) return 0;
-
-  // Parse packet ID (next varint)
-  int packet_id = 0;
-  shift = 0;
-
-  while (pos < peeked) {
-    uint8_t byte = peek_buf[pos++];
-    packet_id |= (byte & 0x7F) << shift;
-    if (!(byte & 0x80)) break;
-    shift += 7;
+int hasMoreMovementPackets (int client_fd, int remaining) {
+  RecvQueue *queue = getRecvQueue(client_fd);
+  if (queue == NULL) return 0;
+
+  // Look at the frame that follows the current packet, if it's here yet
+  int32_t length, packet_id;
+  int size = peekVarInt(queue, remaining, &length);
+  if (size <= 0) return 0;
+  int offset = remaining + size;
+  // With compression, the ID comes after the data length, which is 0 for
+  // packets as small as movement packets
+  if (compressed_clients > 0 && isCompressed(client_fd)) {
+    int32_t data_length;
+    size = peekVarInt(queue, offset, &data_length);
+    if (size <= 0 || data_length != 0) return 0;
+    offset += size;
   }
+  if (peekVarInt(queue, offset, &packet_id) <= 0) return 0;
 
   // Movement packets are 0x1D, 0x1E, 0x1F, 0x20
   return (packet_id >= 0x1D && packet_id <= 0x20);
@@ -5,7 +5,6 @@
 #include <string.h>
 
 #ifdef MAC68K_PLATFORM
-#include <Memory.h>
 #include "mac68k_console.h"
 #endif
 
@@ -13,8 +12,10 @@
 #include "tools.h"
 #include "registries.h"
 #include "procedures.h"
+#include "serialize.h"
 #include "worldgen.h"
 #include "profiler.h"
+#include "arena.h"
 
 uint32_t getChunkHash (short x, short z) {
 
@@ -186,6 +187,22 @@ uint8_t getHeightAt (int x, int z) {
 
 }
 
+// Caves are only carved between these Y levels (inclusive)
+#define CAVE_MIN_Y 5
+#define CAVE_MAX_Y 47
+
+// The chunk-relative X and Z coordinates are used as the seed for an
+// xorshift RNG/hash function to generate the Y coordinate of the ore
+// in this column. This way, each column is guaranteed to have exactly
+// one ore candidate, as there will always be a Y value to reference.
+static inline uint8_t getOreHeight (int rx, int rz) {
+  uint8_t ore_y = ((rx & 15) << 4) + (rz & 15);
+  ore_y ^= ore_y << 4;
+  ore_y ^= ore_y >> 5;
+  ore_y ^= ore_y << 1;
+  return ore_y & 63;
+}
+
 uint8_t getTerrainAtFromCache (int x, int y, int z, int rx, int rz, ChunkAnchor anchor, ChunkFeature feature, uint8_t height) {
 
   if (y >= 64 && y >= height && feature.y != 255) switch (anchor.biome) {
@@ -301,15 +318,7 @@ uint8_t getTerrainAtFromCache (int x, int y, int z, int rx, int rz, ChunkAnchor
       }
     }
 
-    // The chunk-relative X and Z coordinates are used as the seed for an
-    // xorshift RNG/hash function to generate the Y coordinate of the ore
-    // in this column. This way, each column is guaranteed to have exactly
-    // one ore candidate, as there will always be a Y value to reference.
-    uint8_t ore_y = ((rx & 15) << 4) + (rz & 15);
-    ore_y ^= ore_y << 4;
-    ore_y ^= ore_y >> 5;
-    ore_y ^= ore_y << 1;
-    ore_y &= 63;
+    uint8_t ore_y = getOreHeight(rx, rz);
 
     if (y == ore_y) {
       // Since the ore Y coordinate is effectely a random number in range [0;64),
@@ -426,6 +435,7 @@ uint8_t getBlockAt (int x, int y, int z) {
 }
 
 uint8_t chunk_section[4096];
+int16_t chunk_section_uniform = -1;
 ChunkAnchor chunk_anchors[(16 / CHUNK_SIZE + 1) * (16 / CHUNK_SIZE + 1)];
 ChunkFeature chunk_features[256 / (CHUNK_SIZE * CHUNK_SIZE)];
 uint8_t chunk_section_height[16][16];
@@ -433,151 +443,872 @@ uint8_t chunk_section_height[16][16];
 // ============================================================================
 // Chunk Section Cache
 // Dynamically sized based on available RAM (configurable via Get Info on Mac)
-// Each cached chunk section is ~4KB, size calculated at runtime
+// Sections are stored palette-compressed in a pool of 1KB pages: uniform
+// sections take no pages, and sections of up to 4 or 16 distinct blocks
+// take 1 or 2 pages. Only sections with more than that need all 4.
+// Entries are whole chunk columns, held in sets of CACHE_WAYS, so that a
+// column is found with at most CACHE_WAYS compares and is evicted as a
+// unit. Eviction uses CLOCK (second chance) reference bits.
 // ============================================================================
 
+#define CACHE_PAGE_SIZE 1024
+
+/* Columns per set, a column can only be cached in its own set */
+#define CACHE_WAYS 4
+
+/* Pool pages to allow for per column, most sections of a column are uniform */
+#define CACHE_PAGES_PER_COLUMN 8
+
 typedef struct {
-  int16_t cx, cy, cz;     /* Chunk coordinates (signed for negative coords) */
-  uint8_t biome;          /* Cached biome value */
   uint8_t valid;          /* 1 if entry contains valid data */
-  uint16_t lru_counter;   /* For LRU eviction */
-  uint8_t data[4096];     /* Cached chunk section data */
+  uint8_t biome;          /* Cached biome value */
+  uint8_t bits;           /* Bits per block: 0, 2, 4, or 8 for raw block IDs */
+  uint8_t palette_len;
+  uint8_t palette[16];    /* Block IDs indexed by the packed data */
+  uint16_t pages[4];      /* Pool pages holding the packed data, in order */
 } CachedChunkSection;
 
-static CachedChunkSection *chunk_cache = NULL;
-static int chunk_cache_size = 0;
-static uint16_t cache_lru_clock = 0;
+typedef struct {
+  int16_t cx, cz;         /* Chunk coordinates (signed for negative coords) */
+  uint8_t valid;          /* 1 if the column is in use */
+  uint8_t referenced;     /* Set on use, cleared as the clock hand passes */
+  uint16_t page_count;    /* Pool pages held by the column's sections */
+  CachedChunkSection sections[CACHE_COLUMN_SECTIONS];
+} CachedChunkColumn;
+
+static CachedChunkColumn *chunk_cache = NULL;
+static int chunk_cache_size = 0;  /* Number of columns */
+static int cache_set_mask = 0;
 static int cache_initialized = 0;
 
-/* Maximum probe distance for hash table operations (O(1) guarantee) */
-#define MAX_PROBE_DISTANCE 32
+ChunkCacheStats chunk_cache_stats;
+
+/* Page pool, free pages are linked through cache_page_next */
+static uint8_t (*cache_pages)[CACHE_PAGE_SIZE] = NULL;
+static uint16_t *cache_page_next = NULL;
+static int cache_page_count = 0;
+static int cache_free_pages = 0;
+static uint16_t cache_free_head = 0;
+/* Clock hand for evicting columns when the page pool runs out */
+static int cache_evict_hand = 0;
+/* Where the next search for a victim within a set starts */
+static int cache_way_hand = 0;
+
+/* Chunk packet cache, defined below */
+#define CHUNK_PACKET_CACHE_SLOTS 64  /* Maximum number of packets held at once */
+static void freeChunkPacket(int index);
+static void invalidateChunkPacket(int16_t x, int16_t z);
+
+/* Lay out entries and pages for a cache of the given size in the arena */
+static int allocChunkCache(long size_kb) {
+  cache_page_count = (int)(size_kb * 1024 / CACHE_PAGE_SIZE);
+  if (cache_page_count > 65535) cache_page_count = 65535;
+  /* The set count is a power of two, so that sets are picked with a mask */
+  int sets = 1;
+  while (sets * CACHE_WAYS * CACHE_PAGES_PER_COLUMN < cache_page_count) sets <<= 1;
+  cache_set_mask = sets - 1;
+  chunk_cache_size = sets * CACHE_WAYS;
+
+  long column_bytes = (long)chunk_cache_size * sizeof(CachedChunkColumn);
+  long page_bytes = (long)cache_page_count * CACHE_PAGE_SIZE;
+  uint8_t *base = (uint8_t *)resizeArenaRegion(ARENA_CHUNK_CACHE,
+    column_bytes + page_bytes + (long)cache_page_count * sizeof(uint16_t));
+  if (base == NULL) {
+    chunk_cache = NULL;
+    cache_pages = NULL;
+    cache_page_next = NULL;
+    chunk_cache_size = 0;
+    cache_page_count = 0;
+    return 1;
+  }
+  chunk_cache = (CachedChunkColumn *)base;
+  cache_pages = (uint8_t (*)[CACHE_PAGE_SIZE])(base + column_bytes);
+  cache_page_next = (uint16_t *)(base + column_bytes + page_bytes);
+  memset(chunk_cache, 0, column_bytes);
+
+  /* Link all pages into the free list */
+  for (int i = 0; i < cache_page_count; i++) {
+    cache_page_next[i] = (uint16_t)(i + 1);
+  }
+  cache_free_head = 0;
+  cache_free_pages = cache_page_count;
+  cache_evict_hand = 0;
+  cache_way_hand = 0;
+  return 0;
+}
 
-/* Forward declaration */
-static int chunkCacheHash(int16_t cx, int16_t cy, int16_t cz);
+/* Resize the cache, dropping everything it holds */
+/* Space comes out of the arena, so nothing else has to be freed first */
+void resizeChunkCache(long size_kb) {
+  /* Clamp to reasonable bounds */
+  if (size_kb < 64) size_kb = 64;
+  if (size_kb > 32768) size_kb = 32768;
+
+  /* Settle for a smaller cache if the arena doesn't have room */
+  while (allocChunkCache(size_kb)) {
+    if (size_kb <= 16) return;
+    size_kb /= 2;
+#ifdef MAC68K_PLATFORM
+    console_printf("Not enough memory, trying %ldKB\r", size_kb);
+#endif
+  }
+
+#ifdef MAC68K_PLATFORM
+  console_printf("Chunk cache: %d columns (%ldKB)\r",
+                 chunk_cache_size,
+                 (long)(chunk_cache_size * sizeof(CachedChunkColumn) +
+                        (long)cache_page_count * CACHE_PAGE_SIZE) / 1024);
+#endif
+}
 
 /* Initialize cache (call once at startup) */
 void initChunkCache(void) {
   if (cache_initialized) return;
 
 #ifdef MAC68K_PLATFORM
-  /* Get cache size from preferences (in entries) */
-  chunk_cache_size = console_get_cache_size();
+  /* Get cache size from preferences */
+  resizeChunkCache(console_get_cache_size_kb());
+#else
+  /* Non-Mac platforms: use fixed size */
+  resizeChunkCache(256);
+#endif
 
-  /* Clamp to reasonable bounds */
-  if (chunk_cache_size < 16) chunk_cache_size = 16;
-  if (chunk_cache_size > 8192) chunk_cache_size = 8192;
+  cache_initialized = 1;
+}
 
-  /* Allocate cache */
-  chunk_cache = (CachedChunkSection *)NewPtrClear(chunk_cache_size * sizeof(CachedChunkSection));
-  if (chunk_cache == NULL) {
-    /* Fallback to minimal cache if allocation fails */
-    console_printf("Cache alloc failed, trying smaller size\r");
-    chunk_cache_size = 16;
-    chunk_cache = (CachedChunkSection *)NewPtrClear(chunk_cache_size * sizeof(CachedChunkSection));
+/* Return the pages of a section to the pool and mark it invalid */
+static void releaseCacheEntry(CachedChunkColumn *column, CachedChunkSection *entry) {
+  if (!entry->valid) return;
+  int page_count = entry->bits / 2;
+  for (int i = 0; i < page_count; i++) {
+    cache_page_next[entry->pages[i]] = cache_free_head;
+    cache_free_head = entry->pages[i];
   }
+  cache_free_pages += page_count;
+  column->page_count -= page_count;
+  entry->valid = 0;
+}
 
-  console_printf("Chunk cache: %d entries (%ldKB)\r",
-                 chunk_cache_size,
-                 (long)(chunk_cache_size * sizeof(CachedChunkSection) / 1024));
-#else
-  /* Non-Mac platforms: use fixed size */
-  chunk_cache_size = 64;
-  chunk_cache = (CachedChunkSection *)calloc(chunk_cache_size, sizeof(CachedChunkSection));
-#endif
+/* Release all sections of a column and mark it unused */
+static void releaseCacheColumn(CachedChunkColumn *column) {
+  if (!column->valid) return;
+  for (int i = 0; i < CACHE_COLUMN_SECTIONS; i++) {
+    releaseCacheEntry(column, &column->sections[i]);
+  }
+  column->valid = 0;
+}
 
-  /* Initialize all entries as invalid */
-  for (int i = 0; i < chunk_cache_size; i++) {
-    chunk_cache[i].valid = 0;
-    chunk_cache[i].lru_counter = 0;
+/* Evict a column holding pages, other than `keep`, 0 if none found */
+/* Columns used since the clock hand last passed get a second chance */
+static int evictCacheColumn(CachedChunkColumn *keep) {
+  for (int i = 0; i < chunk_cache_size * 2; i++) {
+    CachedChunkColumn *column = &chunk_cache[cache_evict_hand];
+    if (++cache_evict_hand == chunk_cache_size) cache_evict_hand = 0;
+    if (!column->valid || column == keep || column->page_count == 0) continue;
+    if (column->referenced) {
+      column->referenced = 0;
+      continue;
+    }
+    releaseCacheColumn(column);
+    chunk_cache_stats.evictions++;
+    return 1;
   }
-  cache_initialized = 1;
+  return 0;
+}
+
+/* Pick the smallest palette for chunk_section, filling in palette_index */
+/* Returns bits per block: 0, 2, 4, or 8 for raw block IDs */
+static uint8_t buildSectionPalette(uint8_t *palette, uint8_t *palette_len, uint8_t *palette_index) {
+  /* Maps block IDs to palette indices, 0xFF means "not yet seen" */
+  memset(palette_index, 0xFF, 256);
+  /* Sections known to be uniform don't need to be scanned */
+  if (chunk_section_uniform >= 0) {
+    palette_index[chunk_section_uniform] = 0;
+    palette[0] = (uint8_t)chunk_section_uniform;
+    *palette_len = 1;
+    return 0;
+  }
+  *palette_len = 0;
+  for (int i = 0; i < 4096; i++) {
+    uint8_t block = chunk_section[i];
+    if (palette_index[block] != 0xFF) continue;
+    if (*palette_len == 16) {
+      *palette_len = 17; /* Too many for a palette, store raw */
+      break;
+    }
+    palette_index[block] = *palette_len;
+    palette[(*palette_len)++] = block;
+  }
+
+  if (*palette_len == 1) return 0;
+  if (*palette_len <= 4) return 2;
+  if (*palette_len <= 16) return 4;
+  return 8;
+}
+
+/* Pack `length` bytes worth of blocks, lowest bits first */
+static void packSectionBlocks(const uint8_t *in, uint8_t *out, int length, uint8_t bits, const uint8_t *palette_index) {
+  if (bits == 8) {
+    memcpy(out, in, length);
+  } else if (bits == 4) {
+    for (int i = 0; i < length; i++, in += 2) {
+      out[i] = palette_index[in[0]] | (palette_index[in[1]] << 4);
+    }
+  } else {
+    for (int i = 0; i < length; i++, in += 4) {
+      out[i] =
+        palette_index[in[0]] |
+        (palette_index[in[1]] << 2) |
+        (palette_index[in[2]] << 4) |
+        (palette_index[in[3]] << 6);
+    }
+  }
+}
+
+/* Unpack `length` bytes of packed blocks, returns the end of the output */
+static uint8_t *unpackSectionBlocks(const uint8_t *in, uint8_t *out, int length, uint8_t bits, const uint8_t *palette) {
+  if (bits == 8) {
+    memcpy(out, in, length);
+    return out + length;
+  }
+  if (bits == 4) {
+    for (int i = 0; i < length; i++) {
+      *out++ = palette[in[i] & 15];
+      *out++ = palette[in[i] >> 4];
+    }
+    return out;
+  }
+  for (int i = 0; i < length; i++) {
+    *out++ = palette[in[i] & 3];
+    *out++ = palette[(in[i] >> 2) & 3];
+    *out++ = palette[(in[i] >> 4) & 3];
+    *out++ = palette[in[i] >> 6];
+  }
+  return out;
+}
+
+/* Compress chunk_section into an entry, evicting other columns for pages */
+/* Returns 1 if there isn't enough room, leaving the entry invalid */
+static int storeCacheEntry(CachedChunkColumn *column, CachedChunkSection *entry) {
+  uint8_t palette_index[256];
+  entry->bits = buildSectionPalette(entry->palette, &entry->palette_len, palette_index);
+
+  int page_count = entry->bits / 2;
+  while (cache_free_pages < page_count) {
+    if (!evictCacheColumn(column)) return 1;
+  }
+  for (int i = 0; i < page_count; i++) {
+    entry->pages[i] = cache_free_head;
+    cache_free_head = cache_page_next[cache_free_head];
+  }
+  cache_free_pages -= page_count;
+  column->page_count += page_count;
+
+  /* 4096 / page_count blocks per page */
+  for (int p = 0; p < page_count; p++) {
+    packSectionBlocks(
+      chunk_section + p * (4096 / page_count), cache_pages[entry->pages[p]],
+      CACHE_PAGE_SIZE, entry->bits, palette_index
+    );
+  }
+
+  entry->valid = 1;
+  return 0;
+}
+
+/* Decompress an entry into chunk_section */
+static void loadCacheEntry(const CachedChunkSection *entry) {
+  if (entry->bits == 0) {
+    memset(chunk_section, entry->palette[0], 4096);
+    chunk_section_uniform = entry->palette[0];
+    return;
+  }
+
+  chunk_section_uniform = -1;
+  uint8_t *out = chunk_section;
+  for (int p = 0; p < entry->bits / 2; p++) {
+    out = unpackSectionBlocks(cache_pages[entry->pages[p]], out, CACHE_PAGE_SIZE, entry->bits, entry->palette);
+  }
+}
+
+/* Index of the section at the given Y in its column, -1 if not cached */
+static int cacheSectionIndex(int cy) {
+  if (cy < 0 || (cy & 15) != 0 || cy >= CACHE_COLUMN_SECTIONS * 16) return -1;
+  return cy / 16;
+}
+
+/* Hash function for cache lookup, returns the first column of the set */
+static int chunkCacheSet(int16_t cx, int16_t cz) {
+  uint32_t h = (uint32_t)(cx * 73856093) ^ (uint32_t)(cz * 83492791);
+  h ^= h >> 16;
+  return (int)(h & cache_set_mask) * CACHE_WAYS;
+}
+
+/* Find the cached column with the given coordinates, NULL if not found */
+static CachedChunkColumn *findCacheColumn(int16_t cx, int16_t cz) {
+  CachedChunkColumn *set = &chunk_cache[chunkCacheSet(cx, cz)];
+  for (int i = 0; i < CACHE_WAYS; i++) {
+    if (set[i].valid && set[i].cx == cx && set[i].cz == cz) return &set[i];
+  }
+  return NULL;
+}
+
+/* Find or make room for a column in its set. A used way is only */
+/* reclaimed if may_evict is set, or else NULL is returned. */
+static CachedChunkColumn *claimCacheColumn(int16_t cx, int16_t cz, int may_evict) {
+  CachedChunkColumn *column = findCacheColumn(cx, cz);
+  if (column) return column;
+
+  CachedChunkColumn *set = &chunk_cache[chunkCacheSet(cx, cz)];
+  for (int i = 0; i < CACHE_WAYS; i++) {
+    if (!set[i].valid) {
+      column = &set[i];
+      break;
+    }
+  }
+  if (column == NULL) {
+    if (!may_evict) return NULL;
+    /* Second chance within the set, settles within two passes */
+    for (int i = 0; column == NULL; i++) {
+      CachedChunkColumn *way = &set[(cache_way_hand + i) % CACHE_WAYS];
+      if (way->referenced) way->referenced = 0;
+      else column = way;
+    }
+    cache_way_hand = (cache_way_hand + 1) % CACHE_WAYS;
+    releaseCacheColumn(column);
+    chunk_cache_stats.evictions++;
+  }
+
+  column->cx = cx;
+  column->cz = cz;
+  column->valid = 1;
+  column->referenced = 0;
+  column->page_count = 0;
+  for (int i = 0; i < CACHE_COLUMN_SECTIONS; i++) {
+    column->sections[i].valid = 0;
+  }
+  return column;
 }
 
 /* Invalidate cache entries affected by block changes */
-/* Uses hash-based lookup with limited probing for O(1) performance */
 void invalidateChunkCache(int16_t x, uint8_t y, int16_t z) {
+  /* The encoded packet covers the whole column */
+  invalidateChunkPacket(div_floor(x, 16), div_floor(z, 16));
+
+  if (chunk_cache_size == 0) return;
+
   /* Find chunk coordinates containing this block */
   int16_t cx = (x < 0) ? ((x - 15) / 16) * 16 : (x / 16) * 16;
-  int16_t cy = (y / 16) * 16;
   int16_t cz = (z < 0) ? ((z - 15) / 16) * 16 : (z / 16) * 16;
 
-  /* Use hash to find entry quickly */
-  int hash = chunkCacheHash(cx, cy, cz);
-  for (int i = 0; i < MAX_PROBE_DISTANCE; i++) {
-    int idx = (hash + i) % chunk_cache_size;
-    if (chunk_cache[idx].valid &&
-        chunk_cache[idx].cx == cx &&
-        chunk_cache[idx].cy == cy &&
-        chunk_cache[idx].cz == cz) {
-      chunk_cache[idx].valid = 0;
-      return;
-    }
-  }
+  CachedChunkColumn *column = findCacheColumn(cx, cz);
+  int index = cacheSectionIndex((y / 16) * 16);
+  if (column == NULL || index == -1) return;
+  releaseCacheEntry(column, &column->sections[index]);
 }
 
 /* Clear entire cache (call when world seed changes) */
 void clearChunkCache(void) {
   for (int i = 0; i < chunk_cache_size; i++) {
-    chunk_cache[i].valid = 0;
+    releaseCacheColumn(&chunk_cache[i]);
+  }
+  for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+    freeChunkPacket(i);
   }
 }
 
-/* Hash function for cache lookup */
-static int chunkCacheHash(int16_t cx, int16_t cy, int16_t cz) {
-  /* Simple hash combining coordinates */
-  uint32_t h = (uint32_t)(cx * 73856093) ^ (uint32_t)(cy * 19349663) ^ (uint32_t)(cz * 83492791);
-  return (int)(h % chunk_cache_size);
-}
+// ============================================================================
+// Chunk Packet Cache
+// Holds fully encoded chunk data packets, so that sending a chunk that
+// hasn't changed since it was last sent skips generation and encoding.
+// Packets are packed into a CHUNK_PACKET_CACHE_SIZE region of the memory
+// arena, and the least recently used ones are evicted until a gap that
+// fits the next one opens up.
+// ============================================================================
 
-/* Find cache entry for coordinates, returns index or -1 if not found */
-/* Uses limited probing (MAX_PROBE_DISTANCE) for O(1) performance */
-static int findCacheEntry(int16_t cx, int16_t cy, int16_t cz) {
-  int hash = chunkCacheHash(cx, cy, cz);
+typedef struct {
+  int16_t x, z;           /* Chunk coordinates */
+  uint16_t lru_counter;   /* For LRU eviction */
+  int size;               /* Packet size in bytes, 0 if the slot is free */
+  uint8_t compressed;     /* Set once replaced by its compressed form */
+  uint8_t *data;          /* Encoded packet, including its length prefix */
+} CachedChunkPacket;
+
+static CachedChunkPacket chunk_packet_cache[CHUNK_PACKET_CACHE_SLOTS];
+static uint16_t packet_lru_clock = 0;
+
+/* Releases the packet held in a slot, if any */
+static void freeChunkPacket(int index) {
+  CachedChunkPacket *entry = &chunk_packet_cache[index];
+  if (entry->size == 0) return;
+  entry->size = 0;
+  entry->data = NULL;
+}
 
-  /* Limited linear probing from hash position */
-  for (int i = 0; i < MAX_PROBE_DISTANCE; i++) {
-    int idx = (hash + i) % chunk_cache_size;
-    if (!chunk_cache[idx].valid) continue;
-    if (chunk_cache[idx].cx == cx &&
-        chunk_cache[idx].cy == cy &&
-        chunk_cache[idx].cz == cz) {
-      return idx;
+/* Finds room for `size` bytes between the packets held in the pool */
+/* Returns the offset of the gap, or -1 if none is big enough */
+static long findChunkPacketGap(uint8_t *pool, int size) {
+  long start = 0;
+  while (start + size <= CHUNK_PACKET_CACHE_SIZE) {
+    /* Skip past every packet overlapping the space starting here */
+    long overlap_end = -1;
+    for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+      CachedChunkPacket *entry = &chunk_packet_cache[i];
+      if (entry->size == 0) continue;
+      long offset = entry->data - pool;
+      if (offset >= start + size || offset + entry->size <= start) continue;
+      if (offset + entry->size > overlap_end) overlap_end = offset + entry->size;
     }
+    if (overlap_end == -1) return start;
+    start = overlap_end;
   }
   return -1;
 }
 
-/* Find slot for new entry - evicts oldest within probe distance for O(1) */
-static int findCacheSlot(int16_t cx, int16_t cy, int16_t cz) {
-  int hash = chunkCacheHash(cx, cy, cz);
+/* Drops the cached packet of a chunk, call when its contents change */
+static void invalidateChunkPacket(int16_t x, int16_t z) {
+  for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+    if (chunk_packet_cache[i].size == 0) continue;
+    if (chunk_packet_cache[i].x != x || chunk_packet_cache[i].z != z) continue;
+    freeChunkPacket(i);
+    return;
+  }
+}
 
-  /* First pass: look for empty slot near hash position (limited probe) */
-  for (int i = 0; i < MAX_PROBE_DISTANCE; i++) {
-    int idx = (hash + i) % chunk_cache_size;
-    if (!chunk_cache[idx].valid) {
-      return idx;
-    }
+/* Drops the cached packets of every chunk in the given range, inclusive */
+void invalidateChunkPackets(int16_t min_x, int16_t min_z, int16_t max_x, int16_t max_z) {
+  for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+    CachedChunkPacket *entry = &chunk_packet_cache[i];
+    if (entry->size == 0) continue;
+    if (entry->x < min_x || entry->x > max_x) continue;
+    if (entry->z < min_z || entry->z > max_z) continue;
+    freeChunkPacket(i);
   }
+}
 
-  /* No empty slots nearby - evict oldest entry within probe distance */
-  /* This ensures entries are always findable by findCacheEntry */
-  int oldest_idx = hash % chunk_cache_size;
+/* Evicts the least recently used packet, returns 0 if none are left */
+static int evictChunkPacket(void) {
+  int oldest_idx = -1;
   uint16_t oldest_age = 0;
-  for (int i = 0; i < MAX_PROBE_DISTANCE; i++) {
-    int idx = (hash + i) % chunk_cache_size;
-    uint16_t age = (uint16_t)(cache_lru_clock - chunk_cache[idx].lru_counter);
-    if (age > oldest_age) {
+  for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+    if (chunk_packet_cache[i].size == 0) continue;
+    uint16_t age = (uint16_t)(packet_lru_clock - chunk_packet_cache[i].lru_counter);
+    if (oldest_idx == -1 || age > oldest_age) {
       oldest_age = age;
-      oldest_idx = idx;
+      oldest_idx = i;
     }
   }
+  if (oldest_idx == -1) return 0;
+  freeChunkPacket(oldest_idx);
+  return 1;
+}
 
-  return oldest_idx;
+/* Returns the cached packet of a chunk and stores its size, or NULL */
+uint8_t *findChunkPacket(int16_t x, int16_t z, int *size) {
+  for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+    CachedChunkPacket *entry = &chunk_packet_cache[i];
+    if (entry->size == 0) continue;
+    if (entry->x != x || entry->z != z) continue;
+    entry->lru_counter = ++packet_lru_clock;
+    *size = entry->size;
+    return entry->data;
+  }
+  return NULL;
 }
 
-/* Internal: Generate chunk section without caching (original algorithm) */
+/* Reserves space for the packet of a chunk, to be filled in by the caller */
+/* Returns NULL if the packet can't be cached */
+uint8_t *allocChunkPacket(int16_t x, int16_t z, int size) {
+  if (size > CHUNK_PACKET_CACHE_SIZE) return NULL;
+  uint8_t *pool = (uint8_t *)getArenaRegion(ARENA_PACKET_CACHE);
+  if (pool == NULL) return NULL;
+
+  invalidateChunkPacket(x, z);
+
+  /* Evict until there's both a free slot and a gap the packet fits in */
+  int slot;
+  long offset;
+  while (true) {
+    slot = -1;
+    for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+      if (chunk_packet_cache[i].size != 0) continue;
+      slot = i;
+      break;
+    }
+    offset = slot == -1 ? -1 : findChunkPacketGap(pool, size);
+    if (offset != -1) break;
+    if (!evictChunkPacket()) return NULL;
+  }
+  uint8_t *data = pool + offset;
+
+  CachedChunkPacket *entry = &chunk_packet_cache[slot];
+  entry->x = x;
+  entry->z = z;
+  entry->lru_counter = ++packet_lru_clock;
+  entry->size = size;
+  entry->compressed = 0;
+  entry->data = data;
+
+  return data;
+}
+
+/* Returns the entry holding the cached packet of a chunk, or NULL */
+static CachedChunkPacket *getChunkPacketEntry(int16_t x, int16_t z) {
+  for (int i = 0; i < CHUNK_PACKET_CACHE_SLOTS; i++) {
+    CachedChunkPacket *entry = &chunk_packet_cache[i];
+    if (entry->size != 0 && entry->x == x && entry->z == z) return entry;
+  }
+  return NULL;
+}
+
+/* Marks the cached packet of a chunk as replaced by its compressed form, */
+/* which takes up the first `size` bytes of its space */
+void setChunkPacketCompressed(int16_t x, int16_t z, int size) {
+  CachedChunkPacket *entry = getChunkPacketEntry(x, z);
+  if (entry == NULL || size > entry->size) return;
+  entry->size = size;
+  entry->compressed = 1;
+}
+
+/* Whether the cached packet of a chunk is framed for compression */
+uint8_t isChunkPacketCompressed(int16_t x, int16_t z) {
+  CachedChunkPacket *entry = getChunkPacketEntry(x, z);
+  return entry != NULL && entry->compressed;
+}
+
+// ============================================================================
+// Terrain File
+// Terrain only depends on the world seed, so generated sections are kept in
+// terrain.bin to survive restarts. The file is a header followed by a fixed
+// number of slots, each section hashing to one slot. Sections are stored
+// palette-compressed like in the chunk cache, and without block changes.
+// ============================================================================
+
+#ifdef ENABLE_TERRAIN_FILE
+
+#define TERRAIN_FILE_PATH "terrain.bin"
+
+/* Bump when generation changes, so that old files are thrown out */
+#define TERRAIN_FILE_VERSION 1
+#define TERRAIN_FILE_MAGIC 0x54455252  /* "TERR" */
+/* Marks slots that hold a section */
+#define TERRAIN_SLOT_USED 0xA5
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t seed;
+  uint32_t slots;
+} TerrainFileHeader;
+
+typedef struct {
+  int16_t cx, cy, cz;
+  uint8_t used;           /* TERRAIN_SLOT_USED if the slot holds a section */
+  uint8_t biome;
+  uint8_t bits;           /* Bits per block: 0, 2, 4, or 8 for raw block IDs */
+  uint8_t palette_len;
+  uint8_t palette[16];
+  uint8_t padding[6];
+} TerrainSlotHeader;
+
+#define TERRAIN_SLOT_SIZE (sizeof(TerrainSlotHeader) + 4096)
+
+static FILE *terrain_file = NULL;
+/* 0 - not opened yet, 1 - open, -1 - failed to open */
+static int terrain_file_state = 0;
+/* Seed the open file was made for */
+static uint32_t terrain_file_seed;
+static uint8_t terrain_buffer[4096];
+
+/* Open terrain.bin, starting it over if it was made for another world */
+static int openTerrainFile(void) {
+  /* Start over if the seed has changed since the file was opened */
+  if (terrain_file_state == 1 && terrain_file_seed != world_seed) {
+    fclose(terrain_file);
+    terrain_file = NULL;
+    terrain_file_state = 0;
+  }
+  if (terrain_file_state != 0) return terrain_file_state == 1;
+  terrain_file_state = -1;
+  terrain_file_seed = world_seed;
+
+  TerrainFileHeader expected;
+  expected.magic = TERRAIN_FILE_MAGIC;
+  expected.version = TERRAIN_FILE_VERSION;
+  expected.seed = world_seed;
+  expected.slots = TERRAIN_FILE_SLOTS;
+
+  terrain_file = fopen(TERRAIN_FILE_PATH, "rb+");
+  if (terrain_file != NULL) {
+    TerrainFileHeader header;
+    if (
+      fread(&header, 1, sizeof(header), terrain_file) == sizeof(header) &&
+      memcmp(&header, &expected, sizeof(header)) == 0
+    ) {
+      terrain_file_state = 1;
+      return 1;
+    }
+    fclose(terrain_file);
+  }
+
+  /* Missing or stale, truncate it and write a new header */
+  terrain_file = fopen(TERRAIN_FILE_PATH, "wb+");
+  if (terrain_file == NULL) {
+    printf("Failed to open \"%s\", terrain won't be kept on disk.\n", TERRAIN_FILE_PATH);
+    return 0;
+  }
+  if (fwrite(&expected, 1, sizeof(expected), terrain_file) != sizeof(expected)) {
+    printf("Failed to write \"%s\", terrain won't be kept on disk.\n", TERRAIN_FILE_PATH);
+    fclose(terrain_file);
+    terrain_file = NULL;
+    return 0;
+  }
+#ifdef MAC68K_PLATFORM
+  console_printf("Created terrain file with %d slots\r", TERRAIN_FILE_SLOTS);
+#else
+  printf("Created \"%s\" with %d slots\n", TERRAIN_FILE_PATH, TERRAIN_FILE_SLOTS);
+#endif
+  terrain_file_state = 1;
+  return 1;
+}
+
+static long terrainSlotOffset(int cx, int cy, int cz) {
+  uint32_t h = (uint32_t)(cx * 73856093) ^ (uint32_t)(cy * 19349663) ^ (uint32_t)(cz * 83492791);
+  return (long)sizeof(TerrainFileHeader) + (long)(h % TERRAIN_FILE_SLOTS) * (long)TERRAIN_SLOT_SIZE;
+}
+
+/* Read a section's terrain into chunk_section, returns 1 if it was found */
+static int readTerrainFile(int cx, int cy, int cz, uint8_t *biome) {
+  if (!openTerrainFile()) return 0;
+
+  long offset = terrainSlotOffset(cx, cy, cz);
+  TerrainSlotHeader slot;
+  /* Slots past the end of the file haven't been written yet */
+  if (fseek(terrain_file, offset, SEEK_SET) != 0) return 0;
+  if (fread(&slot, 1, sizeof(slot), terrain_file) != sizeof(slot)) return 0;
+  if (slot.used != TERRAIN_SLOT_USED) return 0;
+  if (slot.cx != cx || slot.cy != cy || slot.cz != cz) return 0;
+  if (slot.bits != 0 && slot.bits != 2 && slot.bits != 4 && slot.bits != 8) return 0;
+
+  if (slot.bits == 0) {
+    memset(chunk_section, slot.palette[0], 4096);
+    chunk_section_uniform = slot.palette[0];
+  } else {
+    int length = 512 * slot.bits;
+    if (fread(terrain_buffer, 1, length, terrain_file) != (size_t)length) return 0;
+    unpackSectionBlocks(terrain_buffer, chunk_section, length, slot.bits, slot.palette);
+    chunk_section_uniform = -1;
+  }
+
+  *biome = slot.biome;
+  return 1;
+}
+
+/* Write the terrain in chunk_section to its slot */
+static void writeTerrainFile(int cx, int cy, int cz, uint8_t biome) {
+  if (!openTerrainFile()) return;
+
+  TerrainSlotHeader slot;
+  memset(&slot, 0, sizeof(slot));
+  slot.cx = (int16_t)cx;
+  slot.cy = (int16_t)cy;
+  slot.cz = (int16_t)cz;
+  slot.used = TERRAIN_SLOT_USED;
+  slot.biome = biome;
+
+  uint8_t palette_index[256];
+  slot.bits = buildSectionPalette(slot.palette, &slot.palette_len, palette_index);
+  int length = 512 * slot.bits;
+  if (length) packSectionBlocks(chunk_section, terrain_buffer, length, slot.bits, palette_index);
+
+  /* The data goes first, so that a partly written slot isn't marked used */
+  long offset = terrainSlotOffset(cx, cy, cz);
+  if (length) {
+    if (fseek(terrain_file, offset + (long)sizeof(slot), SEEK_SET) != 0) return;
+    if (fwrite(terrain_buffer, 1, length, terrain_file) != (size_t)length) return;
+  }
+  if (fseek(terrain_file, offset, SEEK_SET) != 0) return;
+  fwrite(&slot, 1, sizeof(slot), terrain_file);
+}
+
+#else
+
+static inline int readTerrainFile(int cx, int cy, int cz, uint8_t *biome) {
+  (void)cx; (void)cy; (void)cz; (void)biome;
+  return 0;
+}
+static inline void writeTerrainFile(int cx, int cy, int cz, uint8_t biome) {
+  (void)cx; (void)cy; (void)cz; (void)biome;
+}
+
+#endif
+
+// ============================================================================
+// Block Change Index
+// Buckets block_changes entries by the section they fall in, so that
+// sections can apply their overrides without scanning the whole array.
+// Links are stored as index + 1, leaving 0 to mark the end of a chain,
+// which means the zero-initialized arrays are already a valid empty index.
+// ============================================================================
+
+#define BLOCK_CHANGE_BUCKETS 1024  /* Must be a power of 2 */
+
+static uint16_t block_change_bucket[BLOCK_CHANGE_BUCKETS];
+static uint16_t block_change_next[MAX_BLOCK_CHANGES];
+
+/* Hash of the section containing the given block coordinates */
+static int blockChangeBucket(int x, int y, int z) {
+  uint32_t h =
+    (uint32_t)(div_floor(x, 16) * 73856093) ^
+    (uint32_t)(div_floor(y, 16) * 19349663) ^
+    (uint32_t)(div_floor(z, 16) * 83492791);
+  return (int)(h & (BLOCK_CHANGE_BUCKETS - 1));
+}
+
+/* Adds the entry at `index` to the index, call after it has been written */
+void indexBlockChange(int index) {
+  int bucket = blockChangeBucket(block_changes[index].x, block_changes[index].y, block_changes[index].z);
+  block_change_next[index] = block_change_bucket[bucket];
+  block_change_bucket[bucket] = index + 1;
+}
+
+/* Removes the entry at `index`, call before its coordinates are changed */
+void unindexBlockChange(int index) {
+  int bucket = blockChangeBucket(block_changes[index].x, block_changes[index].y, block_changes[index].z);
+  uint16_t *link = &block_change_bucket[bucket];
+  while (*link != 0) {
+    if (*link == index + 1) {
+      *link = block_change_next[index];
+      block_change_next[index] = 0;
+      return;
+    }
+    link = &block_change_next[*link - 1];
+  }
+}
+
+/*
+ * Updates the index after the entries starting at `from` have been moved
+ * by `delta` slots within block_changes, as the sorted storage does when
+ * inserting or removing. block_changes_count must already be updated.
+ * Removed entries have to be unindexed before the move, inserted entries
+ * indexed after calling this.
+ */
+void shiftBlockChangeIndex(int from, int delta) {
+  int moved = block_changes_count - (from + delta);
+  if (moved > 0) {
+    memmove(block_change_next + from + delta, block_change_next + from, moved * sizeof(uint16_t));
+  }
+  for (int i = 0; i < BLOCK_CHANGE_BUCKETS; i++) {
+    if (block_change_bucket[i] > from) block_change_bucket[i] += delta;
+  }
+  for (int i = 0; i < block_changes_count; i++) {
+    if (block_change_next[i] > from) block_change_next[i] += delta;
+  }
+}
+
+/* Rebuilds the index from scratch, call after block_changes is loaded */
+void rebuildBlockChangeIndex(void) {
+  memset(block_change_bucket, 0, sizeof(block_change_bucket));
+  memset(block_change_next, 0, sizeof(block_change_next));
+  for (int i = 0; i < block_changes_count; i++) {
+    if (block_changes[i].block == 0xFF) continue;
+    indexBlockChange(i);
+  }
+}
+
+/*
+ * Iterates the block changes that may fall in the section at the given
+ * block coordinates. Returns -1 when done. Buckets are shared between
+ * sections, so callers still have to check the coordinates of each entry.
+ */
+int firstBlockChangeInSection(int cx, int cy, int cz) {
+  return (int)block_change_bucket[blockChangeBucket(cx, cy, cz)] - 1;
+}
+
+int nextBlockChangeInSection(int index) {
+  return (int)block_change_next[index] - 1;
+}
+
+// Applies block changes on top of the terrain in chunk_section
+static void applySectionBlockChanges(int cx, int cy, int cz) {
+
+  // Pre-compute chunk bounds for faster comparison
+  int cx_max = cx + 16;
+  int cy_max = cy + 16;
+  int cz_max = cz + 16;
+
+  for (int i = firstBlockChangeInSection(cx, cy, cz); i != -1; i = nextBlockChangeInSection(i)) {
+    uint8_t block = block_changes[i].block;
+
+    // Skip unallocated entries
+    if (block == 0xFF) continue;
+    // Skip blocks that behave better when sent using a block update
+    if (block == B_torch) continue;
+    #ifdef ALLOW_CHESTS
+      if (block == B_chest) continue;
+    #endif
+
+    // Load coordinates once for bounds checking
+    short bx = block_changes[i].x;
+    uint8_t by = block_changes[i].y;
+    short bz = block_changes[i].z;
+
+    // Skip entries from other sections sharing this bucket
+    if (bx < cx || bx >= cx_max) continue;
+    if (by < cy || by >= cy_max) continue;
+    if (bz < cz || bz >= cz_max) continue;
+
+    // Apply block change
+    int dx = bx - cx;
+    int dy = by - cy;
+    int dz = bz - cz;
+    // Same 8-block sequence reversal as before, this time 10x dirtier
+    // because we're working with specific indexes.
+    unsigned address = (unsigned)(dx + (dz << 4) + (dy << 8));
+    unsigned index = (address & ~7u) | (7u - (address & 7u));
+    chunk_section[index] = block;
+    chunk_section_uniform = -1;
+  }
+
+}
+
+/* Internal: Generate chunk section terrain, without block changes */
 static uint8_t buildChunkSectionInternal(int cx, int cy, int cz);
 
+/* Fill chunk_section with a section's terrain, from terrain.bin if it */
+/* has it, or else by generating it and storing it there */
+static uint8_t loadSectionTerrain(int cx, int cy, int cz) {
+  uint8_t biome;
+  if (readTerrainFile(cx, cy, cz, &biome)) return biome;
+  biome = buildChunkSectionInternal(cx, cy, cz);
+  writeTerrainFile(cx, cy, cz, biome);
+  return biome;
+}
+
+/* Terrain with the block changes in a section applied on top. This does */
+/* mean that we're generating some terrain only to replace it, but it's */
+/* better to apply changes in one run rather than in individual runs per */
+/* block, as this is more expensive than terrain generation. */
+static uint8_t buildSectionWithChanges(int cx, int cy, int cz) {
+  uint8_t biome = loadSectionTerrain(cx, cy, cz);
+  /* OPTIMIZATION: Early exit if no block changes (saves ~3.9s per view update) */
+  if (block_changes_count > 0) {
+    applySectionBlockChanges(cx, cy, cz);
+  }
+  return biome;
+}
+
+/* Store the section just generated into chunk_section in the cache */
+static void storeGeneratedSection(CachedChunkColumn *column, int index, uint8_t biome) {
+  /* Store in cache (only if no block changes affect this chunk) */
+  /* Note: We always cache, but invalidate on block changes */
+  CachedChunkSection *entry = &column->sections[index];
+  releaseCacheEntry(column, entry);
+  entry->biome = biome;
+  column->referenced = 1;
+  storeCacheEntry(column, entry);
+}
+
 // Builds a 16x16x16 chunk of blocks and writes it to `chunk_section`
 // Returns the biome at the origin corner of the chunk
 // This is the PUBLIC function that uses caching
@@ -587,66 +1318,130 @@ uint8_t buildChunkSection(int cx, int cy, int cz) {
     initChunkCache();
   }
 
+  /* Page in the section's block changes before checking for any, as */
+  /* block_changes_count is 0 when every region is paged out */
+  loadBlockRegion(cx, cz);
+
+  /* Without a cache, or outside of the cached height range, always generate */
+  int index = cacheSectionIndex(cy);
+  if (chunk_cache_size == 0 || index == -1) {
+    return buildSectionWithChanges(cx, cy, cz);
+  }
+
   /* Check cache for existing entry */
-  int cache_idx = findCacheEntry((int16_t)cx, (int16_t)cy, (int16_t)cz);
-  if (cache_idx >= 0) {
-    /* Cache hit: copy cached data to chunk_section */
-    memcpy(chunk_section, chunk_cache[cache_idx].data, 4096);
-    chunk_cache[cache_idx].lru_counter = ++cache_lru_clock;
+  CachedChunkColumn *column = findCacheColumn((int16_t)cx, (int16_t)cz);
+  if (column && column->sections[index].valid) {
+    /* Cache hit: decompress cached data into chunk_section */
+    CachedChunkSection *entry = &column->sections[index];
+    loadCacheEntry(entry);
+    column->referenced = 1;
+    chunk_cache_stats.hits++;
 
     /* Still need to apply block changes on top of cached data */
     if (block_changes_count > 0) {
-      int cx_max = cx + 16;
-      int cy_max = cy + 16;
-      int cz_max = cz + 16;
-
-      for (int i = 0; i < block_changes_count; i++) {
-        uint8_t block = block_changes[i].block;
-        if (block == 0xFF) continue;
-        if (block == B_torch) continue;
-        #ifdef ALLOW_CHESTS
-          if (block == B_chest) continue;
-        #endif
-
-        short bx = block_changes[i].x;
-        uint8_t by = block_changes[i].y;
-        short bz = block_changes[i].z;
-
-        if (bx < cx || bx >= cx_max) continue;
-        if (by < cy || by >= cy_max) continue;
-        if (bz < cz || bz >= cz_max) continue;
-
-        int dx = bx - cx;
-        int dy = by - cy;
-        int dz = bz - cz;
-        unsigned address = (unsigned)(dx + (dz << 4) + (dy << 8));
-        unsigned index = (address & ~7u) | (7u - (address & 7u));
-        chunk_section[index] = block;
-      }
+      applySectionBlockChanges(cx, cy, cz);
     }
 
-    return chunk_cache[cache_idx].biome;
+    return entry->biome;
   }
 
   /* Cache miss: generate chunk section */
-  uint8_t biome = buildChunkSectionInternal(cx, cy, cz);
-
-  /* Store in cache (only if no block changes affect this chunk) */
-  /* Note: We always cache, but invalidate on block changes */
-  cache_idx = findCacheSlot((int16_t)cx, (int16_t)cy, (int16_t)cz);
-  chunk_cache[cache_idx].cx = (int16_t)cx;
-  chunk_cache[cache_idx].cy = (int16_t)cy;
-  chunk_cache[cache_idx].cz = (int16_t)cz;
-  chunk_cache[cache_idx].biome = biome;
-  chunk_cache[cache_idx].valid = 1;
-  chunk_cache[cache_idx].lru_counter = ++cache_lru_clock;
-  memcpy(chunk_cache[cache_idx].data, chunk_section, 4096);
+  chunk_cache_stats.misses++;
+  uint8_t biome = buildSectionWithChanges(cx, cy, cz);
+  if (column == NULL) column = claimCacheColumn((int16_t)cx, (int16_t)cz, 1);
+  storeGeneratedSection(column, index, biome);
 
   return biome;
 }
 
-// Internal: Generate chunk section (called by buildChunkSection on cache miss)
-static uint8_t buildChunkSectionInternal(int cx, int cy, int cz) {
+/* Generate a section into the cache ahead of it being needed */
+/* Unless may_evict is set, only free space in the cache is used */
+/* Returns 1 if it was generated, 0 if it was cached already or can't be */
+/* Overwrites chunk_section, so don't call while a chunk is being built */
+int pregenerateChunkSection(int cx, int cy, int cz, int may_evict) {
+  if (!cache_initialized) {
+    initChunkCache();
+  }
+  int index = cacheSectionIndex(cy);
+  if (chunk_cache_size == 0 || index == -1) return 0;
+  CachedChunkColumn *column = findCacheColumn((int16_t)cx, (int16_t)cz);
+  if (column && column->sections[index].valid) return 0;
+  /* Leave room for a section that needs all 4 pages */
+  if (!may_evict && cache_free_pages < 4) return 0;
+  if (column == NULL) column = claimCacheColumn((int16_t)cx, (int16_t)cz, may_evict);
+  if (column == NULL) return 0;
+
+  uint8_t biome = buildSectionWithChanges(cx, cy, cz);
+  storeGeneratedSection(column, index, biome);
+  return 1;
+}
+
+// Encodes the section currently held in chunk_section using the smallest
+// paletted container format available: a single value when the section is
+// uniform, 4 bits per entry with a local palette of up to 16 blocks, or
+// the original 8-bit format indexing the full network_block_palette.
+// Packed entries go in `data`, which needs room for 2048 or 4096 bytes.
+void paletteChunkSection (PalettedSection *out, uint8_t *data) {
+
+  // Maps block IDs to local palette indices, 0xFF means "not yet seen"
+  uint8_t palette_index[256];
+  memset(palette_index, 0xFF, sizeof(palette_index));
+
+  out->palette_len = 0;
+
+  if (chunk_section_uniform >= 0) {
+    // Sections that are known to be uniform don't need to be scanned
+    out->palette[0] = chunk_section_uniform;
+    out->palette_len = 1;
+  } else for (int i = 0; i < 4096; i ++) {
+    uint8_t block = chunk_section[i];
+    if (palette_index[block] != 0xFF) continue;
+    if (out->palette_len == 16) {
+      out->palette_len = 17; // too many for a 4-bit palette
+      break;
+    }
+    palette_index[block] = out->palette_len;
+    out->palette[out->palette_len ++] = block;
+  }
+
+  if (out->palette_len == 1) {
+    out->bits = 0;
+    return;
+  }
+
+  if (out->palette_len > 16) {
+    out->bits = 8;
+    memcpy(data, chunk_section, 4096);
+    return;
+  }
+
+  out->bits = 4;
+  // Pack 16 entries per long, lowest bits first, each long big-endian
+  for (int address = 0; address < 4096; address += 16) {
+    uint8_t *long_out = data + (address >> 1);
+    for (int j = 0; j < 8; j ++) {
+      int entry = address + (7 - j) * 2;
+      long_out[j] =
+        palette_index[SECTION_BLOCK(entry)] |
+        (palette_index[SECTION_BLOCK(entry + 1)] << 4);
+    }
+  }
+
+}
+
+// Column context: the anchors, features and heightmap of the chunk
+// column last generated. These only depend on X/Z, so they're computed
+// once per column and shared by all sections generated in it.
+static int column_valid = false;
+static int column_cx, column_cz;
+static uint32_t column_seed;
+static uint8_t column_min_height, column_max_height;
+
+// Computes the column context for the chunk at (cx, cz), unless it's
+// the column that the context already describes
+static void prepareColumnContext(int cx, int cz) {
+
+  if (column_valid && column_cx == cx && column_cz == cz && column_seed == world_seed) return;
 
   // Precompute hashes, anchors and features for each relevant minichunk
   int anchor_index = 0, feature_index = 0;
@@ -670,15 +1465,84 @@ static uint8_t buildChunkSectionInternal(int cx, int cy, int cz) {
     }
   }
 
-  // Precompute terrain height for entire chunk section
+  // Precompute terrain height for the entire column
+  column_min_height = 255;
+  column_max_height = 0;
   for (int i = 0; i < 16; i ++) {
     for (int j = 0; j < 16; j ++) {
       anchor_index = (j / CHUNK_SIZE) + (i / CHUNK_SIZE) * (16 / CHUNK_SIZE + 1);
       ChunkAnchor *anchor_ptr = chunk_anchors + anchor_index;
-      chunk_section_height[j][i] = getHeightAtFromAnchors(j % CHUNK_SIZE, i % CHUNK_SIZE, anchor_ptr);
+      uint8_t height = getHeightAtFromAnchors(j % CHUNK_SIZE, i % CHUNK_SIZE, anchor_ptr);
+      chunk_section_height[j][i] = height;
+      if (height < column_min_height) column_min_height = height;
+      if (height > column_max_height) column_max_height = height;
+    }
+  }
+
+  column_cx = cx;
+  column_cz = cz;
+  column_seed = world_seed;
+  column_valid = true;
+
+}
+
+// Internal: Generate chunk section (called by buildChunkSection on cache miss)
+static uint8_t buildChunkSectionInternal(int cx, int cy, int cz) {
+
+  prepareColumnContext(cx, cz);
+  int anchor_index, feature_index;
+
+  // Sections entirely above or below the surface band are filled in
+  // directly, without going through getTerrainAtFromCache per block
+  uint8_t biome = chunk_anchors[0].biome;
+  int section_top = cy + 15;
+
+  // Nothing generates more than 7 blocks above the terrain (tree tops),
+  // and lily pads at Y 64 are the only features placed in water
+  if (cy > 64 && cy > column_max_height + 7) {
+    memset(chunk_section, B_air, 4096);
+    chunk_section_uniform = B_air;
+    return biome;
+  }
+  if (section_top < 63 && cy > column_max_height + 1) {
+    memset(chunk_section, B_water, 4096);
+    chunk_section_uniform = B_water;
+    return biome;
+  }
+
+  // At least 4 blocks below the surface everywhere, all that isn't stone
+  // is caves and the one ore candidate of each column
+  if (section_top <= column_min_height - 4) {
+    memset(chunk_section, B_stone, 4096);
+    chunk_section_uniform = B_stone;
+    int cave_min = cy > CAVE_MIN_Y ? cy : CAVE_MIN_Y;
+    int cave_max = section_top < CAVE_MAX_Y ? section_top : CAVE_MAX_Y;
+    for (int rz = 0; rz < 16; rz ++) {
+      for (int rx = 0; rx < 16; rx ++) {
+        feature_index = rx / CHUNK_SIZE + rz / CHUNK_SIZE * (16 / CHUNK_SIZE);
+        anchor_index = rx / CHUNK_SIZE + rz / CHUNK_SIZE * (16 / CHUNK_SIZE + 1);
+        ChunkAnchor anchor = chunk_anchors[anchor_index];
+        ChunkFeature feature = chunk_features[feature_index];
+        uint8_t height = chunk_section_height[rx][rz];
+        int ore_y = getOreHeight(rx % CHUNK_SIZE, rz % CHUNK_SIZE);
+        for (int y = cy; y <= section_top; y ++) {
+          if ((y < cave_min || y > cave_max) && y != ore_y) continue;
+          uint8_t block = getTerrainAtFromCache(
+            rx + cx, y, rz + cz, rx % CHUNK_SIZE, rz % CHUNK_SIZE,
+            anchor, feature, height
+          );
+          if (block == B_stone) continue;
+          unsigned address = (unsigned)(rx + (rz << 4) + ((y - cy) << 8));
+          chunk_section[(address & ~7u) | (7u - (address & 7u))] = block;
+          chunk_section_uniform = -1;
+        }
+      }
     }
+    return biome;
   }
 
+  chunk_section_uniform = -1;
+
   // Generate 4096 blocks in one buffer to reduce overhead
   // OPTIMIZATION: Unrolled inner loop eliminates loop overhead and
   // pre-computes rx values to avoid modulo operations (saves ~0.3-0.8s)
@@ -773,51 +1637,6 @@ static uint8_t buildChunkSectionInternal(int cx, int cy, int cz) {
     }
   }
 
-  // Apply block changes on top of terrain
-  // This does mean that we're generating some terrain only to replace it,
-  // but it's better to apply changes in one run rather than in individual
-  // runs per block, as this is more expensive than terrain generation.
-
-  // OPTIMIZATION: Early exit if no block changes (saves ~3.9s per view update)
-  if (block_changes_count > 0) {
-    // Pre-compute chunk bounds for faster comparison
-    int cx_max = cx + 16;
-    int cy_max = cy + 16;
-    int cz_max = cz + 16;
-
-    for (int i = 0; i < block_changes_count; i ++) {
-      uint8_t block = block_changes[i].block;
-
-      // Skip unallocated entries
-      if (block == 0xFF) continue;
-      // Skip blocks that behave better when sent using a block update
-      if (block == B_torch) continue;
-      #ifdef ALLOW_CHESTS
-        if (block == B_chest) continue;
-      #endif
-
-      // Load coordinates once for bounds checking
-      short bx = block_changes[i].x;
-      uint8_t by = block_changes[i].y;
-      short bz = block_changes[i].z;
-
-      // Check if block is within this chunk section (optimized order)
-      if (bx < cx || bx >= cx_max) continue;
-      if (by < cy || by >= cy_max) continue;
-      if (bz < cz || bz >= cz_max) continue;
-
-      // Apply block change
-      int dx = bx - cx;
-      int dy = by - cy;
-      int dz = bz - cz;
-      // Same 8-block sequence reversal as before, this time 10x dirtier
-      // because we're working with specific indexes.
-      unsigned address = (unsigned)(dx + (dz << 4) + (dy << 8));
-      unsigned index = (address & ~7u) | (7u - (address & 7u));
-      chunk_section[index] = block;
-    }
-  }
-
-  return chunk_anchors[0].biome;
+  return biome;
 
 }
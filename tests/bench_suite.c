@@ -0,0 +1,268 @@
+/*
+ * bench_suite.c - Regression benchmarks against the real server code
+ *
+ * Unlike bench_worldgen, which estimates 68040 timings from its own
+ * simplified copies, this links the actual server sources (everything
+ * but main.c) and times:
+ * 1. getBlockChange hits and misses at several block_changes counts
+ * 2. makeBlockChange inserts, including the base terrain check
+ * 3. Chunk packet encoding into a socket nobody reads from
+ * 4. Chunk sends with different shares of recently sent columns, served
+ *    from the section cache rather than the packet cache
+ * 5. Fluid flow spreading from a single water source
+ *
+ * Results are printed one JSON object per line, so that runs can be
+ * saved and compared with a script.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../include/globals.h"
+#include "../include/registries.h"
+#include "../include/tools.h"
+#include "../include/procedures.h"
+#include "../include/packets.h"
+#include "../include/worldgen.h"
+
+/* Label for the results of this build, pass -DVARIANT=... to compare builds */
+#ifndef VARIANT
+#define VARIANT "default"
+#endif
+
+/* Both ends of the socket chunk packets are written to */
+static int null_fd = -1, drain_fd = -1;
+
+static double get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Prints one result line. Extra fields are passed preformatted. */
+static void report(const char *bench, const char *variant, long ops, double total_ns, const char *extra) {
+    printf("{\"bench\":\"%s\",\"variant\":\"%s\",\"ops\":%ld,\"ns_per_op\":%.1f,\"total_ms\":%.3f%s%s}\n",
+           bench, variant, ops, ops ? total_ns / ops : 0.0, total_ns / 1e6,
+           extra ? "," : "", extra ? extra : "");
+    fflush(stdout);
+}
+
+/* Throws away whatever has been written to the null socket */
+static size_t drain(void) {
+    uint8_t buf[65536];
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(drain_fd, buf, sizeof(buf))) > 0) total += n;
+    return total;
+}
+
+static void reset_world(void) {
+    for (int i = 0; i < MAX_BLOCK_CHANGES; i++) block_changes[i].block = 0xFF;
+    block_changes_count = 0;
+    rebuildBlockChangeIndex();
+    clearChunkCache();
+    flushBlockUpdates();
+    world_seed = splitmix64(INITIAL_WORLD_SEED);
+    rng_seed = splitmix64(INITIAL_RNG_SEED);
+}
+
+/* Fills block_changes with `count` entries spread over the spawn area */
+static void fill_block_changes(int count) {
+    reset_world();
+    for (int i = 0; i < count; i++) {
+        short x = (short)((fast_rand() % 256) - 128);
+        short z = (short)((fast_rand() % 256) - 128);
+        uint8_t y = (uint8_t)(40 + fast_rand() % 40);
+        applyBlockChange(x, y, z, B_stone);
+        applyBlockChange(x, y + 1, z, B_air);
+    }
+    flushBlockUpdates();
+}
+
+/*
+ * Benchmark 1: getBlockChange lookups
+ */
+static void bench_get_block_change(void) {
+    static const int counts[] = { 500, 5000, 20000 };
+    const int lookups = 200000;
+
+    for (int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+        fill_block_changes(counts[c] / 2);
+        char extra[48];
+        snprintf(extra, sizeof(extra), "\"block_changes\":%d", block_changes_count);
+
+        /* Hits: look up entries that are known to exist */
+        volatile uint8_t sink = 0;
+        double start = get_time_ns();
+        for (int i = 0; i < lookups; i++) {
+            BlockChange *entry = &block_changes[i % block_changes_count];
+            sink ^= getBlockChange(entry->x, entry->y, entry->z);
+        }
+        report("getBlockChange_hit", VARIANT, lookups, get_time_ns() - start, extra);
+
+        /* Misses: coordinates near the changes, but not on them */
+        start = get_time_ns();
+        for (int i = 0; i < lookups; i++) {
+            BlockChange *entry = &block_changes[i % block_changes_count];
+            sink ^= getBlockChange(entry->x, (uint8_t)(entry->y + 100), entry->z);
+        }
+        report("getBlockChange_miss", VARIANT, lookups, get_time_ns() - start, extra);
+        (void)sink;
+    }
+}
+
+/*
+ * Benchmark 2: makeBlockChange inserts from an empty world
+ */
+static void bench_make_block_change(void) {
+    static const int counts[] = { 1000, 10000 };
+
+    for (int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++) {
+        reset_world();
+        double start = get_time_ns();
+        for (int i = 0; i < counts[c]; i++) {
+            short x = (short)((fast_rand() % 256) - 128);
+            short z = (short)((fast_rand() % 256) - 128);
+            makeBlockChange(x, (uint8_t)(100 + fast_rand() % 100), z, B_cobblestone);
+        }
+        flushBlockUpdates();
+        char extra[48];
+        snprintf(extra, sizeof(extra), "\"block_changes\":%d", block_changes_count);
+        report("makeBlockChange_insert", VARIANT, counts[c], get_time_ns() - start, extra);
+    }
+}
+
+/*
+ * Benchmark 3: chunk packet encoding, cold and from the packet cache
+ */
+static void bench_chunk_encoding(void) {
+    /* Few enough columns that all of them fit the host's caches */
+    const int side = 4;
+    size_t bytes = 0;
+    char extra[64];
+
+    /* Cold: every column is generated and encoded from scratch */
+    reset_world();
+    double total = 0;
+    for (int i = 0; i < side * side; i++) {
+        clearChunkCache();
+        double start = get_time_ns();
+        sc_chunkDataAndUpdateLight(null_fd, i % side, i / side);
+        total += get_time_ns() - start;
+        bytes += drain();
+    }
+    snprintf(extra, sizeof(extra), "\"bytes_per_op\":%zu", bytes / (side * side));
+    report("chunk_encode_cold", VARIANT, side * side, total, extra);
+
+    /* Warm: the same columns again, now in the chunk and packet caches */
+    bytes = 0;
+    total = 0;
+    for (int i = 0; i < side * side; i++) {
+        sc_chunkDataAndUpdateLight(null_fd, i % side, i / side);
+        bytes += drain();
+    }
+    for (int i = 0; i < side * side; i++) {
+        double start = get_time_ns();
+        sc_chunkDataAndUpdateLight(null_fd, i % side, i / side);
+        total += get_time_ns() - start;
+        bytes += drain();
+    }
+    snprintf(extra, sizeof(extra), "\"bytes_per_op\":%zu", bytes / (side * side * 2));
+    report("chunk_encode_cached", VARIANT, side * side, total, extra);
+}
+
+/*
+ * Benchmark 4: chunk sends where a given share revisits recent columns.
+ * Revisited columns would otherwise come straight from the packet cache,
+ * so their packets are dropped first to measure the section cache.
+ */
+static void bench_cache_mix(void) {
+    static const int hit_percents[] = { 0, 50, 90 };
+    const int sends = 100;
+
+    for (int h = 0; h < (int)(sizeof(hit_percents) / sizeof(hit_percents[0])); h++) {
+        reset_world();
+        memset(&chunk_cache_stats, 0, sizeof(chunk_cache_stats));
+
+        /* Players mostly walk back and forth over the last few columns
+         * they've seen, with new terrain coming in at the edge */
+        int next_new = 0, hits = 0;
+        double start = get_time_ns();
+        for (int i = 0; i < sends; i++) {
+            int cx;
+            if (next_new > 4 && (int)(fast_rand() % 100) < hit_percents[h]) {
+                cx = next_new - 1 - (int)(fast_rand() % 4);
+                hits++;
+            } else {
+                cx = next_new++;
+            }
+            invalidateChunkPackets(cx, 40, cx, 40);
+            sc_chunkDataAndUpdateLight(null_fd, cx, 40);
+            drain();
+        }
+        char extra[128];
+        snprintf(extra, sizeof(extra),
+                 "\"hit_percent\":%d,\"revisits\":%d,\"section_hits\":%lu,\"section_misses\":%lu",
+                 hit_percents[h], hits, (unsigned long)chunk_cache_stats.hits,
+                 (unsigned long)chunk_cache_stats.misses);
+        report("chunk_send_mix", VARIANT, sends, get_time_ns() - start, extra);
+    }
+}
+
+/*
+ * Benchmark 5: fluid flow from a water source placed on the surface
+ */
+static void bench_fluid_flow(void) {
+    const int ticks = 64;
+    reset_world();
+
+    short x = 8, z = 8;
+    uint8_t y = 200;
+    while (y > 0 && getBlockAt(x, y, z) == B_air) y--;
+    y++;
+
+    int before = block_changes_count;
+    double start = get_time_ns();
+    makeBlockChange(x, y, z, B_water);
+    checkFluidUpdate(x, y, z, B_water);
+    for (int i = 0; i < ticks; i++) processFluidUpdates();
+    flushBlockUpdates();
+
+    char extra[64];
+    snprintf(extra, sizeof(extra), "\"blocks_changed\":%d,\"surface_y\":%d", block_changes_count - before, y);
+    report("fluid_flow_tick", VARIANT, ticks, get_time_ns() - start, extra);
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc; (void)argv;
+
+    /* Chunk packets go to one end of a socket pair and get read back out */
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    null_fd = fds[0];
+    drain_fd = fds[1];
+    fcntl(drain_fd, F_SETFL, fcntl(drain_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    for (int i = 0; i < MAX_PLAYERS; i++) player_data[i].client_fd = -1;
+    initClientTable();
+    initChunkTemplates();
+
+    bench_get_block_change();
+    bench_make_block_change();
+    bench_chunk_encoding();
+    bench_cache_mix();
+    bench_fluid_flow();
+
+    close(null_fd);
+    close(drain_fd);
+    return 0;
+}
@@ -49,6 +49,12 @@ uint8_t getBlockChange(short x, uint8_t y, short z) {
     return 0xFF;
 }
 
+/* Stub for loadBlockRegion (from serialize.c), every region stays in memory */
+void loadBlockRegion(short x, short z) {
+    (void)x;
+    (void)z;
+}
+
 /* Simulates makeBlockChange from procedures.c (simplified) */
 int makeBlockChange(short x, uint8_t y, short z, uint8_t block) {
     int first_gap = block_changes_count;
@@ -129,6 +135,7 @@ void bench_block_mining_scenario(void) {
         block_changes[i].z = (short)(i * 2);
         block_changes[i].block = B_air;
     }
+    rebuildBlockChangeIndex();
 
     printf("Setup: %d existing block changes (typical gameplay)\n\n", existing_changes);
 
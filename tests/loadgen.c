@@ -0,0 +1,669 @@
+/*
+ * loadgen.c - Multi-client load generator for the headless host server
+ *
+ * Logs in a number of scripted bot players, walks each of them around a
+ * square path, and periodically has them break and re-place the block
+ * under their feet. Optionally, bots also right-click a given block (a
+ * chest placed there beforehand) to exercise container handling.
+ *
+ * Only standard POSIX sockets are used, so this builds anywhere the host
+ * server does. At the end of the run it reports:
+ * - chunk send latency (chunk border crossed -> first new chunk received)
+ * - bytes per chunk packet, and how many arrived compressed
+ * - tick jitter, taken from the spacing of Keep Alive packets
+ * - packets and bytes per second in both directions
+ *
+ * Usage: ./loadgen [-h host] [-p port] [-n bots] [-t seconds]
+ *                  [-r radius] [-c x,y,z]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../include/deflate.h"
+
+#define MAX_BOTS 32
+#define PROTOCOL_VERSION 772 /* 1.21.8 */
+
+/* Movement packets per second, matching the vanilla client */
+#define MOVE_RATE 20
+/* Walking speed in blocks per second */
+#define WALK_SPEED 4.3
+/* Time between block and chest actions of each bot */
+#define ACTION_INTERVAL 2000000
+/* Expected spacing of Keep Alive packets, see KEEP_ALIVE_INTERVAL */
+#define KEEP_ALIVE_SPACING 1000000
+
+enum {
+    BOT_CONNECTING,
+    BOT_LOGIN,
+    BOT_CONFIGURATION,
+    BOT_PLAY,
+    BOT_DEAD
+};
+
+typedef struct {
+    int fd;
+    int state;
+    int index;
+    /* Set once the server has sent Set Compression */
+    int compressed;
+
+    /* Incoming data, grown as needed to hold a whole packet */
+    uint8_t *rbuf;
+    size_t rlen, rcap;
+    /* Inflated body of the current compressed packet */
+    uint8_t *zbuf;
+    size_t zcap;
+    /* Outgoing data the socket hasn't taken yet */
+    uint8_t wbuf[8192];
+    size_t wlen;
+
+    /* Spawn point and current position */
+    double spawn_x, spawn_y, spawn_z;
+    double x, y, z;
+    double path_pos;
+    int spawned;
+    int sequence;
+
+    int64_t connect_time;
+    int64_t next_move;
+    int64_t next_action;
+    /* When a chunk border was crossed without a new chunk arriving yet */
+    int64_t crossed_at;
+    int chunk_x, chunk_z;
+    int64_t last_keep_alive;
+} Bot;
+
+/* Totals across all bots */
+typedef struct {
+    uint64_t packets_in, packets_out;
+    uint64_t bytes_in, bytes_out;
+    uint64_t chunks, chunk_bytes, chunks_compressed;
+    uint64_t latency_samples;
+    int64_t latency_total, latency_max;
+    uint64_t jitter_samples;
+    int64_t jitter_total, jitter_max;
+    uint64_t login_samples;
+    int64_t login_total, login_max;
+    uint32_t block_actions, screens_opened;
+    uint32_t connected, disconnected;
+} Stats;
+
+static Bot bots[MAX_BOTS];
+static Stats stats;
+
+static const char *host = "127.0.0.1";
+static int port = 25565;
+static int bot_count = 4;
+static int duration = 30;
+static int radius = 24;
+static int have_chest = 0;
+static int chest_x, chest_y, chest_z;
+
+static int64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* ---------- Packet building ---------- */
+
+typedef struct {
+    uint8_t data[512];
+    size_t len;
+} Packet;
+
+static void put_byte(Packet *p, uint8_t b) {
+    p->data[p->len++] = b;
+}
+
+static void put_varint(Packet *p, int32_t value) {
+    uint32_t v = (uint32_t)value;
+    do {
+        uint8_t b = v & 0x7F;
+        v >>= 7;
+        if (v) b |= 0x80;
+        put_byte(p, b);
+    } while (v);
+}
+
+static void put_u16(Packet *p, uint16_t v) {
+    put_byte(p, v >> 8);
+    put_byte(p, v & 0xFF);
+}
+
+static void put_u64(Packet *p, uint64_t v) {
+    for (int i = 7; i >= 0; i--) put_byte(p, (v >> (i * 8)) & 0xFF);
+}
+
+static void put_double(Packet *p, double d) {
+    uint64_t v;
+    memcpy(&v, &d, 8);
+    put_u64(p, v);
+}
+
+static void put_float(Packet *p, float f) {
+    uint32_t v;
+    memcpy(&v, &f, 4);
+    for (int i = 3; i >= 0; i--) put_byte(p, (v >> (i * 8)) & 0xFF);
+}
+
+static void put_string(Packet *p, const char *s) {
+    size_t n = strlen(s);
+    put_varint(p, (int32_t)n);
+    memcpy(p->data + p->len, s, n);
+    p->len += n;
+}
+
+static void put_position(Packet *p, int x, int y, int z) {
+    uint64_t v = ((uint64_t)(x & 0x3FFFFFF) << 38) |
+                 ((uint64_t)(z & 0x3FFFFFF) << 12) |
+                 (uint64_t)(y & 0xFFF);
+    put_u64(p, v);
+}
+
+static void begin(Packet *p, int id) {
+    p->len = 0;
+    put_varint(p, id);
+}
+
+/* Frames a packet and queues it on the bot's socket */
+static void send_packet(Bot *bot, Packet *p) {
+    Packet frame;
+    frame.len = 0;
+    if (bot->compressed) {
+        /* Everything the bots send is small, so it's never compressed */
+        put_varint(&frame, (int32_t)p->len + 1);
+        put_byte(&frame, 0);
+    } else {
+        put_varint(&frame, (int32_t)p->len);
+    }
+    if (bot->wlen + frame.len + p->len > sizeof(bot->wbuf)) {
+        /* The server isn't keeping up, drop the packet */
+        return;
+    }
+    memcpy(bot->wbuf + bot->wlen, frame.data, frame.len);
+    bot->wlen += frame.len;
+    memcpy(bot->wbuf + bot->wlen, p->data, p->len);
+    bot->wlen += p->len;
+    stats.packets_out++;
+    stats.bytes_out += frame.len + p->len;
+}
+
+static void flush_bot(Bot *bot) {
+    while (bot->wlen > 0) {
+        ssize_t n = send(bot->fd, bot->wbuf, bot->wlen, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            bot->state = BOT_DEAD;
+            return;
+        }
+        memmove(bot->wbuf, bot->wbuf + n, bot->wlen - n);
+        bot->wlen -= n;
+    }
+}
+
+/* ---------- Bot behavior ---------- */
+
+static void send_login(Bot *bot) {
+    Packet p;
+    char name[16];
+    snprintf(name, sizeof(name), "bot%d", bot->index);
+
+    /* Handshake, intent 2 = login */
+    begin(&p, 0x00);
+    put_varint(&p, PROTOCOL_VERSION);
+    put_string(&p, host);
+    put_u16(&p, (uint16_t)port);
+    put_varint(&p, 2);
+    send_packet(bot, &p);
+
+    /* Login Start, with a UUID made up from the bot index */
+    begin(&p, 0x00);
+    put_string(&p, name);
+    put_u64(&p, 0x6c6f616467656e00ULL);
+    put_u64(&p, (uint64_t)bot->index + 1);
+    send_packet(bot, &p);
+}
+
+static void send_configuration(Bot *bot) {
+    Packet p;
+
+    /* Login Acknowledged */
+    begin(&p, 0x03);
+    send_packet(bot, &p);
+
+    /* Client Information */
+    begin(&p, 0x00);
+    put_string(&p, "en_us");
+    put_byte(&p, 8);     /* view distance */
+    put_varint(&p, 0);   /* chat mode */
+    put_byte(&p, 1);     /* chat colors */
+    put_byte(&p, 0x7F);  /* skin parts */
+    put_varint(&p, 1);   /* main hand */
+    put_byte(&p, 0);     /* text filtering */
+    put_byte(&p, 1);     /* allow listing */
+    put_varint(&p, 0);   /* particles */
+    send_packet(bot, &p);
+
+    /* Serverbound Known Packs, none */
+    begin(&p, 0x07);
+    put_varint(&p, 0);
+    send_packet(bot, &p);
+}
+
+static int chunk_of(double v) {
+    return (int)floor(v / 16.0);
+}
+
+/* Walks the bot one step along a square path around its spawn point */
+static void step_bot(Bot *bot) {
+    Packet p;
+    double side = radius * 2.0;
+
+    bot->path_pos += WALK_SPEED / MOVE_RATE;
+    if (bot->path_pos >= side * 4) bot->path_pos -= side * 4;
+
+    double d = bot->path_pos, dx, dz;
+    if (d < side) { dx = d; dz = 0; }
+    else if (d < side * 2) { dx = side; dz = d - side; }
+    else if (d < side * 3) { dx = side * 3 - d; dz = side; }
+    else { dx = 0; dz = side * 4 - d; }
+    bot->x = bot->spawn_x - radius + dx;
+    bot->z = bot->spawn_z - radius + dz;
+
+    /* Set Player Position, kept off the ground to avoid fall damage */
+    begin(&p, 0x1D);
+    put_double(&p, bot->x);
+    put_double(&p, bot->y);
+    put_double(&p, bot->z);
+    put_byte(&p, 0);
+    send_packet(bot, &p);
+
+    int cx = chunk_of(bot->x), cz = chunk_of(bot->z);
+    if (cx != bot->chunk_x || cz != bot->chunk_z) {
+        if (bot->crossed_at == 0) bot->crossed_at = now_us();
+        bot->chunk_x = cx;
+        bot->chunk_z = cz;
+    }
+}
+
+/* Breaks the block under the bot, puts it back, and uses the chest */
+static void act_bot(Bot *bot) {
+    Packet p;
+    int bx = (int)floor(bot->x), bz = (int)floor(bot->z);
+    int by = (int)floor(bot->y) - 1;
+
+    /* Player Action: start and finish digging */
+    for (int status = 0; status <= 2; status += 2) {
+        begin(&p, 0x28);
+        put_varint(&p, status);
+        put_position(&p, bx, by, bz);
+        put_byte(&p, 1);
+        put_varint(&p, ++bot->sequence);
+        send_packet(bot, &p);
+    }
+
+    /* Use Item On the top face of the block below, placing the held item */
+    begin(&p, 0x3F);
+    put_varint(&p, 0);
+    put_position(&p, bx, by - 1, bz);
+    put_varint(&p, 1);
+    put_float(&p, 0.5f);
+    put_float(&p, 1.0f);
+    put_float(&p, 0.5f);
+    put_byte(&p, 0);
+    put_byte(&p, 0);
+    put_varint(&p, ++bot->sequence);
+    send_packet(bot, &p);
+    stats.block_actions++;
+
+    if (!have_chest) return;
+    begin(&p, 0x3F);
+    put_varint(&p, 0);
+    put_position(&p, chest_x, chest_y, chest_z);
+    put_varint(&p, 1);
+    put_float(&p, 0.5f);
+    put_float(&p, 1.0f);
+    put_float(&p, 0.5f);
+    put_byte(&p, 0);
+    put_byte(&p, 0);
+    put_varint(&p, ++bot->sequence);
+    send_packet(bot, &p);
+}
+
+/* ---------- Packet parsing ---------- */
+
+/* Reads a VarInt, returns bytes used, 0 if incomplete, -1 if malformed */
+static int get_varint(const uint8_t *buf, size_t len, int32_t *out) {
+    uint32_t value = 0;
+    for (int i = 0; i < 5; i++) {
+        if ((size_t)i >= len) return 0;
+        value |= (uint32_t)(buf[i] & 0x7F) << (7 * i);
+        if (!(buf[i] & 0x80)) {
+            *out = (int32_t)value;
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+static double get_double(const uint8_t *buf) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) v = (v << 8) | buf[i];
+    double d;
+    memcpy(&d, &v, 8);
+    return d;
+}
+
+static void handle_packet(Bot *bot, int id, const uint8_t *data, size_t len, size_t frame_len, int deflated) {
+    Packet p;
+    int64_t now = now_us();
+
+    stats.packets_in++;
+
+    if (bot->state == BOT_LOGIN) {
+        if (id == 0x03) { /* Set Compression */
+            bot->compressed = 1;
+        } else if (id == 0x02) { /* Login Success */
+            send_configuration(bot);
+            bot->state = BOT_CONFIGURATION;
+        }
+        return;
+    }
+
+    if (bot->state == BOT_CONFIGURATION) {
+        if (id == 0x03) { /* Finish Configuration */
+            begin(&p, 0x03);
+            send_packet(bot, &p);
+            bot->state = BOT_PLAY;
+        }
+        return;
+    }
+
+    switch (id) {
+        case 0x41: { /* Synchronize Player Position */
+            int32_t teleport_id;
+            int n = get_varint(data, len, &teleport_id);
+            if (n <= 0 || len < (size_t)n + 24) break;
+            bot->x = get_double(data + n);
+            bot->y = get_double(data + n + 8);
+            bot->z = get_double(data + n + 16);
+            /* Confirm Teleportation */
+            begin(&p, 0x00);
+            put_varint(&p, teleport_id);
+            send_packet(bot, &p);
+            if (bot->spawned) break;
+            /* Player Loaded, so the server doesn't wait out its timeout */
+            begin(&p, 0x2B);
+            send_packet(bot, &p);
+            bot->spawned = 1;
+            bot->spawn_x = bot->x;
+            bot->spawn_y = bot->y;
+            bot->spawn_z = bot->z;
+            bot->path_pos = radius;
+            bot->chunk_x = chunk_of(bot->x);
+            bot->chunk_z = chunk_of(bot->z);
+            bot->next_move = now;
+            bot->next_action = now + ACTION_INTERVAL + bot->index * (ACTION_INTERVAL / MAX_BOTS);
+            int64_t login = now - bot->connect_time;
+            stats.login_samples++;
+            stats.login_total += login;
+            if (login > stats.login_max) stats.login_max = login;
+            break;
+        }
+        case 0x26: /* Keep Alive */
+            if (bot->last_keep_alive != 0) {
+                int64_t jitter = now - bot->last_keep_alive - KEEP_ALIVE_SPACING;
+                if (jitter < 0) jitter = -jitter;
+                stats.jitter_samples++;
+                stats.jitter_total += jitter;
+                if (jitter > stats.jitter_max) stats.jitter_max = jitter;
+            }
+            bot->last_keep_alive = now;
+            begin(&p, 0x1B);
+            for (size_t i = 0; i < 8 && i < len; i++) put_byte(&p, data[i]);
+            send_packet(bot, &p);
+            break;
+        case 0x27: /* Chunk Data and Update Light */
+            stats.chunks++;
+            stats.chunk_bytes += frame_len;
+            if (deflated) stats.chunks_compressed++;
+            if (bot->crossed_at != 0) {
+                int64_t latency = now - bot->crossed_at;
+                stats.latency_samples++;
+                stats.latency_total += latency;
+                if (latency > stats.latency_max) stats.latency_max = latency;
+                bot->crossed_at = 0;
+            }
+            break;
+        case 0x34: { /* Open Screen */
+            int32_t window;
+            if (get_varint(data, len, &window) <= 0) break;
+            stats.screens_opened++;
+            begin(&p, 0x12);
+            put_varint(&p, window);
+            send_packet(bot, &p);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/* Reads what the socket has and handles every whole packet in it */
+static void receive_bot(Bot *bot) {
+    for (;;) {
+        if (bot->rcap - bot->rlen < 4096) {
+            bot->rcap = bot->rcap ? bot->rcap * 2 : 65536;
+            bot->rbuf = realloc(bot->rbuf, bot->rcap);
+        }
+        ssize_t n = recv(bot->fd, bot->rbuf + bot->rlen, bot->rcap - bot->rlen, 0);
+        if (n == 0) { bot->state = BOT_DEAD; return; }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) bot->state = BOT_DEAD;
+            break;
+        }
+        bot->rlen += n;
+        stats.bytes_in += n;
+    }
+
+    size_t pos = 0;
+    while (pos < bot->rlen && bot->state != BOT_DEAD) {
+        int32_t length = 0, id = 0;
+        int n = get_varint(bot->rbuf + pos, bot->rlen - pos, &length);
+        if (n < 0 || length < 0) { bot->state = BOT_DEAD; break; }
+        if (n == 0 || bot->rlen - pos < (size_t)n + length) break;
+        const uint8_t *body = bot->rbuf + pos + n;
+        int32_t body_len = length;
+        int32_t data_length = 0;
+        if (bot->compressed) {
+            int k = get_varint(body, body_len, &data_length);
+            if (k <= 0 || data_length < 0) { bot->state = BOT_DEAD; break; }
+            body += k;
+            body_len -= k;
+            if (data_length > 0) {
+                if (bot->zcap < (size_t)data_length) {
+                    bot->zcap = data_length;
+                    bot->zbuf = realloc(bot->zbuf, bot->zcap);
+                }
+                if (zlibDecompress(body, body_len, bot->zbuf, data_length)) {
+                    fprintf(stderr, "bot%d: bad compressed packet\n", bot->index);
+                    bot->state = BOT_DEAD;
+                    break;
+                }
+                body = bot->zbuf;
+                body_len = data_length;
+            }
+        }
+        int m = get_varint(body, body_len, &id);
+        if (m <= 0) { bot->state = BOT_DEAD; break; }
+        handle_packet(bot, id, body + m, body_len - m, n + length, data_length > 0);
+        pos += n + length;
+    }
+    memmove(bot->rbuf, bot->rbuf + pos, bot->rlen - pos);
+    bot->rlen -= pos;
+}
+
+static int connect_bot(Bot *bot, struct addrinfo *addr) {
+    bot->fd = socket(addr->ai_family, SOCK_STREAM, 0);
+    if (bot->fd < 0) return 1;
+    if (connect(bot->fd, addr->ai_addr, addr->ai_addrlen) < 0) {
+        close(bot->fd);
+        return 1;
+    }
+    int one = 1;
+    setsockopt(bot->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(bot->fd, F_SETFL, fcntl(bot->fd, F_GETFL, 0) | O_NONBLOCK);
+    bot->connect_time = now_us();
+    bot->state = BOT_LOGIN;
+    send_login(bot);
+    stats.connected++;
+    return 0;
+}
+
+static void print_report(int64_t elapsed) {
+    double seconds = elapsed / 1000000.0;
+    printf("\n=== Load generator report ===\n");
+    printf("Bots: %d requested, %u connected, %u disconnected early\n",
+           bot_count, stats.connected, stats.disconnected);
+    printf("Run time: %.1f s\n", seconds);
+    if (stats.login_samples) {
+        printf("Login to spawn: avg %.1f ms, max %.1f ms\n",
+               stats.login_total / 1000.0 / stats.login_samples, stats.login_max / 1000.0);
+    }
+    printf("Chunks received: %llu, avg %.0f bytes per chunk, %llu compressed\n",
+           (unsigned long long)stats.chunks,
+           stats.chunks ? (double)stats.chunk_bytes / stats.chunks : 0.0,
+           (unsigned long long)stats.chunks_compressed);
+    if (stats.latency_samples) {
+        printf("Chunk send latency: avg %.1f ms, max %.1f ms (%llu border crossings)\n",
+               stats.latency_total / 1000.0 / stats.latency_samples, stats.latency_max / 1000.0,
+               (unsigned long long)stats.latency_samples);
+    }
+    if (stats.jitter_samples) {
+        printf("Tick jitter: avg %.1f ms, max %.1f ms (%llu keep-alive intervals)\n",
+               stats.jitter_total / 1000.0 / stats.jitter_samples, stats.jitter_max / 1000.0,
+               (unsigned long long)stats.jitter_samples);
+    }
+    printf("Received: %.0f packets/s, %.1f KB/s\n",
+           stats.packets_in / seconds, stats.bytes_in / 1024.0 / seconds);
+    printf("Sent: %.0f packets/s, %.1f KB/s\n",
+           stats.packets_out / seconds, stats.bytes_out / 1024.0 / seconds);
+    printf("Block actions: %u, screens opened: %u\n", stats.block_actions, stats.screens_opened);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-n bots] [-t seconds] [-r radius] [-c x,y,z]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:n:t:r:c:")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': bot_count = atoi(optarg); break;
+            case 't': duration = atoi(optarg); break;
+            case 'r': radius = atoi(optarg); break;
+            case 'c':
+                if (sscanf(optarg, "%d,%d,%d", &chest_x, &chest_y, &chest_z) != 3) usage(argv[0]);
+                have_chest = 1;
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (bot_count < 1 || bot_count > MAX_BOTS || duration < 1 || radius < 1) usage(argv[0]);
+
+    struct addrinfo hints, *addr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if (getaddrinfo(host, port_str, &hints, &addr) != 0) {
+        fprintf(stderr, "Failed to resolve %s\n", host);
+        return 1;
+    }
+
+    printf("Connecting %d bots to %s:%d for %d s\n", bot_count, host, port, duration);
+
+    /* Bots log in one after another, a quarter second apart */
+    int64_t start = now_us();
+    int64_t end = start + (int64_t)duration * 1000000;
+    int next_bot = 0;
+    int64_t next_connect = start;
+
+    while (now_us() < end) {
+        int64_t now = now_us();
+
+        if (next_bot < bot_count && now >= next_connect) {
+            Bot *bot = &bots[next_bot];
+            bot->index = next_bot;
+            if (connect_bot(bot, addr)) {
+                fprintf(stderr, "bot%d: failed to connect\n", next_bot);
+                bot->state = BOT_DEAD;
+                bot->fd = -1;
+            }
+            next_bot++;
+            next_connect = now + 250000;
+        }
+
+        struct pollfd fds[MAX_BOTS];
+        for (int i = 0; i < next_bot; i++) {
+            fds[i].fd = bots[i].state == BOT_DEAD ? -1 : bots[i].fd;
+            fds[i].events = POLLIN | (bots[i].wlen ? POLLOUT : 0);
+            fds[i].revents = 0;
+        }
+        poll(fds, next_bot, 1000 / MOVE_RATE / 2);
+
+        now = now_us();
+        for (int i = 0; i < next_bot; i++) {
+            Bot *bot = &bots[i];
+            if (bot->state == BOT_DEAD) continue;
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) receive_bot(bot);
+            if (bot->state == BOT_PLAY && bot->spawned) {
+                if (now >= bot->next_move) {
+                    step_bot(bot);
+                    bot->next_move += 1000000 / MOVE_RATE;
+                    /* Don't try to catch up after a stall */
+                    if (bot->next_move < now) bot->next_move = now;
+                }
+                if (now >= bot->next_action) {
+                    act_bot(bot);
+                    bot->next_action += ACTION_INTERVAL;
+                }
+            }
+            flush_bot(bot);
+            if (bot->state == BOT_DEAD) {
+                fprintf(stderr, "bot%d: disconnected\n", i);
+                stats.disconnected++;
+                close(bot->fd);
+            }
+        }
+    }
+
+    print_report(now_us() - start);
+
+    for (int i = 0; i < next_bot; i++) {
+        if (bots[i].state != BOT_DEAD) close(bots[i].fd);
+        free(bots[i].rbuf);
+        free(bots[i].zbuf);
+    }
+    freeaddrinfo(addr);
+    return 0;
+}
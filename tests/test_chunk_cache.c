@@ -5,6 +5,10 @@
  * 1. buildChunkSection produces deterministic output
  * 2. Cached chunks match freshly generated chunks
  * 3. Cache eviction works correctly
+ * 4. Encoded chunk packets are cached and invalidated per column
+ * 5. Compressed sections decode correctly when the page pool is full
+ * 6. Columns are cached and evicted as a whole
+ * 7. Sections are packed into the right palette format for chunk packets
  */
 
 #include <stdio.h>
@@ -51,6 +55,12 @@ uint8_t getBlockChange(short x, uint8_t y, short z) {
     return 0xFF;
 }
 
+/* Stub for loadBlockRegion (from serialize.c), every region stays in memory */
+void loadBlockRegion(short x, short z) {
+    (void)x;
+    (void)z;
+}
+
 /* External chunk_section from worldgen.c */
 extern uint8_t chunk_section[4096];
 
@@ -263,6 +273,7 @@ int test_block_changes_applied(void) {
     block_changes[0].z = 8;
     block_changes[0].block = B_diamond_block;
     block_changes_count = 1;
+    rebuildBlockChangeIndex();
 
     /* Regenerate with block change */
     world_seed = splitmix64(0xA103DE6C);
@@ -278,11 +289,13 @@ int test_block_changes_applied(void) {
         printf("FAIL (expected diamond at index %u, got %d)\n",
                index, chunk_section[index]);
         block_changes_count = 0;
+        rebuildBlockChangeIndex();
         return 0;
     }
 
     /* Clean up */
     block_changes_count = 0;
+    rebuildBlockChangeIndex();
 
     printf("PASS (diamond at index %u)\n", index);
     return 1;
@@ -535,13 +548,249 @@ int test_cache_invalidation(void) {
     return 1;
 }
 
+/* Test 13: Chunk packet cache stores, finds and invalidates packets */
+int test_chunk_packet_cache(void) {
+    printf("Test 13: Chunk packet cache... ");
+
+    clearChunkCache();
+
+    int size = 0;
+    if (findChunkPacket(1, -2, &size) != NULL) {
+        printf("FAIL (found packet in empty cache)\n");
+        return 0;
+    }
+
+    uint8_t *data = allocChunkPacket(1, -2, 1000);
+    if (data == NULL) {
+        printf("FAIL (allocation failed)\n");
+        return 0;
+    }
+    memset(data, 0xAB, 1000);
+
+    uint8_t *found = findChunkPacket(1, -2, &size);
+    if (found != data || size != 1000 || found[999] != 0xAB) {
+        printf("FAIL (stored packet not returned)\n");
+        return 0;
+    }
+
+    /* A block change anywhere in the column drops the packet */
+    invalidateChunkCache(16 + 5, 200, -32 + 7);
+    if (findChunkPacket(1, -2, &size) != NULL) {
+        printf("FAIL (packet not invalidated)\n");
+        return 0;
+    }
+
+    /* Filling past the byte budget evicts the least recently used */
+    int count = CHUNK_PACKET_CACHE_SIZE / 40000 + 2;
+    for (int i = 0; i < count; i++) {
+        if (allocChunkPacket(i, 0, 40000) == NULL) {
+            printf("FAIL (allocation %d failed)\n", i);
+            return 0;
+        }
+        /* Keep the first packet recently used */
+        findChunkPacket(0, 0, &size);
+    }
+    if (findChunkPacket(0, 0, &size) == NULL ||
+        findChunkPacket(1, 0, &size) != NULL ||
+        findChunkPacket(count - 1, 0, &size) == NULL) {
+        printf("FAIL (wrong packet evicted)\n");
+        return 0;
+    }
+
+    clearChunkCache();
+    printf("PASS (store, invalidate and evict work)\n");
+    return 1;
+}
+
+/* Test 14: Compressed entries survive eviction of other entries */
+#define PRESSURE_COLUMNS 12
+int test_cache_page_pressure(void) {
+    printf("Test 14: Cache under page pressure... ");
+
+    clearChunkCache();
+    world_seed = splitmix64(0xA103DE6C);
+    rng_seed = splitmix64(0xE2B9419);
+    block_changes_count = 0;
+
+    /* Far more mixed sections than the page pool holds */
+    static uint32_t checksums[PRESSURE_COLUMNS][PRESSURE_COLUMNS][5];
+    for (int x = 0; x < PRESSURE_COLUMNS; x++) {
+        for (int z = 0; z < PRESSURE_COLUMNS; z++) {
+            for (int y = 0; y < 5; y++) {
+                buildChunkSection(x * 16, y * 16, z * 16);
+                checksums[x][z][y] = chunk_checksum(chunk_section);
+            }
+        }
+    }
+
+    /* Read everything back in a different order, mixing hits and misses */
+    int mismatches = 0;
+    for (int y = 4; y >= 0; y--) {
+        for (int z = PRESSURE_COLUMNS - 1; z >= 0; z--) {
+            for (int x = 0; x < PRESSURE_COLUMNS; x++) {
+                buildChunkSection(x * 16, y * 16, z * 16);
+                if (chunk_checksum(chunk_section) != checksums[x][z][y]) mismatches++;
+            }
+        }
+    }
+
+    if (mismatches > 0) {
+        printf("FAIL (%d sections differ)\n", mismatches);
+        return 0;
+    }
+
+    printf("PASS (%d sections consistent)\n", PRESSURE_COLUMNS * PRESSURE_COLUMNS * 5);
+    return 1;
+}
+
+/* Test 15: Columns are cached and evicted as a whole */
+#define COLUMN_SECTIONS 20
+int test_cache_whole_columns(void) {
+    printf("Test 15: Whole column hits... ");
+
+    clearChunkCache();
+    world_seed = splitmix64(0xA103DE6C);
+    rng_seed = splitmix64(0xE2B9419);
+    block_changes_count = 0;
+
+    /* A column that was just built is found in full */
+    for (int y = 0; y < COLUMN_SECTIONS; y++) buildChunkSection(0, y * 16, 0);
+    uint32_t hits = chunk_cache_stats.hits;
+    for (int y = 0; y < COLUMN_SECTIONS; y++) buildChunkSection(0, y * 16, 0);
+    if (chunk_cache_stats.hits - hits != COLUMN_SECTIONS) {
+        printf("FAIL (%u/%d sections hit)\n", chunk_cache_stats.hits - hits, COLUMN_SECTIONS);
+        return 0;
+    }
+
+    /* After enough other columns to force evictions, it's either still */
+    /* cached in full or not at all */
+    uint32_t evictions = chunk_cache_stats.evictions;
+    for (int x = 1; x <= 64; x++) {
+        for (int y = 0; y < COLUMN_SECTIONS; y++) buildChunkSection(x * 16, y * 16, 0);
+    }
+    if (chunk_cache_stats.evictions == evictions) {
+        printf("FAIL (no evictions)\n");
+        return 0;
+    }
+    hits = chunk_cache_stats.hits;
+    for (int y = 0; y < COLUMN_SECTIONS; y++) buildChunkSection(0, y * 16, 0);
+    uint32_t column_hits = chunk_cache_stats.hits - hits;
+    if (column_hits != 0 && column_hits != COLUMN_SECTIONS) {
+        printf("FAIL (partial column, %u/%d sections hit)\n", column_hits, COLUMN_SECTIONS);
+        return 0;
+    }
+
+    printf("PASS (%u evictions)\n", chunk_cache_stats.evictions - evictions);
+    return 1;
+}
+
+/* Returns the block at a section address from chunk_section */
+static uint8_t section_block(int address) {
+    return chunk_section[(address & ~7) | (7 - (address & 7))];
+}
+
+/* Decodes a section packed by paletteChunkSection, checking each entry
+ * against chunk_section. Returns the number of entries that differ. */
+static int count_palette_mismatches(PalettedSection *section, uint8_t *data) {
+    int mismatches = 0;
+    for (int address = 0; address < 4096; address++) {
+        uint8_t block;
+        if (section->bits == 0) {
+            block = section->palette[0];
+        } else if (section->bits == 4) {
+            /* 16 entries per long, lowest bits first, longs big-endian */
+            int k = address & 15;
+            uint8_t byte = data[(address >> 4) * 8 + 7 - (k >> 1)];
+            block = section->palette[(byte >> ((k & 1) * 4)) & 15];
+        } else {
+            /* 8 entries per long, indexing the global palette */
+            block = data[(address & ~7) | (7 - (address & 7))];
+        }
+        if (block != section_block(address)) mismatches++;
+    }
+    return mismatches;
+}
+
+/* Counts the different blocks in chunk_section */
+static int count_section_blocks(void) {
+    uint8_t seen[256] = { 0 };
+    int count = 0;
+    for (int i = 0; i < 4096; i++) {
+        if (!seen[chunk_section[i]]) count++;
+        seen[chunk_section[i]] = 1;
+    }
+    return count;
+}
+
+/* Paints n distinct blocks into the section at (0, 240, 0) and builds it */
+static void build_painted_section(int n) {
+    for (int i = 0; i < n; i++) {
+        int address = (i * 397) & 4095;
+        block_changes[i].x = address & 15;
+        block_changes[i].z = (address >> 4) & 15;
+        block_changes[i].y = 240 + (address >> 8);
+        block_changes[i].block = (uint8_t)(1 + i);
+    }
+    block_changes_count = n;
+    rebuildBlockChangeIndex();
+    buildChunkSection(0, 240, 0);
+}
+
+/* Test 16: Sections are encoded in the smallest palette and decode back */
+int test_section_palettes(void) {
+    printf("Test 16: Section palettes... ");
+
+    static uint8_t data[4096];
+    PalettedSection section;
+    world_seed = splitmix64(0xA103DE6C);
+    rng_seed = splitmix64(0xE2B9419);
+    block_changes_count = 0;
+    rebuildBlockChangeIndex();
+
+    /* Above the terrain, nothing but air */
+    buildChunkSection(0, 304, 0);
+    paletteChunkSection(&section, data);
+    if (section.bits != 0 || count_palette_mismatches(&section, data) != 0) {
+        printf("FAIL (uniform section, %d bits)\n", section.bits);
+        return 0;
+    }
+
+    /* A few blocks on top of the air still fit a local palette */
+    build_painted_section(12);
+    int blocks = count_section_blocks();
+    paletteChunkSection(&section, data);
+    int mismatches = count_palette_mismatches(&section, data);
+    if (blocks < 2 || blocks > 16 || section.bits != 4 ||
+        section.palette_len != blocks || mismatches != 0) {
+        printf("FAIL (%d blocks, %d bits, %d mismatches)\n", blocks, section.bits, mismatches);
+        block_changes_count = 0;
+        rebuildBlockChangeIndex();
+        return 0;
+    }
+
+    /* Too many for a local palette, the global one is used */
+    build_painted_section(40);
+    blocks = count_section_blocks();
+    paletteChunkSection(&section, data);
+    mismatches = count_palette_mismatches(&section, data);
+    block_changes_count = 0;
+    rebuildBlockChangeIndex();
+    if (blocks <= 16 || section.bits != 8 || mismatches != 0) {
+        printf("FAIL (%d blocks, %d bits, %d mismatches)\n", blocks, section.bits, mismatches);
+        return 0;
+    }
+
+    printf("PASS\n");
+    return 1;
+}
+
 int main(int argc, char *argv[]) {
     (void)argc; (void)argv;
 
     printf("=== Chunk Generation Tests ===\n\n");
 
     int passed = 0;
-    int total = 12;
+    int total = 16;
 
     passed += test_deterministic_generation();
     passed += test_generate_reference_chunks();
@@ -558,6 +807,10 @@ int main(int argc, char *argv[]) {
     passed += test_cache_clear();
     passed += test_cache_miss_performance();
     passed += test_cache_invalidation();
+    passed += test_chunk_packet_cache();
+    passed += test_cache_page_pressure();
+    passed += test_cache_whole_columns();
+    passed += test_section_palettes();
 
     printf("\n=== Results: %d/%d tests passed ===\n", passed, total);
 
@@ -0,0 +1,105 @@
+/*
+ * test_deflate.c - Tests for the built-in zlib compressor and decompressor
+ *
+ * Checks that:
+ * 1. Data of all kinds survives a compress/decompress round trip
+ * 2. Repetitive data, like chunk sections, actually gets smaller
+ * 3. Streams made by real zlib, with dynamic Huffman codes, are decoded
+ * 4. Output that doesn't fit, and corrupted streams, are reported
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../include/deflate.h"
+
+#define TEST_SIZE 65536
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+static uint8_t input[TEST_SIZE];
+/* Fixed Huffman codes take up to 9 bits per literal */
+static uint8_t packed[TEST_SIZE / 8 * 9 + 64];
+static uint8_t output[TEST_SIZE];
+
+static void check(const char *name, int ok) {
+    tests_run++;
+    if (ok) tests_passed++;
+    printf("Test %d: %s... %s\n", tests_run, name, ok ? "PASS" : "FAIL");
+}
+
+/* Compresses `len` bytes of input and expands them again */
+static int round_trip(int len, int *packed_len) {
+    int size = zlibCompress(input, len, packed, sizeof(packed));
+    if (packed_len) *packed_len = size;
+    if (size < 0) return 0;
+    memset(output, 0xAA, sizeof(output));
+    if (zlibDecompress(packed, size, output, len)) return 0;
+    return memcmp(input, output, len) == 0;
+}
+
+/* Made with Python's zlib.compress(text * 2, 6), see block_names below */
+static const uint8_t zlib_stream[] = {
+    0x78, 0x9c, 0xd5, 0xce, 0xc1, 0x0d, 0xc0, 0x20, 0x08, 0x85, 0xe1, 0x55, 0x3a, 0x47, 0x97, 0x31,
+    0x54, 0xd1, 0x18, 0x11, 0x12, 0x20, 0x76, 0xfd, 0xde, 0x1a, 0xea, 0x06, 0x3d, 0xfe, 0xdf, 0xe1,
+    0xe5, 0xcd, 0xce, 0x98, 0x15, 0xaa, 0x9f, 0xe6, 0xc2, 0x78, 0xcc, 0xb7, 0x4b, 0x57, 0x0f, 0xd9,
+    0x14, 0xcc, 0xd2, 0x45, 0x92, 0x47, 0x50, 0x81, 0x91, 0x48, 0xda, 0x2e, 0x08, 0x0b, 0x2d, 0xe0,
+    0x0d, 0x8e, 0x1a, 0xda, 0x80, 0xcb, 0x77, 0x7b, 0x21, 0x05, 0xc8, 0x02, 0x94, 0x44, 0xe3, 0x9d,
+    0xae, 0xc2, 0x1b, 0xfd, 0xe5, 0xf1, 0x03, 0x7a, 0xfa, 0x8a, 0x0b
+};
+
+static const char block_names[] =
+    "minecraft:stone minecraft:dirt minecraft:grass_block minecraft:oak_log "
+    "minecraft:oak_leaves minecraft:water minecraft:sand minecraft:gravel "
+    "minecraft:coal_ore minecraft:iron_ore ";
+
+int main(int argc, char *argv[]) {
+    (void)argc; (void)argv;
+    int size;
+
+    printf("=== Deflate tests ===\n");
+
+    check("Empty input", round_trip(0, NULL));
+
+    memset(input, 0, TEST_SIZE);
+    int zeros_ok = round_trip(TEST_SIZE, &size);
+    check("All zeros round trip", zeros_ok);
+    check("All zeros get much smaller", zeros_ok && size < TEST_SIZE / 50);
+
+    /* Shaped like a paletted section: short runs of a few block IDs */
+    srand(1);
+    for (int i = 0; i < 4096; i++) input[i] = (uint8_t)((i / 16) % 3 == 0 ? rand() % 4 : 1);
+    int section_ok = round_trip(4096, &size);
+    check("Chunk-like data round trip", section_ok);
+    check("Chunk-like data gets smaller", section_ok && size < 4096 / 2);
+
+    /* Incompressible data grows, but still has to survive */
+    for (int i = 0; i < TEST_SIZE; i++) input[i] = (uint8_t)rand();
+    check("Random data round trip", round_trip(TEST_SIZE, NULL));
+
+    int names_len = (int)strlen(block_names);
+    memcpy(input, block_names, names_len);
+    memcpy(input + names_len, block_names, names_len);
+    memset(output, 0, sizeof(output));
+    check("Decodes a stream made by zlib",
+          zlibDecompress(zlib_stream, sizeof(zlib_stream), output, names_len * 2) == 0 &&
+          memcmp(input, output, names_len * 2) == 0);
+
+    check("Output larger than out_size is refused",
+          zlibCompress(input, TEST_SIZE, packed, 64) == -1);
+
+    size = zlibCompress(input, 4096, packed, sizeof(packed));
+    check("Wrong expected size is an error",
+          size > 0 && zlibDecompress(packed, size, output, 4095) != 0);
+
+    packed[size - 1] ^= 0x01;
+    check("Bad checksum is an error", zlibDecompress(packed, size, output, 4096) != 0);
+
+    check("Truncated stream is an error", zlibDecompress(packed, size / 2, output, 4096) != 0);
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+    return tests_passed == tests_run ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+/*
+ * test_framing.c - Tests for packet framing with and without compression
+ *
+ * Links the real server code (everything but main.c) and talks to it over
+ * a socket pair, checking that:
+ * 1. send_all passes packets through as they are until compression is on
+ * 2. With compression, send_all adds a data length of 0 to every packet,
+ *    even when packets and their length prefixes arrive in pieces
+ * 3. Stale movement packets are spotted with either framing
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../include/globals.h"
+#include "../include/arena.h"
+#include "../include/tools.h"
+#include "../include/varnum.h"
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+/* Server and client ends of the connection */
+static int server_fd, client_fd;
+
+static void check(const char *name, int ok) {
+    tests_run++;
+    if (ok) tests_passed++;
+    printf("Test %d: %s... %s\n", tests_run, name, ok ? "PASS" : "FAIL");
+}
+
+/* Reads everything the server has sent so far */
+static int receive(uint8_t *buf, int size) {
+    int len = 0;
+    while (len < size) {
+        ssize_t n = recv(client_fd, buf + len, size - len, MSG_DONTWAIT);
+        if (n <= 0) break;
+        len += (int)n;
+    }
+    return len;
+}
+
+/* Checks that the server sent exactly the given bytes */
+static int received(const uint8_t *expected, int len) {
+    uint8_t buf[512];
+    return receive(buf, sizeof(buf)) == len && memcmp(buf, expected, len) == 0;
+}
+
+/* Handles the packet at the front of the receive queue like main.c does,
+ * up to the stale movement check, then skips the rest of it */
+static int is_followed_by_movement(void) {
+    if (pollRecvQueue(server_fd, true) != 1) return -1;
+    int length = readPacketLength(server_fd);
+    int packet_id = readVarInt(server_fd);
+    if (length == (int)VARNUM_ERROR || packet_id == (int)VARNUM_ERROR) return -1;
+    int remaining = length - sizeVarInt(packet_id);
+    int result = hasMoreMovementPackets(server_fd, remaining);
+    discard_all(server_fd, remaining, false);
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc; (void)argv;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("Failed to create socket pair");
+        return 1;
+    }
+    server_fd = fds[0];
+    client_fd = fds[1];
+    fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) | O_NONBLOCK);
+
+    printf("=== Framing tests ===\n");
+
+    if (initArena() || openSendQueue(server_fd) || openRecvQueue(server_fd)) {
+        printf("Failed to set up queues\n");
+        return 1;
+    }
+
+    /* Length 3, ID 0x26, two bytes of data */
+    const uint8_t packet[] = { 0x03, 0x26, 0xAB, 0xCD };
+    send_all(server_fd, packet, sizeof(packet));
+    check("Packets pass through without compression", received(packet, sizeof(packet)));
+
+    setCompression(server_fd, true);
+    send_all(server_fd, packet, sizeof(packet));
+    const uint8_t framed[] = { 0x04, 0x00, 0x26, 0xAB, 0xCD };
+    check("Compressed framing adds a data length", received(framed, sizeof(framed)));
+
+    /* Two packets in one call, then one packet a byte at a time */
+    const uint8_t pair[] = { 0x01, 0x10, 0x02, 0x11, 0x22 };
+    send_all(server_fd, pair, sizeof(pair));
+    for (int i = 0; i < (int)sizeof(packet); i++) send_all(server_fd, packet + i, 1);
+    const uint8_t pair_framed[] = { 0x02, 0x00, 0x10, 0x03, 0x00, 0x11, 0x22, 0x04, 0x00, 0x26, 0xAB, 0xCD };
+    check("Packets are re-framed whole or a byte at a time",
+          received(pair_framed, sizeof(pair_framed)));
+
+    /* A two byte length prefix (200) split across calls, along with the
+     * body, which is split again further in */
+    uint8_t big[2 + 200];
+    big[0] = 0xC8;
+    big[1] = 0x01;
+    for (int i = 0; i < 200; i++) big[2 + i] = (uint8_t)i;
+    send_all(server_fd, big, 1);
+    send_all(server_fd, big + 1, 50);
+    send_all(server_fd, big + 51, sizeof(big) - 51);
+    uint8_t big_framed[3 + 200];
+    big_framed[0] = 0xC9;
+    big_framed[1] = 0x01;
+    big_framed[2] = 0x00;
+    memcpy(big_framed + 3, big + 2, 200);
+    check("Length prefixes split across calls", received(big_framed, sizeof(big_framed)));
+
+    /* Counting the data length pushes 127 past what one byte holds */
+    uint8_t edge[1 + 127];
+    edge[0] = 0x7F;
+    memset(edge + 1, 0x55, 127);
+    send_all(server_fd, edge, sizeof(edge));
+    uint8_t edge_framed[3 + 127];
+    edge_framed[0] = 0x80;
+    edge_framed[1] = 0x01;
+    edge_framed[2] = 0x00;
+    memset(edge_framed + 3, 0x55, 127);
+    check("Data length can grow the length prefix", received(edge_framed, sizeof(edge_framed)));
+
+    setCompression(server_fd, false);
+    send_all(server_fd, packet, sizeof(packet));
+    check("Framing goes back to normal with compression off", received(packet, sizeof(packet)));
+
+    /* Set Player Rotation (0x1F), followed by another one, then by a
+     * keep alive (0x1B) */
+    const uint8_t moves[] = {
+        0x0B, 0x1F, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x0B, 0x1F, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x09, 0x1B, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+    if (write(client_fd, moves, sizeof(moves)) != (ssize_t)sizeof(moves)) return 1;
+    check("Stale movement is spotted without compression",
+          is_followed_by_movement() == 1 && is_followed_by_movement() == 0);
+    is_followed_by_movement();
+
+    setCompression(server_fd, true);
+    const uint8_t compressed_moves[] = {
+        0x0C, 0x00, 0x1F, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x0C, 0x00, 0x1F, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x0A, 0x00, 0x1B, 0, 0, 0, 0, 0, 0, 0, 0
+    };
+    if (write(client_fd, compressed_moves, sizeof(compressed_moves)) != (ssize_t)sizeof(compressed_moves)) return 1;
+    check("Stale movement is spotted with compression",
+          is_followed_by_movement() == 1 && is_followed_by_movement() == 0);
+    is_followed_by_movement();
+
+    closeSendQueue(server_fd);
+    closeRecvQueue(server_fd);
+    close(server_fd);
+    close(client_fd);
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+    return tests_passed == tests_run ? 0 : 1;
+}
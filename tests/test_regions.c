@@ -0,0 +1,203 @@
+/*
+ * test_regions.c - Tests for region paging of block changes
+ *
+ * Links the real server code (everything but main.c) and runs the
+ * serializer in a scratch directory, checking that:
+ * 1. A new world file is created with a region directory
+ * 2. More block changes than MAX_BLOCK_CHANGES can be stored by paging
+ *    regions out to the world file and back in
+ * 3. Block changes survive a restart, both from the world file and from
+ *    the journal, and chunks built right after a restart include them
+ * 4. Compaction reclaims replaced slots, and its new world file is picked
+ *    up on startup if it wasn't moved in place yet
+ * 5. World files from before regions are converted on startup
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../include/globals.h"
+#include "../include/registries.h"
+#include "../include/procedures.h"
+#include "../include/packets.h"
+#include "../include/worldgen.h"
+#include "../include/serialize.h"
+
+#define TEST_REGIONS 6
+#define CHANGES_PER_REGION 5000
+#define TEST_Y 250
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+static void check(const char *name, int ok) {
+    tests_run++;
+    if (ok) tests_passed++;
+    printf("Test %d: %s... %s\n", tests_run, name, ok ? "PASS" : "FAIL");
+}
+
+/* Coordinates of the n-th change in region r, spread along the diagonal */
+static short change_x(int r, int n) { return (short)(r * 256 - 512 + n % 256); }
+static short change_z(int r, int n) { return (short)(r * 256 - 512 + n / 256); }
+
+/* Drops everything in memory, as if the server had been restarted */
+static void forget_world(void) {
+    for (int i = 0; i < MAX_BLOCK_CHANGES; i++) block_changes[i].block = 0xFF;
+    block_changes_count = 0;
+    rebuildBlockChangeIndex();
+    clearChunkCache();
+}
+
+/* Counts how many of the changes made by make_changes are visible */
+static int count_changes_present(void) {
+    int present = 0;
+    for (int r = 0; r < TEST_REGIONS; r++) {
+        for (int n = 0; n < CHANGES_PER_REGION; n++) {
+            if (getBlockChange(change_x(r, n), TEST_Y, change_z(r, n)) == B_stone) present++;
+        }
+    }
+    return present;
+}
+
+static int make_changes(void) {
+    for (int r = 0; r < TEST_REGIONS; r++) {
+        for (int n = 0; n < CHANGES_PER_REGION; n++) {
+            if (applyBlockChange(change_x(r, n), TEST_Y, change_z(r, n), B_stone)) return 0;
+        }
+    }
+    flushBlockUpdates();
+    return 1;
+}
+
+/* Builds the section holding a block and returns that block from it */
+static uint8_t block_in_built_section(short x, uint8_t y, short z) {
+    int cx = x & ~15, cy = y & ~15, cz = z & ~15;
+    buildChunkSection(cx, cy, cz);
+    unsigned address = (unsigned)((x - cx) + ((z - cz) << 4) + ((y - cy) << 8));
+    unsigned index = (address & ~7u) | (7u - (address & 7u));
+    return chunk_section[index];
+}
+
+/* Returns the size of a file, or -1 if it doesn't exist */
+static long file_size(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static int file_starts_with_magic(void) {
+    FILE *file = fopen("world.bin", "rb");
+    if (!file) return 0;
+    uint32_t magic = 0;
+    size_t read = fread(&magic, sizeof(magic), 1, file);
+    fclose(file);
+    return read == 1 && magic == 0x42525744;
+}
+
+int main(int argc, char *argv[]) {
+    (void)argc; (void)argv;
+
+    char dir[] = "/tmp/test_regions_XXXXXX";
+    if (!mkdtemp(dir) || chdir(dir) != 0) {
+        perror("Failed to set up scratch directory");
+        return 1;
+    }
+
+    printf("=== Region paging tests ===\n");
+
+    for (int i = 0; i < MAX_PLAYERS; i++) player_data[i].client_fd = -1;
+    initClientTable();
+    initChunkTemplates();
+    forget_world();
+
+    check("New world file is created", initSerializer() == 0 && file_starts_with_magic());
+
+    int stored = make_changes();
+    check("More changes than MAX_BLOCK_CHANGES are stored",
+          stored && TEST_REGIONS * CHANGES_PER_REGION > MAX_BLOCK_CHANGES);
+    check("block_changes stays within its limit", block_changes_count <= MAX_BLOCK_CHANGES);
+    check("Paged out changes are read back in", count_changes_present() == TEST_REGIONS * CHANGES_PER_REGION);
+
+    /* Restore a block in the first region, which has been paged out by now */
+    short bx = change_x(0, 7), bz = change_z(0, 7);
+    check("Restoring terrain in a paged out region",
+          applyBlockChange(bx, TEST_Y, bz, B_air) == 0 && getBlockChange(bx, TEST_Y, bz) == 0xFF);
+
+    writeAllDataToDisk();
+    long compacted_size = file_size("world.bin");
+
+    /* One more change per region, then page them all through, which saves
+     * each of them to a new slot and leaves its old one behind */
+    for (int r = 0; r < TEST_REGIONS; r++) {
+        applyBlockChange(change_x(r, 0), TEST_Y + 1, change_z(r, 0), B_cobblestone);
+    }
+    count_changes_present();
+    long churned_size = file_size("world.bin");
+    writeAllDataToDisk();
+    long grown_size = compacted_size + TEST_REGIONS * (long)sizeof(BlockChange);
+    check("Compaction drops replaced slots",
+          churned_size > grown_size && file_size("world.bin") == grown_size &&
+          file_size("world.bin.tmp") < 0);
+    forget_world();
+    check("Changes survive a restart", initSerializer() == 0 &&
+          count_changes_present() == TEST_REGIONS * CHANGES_PER_REGION - 1);
+    check("Restored terrain survives a restart", getBlockChange(bx, TEST_Y, bz) == 0xFF);
+
+    /* As if a compaction was cut short between removing and renaming */
+    forget_world();
+    rename("world.bin", "world.bin.tmp");
+    check("A finished world.bin.tmp is recovered", initSerializer() == 0 &&
+          count_changes_present() == TEST_REGIONS * CHANGES_PER_REGION - 1);
+
+    /* Nothing is paged in after a restart, building a chunk has to do it */
+    forget_world();
+    check("Chunks built after a restart show changes", initSerializer() == 0 &&
+          block_changes_count == 0 &&
+          block_in_built_section(change_x(2, 9), TEST_Y, change_z(2, 9)) == B_stone);
+
+    /* Journaled but never merged into the world file */
+    applyBlockChange(0, TEST_Y, 1000, B_cobblestone);
+    serviceJournal(JOURNAL_FLUSH_INTERVAL * 2);
+    forget_world();
+    check("Journaled changes are replayed",
+          initSerializer() == 0 && getBlockChange(0, TEST_Y, 1000) == B_cobblestone);
+
+    /* A world file from before regions: block_changes, players, chests */
+    forget_world();
+    for (int n = 0; n < 100; n++) {
+        block_changes[n].x = (short)(n * 37 - 2000);
+        block_changes[n].y = TEST_Y;
+        block_changes[n].z = (short)(n * 53 - 2000);
+        block_changes[n].block = B_stone;
+    }
+    FILE *file = fopen("world.bin", "wb");
+    fwrite(block_changes, 1, sizeof(block_changes), file);
+    fwrite(player_data, 1, sizeof(player_data), file);
+    #ifdef ALLOW_CHESTS
+    fwrite(chest_data, 1, sizeof(chest_data), file);
+    #endif
+    fclose(file);
+    remove("world.jnl");
+    forget_world();
+
+    int converted = initSerializer() == 0 && file_starts_with_magic();
+    forget_world();
+    converted = converted && initSerializer() == 0;
+    for (int n = 0; n < 100 && converted; n++) {
+        if (getBlockChange((short)(n * 37 - 2000), TEST_Y, (short)(n * 53 - 2000)) != B_stone) converted = 0;
+    }
+    check("Legacy world file is converted", converted);
+
+    remove("world.bin");
+    remove("world.jnl");
+    if (chdir("/") == 0) rmdir(dir);
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+    return tests_passed == tests_run ? 0 : 1;
+}